@@ -36,7 +36,8 @@ resources = {}
 resources.project_dir = '~/misc-projects/GLSandbox'
 resources.asset_dirs = {
 	root = path.concat(resources.project_dir, 'assets/'),
-	cached = '~/Library/Application Support/cached_data/assets/'
+	cached = '~/Library/Application Support/cached_data/assets/',
+	pack = ''	-- optional .pack built by tests/pack-tool; loose files still override it in debug builds
 }
 resources.script_dirs = {
 	lib_compiled = '~/Library/Application Support/GLSandbox/compiled_scripts/lib/',
@@ -59,6 +60,7 @@ resources.persistency = {
 	hotload_models = true,
 	hotload_textures = true,
 	hotload_shaders = true,
+	hotload_quiet_window_ms = 100,	-- changes get batched up until files stop changing for this long
 	hotload_app_config = true,
 }
 resources.storage = {
@@ -69,6 +71,16 @@ resources.storage = {
 	},
 	conf_backup = '~/Library/Application Support/GLSandbox/backup/conf/'
 }
+-- Memory budgets (MB) for evictable resources (see ResourceLoader::residency); 0 => unlimited.
+-- Least recently used resources that nothing is using get dropped (+ reloaded on demand) once a
+-- category goes over its budget.
+resources.budgets = {
+	file_buffers = 256,	-- mapped files
+	images = 512,	-- decoded pixels
+	meshes = 512,
+	gl_buffers = 256,	-- vbos (eg. ObjViewer's models)
+	gl_programs = 16,
+}
 resources.filetypes = {
 	models = {
 		obj = { '.obj' },
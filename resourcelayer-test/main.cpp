@@ -8,6 +8,7 @@
 
 #include "../src/common/resourcelayer/resource_layer.hpp"
 #include "../src/common/resourcelayer/file_watcher.hpp"
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <thread>
@@ -53,6 +54,35 @@ void tryDirectLoad (std::string filepath) {
         .onLoadFailed({[](auto path) {
             printf("could not load ~ (%s)\n", path.c_str());
         }});
+    
+    // Loads complete off-thread; callbacks get run here, on the thread that issued them.
+    for (auto i = 0; i < 100; ++i) {
+        resource_impl::async::dispatchCallbacks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void tryStreamingLoad (std::string filepath) {
+    bool done = false;
+    size_t numChunks = 0;
+    ResourceLayer::loadAsStream(filepath)
+        .chunkSize(64 << 10)
+        .onChunk([&](ChunkSpan chunk, size_t offset) {
+            printf("chunk %lu: %lu bytes at offset %lu\n", numChunks++, chunk.size, offset);
+            return true;
+        })
+        .onEnd([&](auto path, size_t size) {
+            printf("streamed '%s' (%lu bytes, %lu chunks)\n", path.c_str(), size, numChunks);
+            done = true;
+        })
+        .onError([&](auto path, auto err) {
+            printf("could not stream file '%s' (%s)\n", path.c_str(), strerror(err));
+            done = true;
+        });
+    while (!done) {
+        resource_impl::async::dispatchCallbacks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
 }
 
 //std::mutex g_coutMutex;
@@ -164,6 +194,7 @@ void tryWatchingForFiles () {
 int main(int argc, const char * argv[]) {
     
 //    tryDirectLoad("~/Library/Application Support/GLSandbox/conf.lua");
+//    tryStreamingLoad("~/Library/Application Support/GLSandbox/conf.lua");
     
     tryWatchingForFiles();
     
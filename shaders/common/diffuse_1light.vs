@@ -15,8 +15,11 @@ uniform mat4 MVP;
 
 void main ()
 {
+#ifdef TRANSFORM_NORMALS
+    vec3 tnorm = normalize(NormalMatrix * VertexNormal);
+#else
     vec3 tnorm = VertexNormal;
-//    vec3 tnorm = normalize(NormalMatrix * VertexNormal);
+#endif
     vec4 eyeCoords = ModelViewMatrix * vec4(VertexPosition, 1.0);
     vec3 s = normalize(vec3(LightPosition - eyeCoords));
     
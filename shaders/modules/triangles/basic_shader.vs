@@ -1,10 +1,8 @@
 #version 410
 
-layout (location = 0) in vec3 VertexPosition;
-layout (location = 1) in vec3 VertexColor;
+#include "vertex_color.glsl"
 layout (location = 2) in vec3 InstancePosition;
 
-out vec3 Color;
 uniform mat4 ViewProjMatrix;
 uniform mat4 RotationMatrix;
 
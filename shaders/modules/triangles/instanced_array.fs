@@ -1,8 +1,3 @@
 #version 410
 
-in vec3 Color;
-out vec4 FragColor;
-
-void main () {
-    FragColor = vec4(Color, 1.0);
-}
+#include "basic_shader.fs"
@@ -1,9 +1,7 @@
 #version 410
 
-layout (location = 0) in vec3 VertexPosition;
-layout (location = 1) in vec3 VertexColor;
+#include "vertex_color.glsl"
 
-out vec3 Color;
 uniform mat4 MVP;
 
 uniform vec3 ArrayOffset;
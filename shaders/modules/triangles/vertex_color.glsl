@@ -0,0 +1,7 @@
+#pragma once
+
+// Shared by the triangle shaders: position + color per vertex, color passed through to the fs.
+layout (location = 0) in vec3 VertexPosition;
+layout (location = 1) in vec3 VertexColor;
+
+out vec3 Color;
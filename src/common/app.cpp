@@ -7,6 +7,7 @@
 //
 
 #include "app.hpp"
+#include "resourcelayer/resource_impl.hpp"
 
 #include <cstdlib>
 #include <iostream>
@@ -251,6 +252,7 @@ void app_config::Resources::loadConfig(gl_sandbox::LuaInstance & lua) {
     lua.getVal("resources.project_dir",                     project_dir);
     lua.getVal("resources.asset_dirs.root",                 asset_dir);
     lua.getVal("resources.asset_dirs.cached",               asset_cache_dir);
+    lua.getVal("resources.asset_dirs.pack",                 asset_pack);
     lua.getVal("resources.script_dirs.lib_src",             script_lib_src_dir);
     lua.getVal("resources.script_dirs.lib_compiled",        script_lib_compiled_dir);
     lua.getVal("resources.script_dirs.ui_src",              script_ui_src_dir);
@@ -263,6 +265,15 @@ void app_config::Resources::loadConfig(gl_sandbox::LuaInstance & lua) {
     
     lua.getVal("resources.storage.persistent_data_dir", persistent_data_dir);
     lua.getVal("resources.storage.persistent_data_backups.dir", persistent_data_backup_dir);
+    
+    lua.getVal("resources.budgets.file_buffers", budgets.file_buffers);
+    lua.getVal("resources.budgets.images",       budgets.images);
+    lua.getVal("resources.budgets.meshes",       budgets.meshes);
+    lua.getVal("resources.budgets.gl_buffers",   budgets.gl_buffers);
+    lua.getVal("resources.budgets.gl_programs",  budgets.gl_programs);
+    
+    lua.getVal("resources.persistency.hotload_shaders",         hotload_shaders);
+    lua.getVal("resources.persistency.hotload_quiet_window_ms", hotload_quiet_window_ms);
 }
 
 
@@ -279,12 +290,49 @@ Application::Application ()
     glfwSetErrorCallback(glfw_callbacks::errorCallback);
     
     loadConfig();
+    if (!m_appConfig.resources.asset_cache_dir.empty())
+        ResourceLoader::setAssetCacheDir(resource_impl::utils::resolvedPath(m_appConfig.resources.asset_cache_dir.string()));
+    if (!m_appConfig.resources.asset_pack.empty()) {
+        std::string err;
+        if (!ResourceLoader::mountPack(resource_impl::utils::resolvedPath(m_appConfig.resources.asset_pack.string()), err))
+            std::cerr << "Not using asset pack: " << err << '\n';
+    }
+    {
+        auto & budgets = m_appConfig.resources.budgets;
+        auto setBudget = [](ResidencyCategory category, unsigned mb) {
+            ResourceLoader::residency().setBudget(category, mb ? (size_t)mb << 20 : ResidencyManager::UNLIMITED);
+        };
+        setBudget(ResidencyCategory::FILE_BUFFERS, budgets.file_buffers);
+        setBudget(ResidencyCategory::IMAGES,       budgets.images);
+        setBudget(ResidencyCategory::MESHES,       budgets.meshes);
+        setBudget(ResidencyCategory::GL_BUFFERS,   budgets.gl_buffers);
+        setBudget(ResidencyCategory::GL_PROGRAMS,  budgets.gl_programs);
+    }
+    // Shader #includes: next to the includer, then the resource roots
+    ShaderPreprocessor::shared().setIncludeDirs({
+        ResourceLoader::g_baseResourcePath.string(),
+        (ResourceLoader::g_baseResourcePath / "common").string()
+    });
+#if defined(__APPLE__) || defined(__linux__)
+    m_dirWatcher.reset(new decltype(m_dirWatcher)::element_type());
+    auto dirWatcher = m_dirWatcher.get();
+    PathIndex::WatchFunction watchDir = [dirWatcher](const ResourceLoader::Path & dir, PathIndex::ChangeHandler onChanged) {
+        return dirWatcher->watchForChanges(boost::filesystem::absolute(dir).string(), onChanged,
+            [](const resource_impl::ResourceError & e) {
+                std::cerr << e.what() << '\n';
+            });
+    };
+    ResourceLoader::setPathWatcher(watchDir);
+#endif
     
     // Create window
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#if GL_ERROR_CHECKS == GL_ERROR_CHECKS_DEBUG_OUTPUT
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+#endif
     
     m_mainWindow = glfwCreateWindow(
             m_appConfig.window.width,
@@ -300,6 +348,21 @@ Application::Application ()
     glfwSwapInterval(1);
     
     initGL();
+    m_uniformRing.reset(new gl::RingBuffer(GL_UNIFORM_BUFFER, 1 << 20));
+    gl::RingBuffer::setUniforms(m_uniformRing.get());
+    std::cout << "Uniform ring: " << gl::RingBuffer::FRAMES << " x " << (m_uniformRing->bytesPerFrame() >> 10) << " KB, "
+              << (m_uniformRing->persistent() ? "persistent mapped" : "unsynchronized maps") << '\n';
+    m_programCache.reset(new gl::ProgramCache(ResourceLoader::assetCache()));
+    gl::ProgramCache::setShared(m_programCache.get());
+    if (!m_programCache->enabled())
+        std::cout << "Not caching program binaries (" << (ResourceLoader::assetCache() ? "no binary formats" : "no asset cache dir") << ")\n";
+#if defined(__APPLE__) || defined(__linux__)
+    if (m_appConfig.resources.hotload_shaders) {
+        m_shaderReloader.reset(new ShaderReloader(watchDir, m_appConfig.resources.hotload_quiet_window_ms * 1e-3));
+        m_shaderReloader->setPreprocessor(&ShaderPreprocessor::shared());
+        std::cout << "Shader hot-reload: on (" << (m_shaderReloader->parallelCompile() ? "parallel" : "synchronous") << " compiles)\n";
+    }
+#endif
     initDefaultModules();
 }
 
@@ -312,7 +375,10 @@ void Application::initGL() {
     // https://stackoverflow.com/questions/10857335/opengl-glgeterror-returns-invalid-enum-after-call-to-glewinit
     while (glGetError()) {}
     
-    glEnable(GL_DEPTH_TEST);
+#if GL_ERROR_CHECKS == GL_ERROR_CHECKS_DEBUG_OUTPUT
+    std::cout << "GL errors: " << (gl::ErrorLog::enableDebugOutput() ? "debug output" : "glGetError (no KHR_debug)") << '\n';
+#endif
+    gl::StateCache::shared().enable(GL_DEPTH_TEST);
     
     std::cout << "GL Sandbox\n";
     std::cout << "Renderer: " << glGetString(GL_RENDERER) << '\n';
@@ -328,6 +394,27 @@ void Application::initDefaultModules () {
 Application::~Application () {
     
     m_modules.killAllModules();
+    m_shaderReloader.reset();                    // after the modules (+ their shaders), before m_dirWatcher
+    if (m_programCache) {
+        auto & stats = m_programCache->stats();
+        std::cout << "Shader programs: " << stats.hits << " from cache (" << stats.loadTime * 1e3 << " ms), "
+                  << stats.links << " linked from source (" << stats.compiles << " compiles: " << stats.compileTime * 1e3
+                  << " ms, links: " << stats.linkTime * 1e3 << " ms), " << stats.rejected << " cached binaries rejected\n";
+        gl::ProgramCache::setShared(nullptr);
+    }
+    {
+        auto & stats = gl::StateCache::shared().total();
+        std::cout << "GL state changes: " << stats.issued << " issued, " << stats.skipped << " skipped as redundant\n";
+    }
+    if (m_uniformRing) {
+        auto & stats = m_uniformRing->stats();
+        std::cout << "Uniform ring: " << stats.writes << " writes (" << (stats.bytes >> 10) << " KB), " << stats.stalls
+                  << " stalls, " << stats.overflows << " overflowed, " << stats.resizes << " resizes\n";
+        gl::RingBuffer::setUniforms(nullptr);
+        m_uniformRing.reset();                   // (needs the context)
+    }
+    gl::ErrorLog::report(std::cerr);
+    ResourceLoader::setPathWatcher(nullptr);     // before m_dirWatcher goes away
     if (m_mainWindow) {
         glfwDestroyWindow(m_mainWindow);
     }
@@ -403,6 +490,13 @@ void Application::run () {
         
         m_inputManager.update();
         
+        // Run callbacks for any ResourceLayer loads that finished since last frame
+        resource_impl::async::dispatchCallbacks();
+        
+        // Swap in any shaders that were edited + have finished recompiling
+        if (m_shaderReloader)
+            m_shaderReloader->update();
+        
         float ratio;
         int width, height;
         glfwGetFramebufferSize(m_mainWindow, &width, &height);
@@ -412,9 +506,16 @@ void Application::run () {
         
         m_modules.runModules();
         
+        // Evict anything that got unpinned this frame, if we're over budget
+        ResourceLoader::residency().trim();
+        
         glfwSwapBuffers(m_mainWindow);    CHECK_GL_ERRORS();
         glfwPollEvents();
         
+        m_uniformRing->endFrame();
+        gl::StateCache::shared().endFrame();
+        gl::ErrorLog::endFrame();
+        
         counter.onFrameEnd();
     }
 }
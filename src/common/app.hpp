@@ -18,6 +18,7 @@
 #include "input.hpp"
 #include "raii_signal.hpp"
 #include "resources.hpp"
+#include "shader_reloader.hpp"
 #include "../modules/modules.hpp"
 #include <boost/filesystem/path.hpp>
 
@@ -70,6 +71,7 @@ struct Resources {
     path project_dir;
     path asset_dir;
     path asset_cache_dir;
+    path asset_pack;        // optional; mounted over the resource dir (see ResourceLoader::mountPack)
     
     path script_lib_src_dir;
     path script_lib_compiled_dir;
@@ -84,6 +86,19 @@ struct Resources {
     path persistent_data_dir;
     path persistent_data_backup_dir;
     
+    // Residency budgets, in MB (0 => unlimited); see ResourceLoader::residency()
+    struct Budgets {
+        unsigned file_buffers = 256;
+        unsigned images       = 512;
+        unsigned meshes       = 512;
+        unsigned gl_buffers   = 256;
+        unsigned gl_programs  = 16;
+    } budgets;
+    
+    // resources.persistency
+    bool     hotload_shaders = true;
+    unsigned hotload_quiet_window_ms = 100;     // edits are batched until files stop changing for this long
+    
     void loadConfig (LuaInstance &);
 };
     
@@ -129,6 +144,15 @@ protected:
     InputManager m_inputManager;
     AppEvents    m_appEvents;
     Camera       m_mainCamera;
+#if defined(__APPLE__)
+    // Keeps ResourceLoader's path index (resolvePath) in sync w/ the resource dirs
+    std::unique_ptr<resource_impl::platform_osx::DirectoryWatcherInstance> m_dirWatcher;
+#elif defined(__linux__)
+    std::unique_ptr<resource_impl::platform_linux::DirectoryWatcherInstance> m_dirWatcher;
+#endif
+    std::unique_ptr<gl::ProgramCache> m_programCache;    // program binaries (in the asset cache dir) + compile timings
+    std::unique_ptr<gl::RingBuffer>   m_uniformRing;     // per-frame uniform blocks (gl::RingBuffer::uniforms())
+    std::unique_ptr<ShaderReloader> m_shaderReloader;   // null if hotload_shaders is off (or there's no watcher)
     
 protected:
     // Global state (required for modules to hook up to the event system, etc)
@@ -151,6 +175,7 @@ public:
     static auto getInputManager () { return g_inputManager; }
     static auto getAppEvents    () { return g_appEvents; }
     static Camera*  mainCamera () { return &(getInstance()->m_mainCamera); }
+    static ShaderReloader * shaderReloader () { return getInstance()->m_shaderReloader.get(); }
     static const decltype(m_appConfig) getConfig () { return *g_appConfig; }
 };
 
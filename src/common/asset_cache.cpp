@@ -0,0 +1,119 @@
+//
+//  asset_cache.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/6/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "asset_cache.hpp"
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::resource_impl;
+
+// On-disk entry header. Payload starts at sizeof(EntryHeader) == 64, so mmapped payloads keep
+// the 64-byte block alignment that formats like mesh_format rely on.
+struct EntryHeader {
+    static constexpr uint32_t MAGIC = 0x43535347; // 'GSSC'
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    uint32_t magic;
+    uint32_t formatVersion;
+    uint32_t processorVersion;
+    uint32_t reserved;
+    uint64_t sourceHashLo;
+    uint64_t sourceHashHi;
+    uint64_t payloadSize;
+    uint64_t payloadHash;   // fasthash of the payload; catches truncated / corrupted entries
+    uint64_t padding [2];
+};
+static_assert(sizeof(EntryHeader) == 64, "cache payload must stay 64-byte aligned");
+
+AssetCache::Key AssetCache::makeKey (const uint8_t * source, size_t size, const char * processor, uint32_t version) {
+    Key key;
+    key.sourceHash = hash::fastHash128(source, size);
+    key.processor  = processor;
+    key.version    = version;
+    return key;
+}
+
+AssetCache::AssetCache (const boost::filesystem::path & cacheDir) :
+    m_cacheDir(cacheDir) {}
+
+boost::filesystem::path AssetCache::entryPath (const Key & key) const {
+    return m_cacheDir / key.processor / (hash::toHex(key.sourceHash) + "-v" + std::to_string(key.version) + ".bin");
+}
+
+AssetCache::Entry AssetCache::lookup (const Key & key) {
+    Entry entry;
+    auto path = entryPath(key);
+
+    immediate::loadFileMappedImmediate(path.string(), [&](const FileBufferRef & file) {
+        EntryHeader header;
+        if (file->size < sizeof(header))
+            return;
+        memcpy(&header, file->data, sizeof(header));
+        if (header.magic != EntryHeader::MAGIC ||
+            header.formatVersion != EntryHeader::FORMAT_VERSION ||
+            header.processorVersion != key.version ||
+            header.sourceHashLo != key.sourceHash.lo ||
+            header.sourceHashHi != key.sourceHash.hi ||
+            header.payloadSize != file->size - sizeof(header))
+            return;
+
+        auto payload = file->data + sizeof(header);
+        if (hash::fastHash64(payload, (size_t)header.payloadSize) != header.payloadHash)
+            return;
+
+        entry.file = file;
+        entry.data = payload;
+        entry.size = (size_t)header.payloadSize;
+    }, [](const FilePath &) {});
+
+    ++(entry ? m_stats.hits : m_stats.misses);
+    return entry;
+}
+
+bool AssetCache::store (const Key & key, const std::vector<uint8_t> & payload) {
+    using namespace boost::filesystem;
+
+    auto path = entryPath(key);
+    boost::system::error_code ec;
+    create_directories(path.parent_path(), ec);
+    if (ec)
+        return ++m_stats.storeFailures, false;
+
+    EntryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic            = EntryHeader::MAGIC;
+    header.formatVersion    = EntryHeader::FORMAT_VERSION;
+    header.processorVersion = key.version;
+    header.sourceHashLo     = key.sourceHash.lo;
+    header.sourceHashHi     = key.sourceHash.hi;
+    header.payloadSize      = payload.size();
+    header.payloadHash      = hash::fastHash64(payload.empty() ? nullptr : &payload[0], payload.size());
+
+    // Unique per writer, so two threads caching the same asset don't clobber each other's temp file
+    auto tmpPath = path;
+    tmpPath += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    FILE * f = fopen(tmpPath.string().c_str(), "wb");
+    if (!f)
+        return ++m_stats.storeFailures, false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              (payload.empty() || fwrite(&payload[0], 1, payload.size(), f) == payload.size());
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok) {
+        rename(tmpPath, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        remove(tmpPath, ec);
+        return ++m_stats.storeFailures, false;
+    }
+    return ++m_stats.stores, true;
+}
@@ -0,0 +1,151 @@
+//
+//  asset_cache.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/6/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef asset_cache_hpp
+#define asset_cache_hpp
+
+#include "resourcelayer/resource_impl.hpp"
+#include "resourcelayer/file_hash.hpp"
+
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+namespace gl_sandbox {
+
+// Content-addressed cache of processed assets (parsed meshes, decoded images, etc).
+//
+// Entries are keyed by a hash of the source file's contents plus the name + version of the
+// processor that produced them, so editing a source file or bumping a processor version just
+// produces a new key (stale entries are never read; they're just left behind). Entries live at
+//     <cache dir>/<processor>/<source hash>-v<version>.bin
+// and are loaded back via mmap, so a hit costs roughly one page fault per 4k of payload.
+//
+// Writes go to a temp file + rename(), so concurrent loaders / crashes never leave a partially
+// written entry visible. The cache is strictly best-effort: any failure just means a miss.
+class AssetCache {
+public:
+    struct Key {
+        hash::Hash128 sourceHash;
+        std::string   processor;
+        uint32_t      version = 0;
+    };
+    static Key makeKey (const uint8_t * source, size_t size, const char * processor, uint32_t version);
+
+    // A cache hit. Payload points into file (kept alive by the FileBufferRef).
+    struct Entry {
+        resource_impl::FileBufferRef file;
+        const uint8_t * data = nullptr;
+        size_t size = 0;
+
+        operator bool () const { return data != nullptr; }
+    };
+
+    struct Stats {
+        std::atomic<size_t> hits   { 0 };
+        std::atomic<size_t> misses { 0 };
+        std::atomic<size_t> stores { 0 };
+        std::atomic<size_t> storeFailures { 0 };
+    };
+
+    explicit AssetCache (const boost::filesystem::path & cacheDir);
+
+    Entry lookup (const Key & key);
+    bool  store  (const Key & key, const std::vector<uint8_t> & payload);
+
+    boost::filesystem::path entryPath (const Key & key) const;
+    const Stats & stats () const { return m_stats; }
+
+protected:
+    boost::filesystem::path m_cacheDir;
+    Stats m_stats;
+};
+
+// Minimal POD / vector / string serialization for cache payloads. Native endianness and
+// layout -- cache entries aren't meant to be portable across machines.
+struct BlobWriter {
+    std::vector<uint8_t> data;
+
+    void writeBytes (const void * bytes, size_t size) {
+        data.insert(data.end(), (const uint8_t*)bytes, (const uint8_t*)bytes + size);
+    }
+    template <typename T>
+    void write (const T & value) {
+        static_assert(std::is_trivially_copyable<T>::value, "BlobWriter::write requires a POD type");
+        writeBytes(&value, sizeof(T));
+    }
+    template <typename T>
+    void write (const std::vector<T> & values) {
+        static_assert(std::is_trivially_copyable<T>::value, "BlobWriter::write requires a POD type");
+        write((uint64_t)values.size());
+        if (!values.empty())
+            writeBytes(&values[0], values.size() * sizeof(T));
+    }
+    void write (const std::string & s) {
+        write((uint64_t)s.size());
+        writeBytes(s.data(), s.size());
+    }
+};
+
+// Reads back what BlobWriter wrote. All reads are bounds checked; once a read fails, ok()
+// stays false and every subsequent read fails too.
+struct BlobReader {
+    BlobReader (const uint8_t * data, size_t size) : m_pos(data), m_end(data + size) {}
+
+    bool ok () const { return m_ok; }
+    bool atEnd () const { return m_pos == m_end; }
+
+    bool readBytes (void * bytes, size_t size) {
+        if (!m_ok || (size_t)(m_end - m_pos) < size)
+            return m_ok = false;
+        memcpy(bytes, m_pos, size);
+        m_pos += size;
+        return true;
+    }
+    template <typename T>
+    bool read (T & value) {
+        static_assert(std::is_trivially_copyable<T>::value, "BlobReader::read requires a POD type");
+        return readBytes(&value, sizeof(T));
+    }
+    // Returns a pointer to the next size bytes (w/out copying), or nullptr if out of bounds.
+    const uint8_t * readSpan (size_t size) {
+        if (!m_ok || (size_t)(m_end - m_pos) < size)
+            return m_ok = false, nullptr;
+        auto span = m_pos;
+        m_pos += size;
+        return span;
+    }
+    template <typename T>
+    bool read (std::vector<T> & values) {
+        static_assert(std::is_trivially_copyable<T>::value, "BlobReader::read requires a POD type");
+        uint64_t count;
+        if (!read(count) || count > (size_t)(m_end - m_pos) / sizeof(T))
+            return m_ok = false;
+        values.resize((size_t)count);
+        return count == 0 || readBytes(&values[0], (size_t)count * sizeof(T));
+    }
+    bool read (std::string & s) {
+        uint64_t count;
+        if (!read(count) || count > (size_t)(m_end - m_pos))
+            return m_ok = false;
+        s.assign((const char*)m_pos, (size_t)count);
+        m_pos += count;
+        return true;
+    }
+protected:
+    const uint8_t * m_pos;
+    const uint8_t * m_end;
+    bool m_ok = true;
+};
+
+}; // namespace gl_sandbox
+
+#endif /* asset_cache_hpp */
@@ -0,0 +1,120 @@
+//
+//  gl_commands.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "gl_commands.hpp"
+#include "gl_error.hpp"
+#include <algorithm>
+
+using namespace gl_sandbox::gl;
+
+uint64_t gl_sandbox::gl::sortKey (const DrawCommand & command) {
+    constexpr uint64_t DEPTH_MAX = (1 << 20) - 1;
+    auto depth = (uint64_t)(std::min(1.0f, std::max(0.0f, command.depth)) * DEPTH_MAX);
+    return ((uint64_t)(command.pass    & 0xf)   << 60)
+        |  ((uint64_t)(command.program & 0xfff) << 48)
+        |  ((uint64_t)(command.vao     & 0xfff) << 36)
+        |  ((uint64_t)command.material          << 20)
+        |  depth;
+}
+
+void gl_sandbox::gl::radixSort (std::vector<SortItem> & items, std::vector<SortItem> & scratch) {
+    auto n = items.size();
+    if (n < 2)
+        return;
+
+    // All 8 histograms in one pass over the keys
+    size_t counts [8][256] = {};
+    for (const auto & item : items) {
+        for (unsigned digit = 0; digit < 8; ++digit)
+            ++counts[digit][(item.key >> (digit * 8)) & 0xff];
+    }
+    scratch.resize(n);
+    auto src = &items[0], dst = &scratch[0];
+    for (unsigned digit = 0, shift = 0; digit < 8; ++digit, shift += 8) {
+        const auto & count = counts[digit];
+        if (count[(src[0].key >> shift) & 0xff] == n)
+            continue;
+        size_t offsets [256];
+        for (size_t bucket = 0, total = 0; bucket < 256; total += count[bucket++])
+            offsets[bucket] = total;
+        for (size_t i = 0; i < n; ++i)
+            dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+        std::swap(src, dst);
+    }
+    if (src != &items[0])
+        items.swap(scratch);
+}
+
+void RenderQueue::enqueue (CommandList && list) {
+    if (list.empty())
+        return;
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_lists.emplace_back(std::move(list));
+}
+
+void RenderQueue::sort () {
+    std::vector<CommandList> lists;
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        std::swap(lists, m_lists);
+    }
+    for (auto & list : lists) {
+        for (auto & command : list.m_commands) {
+            m_order.push_back({ sortKey(command), (uint32_t)m_commands.size() });
+            m_commands.emplace_back(std::move(command));
+        }
+    }
+    m_stats.lists += lists.size();
+    radixSort(m_order, m_scratch);
+}
+
+void RenderQueue::submit (StateCache & state) {
+    sort();
+    m_stats.draws = m_order.size();
+    m_stats.programChanges = m_stats.vaoChanges = 0;
+
+    GLuint program = 0, vao = 0;
+    for (const auto & item : m_order) {
+        const auto & command = m_commands[item.index];
+        if (command.program != program)
+            ++m_stats.programChanges, program = command.program;
+        if (command.vao != vao)
+            ++m_stats.vaoChanges, vao = command.vao;
+
+        state.useProgram(command.program);
+        state.bindVertexArray(command.vao);
+        if (command.elementBuffer)
+            state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, command.elementBuffer);
+        if (command.setup)
+            command.setup();
+
+        switch (command.type) {
+            case DrawCommand::ARRAYS:
+                if (command.instances == 1)
+                    glDrawArrays(command.mode, command.first, command.count);
+                else
+                    glDrawArraysInstanced(command.mode, command.first, command.count, command.instances);
+                break;
+            case DrawCommand::ELEMENTS:
+                if (command.instances == 1)
+                    glDrawElements(command.mode, command.count, command.indexType, command.indices);
+                else
+                    glDrawElementsInstanced(command.mode, command.count, command.indexType, command.indices, command.instances);
+                break;
+            case DrawCommand::MULTI_ELEMENTS_BASE_VERTEX:
+                glMultiDrawElementsBaseVertex(command.mode, command.counts, command.indexType, command.offsets,
+                                              command.drawCount, command.baseVertices);
+                break;
+        }
+        CHECK_GL_ERRORS();
+    }
+    m_commands.clear();
+    m_order.clear();
+    m_lastStats = m_stats;
+    m_stats = Stats();
+}
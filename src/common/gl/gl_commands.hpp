@@ -0,0 +1,129 @@
+//
+//  gl_commands.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef gl_commands_hpp
+#define gl_commands_hpp
+
+#include "gl_state.hpp"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace gl_sandbox {
+namespace gl {
+
+// One deferred draw call + the state it needs. Recorded into a CommandList (no gl calls, so
+// any thread), and issued later by RenderQueue::submit() on the main thread.
+struct DrawCommand {
+    enum Type : uint8_t {
+        ARRAYS,                         // glDrawArrays[Instanced]
+        ELEMENTS,                       // glDrawElements[Instanced]
+        MULTI_ELEMENTS_BASE_VERTEX      // glMultiDrawElementsBaseVertex
+    };
+
+    // State; also what draws get sorted by (see sortKey())
+    uint8_t  pass     = 0;          // lowest first (4 bits)
+    GLuint   program  = 0;
+    GLuint   vao      = 0;
+    GLuint   elementBuffer = 0;     // bound after the vao if non-zero
+    uint16_t material = 0;          // anything that groups draws sharing uniform values / textures
+    float    depth    = 0;          // in [0, 1]; ascending w/in the same state. Flip it for back-to-front.
+
+    // Draw
+    Type     type      = ARRAYS;
+    GLenum   mode      = GL_TRIANGLES;
+    GLenum   indexType = GL_UNSIGNED_INT;
+    GLint    first     = 0;         // ARRAYS
+    GLsizei  count     = 0;         // ARRAYS, ELEMENTS
+    GLsizei  instances = 1;
+    const GLvoid * indices = nullptr;   // ELEMENTS (byte offset into the element buffer)
+
+    // MULTI_ELEMENTS_BASE_VERTEX: drawCount entries each; not copied, so they have to stay put
+    // until the frame's been submitted.
+    const GLsizei *        counts       = nullptr;
+    const GLvoid * const * offsets      = nullptr;
+    const GLint *          baseVertices = nullptr;
+    GLsizei                drawCount    = 0;
+
+    // Run right before the draw, w/ program bound (uniforms, textures, etc). Main thread.
+    std::function<void()> setup;
+};
+
+// 64 bit sort key, msb first: pass (4) | program (12) | vao (12) | material (16) | depth (20).
+// Program / vao names get truncated to their low bits, which only matters for how well draws
+// get grouped -- submit() always compares the real names.
+uint64_t sortKey (const DrawCommand & command);
+
+// Stable LSD radix sort by key, 8 bits per pass; passes where every key has the same digit
+// (eg. the pass bits, most of the time) are skipped. scratch is resized as needed.
+struct SortItem {
+    uint64_t key;
+    uint32_t index;
+};
+void radixSort (std::vector<SortItem> & items, std::vector<SortItem> & scratch);
+
+// Draws recorded by one thread (usually one module's recordFrame()). Not thread safe itself --
+// just cheap enough to give each recorder its own.
+class CommandList {
+public:
+    // Commands w/o a program are dropped: record 0 for a shader that isn't loaded() (eg. one that
+    // failed to compile or link -- its program object still has a name)
+    void push (DrawCommand && command) {
+        if (command.program)
+            m_commands.emplace_back(std::move(command));
+    }
+    void push (const DrawCommand & command) { push(DrawCommand(command)); }
+
+    size_t size () const { return m_commands.size(); }
+    bool empty () const { return m_commands.empty(); }
+    void clear () { m_commands.clear(); }
+
+protected:
+    friend class RenderQueue;
+    std::vector<DrawCommand> m_commands;
+};
+
+// Collects CommandLists from any number of threads, then sorts every draw by sortKey() and
+// issues them through a StateCache, so program / vao / element buffer binds only happen when
+// they actually change between consecutive draws.
+class RenderQueue {
+public:
+    struct Stats {
+        size_t lists = 0;
+        size_t draws = 0;
+        size_t programChanges = 0;
+        size_t vaoChanges     = 0;
+    };
+
+    // Thread safe.
+    void enqueue (CommandList && list);
+
+    // Sorts everything enqueued so far into draw order (done by submit(); exposed for tests).
+    void sort ();
+    const DrawCommand & sorted (size_t i) const { return m_commands[m_order[i].index]; }
+    size_t size () const { return m_order.size(); }
+
+    // Issues every draw, in order + clears the queue. Main (gl) thread.
+    void submit (StateCache & state = StateCache::shared());
+
+    // Of the last submit()
+    const Stats & stats () const { return m_lastStats; }
+
+protected:
+    std::mutex               m_mutex;       // guards m_lists
+    std::vector<CommandList> m_lists;
+    std::vector<DrawCommand> m_commands;    // everything below: main thread
+    std::vector<SortItem>    m_order, m_scratch;
+    Stats                    m_stats, m_lastStats;
+};
+
+}; // namespace gl
+}; // namespace gl_sandbox
+
+#endif /* gl_commands_hpp */
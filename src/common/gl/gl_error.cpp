@@ -0,0 +1,151 @@
+//
+//  gl_error.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "gl_error.hpp"
+#include "gl_state.hpp"
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace gl_sandbox::gl;
+
+bool                      ErrorLog::g_debugOutput = false;
+std::atomic<const char *> ErrorLog::g_file { nullptr };
+std::atomic<int>          ErrorLog::g_line { 0 };
+
+namespace {
+
+struct Site {
+    bool        error;
+    std::string message;    // first one we got
+    size_t      count = 0;
+    bool        reported = false;
+};
+// By (id, file, line)
+typedef std::map<std::tuple<unsigned, std::string, int>, Site> Sites;
+
+// Debug messages can come in on a driver thread, so everything's behind one lock
+struct Log {
+    std::mutex                  mutex;
+    Sites                       sites;
+    std::vector<Sites::value_type *> fresh;     // not printed yet
+    ErrorLog::Summary           frame, lastFrame;
+};
+Log & log () {
+    static Log g_log;
+    return g_log;
+}
+
+const char * errorName (GLenum err) {
+    switch (err) {
+        case GL_INVALID_OPERATION:              return "INVALID_OPERATION";
+        case GL_INVALID_ENUM:                   return "INVALID_ENUM";
+        case GL_INVALID_VALUE:                  return "INVALID_VALUE";
+        case GL_OUT_OF_MEMORY:                  return "OUT_OF_MEMORY";
+        case GL_INVALID_FRAMEBUFFER_OPERATION:  return "INVALID_FRAMEBUFFER_OPERATION";
+        default:                                return "unknown error";
+    }
+}
+
+void print (std::ostream & out, const Sites::value_type & site) {
+    out << std::get<1>(site.first) << ":" << std::get<2>(site.first) << ": OpenGL "
+        << (site.second.error ? "error" : "message") << " " << std::get<0>(site.first) << ": '"
+        << site.second.message << "'";
+}
+
+}; // anonymous namespace
+
+bool ErrorLog::enableDebugOutput (bool synchronous) {
+#if GL_ERROR_CHECKS == GL_ERROR_CHECKS_DEBUG_OUTPUT
+    if (!GLEW_KHR_debug && !GLEW_VERSION_4_3)
+        return false;
+    glDebugMessageCallback(&ErrorLog::onDebugMessage, nullptr);
+    // Notifications are mostly "buffer x will use video memory" spam
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+    StateCache::shared().enable(GL_DEBUG_OUTPUT);
+    StateCache::shared().setEnabled(GL_DEBUG_OUTPUT_SYNCHRONOUS, synchronous);
+    while (glGetError() != GL_NO_ERROR) {}
+    return g_debugOutput = true;
+#else
+    (void)synchronous;
+    return false;
+#endif
+}
+
+void ErrorLog::checkErrors (const char * file, int line) {
+    GLenum err;
+    while ((err = glGetError()) != GL_NO_ERROR)
+        record(true, err, file, line, errorName(err));
+}
+
+void GLAPIENTRY ErrorLog::onDebugMessage (GLenum /*source*/, GLenum type, GLuint id, GLenum severity,
+                                          GLsizei /*length*/, const GLchar * message, const void * /*user*/) {
+    if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+        return;
+    record(type == GL_DEBUG_TYPE_ERROR, id, g_file.load(std::memory_order_relaxed),
+           g_line.load(std::memory_order_relaxed), message);
+}
+
+void ErrorLog::record (bool error, unsigned id, const char * file, int line, const char * message) {
+    auto & log = ::log();
+    std::lock_guard<std::mutex> lock (log.mutex);
+    ++(error ? log.frame.errors : log.frame.messages);
+
+    auto key = std::make_tuple(id, std::string(file ? file : "<before first check>"), line);
+    auto it  = log.sites.find(key);
+    if (it == log.sites.end()) {
+        Site site;
+        site.error   = error;
+        site.message = message;
+        it = log.sites.emplace(std::move(key), std::move(site)).first;
+        // glGetError() checks happen right where the error is, so those get printed right away
+        if (g_debugOutput) {
+            log.fresh.push_back(&*it);
+        } else {
+            print(std::cerr, *it);
+            std::cerr << std::endl;
+            it->second.reported = true;
+        }
+    }
+    ++it->second.count;
+}
+
+void ErrorLog::endFrame () {
+    auto & log = ::log();
+    std::lock_guard<std::mutex> lock (log.mutex);
+    if (!log.fresh.empty()) {
+        std::cerr << "OpenGL: " << log.frame.errors << " error(s), " << log.frame.messages
+                  << " other message(s) this frame; new:\n";
+        for (auto site : log.fresh) {
+            std::cerr << "  ";
+            print(std::cerr, *site);
+            std::cerr << " (x" << site->second.count << ")\n";
+            site->second.reported = true;
+        }
+        log.fresh.clear();
+    }
+    log.lastFrame = log.frame;
+    log.frame     = Summary();
+}
+
+ErrorLog::Summary ErrorLog::lastFrame () {
+    auto & log = ::log();
+    std::lock_guard<std::mutex> lock (log.mutex);
+    return log.lastFrame;
+}
+
+void ErrorLog::report (std::ostream & out) {
+    auto & log = ::log();
+    std::lock_guard<std::mutex> lock (log.mutex);
+    for (const auto & site : log.sites) {
+        print(out, site);
+        out << " x" << site.second.count << '\n';
+    }
+}
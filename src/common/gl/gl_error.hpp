@@ -9,26 +9,82 @@
 #ifndef gl_error_h
 #define gl_error_h
 
+#include <GL/glew.h>
+#include <atomic>
 #include <iostream>
 
-inline void check_gl_errors (const char * file, int line) {
-    GLenum err;
-    while((err = glGetError()) != GL_NO_ERROR) {
-        std::string error;
-        switch(err) {
-            case GL_INVALID_OPERATION:      error="INVALID_OPERATION";      break;
-            case GL_INVALID_ENUM:           error="INVALID_ENUM";           break;
-            case GL_INVALID_VALUE:          error="INVALID_VALUE";          break;
-            case GL_OUT_OF_MEMORY:          error="OUT_OF_MEMORY";          break;
-            case GL_INVALID_FRAMEBUFFER_OPERATION:  error="INVALID_FRAMEBUFFER_OPERATION";  break;
+// What CHECK_GL_ERRORS() does (override w/ -DGL_ERROR_CHECKS=n):
+//  0: nothing; compiled out, so no error queries at all. Release default.
+//  1: glGetError() until it's clear. Every check stalls on the driver.
+//  2: KHR_debug output, when the context has it (see ErrorLog::enableDebugOutput()): the driver
+//     reports errors on its own, asynchronously, and checks just note where we are so reports can
+//     be pinned to the nearest one. Falls back to 1 w/o KHR_debug (eg. apple's gl 4.1). Debug default.
+#define GL_ERROR_CHECKS_OFF          0
+#define GL_ERROR_CHECKS_SYNC         1
+#define GL_ERROR_CHECKS_DEBUG_OUTPUT 2
+#ifndef GL_ERROR_CHECKS
+#ifdef DEBUG
+#define GL_ERROR_CHECKS GL_ERROR_CHECKS_DEBUG_OUTPUT
+#else
+#define GL_ERROR_CHECKS GL_ERROR_CHECKS_OFF
+#endif
+#endif
+
+namespace gl_sandbox {
+namespace gl {
+
+// Errors (+ other debug messages) from the driver, tallied per call site. Reported once per
+// frame by endFrame(): each distinct (site, message) gets printed the first time it shows up;
+// after that it's just counted.
+class ErrorLog {
+public:
+    struct Summary {
+        size_t errors   = 0;
+        size_t messages = 0;    // other debug output (warnings, perf hints, etc)
+    };
+
+    // Needs a current context (ideally created w/ GLFW_OPENGL_DEBUG_CONTEXT). Returns false if
+    // there's no KHR_debug, in which case checks keep using glGetError(). synchronous => messages
+    // arrive during the offending call (exact locations, slower).
+    static bool enableDebugOutput (bool synchronous = false);
+    static bool debugOutputEnabled () { return g_debugOutput; }
+
+    // What CHECK_GL_ERRORS() turns into
+    static void check (const char * file, int line) {
+        if (g_debugOutput) {
+            g_file.store(file, std::memory_order_relaxed);
+            g_line.store(line, std::memory_order_relaxed);
+        } else {
+            checkErrors(file, line);
         }
-        std::cerr << file << ":" << line << "' OpenGL error: '" << error << std::endl;
     }
-}
-#ifdef DEBUG
-#define CHECK_GL_ERRORS() check_gl_errors(__FILE__, __LINE__)
+    static void checkErrors (const char * file, int line);
+
+    // Prints anything new that got reported this frame + starts the next one.
+    static void endFrame ();
+    static Summary lastFrame ();
+    // Totals per site (on shutdown)
+    static void report (std::ostream & out);
+
+protected:
+    static void record (bool error, unsigned id, const char * file, int line, const char * message);
+    static void GLAPIENTRY onDebugMessage (GLenum source, GLenum type, GLuint id, GLenum severity,
+                                          GLsizei length, const GLchar * message, const void * user);
+
+    static bool                       g_debugOutput;
+    static std::atomic<const char *>  g_file;       // last check (=> where a debug message is from)
+    static std::atomic<int>           g_line;
+};
+
+}; // namespace gl
+}; // namespace gl_sandbox
+
+#if GL_ERROR_CHECKS == GL_ERROR_CHECKS_OFF
+#define CHECK_GL_ERRORS() ((void)0)
+#elif GL_ERROR_CHECKS == GL_ERROR_CHECKS_SYNC
+#define CHECK_GL_ERRORS() gl_sandbox::gl::ErrorLog::checkErrors(__FILE__, __LINE__)
 #else
-#define CHECK_GL_ERRORS() 0
+#define CHECK_GL_ERRORS() gl_sandbox::gl::ErrorLog::check(__FILE__, __LINE__)
 #endif
 
 
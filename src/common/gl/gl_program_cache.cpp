@@ -0,0 +1,114 @@
+//
+//  gl_program_cache.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "gl_program_cache.hpp"
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::gl;
+
+constexpr uint32_t ProgramCache::VERSION;
+ProgramCache * ProgramCache::g_shared = nullptr;
+
+static std::string glString (GLenum name) {
+    auto s = glGetString(name);
+    return s ? (const char *)s : "";
+}
+
+ProgramCache::ProgramCache (AssetCache * cache) :
+    m_cache(cache)
+{
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats); CHECK_GL_ERRORS();
+    if (numFormats <= 0)
+        m_cache = nullptr;
+    m_driver = glString(GL_RENDERER) + '\n' + glString(GL_VERSION) + '\n' + glString(GL_VENDOR) + '\n' +
+               glString(GL_SHADING_LANGUAGE_VERSION);
+}
+
+AssetCache::Key ProgramCache::key (const std::string & fragmentSrc, const std::string & vertexSrc) const {
+    // Separators keep ("ab", "c") and ("a", "bc") apart
+    const uint8_t separator = 0;
+    hash::FastHash64 h;
+    h.update((const uint8_t *)m_driver.data(), m_driver.size());
+    h.update(&separator, 1);
+    h.update((const uint8_t *)fragmentSrc.data(), fragmentSrc.size());
+    h.update(&separator, 1);
+    h.update((const uint8_t *)vertexSrc.data(), vertexSrc.size());
+
+    AssetCache::Key key;
+    key.sourceHash = h.finish128();
+    key.processor  = "glprogram";
+    key.version    = VERSION;
+    return key;
+}
+
+bool ProgramCache::load (const AssetCache::Key & key, const gl::ShaderProgram & program) {
+    if (!m_cache)
+        return false;
+    auto entry = m_cache->lookup(key);
+    GLenum format = 0;
+    uint64_t length = 0;
+    const uint8_t * binary = nullptr;
+    if (entry) {
+        BlobReader reader (entry.data, entry.size);
+        if (reader.read(format) && reader.read(length) && length > 0)
+            binary = reader.readSpan((size_t)length);
+    }
+    if (!binary)
+        return ++m_stats.misses, false;
+
+    CHECK_GL_ERRORS();
+    auto start = glfwGetTime();
+    glProgramBinary(program.handle, format, binary, (GLsizei)length);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program.handle, GL_LINK_STATUS, &linked);
+    // A format the driver doesn't take anymore raises INVALID_ENUM; that's just a miss
+    // (w/ debug output on, it still shows up in the error log -- pinned to the check above)
+    while (glGetError() != GL_NO_ERROR) {}
+    if (!linked) {
+        ++m_stats.rejected;
+        return ++m_stats.misses, false;
+    }
+    ++m_stats.hits;
+    m_stats.loadTime += glfwGetTime() - start;
+    return true;
+}
+
+void ProgramCache::prepare (const gl::ShaderProgram & program) {
+    if (m_cache) {
+        glProgramParameteri(program.handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); CHECK_GL_ERRORS();
+    }
+}
+
+bool ProgramCache::store (const AssetCache::Key & key, const gl::ShaderProgram & program) {
+    if (!m_cache)
+        return false;
+    GLint length = 0;
+    glGetProgramiv(program.handle, GL_PROGRAM_BINARY_LENGTH, &length); CHECK_GL_ERRORS();
+    if (length <= 0)
+        return false;
+
+    // Payload: format, length, binary
+    BlobWriter writer;
+    writer.write((GLenum)0);
+    writer.write((uint64_t)length);
+    auto header = writer.data.size();
+    writer.data.resize(header + (size_t)length);
+
+    GLenum  format  = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program.handle, length, &written, &format, &writer.data[header]); CHECK_GL_ERRORS();
+    if (written != length)
+        return false;
+    memcpy(&writer.data[0], &format, sizeof(format));
+
+    if (!m_cache->store(key, writer.data))
+        return false;
+    ++m_stats.stores;
+    return true;
+}
@@ -0,0 +1,83 @@
+//
+//  gl_program_cache.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef gl_program_cache_hpp
+#define gl_program_cache_hpp
+
+#include "gl_traits.hpp"
+#include "../asset_cache.hpp"
+#include <string>
+
+namespace gl_sandbox {
+namespace gl {
+
+// Linked program binaries (glGetProgramBinary), kept in the asset cache so warm runs (+ modules
+// getting toggled back on) skip the driver's compiler.
+//
+// Keys hash the (preprocessed) stage sources together w/ the renderer / version / vendor
+// strings, so a driver update never even looks at binaries built by the old one. Drivers can
+// still reject a binary (glProgramBinary => link status false), so a hit that doesn't link is
+// counted as rejected, and callers compile from source like it was a miss.
+//
+// Also tracks compile / link times (cumulative), whether or not binaries get cached. Main
+// (gl) thread only.
+class ProgramCache {
+public:
+    struct Stats {
+        size_t hits     = 0;
+        size_t misses   = 0;
+        size_t rejected = 0;    // binaries the driver refused (counted in misses too)
+        size_t stores   = 0;
+        size_t compiles = 0;    // stages compiled from source
+        size_t links    = 0;    // programs linked from source
+        double compileTime = 0; // seconds
+        double linkTime    = 0;
+        double loadTime    = 0; // in glProgramBinary (hits)
+    };
+    static constexpr uint32_t VERSION = 1;
+
+    // Needs a current gl context. cache can be null (=> timings only).
+    explicit ProgramCache (AssetCache * cache);
+    ProgramCache (const ProgramCache &) = delete;
+    ProgramCache & operator= (const ProgramCache &) = delete;
+
+    // False if there's no asset cache, or the driver doesn't support any binary formats
+    // (eg. apple's gl 4.1 reports none).
+    bool enabled () const { return m_cache != nullptr; }
+
+    AssetCache::Key key (const std::string & fragmentSrc, const std::string & vertexSrc) const;
+
+    // Loads a cached binary into program; false on a miss / rejected binary (program is
+    // unlinked then, but can still get shaders attached + linked as usual).
+    bool load (const AssetCache::Key & key, const gl::ShaderProgram & program);
+
+    // Call before linking anything you're going to store() (lets the driver keep the binary around).
+    void prepare (const gl::ShaderProgram & program);
+    // Stores a successfully linked program. Returns false if it wasn't stored.
+    bool store (const AssetCache::Key & key, const gl::ShaderProgram & program);
+
+    void recordCompile (double seconds) { ++m_stats.compiles; m_stats.compileTime += seconds; }
+    void recordLink    (double seconds) { ++m_stats.links;    m_stats.linkTime    += seconds; }
+    const Stats & stats () const { return m_stats; }
+
+    // Used by Shader + ShaderReloader; null (the default) => always compile from source. Set at
+    // startup / shutdown, not while shaders are half loaded.
+    static ProgramCache * shared () { return g_shared; }
+    static void setShared (ProgramCache * cache) { g_shared = cache; }
+
+protected:
+    AssetCache * m_cache;
+    std::string  m_driver;      // renderer / version / vendor, hashed into every key
+    Stats        m_stats;
+    static ProgramCache * g_shared;
+};
+
+}; // namespace gl
+}; // namespace gl_sandbox
+
+#endif /* gl_program_cache_hpp */
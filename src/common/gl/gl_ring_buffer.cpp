@@ -0,0 +1,165 @@
+//
+//  gl_ring_buffer.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "gl_ring_buffer.hpp"
+#include "gl_error.hpp"
+#include <algorithm>
+
+using namespace gl_sandbox::gl;
+
+RingBuffer * RingBuffer::g_uniforms = nullptr;
+
+RingBuffer::RingBuffer (GLenum target, size_t bytesPerFrame) : m_target(target) {
+    if (target == GL_UNIFORM_BUFFER) {
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment); CHECK_GL_ERRORS();
+        m_alignment = std::max(m_alignment, (size_t)alignment);
+    }
+    m_regionSize = aligned(std::max(bytesPerFrame, (size_t)1));
+    createStorage();
+}
+
+RingBuffer::~RingBuffer () {
+    releaseStorage();
+    drainRetired(true);
+}
+
+void RingBuffer::createStorage () {
+    auto & state = StateCache::shared();
+    auto size = (GLsizeiptr)(m_regionSize * FRAMES);
+    if (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        state.bindBuffer(m_target, m_buffer.handle);
+        glBufferStorage(m_target, size, nullptr, flags); CHECK_GL_ERRORS();
+        m_mapping = (uint8_t*)glMapBufferRange(m_target, 0, size, flags); CHECK_GL_ERRORS();
+        if (!m_mapping)
+            m_buffer = VBO();       // (storage is immutable, so start over w/ a fresh one)
+    }
+    if (!m_mapping) {
+        state.bindBuffer(m_target, m_buffer.handle);
+        glBufferData(m_target, size, nullptr, GL_STREAM_DRAW); CHECK_GL_ERRORS();
+    }
+    m_region = 0;
+    m_head   = 0;
+}
+
+void RingBuffer::releaseStorage () {
+    for (unsigned region = 0; region < FRAMES; ++region)
+        reclaim(region);
+    if (m_mapping) {
+        StateCache::shared().bindBuffer(m_target, m_buffer.handle);
+        glUnmapBuffer(m_target); CHECK_GL_ERRORS();
+        m_mapping = nullptr;
+    }
+}
+
+void RingBuffer::retireStorage () {
+    Retired retired;
+    std::swap(retired.buffer, m_buffer);    // (leaves us w/ its fresh, unallocated buffer)
+    retired.mapping = m_mapping;
+    std::copy(m_fences, m_fences + FRAMES, retired.fences);
+    std::fill(m_fences, m_fences + FRAMES, nullptr);
+    m_retired.push_back(std::move(retired));
+    m_mapping = nullptr;
+}
+
+// Deletes retired buffers nothing can be using anymore. W/ wait set, deletes all of them (once
+// the gpu's done).
+void RingBuffer::drainRetired (bool wait) {
+    for (auto it = m_retired.begin(); it != m_retired.end(); ) {
+        if (!wait && it->framesLeft > 0) {
+            --it->framesLeft;
+            ++it;
+            continue;
+        }
+        bool signaled = true;
+        for (auto & fence : it->fences) {
+            if (fence && glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+                if (!wait) {
+                    signaled = false;
+                    break;
+                }
+                while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            }
+        }
+        if (!signaled) {
+            ++it;
+            continue;
+        }
+        for (auto & fence : it->fences)
+            if (fence) glDeleteSync(fence);
+        if (it->mapping) {
+            StateCache::shared().bindBuffer(m_target, it->buffer.handle);
+            glUnmapBuffer(m_target); CHECK_GL_ERRORS();
+        }
+        it = m_retired.erase(it);
+    }
+}
+
+void RingBuffer::reclaim (unsigned region) {
+    auto & fence = m_fences[region];
+    if (!fence)
+        return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        ++m_stats.stalls;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+RingBuffer::Range RingBuffer::allocate (size_t size) {
+    Range range;
+    if (!size)
+        return range;
+    m_requested += aligned(size);
+    if (m_head + size > m_regionSize) {
+        ++m_stats.overflows;
+        return range;
+    }
+    // Waited on lazily, so a frame that doesn't write anything never waits
+    reclaim(m_region);
+
+    range.buffer = m_buffer.handle;
+    range.offset = (GLintptr)(m_region * m_regionSize + m_head);
+    range.size   = (GLsizeiptr)size;
+    m_head = std::min(aligned(m_head + size), m_regionSize);
+    ++m_stats.writes;
+    m_stats.bytes += aligned(size);
+    return range;
+}
+
+uint8_t * RingBuffer::mapRange (const Range & range) {
+    StateCache::shared().bindBuffer(m_target, range.buffer);
+    auto dst = glMapBufferRange(m_target, range.offset, range.size,
+                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    CHECK_GL_ERRORS();
+    return (uint8_t*)dst;
+}
+
+void RingBuffer::unmapRange () {
+    glUnmapBuffer(m_target); CHECK_GL_ERRORS();
+}
+
+void RingBuffer::endFrame () {
+    if (m_head > 0)
+        m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    drainRetired(false);
+    if (m_requested > m_regionSize) {
+        // Ranges from this buffer (+ the gpu) can still be using it for FRAMES more frames
+        retireStorage();
+        m_regionSize = aligned(std::max(m_requested, m_regionSize * 2));
+        createStorage();
+        ++m_stats.resizes;
+    } else {
+        m_region = (m_region + 1) % FRAMES;
+        m_head   = 0;
+    }
+    m_requested = 0;
+}
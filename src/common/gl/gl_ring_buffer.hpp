@@ -0,0 +1,136 @@
+//
+//  gl_ring_buffer.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef gl_ring_buffer_hpp
+#define gl_ring_buffer_hpp
+
+#include "gl_traits.hpp"
+#include "gl_state.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace gl_sandbox {
+namespace gl {
+
+// Streaming memory for data that changes every frame (uniform blocks; any target works). One
+// buffer, split into FRAMES regions that get used round robin: each frame sub-allocates front to
+// back from its region, and endFrame() fences it + moves on to the next one. A region only gets
+// written again once its fence has passed, which w/ 3 frames in flight it usually has.
+//
+// Storage is allocated once w/ glBufferStorage and stays mapped PERSISTENT | COHERENT, so a write
+// is just a memcpy into the mapping. W/o ARB_buffer_storage (eg. apple's 4.1) it's a plain
+// glBufferData'd buffer and each write maps only its own range UNSYNCHRONIZED (the fences are
+// what keep us off anything the gpu could be reading). Either way there's no reallocation or
+// orphaning per frame; if a frame asks for more than fits, the writes that don't fit fail
+// (empty Range) and the regions grow at the next endFrame(). The old buffer gets retired rather
+// than deleted, so Ranges handed out from it stay good for as long as they were promised.
+//
+// Main (gl) thread only.
+class RingBuffer {
+public:
+    enum { FRAMES = 3 };
+
+    // Part of the buffer; good until FRAMES more endFrame()s.
+    struct Range {
+        GLuint     buffer = 0;
+        GLintptr   offset = 0;
+        GLsizeiptr size   = 0;
+        explicit operator bool () const { return buffer != 0; }
+    };
+    struct Stats {
+        size_t writes    = 0;
+        size_t bytes     = 0;   // incl. alignment
+        size_t stalls    = 0;   // times we had to wait for the gpu to be done w/ a region
+        size_t overflows = 0;   // writes that didn't fit
+        size_t resizes   = 0;
+    };
+
+    // Offsets are aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for uniform buffers (so ranges
+    // can go straight to glBindBufferRange), 16 bytes otherwise.
+    RingBuffer (GLenum target, size_t bytesPerFrame);
+    ~RingBuffer ();
+    RingBuffer (const RingBuffer &) = delete;
+    RingBuffer & operator= (const RingBuffer &) = delete;
+
+    // Reserves size bytes from this frame's region, and calls fill(uint8_t * dst) to write them.
+    template <typename F>
+    Range write (size_t size, F && fill) {
+        auto range = allocate(size);
+        if (!range)
+            return range;
+        if (m_mapping) {
+            fill(m_mapping + range.offset);
+        } else if (auto dst = mapRange(range)) {
+            fill(dst);
+            unmapRange();
+        } else {
+            return Range();     // nothing got written; let the caller fall back
+        }
+        return range;
+    }
+    Range write (const void * data, size_t size) {
+        return write(size, [data, size] (uint8_t * dst) { memcpy(dst, data, size); });
+    }
+
+    // To an indexed binding point (eg. a uniform block binding)
+    void bindRange (GLuint index, const Range & range) const {
+        StateCache::shared().bindBufferRange(m_target, index, range.buffer, range.offset, range.size);
+    }
+
+    // Once per frame, after everything that reads this frame's writes has been submitted.
+    void endFrame ();
+
+    bool   persistent () const    { return m_mapping != nullptr; }
+    size_t bytesPerFrame () const { return m_regionSize; }
+    const Stats & stats () const  { return m_stats; }
+
+    // For per-frame uniform blocks (see ubo_fast / ubo_dynamic::UniformBuffer). Owned by the
+    // Application; null if there isn't one (eg. tests), in which case they upload the old way.
+    static RingBuffer * uniforms () { return g_uniforms; }
+    static void setUniforms (RingBuffer * ring) { g_uniforms = ring; }
+
+protected:
+    size_t aligned (size_t size) const { return (size + m_alignment - 1) / m_alignment * m_alignment; }
+    Range allocate (size_t size);
+    uint8_t * mapRange (const Range & range);
+    void unmapRange ();
+    void reclaim (unsigned region);     // waits on its fence, if it has one
+    void createStorage ();
+    void releaseStorage ();             // waits on everything
+    void retireStorage ();              // hands the buffer + its fences to m_retired
+    void drainRetired (bool wait);
+
+protected:
+    const GLenum m_target;
+    size_t    m_alignment  = 16;
+    size_t    m_regionSize = 0;
+    VBO       m_buffer;
+    uint8_t * m_mapping    = nullptr;   // persistent mapping of the whole buffer
+    unsigned  m_region     = 0;
+    size_t    m_head       = 0;         // next free byte in m_region
+    size_t    m_requested  = 0;         // this frame, incl. writes that didn't fit
+    GLsync    m_fences [FRAMES] = {};
+    Stats     m_stats;
+
+    // Buffers we outgrew: deleted once FRAMES endFrame()s have passed and the gpu's done w/ them
+    struct Retired {
+        VBO       buffer;
+        uint8_t * mapping = nullptr;
+        GLsync    fences [FRAMES] = {};
+        unsigned  framesLeft = FRAMES;
+    };
+    std::vector<Retired> m_retired;
+
+    static RingBuffer * g_uniforms;
+};
+
+}; // namespace gl
+}; // namespace gl_sandbox
+
+#endif /* gl_ring_buffer_hpp */
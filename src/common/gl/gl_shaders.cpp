@@ -7,6 +7,7 @@
 //
 
 #include "gl_shaders.hpp"
+#include "gl_program_cache.hpp"
 #include <boost/format.hpp>
 #include <iostream>
 
@@ -74,16 +75,29 @@ bool linkShader (ShaderProgram & program, const VertexShader & vertexShader, con
     return true;
 }
 
+// Compiles right away; timed if there's a ProgramCache to record it in.
+template <typename T>
+static bool timedCompile (T & shader, const char * src, std::function<void(const char *)> onError) {
+    auto start = glfwGetTime();
+    bool ok = compileShader(shader, src, onError);
+    if (auto cache = ProgramCache::shared())
+        cache->recordCompile(glfwGetTime() - start);
+    return ok;
+}
+
+static bool deferCompiles () {
+    auto cache = ProgramCache::shared();
+    return cache && cache->enabled();
+}
+
 bool Shader::compileFragment (const char * src, std::function<void(const ShaderLoadError &)> onError) {
     using boost::format;
     if (fragment_compiled) {
         return onError(ShaderLoadError { (format("Fragment shader already compiled (%s.fs)\n") % name).str() }), false;
     }
-    return fragment_compiled = gl::compileShader(_fs, src, [&onError,this](const char * errorLog) {
-        onError(ShaderLoadError {
-            (format("Error compiling fragment shader (%s.fs):\n%s") % name % errorLog).str()
-        });
-    });
+    if (deferCompiles())
+        return m_fragmentSrc = src, fragment_compiled = true;
+    return fragment_compiled = compileFragmentNow(src, onError);
 }
 
 bool Shader::compileVertex (const char * src, std::function<void(const ShaderLoadError &)> onError) {
@@ -91,7 +105,23 @@ bool Shader::compileVertex (const char * src, std::function<void(const ShaderLoa
     if (vertex_compiled) {
         return onError(ShaderLoadError { (format("Vertex shader already compiled (%s.vs)\n") % name).str() }), false;
     }
-    return vertex_compiled = compileShader(_vs, src, [&onError,this](const char *errorLog) {
+    if (deferCompiles())
+        return m_vertexSrc = src, vertex_compiled = true;
+    return vertex_compiled = compileVertexNow(src, onError);
+}
+
+bool Shader::compileFragmentNow (const char * src, const ErrorCallback & onError) {
+    using boost::format;
+    return timedCompile(_fs, src, [&onError,this](const char * errorLog) {
+        onError(ShaderLoadError {
+            (format("Error compiling fragment shader (%s.fs):\n%s") % name % errorLog).str()
+        });
+    });
+}
+
+bool Shader::compileVertexNow (const char * src, const ErrorCallback & onError) {
+    using boost::format;
+    return timedCompile(_vs, src, [&onError,this](const char * errorLog) {
         onError(ShaderLoadError {
             (format("Error compiling vertex shader (%s.vs):\n%s") % name % errorLog).str()
         });
@@ -104,11 +134,121 @@ bool Shader::linkProgram (std::function<void(const ShaderLoadError &)> onError)
         return onError(ShaderLoadError { (format("Cannot link shader '%s' -- uncompiled vertex/fragment shader(s)") % name).str() }), false;
     if (program_linked)
         return onError(ShaderLoadError { (format("Shader program '%s' already linked ") % name).str() }), false;
-    return program_linked = gl::linkShader(_program, _vs, _fs, [&onError,this] (const char * errorLog) {
+    
+    auto cache = ProgramCache::shared();
+    AssetCache::Key key;
+    bool deferred = !m_fragmentSrc.empty() || !m_vertexSrc.empty();
+    if (deferred) {
+        std::string fs, vs;
+        std::swap(fs, m_fragmentSrc);
+        std::swap(vs, m_vertexSrc);
+        if (cache && cache->load(key = cache->key(fs, vs), _program))
+            return reflectUniforms(), program_linked = true;
+        
+        // Miss (or the driver rejected the binary, which leaves _program as if a link failed --
+        // still fine to link normally)
+        fragment_compiled = compileFragmentNow(fs.c_str(), onError);
+        vertex_compiled   = compileVertexNow(vs.c_str(), onError);
+        if (!fragment_compiled || !vertex_compiled)
+            return false;
+        if (cache)
+            cache->prepare(_program);
+    }
+    auto start = glfwGetTime();
+    program_linked = gl::linkShader(_program, _vs, _fs, [&onError,this] (const char * errorLog) {
         onError(ShaderLoadError {
             (format("Error linking shader program '%s':\n%s") % name % errorLog).str()
         });
     });
+    if (cache)
+        cache->recordLink(glfwGetTime() - start);
+    if (program_linked && deferred && cache)
+        cache->store(key, _program);
+    if (program_linked)
+        reflectUniforms();
+    return program_linked;
+}
+
+void Shader::replaceProgram (gl::ShaderProgram && program, gl::VertexShader && vs, gl::FragmentShader && fs) {
+    _program = std::move(program);
+    _vs = std::move(vs);
+    _fs = std::move(fs);
+    fragment_compiled = vertex_compiled = program_linked = true;
+    reflectUniforms();
+}
+
+GLint Shader::getUniformLocation (const char * name) {
+    auto hash = uniformHash(name);
+    auto it = std::find(m_uniformHashes.begin(), m_uniformHashes.end(), hash);
+    if (it != m_uniformHashes.end())
+        return (GLint)(it - m_uniformHashes.begin());
+    if (!loaded()) {
+        std::cerr << "Error: can't get uniform from null shader ('" << this->name << "')\n";
+    } else {
+        std::cerr << "Error: No uniform '" << name << "' in shader '" << this->name << "'\n";
+    }
+    return addUniform(hash, name);
+}
+
+GLint Shader::addUniform (uint64_t hash, const std::string & name) {
+    m_uniformHashes.push_back(hash);
+    m_uniformNames.push_back(name);
+    m_uniforms.emplace_back();
+    return (GLint)m_uniforms.size() - 1;
+}
+
+void Shader::reflectUniforms () {
+    for (auto & slot : m_uniforms)
+        slot = UniformSlot();
+    
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(_program.handle, GL_ACTIVE_UNIFORMS, &count);                CHECK_GL_ERRORS();
+    glGetProgramiv(_program.handle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);  CHECK_GL_ERRORS();
+    std::vector<char> buffer ((size_t)std::max(maxLength, 1));
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint   size   = 0;
+        GLenum  type   = 0;
+        glGetActiveUniform(_program.handle, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]); CHECK_GL_ERRORS();
+        std::string name (&buffer[0], (size_t)length);
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            name.resize(name.size() - 3);   // arrays are reported as "foo[0]"
+        
+        // Uniform block members (+ builtins) have no location
+        auto location = glGetUniformLocation(_program.handle, name.c_str()); CHECK_GL_ERRORS();
+        if (location < 0)
+            continue;
+        auto hash = uniformHash(name.c_str());
+        auto it = std::find(m_uniformHashes.begin(), m_uniformHashes.end(), hash);
+        auto index = it != m_uniformHashes.end() ? it - m_uniformHashes.begin() : addUniform(hash, name);
+        assert(m_uniformNames[index] == name);  // 64 bit hash collision
+        m_uniforms[index].location = location;
+        m_uniforms[index].type     = type;
+    }
+}
+
+std::string shaderInfoLog (GLuint shader) {
+    GLint size = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &size);
+    std::string log (size > 0 ? size : 0, '\0');
+    if (size > 0) {
+        GLsizei written = 0;
+        glGetShaderInfoLog(shader, size, &written, &log[0]);
+        log.resize(written);
+    }
+    return log;
+}
+
+std::string programInfoLog (GLuint program) {
+    GLint size = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &size);
+    std::string log (size > 0 ? size : 0, '\0');
+    if (size > 0) {
+        GLsizei written = 0;
+        glGetProgramInfoLog(program, size, &written, &log[0]);
+        log.resize(written);
+    }
+    return log;
 }
 
 // Default stand in for the onError parameter in the Shader class.
@@ -116,6 +256,35 @@ void Shader::dumpToStderr(const gl_sandbox::gl::ShaderLoadError &e) {
     std::cerr << e.what() << std::endl;
 }
 
+//
+// ubo_dynamic (the rest of it is templates, in gl_shaders.hpp)
+//
+
+namespace ubo_dynamic {
+
+std::vector<CopySpan> coalesceCopies (std::vector<CopySpan> spans, size_t maxGap) {
+    std::sort(spans.begin(), spans.end(), [] (const CopySpan & a, const CopySpan & b) {
+        return a.dst_offset < b.dst_offset;
+    });
+    std::vector<CopySpan> merged;
+    for (const auto & span : spans) {
+        if (!merged.empty()) {
+            auto & last   = merged.back();
+            auto srcEnd   = last.src_offset + last.size;
+            auto dstEnd   = last.dst_offset + last.size;
+            if (span.src_offset >= srcEnd && span.dst_offset >= dstEnd &&
+                span.src_offset - srcEnd == span.dst_offset - dstEnd && span.dst_offset - dstEnd <= maxGap) {
+                last.size = span.dst_offset + span.size - last.dst_offset;
+                continue;
+            }
+        }
+        merged.push_back(span);
+    }
+    return merged;
+}
+
+}; // namespace ubo_dynamic
+
 };
 };
 
@@ -11,11 +11,14 @@
 
 #include "gl_traits.hpp"
 #include "gl_error.hpp"
+#include "gl_ring_buffer.hpp"
 #include <functional>
 #include <sstream>
 #include <cassert>
 #include <vector>
 #include <algorithm>
+#include <cstring>
+#include <iostream>
 #include <glm/glm.hpp>
 
 namespace gl_sandbox {
@@ -25,6 +28,71 @@ bool compileShader (gl::FragmentShader & shader, const char * src, std::function
 bool compileShader (gl::VertexShader & shader, const char * src, std::function<void(const char *)> onError);
 bool linkShader (gl::ShaderProgram & program, const gl::VertexShader & vertexShader, const gl::FragmentShader & fragmentShader, std::function<void(const char *)> onError);
 
+// Info logs (empty if there's nothing in them)
+std::string shaderInfoLog (GLuint shader);
+std::string programInfoLog (GLuint program);
+
+// FNV-1a; constexpr so uniform names get hashed at compile time.
+constexpr uint64_t uniformHash (const char * name) {
+    uint64_t hash = 14695981039346656037ull;
+    while (*name)
+        hash = (hash ^ (uint8_t)*name++) * 1099511628211ull;
+    return hash;
+}
+
+// Uniform name + the type it's set with; see Shader::setUniform(). Meant to be declared constexpr
+// next to the code that uses it:
+//     constexpr gl::Uniform<glm::mat4> MVP { "MVP" };
+//     shader.setUniform(MVP, proj * view * model);
+template <typename T>
+struct Uniform {
+    typedef T value_type;
+    const char * name;
+    uint64_t     hash;
+    constexpr explicit Uniform (const char * name) : name(name), hash(uniformHash(name)) {}
+};
+
+// Which glUniform* a type goes through, + which glsl types it can set.
+template <typename T> struct UniformTraits;
+template <> struct UniformTraits<float> {
+    static bool accepts (GLenum type) { return type == GL_FLOAT; }
+    static void set (GLint location, float v) { glUniform1f(location, v); }
+};
+template <> struct UniformTraits<GLint> {
+    static bool accepts (GLenum type) {
+        switch (type) {
+            case GL_INT: case GL_BOOL:
+            case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+            case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_BUFFER:
+            case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+                return true;
+            default:
+                return false;
+        }
+    }
+    static void set (GLint location, GLint v) { glUniform1i(location, v); }
+};
+template <> struct UniformTraits<glm::vec2> {
+    static bool accepts (GLenum type) { return type == GL_FLOAT_VEC2; }
+    static void set (GLint location, const glm::vec2 & v) { glUniform2fv(location, 1, &v[0]); }
+};
+template <> struct UniformTraits<glm::vec3> {
+    static bool accepts (GLenum type) { return type == GL_FLOAT_VEC3; }
+    static void set (GLint location, const glm::vec3 & v) { glUniform3fv(location, 1, &v[0]); }
+};
+template <> struct UniformTraits<glm::vec4> {
+    static bool accepts (GLenum type) { return type == GL_FLOAT_VEC4; }
+    static void set (GLint location, const glm::vec4 & v) { glUniform4fv(location, 1, &v[0]); }
+};
+template <> struct UniformTraits<glm::mat3x3> {
+    static bool accepts (GLenum type) { return type == GL_FLOAT_MAT3; }
+    static void set (GLint location, const glm::mat3x3 & m) { glUniformMatrix3fv(location, 1, GL_FALSE, &m[0][0]); }
+};
+template <> struct UniformTraits<glm::mat4x4> {
+    static bool accepts (GLenum type) { return type == GL_FLOAT_MAT4; }
+    static void set (GLint location, const glm::mat4x4 & m) { glUniformMatrix4fv(location, 1, GL_FALSE, &m[0][0]); }
+};
+
 struct ShaderLoadError : public std::runtime_error {
     ShaderLoadError (const std::string & s) : std::runtime_error(s) {}
 };
@@ -54,6 +122,10 @@ public:
     }
     typedef std::function<void(const ShaderLoadError &)> ErrorCallback;
 
+    // When there's a ProgramCache (see gl_program_cache.hpp) w/ binaries enabled, compiles are
+    // deferred until linkProgram(), which loads the cached binary for these sources if there is
+    // one (and only compiles + links + stores one if there isn't). Compile errors get reported
+    // from linkProgram() then.
     bool compileFragment (const char * src, ErrorCallback onError = dumpToStderr);
     bool compileVertex (const char * src, ErrorCallback onError = dumpToStderr);
     bool linkProgram (ErrorCallback onError = dumpToStderr);
@@ -63,36 +135,93 @@ public:
         assert(program_linked ? fragment_compiled && vertex_compiled : true); // sanity check state flags
         return program_linked;
     }
-    GLint getUniformLocation (const char * name) const {
-        if (!loaded())
-            return std::cerr << "Error: can't get uniform from null shader ('" << this->name << "')\n", -1;
-        auto loc = glGetUniformLocation(handle(), name); CHECK_GL_ERRORS();
-        if (loc < 0)
-            std::cerr << "Error: No uniform '" << name << "' in shader '" << this->name << "'\n";
-        return loc;
-    }
-    void setUniform (GLint location, const glm::mat4x4 & m) const {
-        glUniformMatrix4fv(location, 1, GL_FALSE, &m[0][0]);
-    }
-    void setUniform (GLint location, const glm::vec3 & v) const {
-        glUniform3fv(location, 1, &v[0]);
-    }
-    void setUniform (GLint location, const glm::vec4 & v) const {
-        glUniform4fv(location, 1, &v[0]);
-    }
-    void setUniform (GLint location, float s) const {
-        glUniform1f(location, s);
-    }
-    void setUniform (GLint location, const glm::mat3x3 & m) const {
-        glUniformMatrix3fv(location, 1, GL_FALSE, &m[0][0]);
+    // Returns a handle for setUniform(), not a raw gl location: handles stay valid when the program
+    // gets swapped out (see replaceProgram()), and get pointed at the new program's locations --
+    // including ones that were missing (or had no program at all) when they were looked up.
+    // Active uniforms are all reflected at link time, so this never has to ask gl.
+    GLint getUniformLocation (const char * name);
+    
+    void setUniform (GLint uniform, const glm::mat4x4 & m) const { set(uniform, m); }
+    void setUniform (GLint uniform, const glm::mat3x3 & m) const { set(uniform, m); }
+    void setUniform (GLint uniform, const glm::vec4 & v) const   { set(uniform, v); }
+    void setUniform (GLint uniform, const glm::vec3 & v) const   { set(uniform, v); }
+    void setUniform (GLint uniform, const glm::vec2 & v) const   { set(uniform, v); }
+    void setUniform (GLint uniform, float s) const               { set(uniform, s); }
+    void setUniform (GLint uniform, GLint i) const               { set(uniform, i); }
+    
+    // Typed version (see Uniform<T>): finds the uniform by its precomputed hash. Uniforms the
+    // program doesn't have are skipped, same as w/ a -1 location.
+    template <typename T>
+    void setUniform (Uniform<T> uniform, const typename Uniform<T>::value_type & value) const {
+        for (size_t i = 0, n = m_uniformHashes.size(); i < n; ++i) {
+            if (m_uniformHashes[i] == uniform.hash)
+                return set((GLint)i, value);
+        }
     }
-//    template <typename T>
-//    void setUniform (const char * name, const T & v) { setUniform(getUniformLocation(name), v); }
+    
+    // Swaps in a program that's already been compiled + linked (eg. by ShaderReloader), and
+    // re-resolves uniform handles against it. The old program + shaders get deleted.
+    void replaceProgram (gl::ShaderProgram && program, gl::VertexShader && vs, gl::FragmentShader && fs);
+    
+    // setUniform() calls that reached gl vs ones skipped cuz the program already had that value.
+    struct UniformStats {
+        size_t sets    = 0;
+        size_t skipped = 0;
+    };
+    const UniformStats & uniformStats () const { return m_uniformStats; }
     
 protected:
     // Default impl for the optional onError parameter on compileFragment, etc;
     // Just takes message (e.what) and prints to stdout (cerr).
     static void dumpToStderr (const ShaderLoadError & e);
+    
+    bool compileFragmentNow (const char * src, const ErrorCallback & onError);
+    bool compileVertexNow (const char * src, const ErrorCallback & onError);
+    std::string m_fragmentSrc, m_vertexSrc;         // deferred compiles (see compileFragment())
+    
+    // Reads every active (default block) uniform of the just linked program into m_uniforms, and
+    // forgets any cached values.
+    void reflectUniforms ();
+    GLint addUniform (uint64_t hash, const std::string & name);
+    
+    // Uniform values live in the program, so as long as all sets go through here, we know what it
+    // has + can skip sets that wouldn't change anything.
+    template <typename T>
+    void set (GLint uniform, const T & value) const {
+        static_assert(sizeof(T) <= sizeof(UniformSlot::value), "uniform type too large");
+        if (uniform < 0 || (size_t)uniform >= m_uniforms.size())
+            return;
+        auto & slot = m_uniforms[uniform];
+        if (slot.location < 0)
+            return;
+        if (slot.cached && memcmp(slot.value, &value, sizeof(T)) == 0) {
+            ++m_uniformStats.skipped;
+            return;
+        }
+        if (!UniformTraits<T>::accepts(slot.type)) {
+            if (!slot.mismatched)
+                std::cerr << "Error: uniform '" << m_uniformNames[uniform] << "' in shader '" << name << "' set w/ the wrong type\n";
+            slot.mismatched = true;
+            return;
+        }
+        memcpy(slot.value, &value, sizeof(T));
+        slot.cached = true;
+        ++m_uniformStats.sets;
+        UniformTraits<T>::set(slot.location, value);
+    }
+    
+    struct UniformSlot {
+        GLint   location   = -1;        // in the current program (-1 => it doesn't have this one)
+        GLenum  type       = 0;
+        bool    cached     = false;     // value is what the program has
+        bool    mismatched = false;     // (already complained about)
+        uint8_t value [64];             // up to a mat4
+    };
+    // Indexed by uniform handle. Hashes are kept apart so typed lookups scan one small array.
+    std::vector<uint64_t>            m_uniformHashes;
+    std::vector<std::string>         m_uniformNames;
+    mutable std::vector<UniformSlot> m_uniforms;
+    mutable UniformStats             m_uniformStats;
 };
 
 namespace ubo_fast {
@@ -101,7 +230,7 @@ template <typename T>
 struct UniformBuffer {
     UniformBuffer (const Shader & shader, const char * uniformBlockName) : handle(m_buffer.handle) {
         auto index = glGetUniformBlockIndex(shader.handle(), uniformBlockName);
-        if (index <= 0) {
+        if (index == GL_INVALID_INDEX) {
             std::cerr << "Invalid uniform block -- no block matching '" << uniformBlockName << "' in shader '" << shader.name << "'\n";
             return;
         }
@@ -112,9 +241,25 @@ struct UniformBuffer {
         }
         m_blockSize = std::min((size_t)std::max((decltype(blockSize))0, blockSize), sizeof(T));
     }
+    // Into this frame's part of the uniform ring if there is one (no allocation / orphaning),
+    // or into our own buffer w/ glBufferData if not (or it's full).
     void bufferData (const T & data) {
-        glBindBuffer(GL_UNIFORM_BUFFER, handle);
+        if (!m_blockSize)
+            return;
+        if (auto ring = RingBuffer::uniforms()) {
+            if ((m_range = ring->write(&data, m_blockSize)))
+                return;
+        }
+        StateCache::shared().bindBuffer(GL_UNIFORM_BUFFER, handle);     // (already bound after the first upload)
         glBufferData(GL_UNIFORM_BUFFER, m_blockSize, &data, GL_DYNAMIC_DRAW);
+        m_range.buffer = handle;
+        m_range.offset = 0;
+        m_range.size   = (GLsizeiptr)m_blockSize;
+    }
+    // Binds the last upload to a uniform block binding point
+    void bind (GLuint binding = 0) const {
+        if (m_range)
+            StateCache::shared().bindBufferRange(GL_UNIFORM_BUFFER, binding, m_range.buffer, m_range.offset, m_range.size);
     }
 protected:
     VBO m_buffer;
@@ -122,12 +267,24 @@ public:
     const GLuint handle;
 protected:
     size_t m_blockSize = 0;
+    RingBuffer::Range m_range;
 };
     
 }; // namespace ubo_fast
     
 namespace ubo_dynamic {
     
+// Src / dst byte ranges to copy from a T to a uniform block, w/ adjacent ones merged: sorted by dst, two spans become one when they
+// have the same gap (up to maxGap bytes) on both sides. Only pass a maxGap if the spans cover every active field in the block --
+// then nothing else can live in that gap, since the next field by dst is the next span. Otherwise the gap may hold a field we'd
+// overwrite w/ whatever T has there, so use 0 (merge only spans that touch).
+struct CopySpan {
+    size_t src_offset;
+    size_t dst_offset;
+    size_t size;
+};
+std::vector<CopySpan> coalesceCopies (std::vector<CopySpan> spans, size_t maxGap = 16);
+
 // Dynamic / introspective UniformBuffer impl. Wraps a type (T), taking shader and field info (for each used field in T and the shader)
 // at construction time, which it uses to build a list of src/dst field offsets so that information can be safely transferred to
 // the shader from any arbitrary POD, even if their internal data layout does not match.
@@ -141,8 +298,9 @@ namespace ubo_dynamic {
 // - Requires lots of state in the ctor (some of which could be tricky to get -- eg. shader has to be initialized, etc)
 // - Fields need to be added to said ctor whenever you change any of the underlying data structures (and forgetting to do so could
 // result in silent errors shader-side, etc)
-// - Probably slower (or at least more overhead) than a plain call to glBufferData. The whole point of UBOs is to limit buffer
-// calls though, so the perf hit is probably minimal. Should test.
+// - Some overhead over a plain glBufferData from a T. To keep that down, the per-field copies get compiled at construction into
+// as few contiguous spans as possible (see CopySpan), and if T's layout matches the block exactly (std140 w/ explicit padding,
+// say) that's a single memcpy straight from T into the uniform ring / buffer. (ubo-*-test time the three cases.)
 //
 template <typename T>
 struct UniformBuffer {
@@ -157,24 +315,15 @@ struct UniformBuffer {
         FieldDescriptor (const char * name, size_t fieldSize, void * fieldPtr) :
             name(name), fieldSize(fieldSize), fieldPtr(fieldPtr) {}
     };
-    struct FieldOffset {
-        size_t src_offset;
-        size_t dst_offset;
-        size_t size;
-        
-        FieldOffset (size_t src_offset, size_t dst_offset, size_t size) :
-            src_offset(src_offset), dst_offset(dst_offset), size(size) {}
-    };
     
     UniformBuffer (const Shader & shader, const char * uniformBlockName, T * startPtr, std::initializer_list<FieldDescriptor> fields) : UniformBuffer(shader, uniformBlockName, (void*)startPtr, fields) {}
     
     UniformBuffer (const Shader & shader, const char * uniformBlockName, void * startPtr, std::initializer_list<FieldDescriptor> fields) :
         handle(m_buffer.handle),
         m_blockIndex(glGetUniformBlockIndex(shader.handle(), uniformBlockName)),
-        m_blockSize(std::max(getBlockSize(shader, m_blockIndex), (GLuint)0)),
-        m_block(m_blockSize > 0 ? new GLubyte(m_blockSize) : nullptr)
+        m_blockSize(m_blockIndex != GL_INVALID_INDEX ? getBlockSize(shader, m_blockIndex) : 0)
     {
-        if (m_blockIndex <= 0) {
+        if (m_blockIndex == GL_INVALID_INDEX) {
             std::cerr << "Invalid uniform block -- no matching block named '" << uniformBlockName << "' in shader '" << shader.name << "'\n";
             return;
         }
@@ -182,53 +331,97 @@ struct UniformBuffer {
         GLint fieldOffsets [fields.size()];
         const char * names  [fields.size()];
         auto i = 0;
-        for (auto field : fields)
+        for (const auto & field : fields)
             names[i++] = field.name.c_str();
         
         glGetUniformIndices(shader.handle(), (int)fields.size(), names, fieldIndices);
-        glGetActiveUniformsiv(shader.handle(), (int)fields.size(), fieldIndices, GL_UNIFORM_OFFSET, fieldOffsets);
         
-        // Can optimize this by finding + merging fields / sections of data that are adjacent to one another (ie. no padding).
-        // Since, uh, we're currently not doing that xD
-        // (If a data structure is used that maps 1-1 to the gpu version (offsets, etc), it _should_ be possible to optimize
-        // that down to one memcpy (and we could maybe even have it skip the memcpy and do a direct buffer-from-ptr in that
-        // case. However, our current behavior (doing N memcpys) is probably not _too_ terrible since this should be called once per
-        // frame at most...)
-
+        std::vector<CopySpan> spans;
         i = 0;
         size_t totalSize = 0;
-        for (auto field : fields) {
+        for (const auto & field : fields) {
             size_t fieldOffset = (size_t)field.fieldPtr - (size_t)startPtr;
             assert(fieldOffset < sizeof(T));
-            m_offsets.emplace_back(fieldOffset, fieldOffsets[i], field.fieldSize);
+            if (fieldIndices[i] == GL_INVALID_INDEX) {
+                std::cerr << "Warning: no field '" << field.name << "' in uniform block '" << uniformBlockName << "' (shader '" << shader.name << "')\n";
+            } else {
+                glGetActiveUniformsiv(shader.handle(), 1, &fieldIndices[i], GL_UNIFORM_OFFSET, &fieldOffsets[i]);
+                if (fieldOffsets[i] >= 0 && fieldOffsets[i] + field.fieldSize <= m_blockSize)
+                    spans.push_back({ fieldOffset, (size_t)fieldOffsets[i], field.fieldSize });
+            }
             totalSize += field.fieldSize;
+            ++i;
         }
         assert(sizeof(T) >= totalSize);
+        
+        // Direct if every field in the block is one of ours and they all line up w/ T from the start (the rest is padding)
+        GLint activeFields = 0;
+        glGetActiveUniformBlockiv(shader.handle(), m_blockIndex, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &activeFields);
+        m_allFields = activeFields == (GLint)spans.size();
+        m_spans  = coalesceCopies(std::move(spans), m_allFields ? 16 : 0);
+        m_direct = m_allFields && m_spans.size() == 1 && m_spans[0].src_offset == 0 && m_spans[0].dst_offset == 0 && m_blockSize <= sizeof(T);
+        if (!m_direct)
+            m_block.reset(new GLubyte[m_blockSize]());  // staging; block fields we don't have stay zeroed
     }
     void bufferData (const T & data) {
-        if (m_block == nullptr) // invalid ubo
+        if (m_spans.empty()) // invalid ubo
             return;
         
-        uint8_t * src = (uint8_t*)&data;
-        for (auto field : m_offsets)
-            memcpy(m_block + field.dst_offset, src + field.src_offset, field.size);
-        glBindBuffer(GL_UNIFORM_BUFFER, handle);
-        glBufferData(GL_UNIFORM_BUFFER, m_blockSize, m_block, GL_DYNAMIC_DRAW);
+        auto src = (const uint8_t*)&data;
+        if (auto ring = RingBuffer::uniforms()) {
+            // Ring memory holds whatever was written there frames ago. If we have every field, the bytes we skip are padding
+            // and can stay that way; if not, the block goes through the staging copy so the fields we don't set read as 0.
+            if ((m_range = ring->write(m_blockSize, [this, src] (uint8_t * dst) {
+                if (m_allFields) {
+                    copy(dst, src);
+                } else {
+                    copy(m_block.get(), src);
+                    memcpy(dst, m_block.get(), m_blockSize);
+                }
+            })))
+                return;
+        }
+        if (!m_direct)
+            copy(m_block.get(), src);
+        StateCache::shared().bindBuffer(GL_UNIFORM_BUFFER, handle);
+        glBufferData(GL_UNIFORM_BUFFER, m_blockSize, m_direct ? src : m_block.get(), GL_DYNAMIC_DRAW);
+        m_range.buffer = handle;
+        m_range.offset = 0;
+        m_range.size   = (GLsizeiptr)m_blockSize;
+    }
+    // Binds the last upload to a uniform block binding point
+    void bind (GLuint binding = 0) const {
+        if (m_range)
+            StateCache::shared().bindBufferRange(GL_UNIFORM_BUFFER, binding, m_range.buffer, m_range.offset, m_range.size);
     }
+    // After coalescing (1 + direct() => T matches the block)
+    size_t copySpans () const { return m_spans.size(); }
+    bool direct () const { return m_direct; }
 protected:
+    void copy (uint8_t * dst, const uint8_t * src) const {
+        if (m_direct) {
+            memcpy(dst, src, m_blockSize);
+        } else {
+            for (const auto & span : m_spans)
+                memcpy(dst + span.dst_offset, src + span.src_offset, span.size);
+        }
+    }
     // Helper function
-    static GLuint getBlockSize (const Shader & shader, GLint blockIndex) {
-        GLint blockSize; return glGetActiveUniformBlockiv(shader.handle(), blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &blockSize), blockSize;
+    static GLuint getBlockSize (const Shader & shader, GLuint blockIndex) {
+        GLint blockSize = 0; return glGetActiveUniformBlockiv(shader.handle(), blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &blockSize), (GLuint)std::max(blockSize, 0);
     }
 protected:
-    VAO m_buffer; // doubles as a UBO
+    VBO m_buffer;
 public:
     GLuint handle;
 protected:
-    const GLint m_blockIndex;
-    const GLint m_blockSize;
-    GLubyte * const m_block;
-    std::vector<FieldOffset> m_offsets;
+    const GLuint m_blockIndex;
+    const GLuint m_blockSize;
+    std::unique_ptr<GLubyte[]> m_block;
+    std::vector<CopySpan> m_spans;
+    bool m_allFields = false;   // every active field in the block is one of ours
+    bool m_direct = false;
+    RingBuffer::Range m_range;
 };
     
 struct Foo {
@@ -0,0 +1,119 @@
+//
+//  gl_state.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "gl_state.hpp"
+#include <algorithm>
+#include <iterator>
+
+using namespace gl_sandbox::gl;
+
+constexpr GLuint StateCache::UNKNOWN;
+
+StateCache::Functions StateCache::glFunctions () {
+    // Wrapped, since w/ glew these are function pointers that don't get loaded 'til glewInit()
+    Functions fns;
+    fns.useProgram      = [](GLuint program) { glUseProgram(program); };
+    fns.bindVertexArray = [](GLuint vao) { glBindVertexArray(vao); };
+    fns.bindBuffer      = [](GLenum target, GLuint buffer) { glBindBuffer(target, buffer); };
+    fns.bindBufferRange = [](GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+        glBindBufferRange(target, index, buffer, offset, size);
+    };
+    fns.enable          = [](GLenum cap) { glEnable(cap); };
+    fns.disable         = [](GLenum cap) { glDisable(cap); };
+    return fns;
+}
+
+StateCache::StateCache (const Functions & functions) : m_gl(functions) {
+    invalidate();
+}
+
+StateCache & StateCache::shared () {
+    static StateCache g_stateCache;
+    return g_stateCache;
+}
+
+int StateCache::targetIndex (GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER:           return 0;
+        case GL_ELEMENT_ARRAY_BUFFER:   return 1;
+        case GL_UNIFORM_BUFFER:         return 2;
+        case GL_COPY_READ_BUFFER:       return 3;
+        case GL_COPY_WRITE_BUFFER:      return 4;
+        case GL_PIXEL_PACK_BUFFER:      return 5;
+        case GL_PIXEL_UNPACK_BUFFER:    return 6;
+        case GL_TEXTURE_BUFFER:         return 7;
+        case GL_DRAW_INDIRECT_BUFFER:   return 8;
+        default:                        return -1;
+    }
+}
+
+void StateCache::useProgram (GLuint program) {
+    if (changed(m_program, program))
+        m_gl.useProgram(program);
+}
+
+void StateCache::bindVertexArray (GLuint vao) {
+    if (changed(m_vao, vao)) {
+        m_gl.bindVertexArray(vao);
+        m_buffers[targetIndex(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+}
+
+void StateCache::bindBuffer (GLenum target, GLuint buffer) {
+    auto index = targetIndex(target);
+    if (index < 0) {
+        ++m_frame.issued;
+        m_gl.bindBuffer(target, buffer);
+    } else if (changed(m_buffers[index], buffer)) {
+        m_gl.bindBuffer(target, buffer);
+    }
+}
+
+void StateCache::bindBufferRange (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    ++m_frame.issued;
+    m_gl.bindBufferRange(target, index, buffer, offset, size);
+    auto i = targetIndex(target);
+    if (i >= 0)
+        m_buffers[i] = buffer;
+}
+
+void StateCache::setEnabled (GLenum cap, bool enabled) {
+    auto it = std::find_if(m_caps.begin(), m_caps.end(), [cap](const std::pair<GLenum, GLuint> & c) {
+        return c.first == cap;
+    });
+    if (it == m_caps.end())
+        it = m_caps.emplace(m_caps.end(), cap, UNKNOWN);
+    if (changed(it->second, enabled ? 1 : 0))
+        enabled ? m_gl.enable(cap) : m_gl.disable(cap);
+}
+
+void StateCache::onDeleteBuffer (GLuint buffer) {
+    for (auto & bound : m_buffers) {
+        if (bound == buffer)
+            bound = 0;
+    }
+}
+
+void StateCache::onDeleteVertexArray (GLuint vao) {
+    if (m_vao == vao) {
+        m_vao = 0;
+        m_buffers[targetIndex(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+}
+
+void StateCache::invalidate () {
+    m_program = m_vao = UNKNOWN;
+    std::fill(std::begin(m_buffers), std::end(m_buffers), UNKNOWN);
+    m_caps.clear();
+}
+
+void StateCache::endFrame () {
+    m_lastFrame = m_frame;
+    m_total    += m_frame;
+    m_frame     = Stats();
+}
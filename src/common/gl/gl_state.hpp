@@ -0,0 +1,108 @@
+//
+//  gl_state.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef gl_state_hpp
+#define gl_state_hpp
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace gl_sandbox {
+namespace gl {
+
+// Shadows the bits of gl state that get set over and over (current program, vao, buffer bound
+// to each target, enable flags), and drops calls that wouldn't change anything. Modules go
+// through StateCache::shared() instead of calling glUseProgram / glBindVertexArray /
+// glBindBuffer / glEnable directly -- anything that does bypass it has to call invalidate().
+//
+// Everything starts out unknown, so the first call of each kind always goes through. Calls go
+// out through a table of function pointers, which is the real gl by default; tests hand it a
+// recording one instead (see tests/gl-state-test), so no context is needed.
+//
+// Main (gl) thread only.
+class StateCache {
+public:
+    struct Functions {
+        void (*useProgram)      (GLuint program);
+        void (*bindVertexArray) (GLuint vao);
+        void (*bindBuffer)      (GLenum target, GLuint buffer);
+        void (*bindBufferRange) (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+        void (*enable)          (GLenum cap);
+        void (*disable)         (GLenum cap);
+    };
+    static Functions glFunctions ();
+
+    // Calls made (issued) vs dropped as redundant (skipped)
+    struct Stats {
+        size_t issued  = 0;
+        size_t skipped = 0;
+        Stats & operator+= (const Stats & other) { issued += other.issued; skipped += other.skipped; return *this; }
+    };
+
+    explicit StateCache (const Functions & functions = glFunctions());
+    StateCache (const StateCache &) = delete;
+    StateCache & operator= (const StateCache &) = delete;
+
+    void useProgram      (GLuint program);
+    // Also forgets the GL_ELEMENT_ARRAY_BUFFER binding, which is part of the vao's state.
+    void bindVertexArray (GLuint vao);
+    void bindBuffer      (GLenum target, GLuint buffer);
+    // Indexed bindings aren't tracked (the range usually changes every call), so this always
+    // goes through -- but it binds target too, which is.
+    void bindBufferRange (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void enable  (GLenum cap) { setEnabled(cap, true); }
+    void disable (GLenum cap) { setEnabled(cap, false); }
+    void setEnabled (GLenum cap, bool enabled);
+
+    // gl resets bindings of deleted buffers / vaos to 0 (see gl::traits); programs stay current
+    // until replaced, so their names can't get reused while we still think they're bound.
+    void onDeleteBuffer      (GLuint buffer);
+    void onDeleteVertexArray (GLuint vao);
+
+    // Forget everything (eg. after code that calls gl directly); next calls all go through.
+    void invalidate ();
+
+    // Rolls the current frame's counts into lastFrame() + total().
+    void endFrame ();
+    const Stats & frame ()     const { return m_frame; }
+    const Stats & lastFrame () const { return m_lastFrame; }
+    const Stats & total ()     const { return m_total; }
+
+    static StateCache & shared ();
+
+protected:
+    // Indexed binding targets; others are passed straight through (+ counted as issued).
+    enum { NUM_BUFFER_TARGETS = 9 };
+    static int targetIndex (GLenum target);
+    static constexpr GLuint UNKNOWN = ~0u;      // never a valid gl name
+
+    bool changed (GLuint & current, GLuint value) {
+        if (current == value) {
+            ++m_frame.skipped;
+            return false;
+        }
+        current = value;
+        ++m_frame.issued;
+        return true;
+    }
+
+protected:
+    Functions m_gl;
+    GLuint    m_program = UNKNOWN;
+    GLuint    m_vao     = UNKNOWN;
+    GLuint    m_buffers [NUM_BUFFER_TARGETS];
+    std::vector<std::pair<GLenum, GLuint>> m_caps;  // cap => 0 / 1 / UNKNOWN; only a handful ever get used
+    Stats     m_frame, m_lastFrame, m_total;
+};
+
+}; // namespace gl
+}; // namespace gl_sandbox
+
+#endif /* gl_state_hpp */
@@ -12,14 +12,16 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "gl_error.hpp"
+#include "gl_state.hpp"
 #include <memory>
+#include <utility>
 
 namespace gl_sandbox {
 
 namespace gl {
 namespace traits {
 
-#ifdef DEBUG
+#if GL_ERROR_CHECKS
 #define return_withCheck(xs) auto x = (xs); return CHECK_GL_ERRORS(), x
 #else
 #define return_withCheck(xs) return xs
@@ -42,7 +44,11 @@ struct Program {
 struct VAO {
     typedef GLuint value_type;
     static value_type create () { value_type v = 0; glGenVertexArrays(1, &v); CHECK_GL_ERRORS(); return v; }
-    static void destroy (value_type v) { if (v) glDeleteVertexArrays(1, &v), CHECK_GL_ERRORS(); }
+    static void destroy (value_type v) {
+        if (!v) return;
+        glDeleteVertexArrays(1, &v); CHECK_GL_ERRORS();
+        StateCache::shared().onDeleteVertexArray(v);
+    }
 };
 struct VBO {
     typedef GLuint value_type;
@@ -56,6 +62,7 @@ struct VBO {
     static void destroy (value_type v) {
 //        std::cout << "destroying vbo " << v << '\n';
         glDeleteBuffers(1, &v); CHECK_GL_ERRORS();
+        StateCache::shared().onDeleteBuffer(v);
 //        std::cout << "done\n";
     }
 };
@@ -65,13 +72,20 @@ struct VBO {
     
 template <typename traits>
 struct GLObject {
-    const typename traits::value_type handle;
+    typename traits::value_type handle;
     GLObject () : handle(traits::create()) {}
     ~GLObject () { traits::destroy(handle); }
     
     GLObject (const GLObject<traits> & other) = delete;
+    GLObject & operator= (const GLObject<traits> & other) = delete;
+    
+    // Moved-from objects are left empty (0), so only one of the two deletes the gl object
     GLObject (GLObject<traits> && other)
-        : handle(other.handle) {}
+        : handle(other.handle) { other.handle = 0; }
+    GLObject & operator= (GLObject<traits> && other) {
+        std::swap(handle, other.handle);
+        return *this;
+    }
 };
     
 template <typename traits>
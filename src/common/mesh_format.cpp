@@ -0,0 +1,205 @@
+//
+//  mesh_format.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/7/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "mesh_format.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::mesh;
+
+static size_t alignUp (size_t offset) {
+    return (offset + MESH_BLOCK_ALIGNMENT - 1) & ~(MESH_BLOCK_ALIGNMENT - 1);
+}
+
+bool mesh::parseMesh (const resource_impl::FileBufferRef & storage, const uint8_t * data, size_t size,
+                      MeshView & mesh, std::string & err) {
+    if (size < sizeof(MeshHeader))
+        return err = "mesh: file too small", false;
+    if (((uintptr_t)data & 3) != 0)
+        return err = "mesh: data is misaligned", false;
+
+    auto header = (const MeshHeader*)data;
+    if (header->magic != MESH_MAGIC)
+        return err = "mesh: bad magic (not a mesh file, or wrong endianness)", false;
+    if (header->version != MESH_VERSION)
+        return err = "mesh: unsupported version " + std::to_string(header->version), false;
+    if (header->fileSize != size)
+        return err = "mesh: truncated file", false;
+    if (header->indexType != (uint32_t)IndexType::UINT16 && header->indexType != (uint32_t)IndexType::UINT32)
+        return err = "mesh: bad index type", false;
+    if (header->numStreams == 0 ||
+        header->numStreams > (size - sizeof(MeshHeader)) / sizeof(StreamDesc))
+        return err = "mesh: bad stream count", false;
+
+    uint64_t indexBytes = header->numIndices * header->indexType;
+    if (header->numIndices > size || header->indexOffset > size || indexBytes > size - header->indexOffset)
+        return err = "mesh: index data out of bounds", false;
+
+    mesh.streams.clear();
+    auto descs = (const StreamDesc*)(data + sizeof(MeshHeader));
+    for (auto i = 0u; i < header->numStreams; ++i) {
+        auto & desc = descs[i];
+        if (desc.blockOffset > size || desc.blockSize > size - desc.blockOffset)
+            return err = "mesh: stream out of bounds", false;
+        if (desc.components == 0 || desc.components > 4 ||
+            desc.attribOffset + desc.components * sizeof(float) > desc.stride ||
+            header->numVertices > desc.blockSize / desc.stride)
+            return err = "mesh: bad stream layout", false;
+
+        MeshView::Stream stream;
+        stream.type         = (StreamType)desc.type;
+        stream.components   = desc.components;
+        stream.stride       = desc.stride;
+        stream.attribOffset = desc.attribOffset;
+        stream.block        = Span<const uint8_t>(data + desc.blockOffset, (size_t)desc.blockSize);
+        mesh.streams.push_back(stream);
+    }
+    mesh.indices     = Span<const uint8_t>(data + header->indexOffset, (size_t)indexBytes);
+    mesh.indexType   = (IndexType)header->indexType;
+    mesh.numVertices = (size_t)header->numVertices;
+    mesh.numIndices  = (size_t)header->numIndices;
+    memcpy(mesh.boundsMin, header->boundsMin, sizeof(mesh.boundsMin));
+    memcpy(mesh.boundsMax, header->boundsMax, sizeof(mesh.boundsMax));
+    mesh.storage = storage;
+    return true;
+}
+
+bool mesh::encodeMesh (const MeshSource & source, bool interleave, std::vector<uint8_t> & out, std::string & err) {
+    if (source.positions.size % 3 != 0 || source.positions.empty())
+        return err = "mesh: positions must be a non-empty list of xyz triples", false;
+
+    size_t numVertices = source.positions.size / 3;
+    if (!source.normals.empty() && source.normals.size != numVertices * 3)
+        return err = "mesh: normal count doesn't match vertex count", false;
+    if (!source.texcoords.empty() && source.texcoords.size != numVertices * 2)
+        return err = "mesh: texcoord count doesn't match vertex count", false;
+    for (auto index : source.indices)
+        if (index >= numVertices)
+            return err = "mesh: index out of range", false;
+
+    struct Input { StreamType type; unsigned components; Span<const float> values; };
+    std::vector<Input> inputs;
+    inputs.push_back({ StreamType::POSITION, 3, source.positions });
+    if (!source.normals.empty())
+        inputs.push_back({ StreamType::NORMAL, 3, source.normals });
+    if (!source.texcoords.empty())
+        inputs.push_back({ StreamType::TEXCOORD, 2, source.texcoords });
+
+    // Lay out stream descs + blocks
+    std::vector<StreamDesc> descs (inputs.size());
+    size_t offset = alignUp(sizeof(MeshHeader) + descs.size() * sizeof(StreamDesc));
+    if (interleave) {
+        unsigned stride = 0;
+        for (auto & input : inputs)
+            stride += input.components * sizeof(float);
+        unsigned attribOffset = 0;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            descs[i].type         = (uint32_t)inputs[i].type;
+            descs[i].components   = inputs[i].components;
+            descs[i].stride       = stride;
+            descs[i].attribOffset = attribOffset;
+            descs[i].blockOffset  = offset;
+            descs[i].blockSize    = numVertices * stride;
+            attribOffset += inputs[i].components * sizeof(float);
+        }
+        offset = alignUp(offset + numVertices * stride);
+    } else {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            descs[i].type         = (uint32_t)inputs[i].type;
+            descs[i].components   = inputs[i].components;
+            descs[i].stride       = inputs[i].components * sizeof(float);
+            descs[i].attribOffset = 0;
+            descs[i].blockOffset  = offset;
+            descs[i].blockSize    = inputs[i].values.bytes();
+            offset = alignUp(offset + inputs[i].values.bytes());
+        }
+    }
+
+    auto indexType = numVertices <= std::numeric_limits<uint16_t>::max() + 1ul ?
+        IndexType::UINT16 : IndexType::UINT32;
+    size_t indexOffset = offset;
+    size_t fileSize = indexOffset + source.indices.size * (size_t)indexType;
+
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic       = MESH_MAGIC;
+    header.version     = MESH_VERSION;
+    header.numStreams  = (uint32_t)descs.size();
+    header.indexType   = (uint32_t)indexType;
+    header.numVertices = numVertices;
+    header.numIndices  = source.indices.size;
+    header.indexOffset = indexOffset;
+    header.fileSize    = fileSize;
+    for (int k = 0; k < 3; ++k) {
+        header.boundsMin[k] = std::numeric_limits<float>::max();
+        header.boundsMax[k] = std::numeric_limits<float>::lowest();
+    }
+    for (size_t i = 0; i < numVertices; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            header.boundsMin[k] = std::min(header.boundsMin[k], source.positions[i * 3 + k]);
+            header.boundsMax[k] = std::max(header.boundsMax[k], source.positions[i * 3 + k]);
+        }
+    }
+
+    out.assign(fileSize, 0);
+    memcpy(&out[0], &header, sizeof(header));
+    memcpy(&out[sizeof(header)], &descs[0], descs.size() * sizeof(StreamDesc));
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        auto & desc  = descs[i];
+        auto & input = inputs[i];
+        if (desc.stride == input.components * sizeof(float)) {
+            memcpy(&out[desc.blockOffset], input.values.data, input.values.bytes());
+        } else {
+            auto dst = &out[desc.blockOffset + desc.attribOffset];
+            for (size_t v = 0; v < numVertices; ++v, dst += desc.stride)
+                memcpy(dst, &input.values[v * input.components], input.components * sizeof(float));
+        }
+    }
+    if (indexType == IndexType::UINT16) {
+        auto dst = (uint16_t*)&out[indexOffset];
+        for (auto index : source.indices)
+            *dst++ = (uint16_t)index;
+    } else if (!source.indices.empty()) {
+        memcpy(&out[indexOffset], source.indices.data, source.indices.bytes());
+    }
+    return true;
+}
+
+bool mesh::convertObj (const std::vector<tinyobj::shape_t> & shapes, bool interleave,
+                       std::vector<uint8_t> & out, std::string & err) {
+    if (shapes.empty())
+        return err = "mesh: obj has no shapes", false;
+    if (shapes.size() == 1) {
+        auto & m = shapes[0].mesh;
+        return encodeMesh({ m.positions, m.normals, m.texcoords, m.indices }, interleave, out, err);
+    }
+
+    // Merge shapes. Only keep normals / uvs if every shape has them.
+    bool hasNormals = true, hasTexcoords = true;
+    for (auto & shape : shapes) {
+        hasNormals   &= !shape.mesh.normals.empty();
+        hasTexcoords &= !shape.mesh.texcoords.empty();
+    }
+    std::vector<float> positions, normals, texcoords;
+    std::vector<uint32_t> indices;
+    for (auto & shape : shapes) {
+        auto & m = shape.mesh;
+        auto base = (uint32_t)(positions.size() / 3);
+        positions.insert(positions.end(), m.positions.begin(), m.positions.end());
+        if (hasNormals)
+            normals.insert(normals.end(), m.normals.begin(), m.normals.end());
+        if (hasTexcoords)
+            texcoords.insert(texcoords.end(), m.texcoords.begin(), m.texcoords.end());
+        for (auto index : m.indices)
+            indices.push_back(index + base);
+    }
+    return encodeMesh({ positions, normals, texcoords, indices }, interleave, out, err);
+}
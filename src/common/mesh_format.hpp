@@ -0,0 +1,120 @@
+//
+//  mesh_format.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/7/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef mesh_format_hpp
+#define mesh_format_hpp
+
+#include "span.hpp"
+#include "resourcelayer/resource_impl.hpp"
+#include "../../libs/tinyobjloader/tiny_obj_loader.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gl_sandbox {
+namespace mesh {
+
+// Binary mesh container, designed to be mmapped and handed to glBufferData as-is:
+//
+//     MeshHeader
+//     StreamDesc [numStreams]
+//     (pad to 64)  vertex block(s) -- either one interleaved block, or one block per stream
+//     (pad to 64)  index data (uint16 or uint32)
+//
+// All offsets are relative to the start of the header, and every block starts on a 64-byte
+// boundary. Everything is native endian; the magic doubles as an endianness check.
+
+static constexpr uint32_t MESH_MAGIC   = 0x484d5347;   // 'GSMH'
+static constexpr uint32_t MESH_VERSION = 1;
+static constexpr size_t   MESH_BLOCK_ALIGNMENT = 64;
+
+enum class IndexType  : uint32_t { UINT16 = 2, UINT32 = 4 };
+enum class StreamType : uint32_t { POSITION = 0, NORMAL = 1, TEXCOORD = 2 };
+
+struct MeshHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numStreams;
+    uint32_t indexType;         // IndexType (== bytes per index)
+    uint64_t numVertices;
+    uint64_t numIndices;
+    uint64_t indexOffset;
+    uint64_t fileSize;
+    float    boundsMin [3];
+    float    boundsMax [3];
+    uint32_t reserved [2];
+};
+static_assert(sizeof(MeshHeader) == 80, "MeshHeader layout changed");
+
+// One vertex attribute. Interleaved streams share a block (same blockOffset / blockSize) and
+// differ in attribOffset; separate streams each get their own block w/ attribOffset == 0.
+// Components are always 32-bit floats.
+struct StreamDesc {
+    uint32_t type;              // StreamType
+    uint32_t components;
+    uint32_t stride;            // bytes between consecutive vertices
+    uint32_t attribOffset;      // byte offset of this attribute within a vertex
+    uint64_t blockOffset;
+    uint64_t blockSize;
+};
+static_assert(sizeof(StreamDesc) == 32, "StreamDesc layout changed");
+
+// A loaded mesh: spans pointing straight into the mapped file (or whatever storage holds it).
+struct MeshView {
+    struct Stream {
+        StreamType     type;
+        unsigned       components;
+        unsigned       stride;
+        unsigned       attribOffset;
+        Span<const uint8_t> block;
+    };
+    std::vector<Stream> streams;
+    Span<const uint8_t> indices;
+    IndexType  indexType = IndexType::UINT32;
+    size_t     numVertices = 0;
+    size_t     numIndices  = 0;
+    float      boundsMin [3] = { 0, 0, 0 };
+    float      boundsMax [3] = { 0, 0, 0 };
+
+    // Keeps the mapping alive as long as the view is around.
+    resource_impl::FileBufferRef storage;
+
+    const Stream * findStream (StreamType type) const {
+        for (auto & stream : streams)
+            if (stream.type == type)
+                return &stream;
+        return nullptr;
+    }
+};
+
+// Validates + sets up a view over [data, data + size) (which storage must keep alive). No
+// per-vertex work; just header / offset checks. Returns false + sets err if malformed.
+bool parseMesh (const resource_impl::FileBufferRef & storage, const uint8_t * data, size_t size,
+                MeshView & mesh, std::string & err);
+
+// Input for encodeMesh. normals / texcoords are optional (empty), but must have one entry per
+// vertex if present.
+struct MeshSource {
+    Span<const float>    positions;    // xyz
+    Span<const float>    normals;      // xyz
+    Span<const float>    texcoords;    // uv
+    Span<const uint32_t> indices;
+};
+
+// Serializes a mesh. Picks uint16 indices when the vertex count allows it.
+bool encodeMesh (const MeshSource & source, bool interleave, std::vector<uint8_t> & out, std::string & err);
+
+// OBJ -> binary mesh converter. All shapes are merged into one mesh (indices get rebased).
+bool convertObj (const std::vector<tinyobj::shape_t> & shapes, bool interleave,
+                 std::vector<uint8_t> & out, std::string & err);
+
+}; // namespace mesh
+}; // namespace gl_sandbox
+
+#endif /* mesh_format_hpp */
@@ -0,0 +1,74 @@
+//
+//  mpsc_queue.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/10/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef mpsc_queue_hpp
+#define mpsc_queue_hpp
+
+#include <atomic>
+#include <utility>
+
+namespace gl_sandbox {
+
+// Unbounded lock-free multi-producer / single-consumer FIFO (Vyukov's node-based queue).
+//
+// push() is wait-free: one allocation, one atomic exchange and one store, so producers never
+// wait on the consumer (or each other). tryPop() must only ever be called from one thread at a
+// time. A push that's halfway done (exchanged, not yet linked) looks like an empty queue to the
+// consumer until it finishes -- fine for completion queues, where "next frame" is soon enough.
+template <typename T>
+class MPSCQueue {
+public:
+    MPSCQueue () : m_head(new Node()), m_tail(m_head.load(std::memory_order_relaxed)) {}
+    ~MPSCQueue () {
+        while (m_tail) {
+            auto next = m_tail->next.load(std::memory_order_relaxed);
+            delete m_tail;
+            m_tail = next;
+        }
+    }
+    MPSCQueue (const MPSCQueue &) = delete;
+    MPSCQueue & operator= (const MPSCQueue &) = delete;
+
+    void push (T value) {
+        auto node = new Node(std::move(value));
+        auto prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Consumer only. Returns false if the queue is (or looks) empty.
+    bool tryPop (T & value) {
+        auto next = m_tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        // next becomes the new stub; its value is moved out so it doesn't linger
+        value = std::move(next->value);
+        delete m_tail;
+        m_tail = next;
+        return true;
+    }
+
+    // Consumer only.
+    bool empty () const {
+        return m_tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+protected:
+    struct Node {
+        std::atomic<Node*> next { nullptr };
+        T value;
+
+        Node () {}
+        explicit Node (T && v) : value(std::move(v)) {}
+    };
+    std::atomic<Node*> m_head;     // last pushed node (producers)
+    Node *             m_tail;     // stub node; m_tail->next is the front (consumer)
+};
+
+}; // namespace gl_sandbox
+
+#endif /* mpsc_queue_hpp */
@@ -0,0 +1,514 @@
+//
+//  obj_parser.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/8/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "obj_parser.hpp"
+#include "resourcelayer/resource_impl.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::obj;
+
+// ============================================================
+//                       NUMBER PARSING
+// ============================================================
+
+static inline bool isDigit (char c) { return c >= '0' && c <= '9'; }
+static inline bool isSpace (char c) { return c == ' ' || c == '\t'; }
+
+bool obj::parseDouble (const char * s, const char * end, double & value) {
+    static const double POW10 [] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char * start = s;
+    if (s >= end)
+        return false;
+    bool negative = false;
+    if (*s == '+' || *s == '-')
+        negative = *s++ == '-';
+    else if (!isDigit(*s))
+        return false;
+
+    // Accumulate up to 19 significant digits as an integer; past that we let strtod sort it out.
+    uint64_t mantissa = 0;
+    int exp10 = 0, significant = 0, intDigits = 0;
+    bool exact = true;
+    for (; s < end && isDigit(*s); ++s, ++intDigits) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*s - '0');
+            significant += mantissa != 0;
+        } else {
+            ++exp10;
+            exact = false;
+        }
+    }
+    if (intDigits == 0)
+        return false;
+    if (s < end && *s == '.') {
+        for (++s; s < end && isDigit(*s); ++s) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*s - '0');
+                significant += mantissa != 0;
+                --exp10;
+            } else {
+                exact = false;
+            }
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        ++s;
+        bool negativeExp = false;
+        if (s < end && (*s == '+' || *s == '-'))
+            negativeExp = *s++ == '-';
+        else if (s >= end || !isDigit(*s))
+            return false;
+        int e = 0, expDigits = 0;
+        for (; s < end && isDigit(*s); ++s, ++expDigits)
+            e = e < 100000 ? e * 10 + (*s - '0') : e;
+        if (expDigits == 0)
+            return false;
+        exp10 += negativeExp ? -e : e;
+    }
+
+    double result;
+    if (exact && mantissa < (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        // Both operands exact => a single correctly rounded operation
+        result = exp10 < 0 ? (double)mantissa / POW10[-exp10] : (double)mantissa * POW10[exp10];
+    } else {
+        char buf [128];
+        size_t len = std::min((size_t)(s - start), sizeof(buf) - 1);
+        memcpy(buf, start, len);
+        buf[len] = '\0';
+        result = fabs(strtod(buf, nullptr));
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+// Same as tinyobj::parseFloat: skip leading whitespace, parse the token (0 on failure), and
+// jump to the end of the token regardless.
+static inline float parseFloat (const char *& p, const char * end) {
+    while (p < end && isSpace(*p))
+        ++p;
+    const char * tokenEnd = p;
+    while (tokenEnd < end && *tokenEnd != ' ' && *tokenEnd != '\t' && *tokenEnd != '\r')
+        ++tokenEnd;
+    double value = 0.0;
+    obj::parseDouble(p, tokenEnd, value);
+    p = tokenEnd;
+    return (float)value;
+}
+
+// atoi() semantics
+static inline int parseInt (const char * p, const char * end) {
+    while (p < end && (isSpace(*p) || *p == '\n' || *p == '\v' || *p == '\f' || *p == '\r'))
+        ++p;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+    int value = 0;
+    for (; p < end && isDigit(*p); ++p)
+        value = value * 10 + (*p - '0');
+    return negative ? -value : value;
+}
+
+static inline const char * skipUntil (const char * p, const char * end, const char * delims) {
+    while (p < end && !strchr(delims, *p))
+        ++p;
+    return p;
+}
+
+// sscanf("%s") semantics
+static std::string readWord (const char * p, const char * end) {
+    while (p < end && isspace((unsigned char)*p))
+        ++p;
+    const char * start = p;
+    while (p < end && !isspace((unsigned char)*p))
+        ++p;
+    return std::string(start, p);
+}
+
+// ============================================================
+//                       CHUNK PARSING
+// ============================================================
+
+namespace {
+
+static const int NO_INDEX = INT_MIN;
+
+// Raw (not yet rebased) face corner, as written in the file
+struct Corner { int v, vt, vn; };
+
+// A face + the chunk-local v / vn / vt counts at the point it was read (for relative indices)
+struct Face {
+    uint32_t numCorners;
+    uint32_t numV, numVn, numVt;
+};
+
+struct Command {
+    enum Type { USEMTL, MTLLIB, GROUP, OBJECT } type;
+    size_t      face;       // index of the first face that comes after this command
+    std::string arg;
+};
+
+struct Chunk {
+    std::vector<float>   v, vn, vt;
+    std::vector<Corner>  corners;
+    std::vector<Face>    faces;
+    std::vector<Command> commands;
+};
+
+static void parseChunk (const char * p, const char * end, Chunk & chunk) {
+    while (p < end) {
+        const char * lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (!lineEnd)
+            lineEnd = end;
+        const char * next = lineEnd < end ? lineEnd + 1 : end;
+        const char * le = lineEnd;
+        if (le > p && le[-1] == '\r')
+            --le;
+
+        const char * t = p;
+        p = next;
+        while (t < le && isSpace(*t))
+            ++t;
+        if (t >= le || *t == '#')
+            continue;
+
+        auto at = [le](const char * q) { return q < le ? *q : '\0'; };
+
+        if (t[0] == 'v') {
+            if (isSpace(at(t + 1))) {
+                t += 2;
+                float x = parseFloat(t, le), y = parseFloat(t, le), z = parseFloat(t, le);
+                chunk.v.push_back(x); chunk.v.push_back(y); chunk.v.push_back(z);
+                continue;
+            }
+            if (at(t + 1) == 'n' && isSpace(at(t + 2))) {
+                t += 3;
+                float x = parseFloat(t, le), y = parseFloat(t, le), z = parseFloat(t, le);
+                chunk.vn.push_back(x); chunk.vn.push_back(y); chunk.vn.push_back(z);
+                continue;
+            }
+            if (at(t + 1) == 't' && isSpace(at(t + 2))) {
+                t += 3;
+                float x = parseFloat(t, le), y = parseFloat(t, le);
+                chunk.vt.push_back(x); chunk.vt.push_back(y);
+                continue;
+            }
+        }
+        if (t[0] == 'f' && isSpace(at(t + 1))) {
+            t += 2;
+            while (t < le && isSpace(*t))
+                ++t;
+            Face face;
+            face.numCorners = 0;
+            face.numV  = (uint32_t)(chunk.v.size() / 3);
+            face.numVn = (uint32_t)(chunk.vn.size() / 3);
+            face.numVt = (uint32_t)(chunk.vt.size() / 2);
+            while (t < le && *t != '\r') {
+                Corner c { parseInt(t, le), NO_INDEX, NO_INDEX };
+                t = skipUntil(t, le, "/ \t\r");
+                if (at(t) == '/') {
+                    ++t;
+                    if (at(t) == '/') {         // i//k
+                        ++t;
+                        c.vn = parseInt(t, le);
+                        t = skipUntil(t, le, "/ \t\r");
+                    } else {                    // i/j or i/j/k
+                        c.vt = parseInt(t, le);
+                        t = skipUntil(t, le, "/ \t\r");
+                        if (at(t) == '/') {
+                            ++t;
+                            c.vn = parseInt(t, le);
+                            t = skipUntil(t, le, "/ \t\r");
+                        }
+                    }
+                }
+                chunk.corners.push_back(c);
+                ++face.numCorners;
+                while (t < le && (isSpace(*t) || *t == '\r'))
+                    ++t;
+            }
+            chunk.faces.push_back(face);
+            continue;
+        }
+        if (le - t >= 7 && isSpace(t[6]) && (!strncmp(t, "usemtl", 6) || !strncmp(t, "mtllib", 6))) {
+            auto type = t[0] == 'u' ? Command::USEMTL : Command::MTLLIB;
+            chunk.commands.push_back({ type, chunk.faces.size(), readWord(t + 7, le) });
+            continue;
+        }
+        if (t[0] == 'g' && isSpace(at(t + 1))) {
+            // Second token (the first is 'g' itself), delimited by space / tab / \r
+            const char * q = t + 1;
+            while (q < le && (isSpace(*q) || *q == '\r'))
+                ++q;
+            chunk.commands.push_back({ Command::GROUP, chunk.faces.size(), std::string(q, skipUntil(q, le, " \t\r")) });
+            continue;
+        }
+        if (t[0] == 'o' && isSpace(at(t + 1))) {
+            chunk.commands.push_back({ Command::OBJECT, chunk.faces.size(), readWord(t + 2, le) });
+            continue;
+        }
+        // Ignore unknown commands
+    }
+}
+
+// ============================================================
+//                     MERGE + TRIANGULATE
+// ============================================================
+
+struct VertexIndex { int v, vt, vn; };
+
+// Faces between two g / o / usemtl commands; becomes one shape (if non-empty)
+struct FaceGroup {
+    std::vector<VertexIndex> corners;
+    std::vector<uint32_t>    faceSizes;
+    int         material = -1;
+    std::string name;
+};
+
+struct VertexIndexHash {
+    size_t operator() (const VertexIndex & i) const {
+        uint64_t h = (uint64_t)(uint32_t)i.v * 0x9e3779b97f4a7c15ull;
+        h ^= ((uint64_t)(uint32_t)i.vn << 32 | (uint32_t)i.vt) * 0xc2b2ae3d27d4eb4full;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+struct VertexIndexEq {
+    bool operator() (const VertexIndex & a, const VertexIndex & b) const {
+        return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+    }
+};
+
+// Same as tinyobj's exportFaceGroupToShape + updateVertex (fan triangulation; vertices welded
+// on (v, vn, vt) w/ a fresh cache per group), just w/ a hash map.
+static bool exportGroup (const FaceGroup & group,
+                         const std::vector<float> & v, const std::vector<float> & vn, const std::vector<float> & vt,
+                         tinyobj::shape_t & shape, std::string & err) {
+    auto & mesh = shape.mesh;
+    std::unordered_map<VertexIndex, unsigned, VertexIndexHash, VertexIndexEq> cache;
+    cache.reserve(group.corners.size());
+
+    auto getVertex = [&](const VertexIndex & i, unsigned & index) {
+        auto it = cache.find(i);
+        if (it != cache.end())
+            return index = it->second, true;
+        if (i.v < 0 || (size_t)i.v * 3 + 2 >= v.size() ||
+            (i.vn >= 0 && (size_t)i.vn * 3 + 2 >= vn.size()) ||
+            (i.vt >= 0 && (size_t)i.vt * 2 + 1 >= vt.size()))
+            return err = "obj: face index out of range", false;
+
+        mesh.positions.insert(mesh.positions.end(), &v[i.v * 3], &v[i.v * 3] + 3);
+        if (i.vn >= 0)
+            mesh.normals.insert(mesh.normals.end(), &vn[i.vn * 3], &vn[i.vn * 3] + 3);
+        if (i.vt >= 0)
+            mesh.texcoords.insert(mesh.texcoords.end(), &vt[i.vt * 2], &vt[i.vt * 2] + 2);
+        index = (unsigned)(mesh.positions.size() / 3 - 1);
+        cache.emplace(i, index);
+        return true;
+    };
+
+    size_t corner = 0;
+    for (auto n : group.faceSizes) {
+        auto face = &group.corners[corner];
+        corner += n;
+        for (size_t k = 2; k < n; ++k) {
+            unsigned i0, i1, i2;
+            if (!getVertex(face[0], i0) || !getVertex(face[k - 1], i1) || !getVertex(face[k], i2))
+                return false;
+            mesh.indices.push_back(i0);
+            mesh.indices.push_back(i1);
+            mesh.indices.push_back(i2);
+            mesh.material_ids.push_back(group.material);
+        }
+    }
+    shape.name = group.name;
+    return true;
+}
+
+// tinyobj's fixIndex (1-based -> 0-based; negative => relative to the current count)
+static inline int fixIndex (int idx, int n) {
+    return idx == NO_INDEX ? -1 : idx > 0 ? idx - 1 : idx == 0 ? 0 : n + idx;
+}
+
+template <typename F>
+static void parallelFor (size_t count, unsigned numThreads, F f) {
+    numThreads = (unsigned)std::min<size_t>(numThreads, count);
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            f(i);
+        return;
+    }
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < count; )
+            f(i);
+    };
+    std::vector<std::thread> threads;
+    for (auto i = 1u; i < numThreads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto & thread : threads)
+        thread.join();
+}
+
+}; // anonymous namespace
+
+bool obj::parseObj (const char * data, size_t size,
+                    std::vector<tinyobj::shape_t> & shapes,
+                    std::vector<tinyobj::material_t> & materials,
+                    std::string & err,
+                    const ParseOptions & options) {
+    shapes.clear();
+    unsigned numThreads = options.numThreads ? options.numThreads : std::max(1u, std::thread::hardware_concurrency());
+
+    // Split at line boundaries
+    size_t numChunks = std::max<size_t>(1, std::min<size_t>(numThreads, size / std::max<size_t>(options.minChunkSize, 1)));
+    std::vector<const char *> bounds { data };
+    for (size_t i = 1; i < numChunks; ++i) {
+        const char * p = std::max(data + size * i / numChunks, bounds.back());
+        const char * nl = (const char*)memchr(p, '\n', data + size - p);
+        bounds.push_back(nl ? nl + 1 : data + size);
+    }
+    bounds.push_back(data + size);
+
+    std::vector<Chunk> chunks (numChunks);
+    parallelFor(numChunks, numThreads, [&](size_t i) {
+        parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+    });
+
+    // Stitch chunks together in file order
+    std::vector<float> v, vn, vt;
+    size_t totalV = 0, totalVn = 0, totalVt = 0;
+    for (auto & chunk : chunks) {
+        totalV += chunk.v.size(); totalVn += chunk.vn.size(); totalVt += chunk.vt.size();
+    }
+    v.reserve(totalV); vn.reserve(totalVn); vt.reserve(totalVt);
+
+    std::vector<FaceGroup> groups (1);
+    std::map<std::string, int> materialMap;
+    tinyobj::MaterialFileReader readMaterials (options.mtlBasePath ? options.mtlBasePath : "");
+    int material = -1;
+    std::string name;
+
+    auto flush = [&]() {
+        if (!groups.back().faceSizes.empty()) {
+            groups.back().material = material;
+            groups.back().name = name;
+            groups.emplace_back();
+        }
+    };
+    // false => an mtllib couldn't be read, which fails the whole load (like tinyobj)
+    auto runCommand = [&](const Command & command) -> bool {
+        switch (command.type) {
+            case Command::USEMTL: {
+                flush();
+                auto it = materialMap.find(command.arg);
+                material = it != materialMap.end() ? it->second : -1;
+            } break;
+            case Command::MTLLIB: {
+                std::string mtlErr;
+                bool ok = readMaterials(command.arg, materials, materialMap, mtlErr);
+                err += mtlErr;
+                if (!ok)
+                    return false;
+            } break;
+            case Command::GROUP:
+            case Command::OBJECT:
+                flush();
+                name = command.arg;
+                break;
+        }
+        return true;
+    };
+
+    for (auto & chunk : chunks) {
+        int baseV = (int)(v.size() / 3), baseVn = (int)(vn.size() / 3), baseVt = (int)(vt.size() / 2);
+        size_t nextCommand = 0, corner = 0;
+        for (size_t f = 0; f < chunk.faces.size(); ++f) {
+            for (; nextCommand < chunk.commands.size() && chunk.commands[nextCommand].face == f; ++nextCommand) {
+                if (!runCommand(chunk.commands[nextCommand]))
+                    return false;
+            }
+
+            auto & face  = chunk.faces[f];
+            auto & group = groups.back();
+            for (auto k = 0u; k < face.numCorners; ++k, ++corner) {
+                auto & c = chunk.corners[corner];
+                // Positive indices are global already; relative ones are relative to the count at
+                // the time the face was read (= everything before this chunk + the chunk-local count).
+                group.corners.push_back({
+                    fixIndex(c.v,  baseV  + (int)face.numV),
+                    fixIndex(c.vt, baseVt + (int)face.numVt),
+                    fixIndex(c.vn, baseVn + (int)face.numVn)
+                });
+            }
+            group.faceSizes.push_back(face.numCorners);
+        }
+        for (; nextCommand < chunk.commands.size(); ++nextCommand) {
+            if (!runCommand(chunk.commands[nextCommand]))
+                return false;
+        }
+
+        v.insert(v.end(), chunk.v.begin(), chunk.v.end());
+        vn.insert(vn.end(), chunk.vn.begin(), chunk.vn.end());
+        vt.insert(vt.end(), chunk.vt.begin(), chunk.vt.end());
+        chunk = Chunk();
+    }
+    flush();
+    if (groups.back().faceSizes.empty())
+        groups.pop_back();
+
+    // Triangulate + weld each group
+    shapes.resize(groups.size());
+    std::vector<std::string> errors (groups.size());
+    std::atomic<bool> ok { true };
+    parallelFor(groups.size(), numThreads, [&](size_t i) {
+        if (!exportGroup(groups[i], v, vn, vt, shapes[i], errors[i]))
+            ok = false;
+    });
+    if (!ok) {
+        for (auto & e : errors)
+            if (!e.empty())
+                return err += e, false;
+    }
+    return true;
+}
+
+bool obj::loadObj (const std::string & path,
+                   std::vector<tinyobj::shape_t> & shapes,
+                   std::vector<tinyobj::material_t> & materials,
+                   std::string & err,
+                   const ParseOptions & options) {
+    bool ok = false;
+    bool mapped = resource_impl::immediate::loadFileMappedImmediate(path,
+    [&](const resource_impl::FileBufferRef & buffer) {
+        ok = parseObj((const char*)buffer->data, buffer->size, shapes, materials, err, options);
+    }, [](const resource_impl::FilePath &) {});
+    if (mapped)
+        return ok;
+
+    // Empty or unmappable file: distinguish that from a missing one, like tinyobj does
+    shapes.clear();
+    std::ifstream f (path, std::ios::binary);
+    if (!f)
+        return err = "Cannot open file [" + path + "]\n", false;
+    std::string contents ((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    return parseObj(contents.data(), contents.size(), shapes, materials, err, options);
+}
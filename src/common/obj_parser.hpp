@@ -0,0 +1,57 @@
+//
+//  obj_parser.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/8/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef obj_parser_hpp
+#define obj_parser_hpp
+
+#include "../../libs/tinyobjloader/tiny_obj_loader.h"
+#include <string>
+#include <vector>
+
+namespace gl_sandbox {
+namespace obj {
+
+// Multithreaded drop-in replacement for tinyobj::LoadObj.
+//
+// The (mapped) file is split into chunks at line boundaries, and each chunk is parsed on its own
+// thread into flat v / vn / vt / face arrays + a list of the g / o / usemtl / mtllib commands it
+// saw. A single sequential pass then stitches the chunks back together in file order (rebasing
+// relative indices, resolving materials), and face groups are triangulated + welded into
+// shapes in parallel (each group has its own vertex cache in tinyobj, so they're independent).
+//
+// Output matches tinyobj's: same shapes, same vertex order, same indices + material ids. Floats
+// are parsed w/ exactly the same number syntax; our intermediate doubles are correctly rounded
+// where tinyobj's pow()-based ones may not be, but that doesn't survive the narrowing to float in
+// practice (objparser-bench checks this).
+struct ParseOptions {
+    unsigned    numThreads   = 0;           // 0 => hardware concurrency
+    size_t      minChunkSize = 1 << 20;     // don't split below this many bytes per thread
+    const char* mtlBasePath  = nullptr;     // same as tinyobj::LoadObj's mtl_basepath
+};
+
+bool parseObj (const char * data, size_t size,
+               std::vector<tinyobj::shape_t> & shapes,
+               std::vector<tinyobj::material_t> & materials,
+               std::string & err,
+               const ParseOptions & options = ParseOptions());
+
+// Maps the file + calls parseObj.
+bool loadObj (const std::string & path,
+              std::vector<tinyobj::shape_t> & shapes,
+              std::vector<tinyobj::material_t> & materials,
+              std::string & err,
+              const ParseOptions & options = ParseOptions());
+
+// Exposed for testing: parses one float w/ tinyobj's syntax ([sign] digits [. digits] [e [sign] digits]),
+// stopping at end. Returns false (and leaves value untouched) on a syntax error.
+bool parseDouble (const char * s, const char * end, double & value);
+
+}; // namespace obj
+}; // namespace gl_sandbox
+
+#endif /* obj_parser_hpp */
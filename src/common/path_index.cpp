@@ -0,0 +1,162 @@
+//
+//  path_index.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/10/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "path_index.hpp"
+#include <vector>
+
+using namespace gl_sandbox;
+
+PathIndex::PathIndex (const Path & root, WatchFunction watch) :
+    m_root(root),
+    m_watch(watch),
+    m_state(std::make_shared<State>())
+{
+    boost::system::error_code ec;
+    m_state->absoluteRoot = boost::filesystem::canonical(root, ec);
+    if (ec)
+        m_state->absoluteRoot = boost::filesystem::absolute(root);
+}
+
+// Watch first, then list, so a change that lands mid-scan still invalidates the result.
+PathIndex::Listing PathIndex::scan (const std::string & dir) {
+    using namespace boost::filesystem;
+    
+    Listing listing;
+    auto path = dir.empty() ? m_root : m_root / dir;
+    boost::system::error_code ec;
+    if (!is_directory(path, ec))
+        return listing;
+    
+    if (m_watch) {
+        std::weak_ptr<State> weakState = m_state;
+        listing.watchHandle = m_watch(path, [weakState, dir](const resource_impl::FilePath &) {
+            if (auto state = weakState.lock())
+                state->invalidate(dir.empty() ? Path(".") : Path(dir));
+        });
+    }
+    listing.exists = true;
+    for (directory_iterator it (path, ec), end; !ec && it != end; it.increment(ec))
+        listing.entries.insert(it->path().filename().string());
+    return listing;
+}
+
+bool PathIndex::exists (const Path & relativePath) {
+    std::string dir;
+    std::string name;
+    for (auto & component : relativePath) {
+        auto s = component.string();
+        if (s == "." || s == ".." || s == "/" || s.empty()) {
+            ++m_state->stats.uncached;
+            return boost::filesystem::exists(m_root / relativePath);
+        }
+        if (!name.empty())
+            dir = dir.empty() ? name : dir + '/' + name;
+        name = s;
+    }
+    if (name.empty())
+        return false;
+    
+    auto & state = *m_state;
+    uint64_t generation;
+    {
+        std::lock_guard<decltype(state.mutex)> lock (state.mutex);
+        auto it = state.dirs.find(dir);
+        if (it != state.dirs.end()) {
+            ++state.stats.hits;
+            return it->second.entries.count(name) != 0;
+        }
+        generation = state.generation;
+    }
+    // Scan outside the lock: watchers call invalidate() w/ their own locks held, so taking
+    // theirs (in m_watch) while holding ours could deadlock.
+    ++state.stats.misses;
+    auto listing = scan(dir);
+    bool found = listing.entries.count(name) != 0;
+    bool missingDir = !listing.exists;
+    {
+        std::lock_guard<decltype(state.mutex)> lock (state.mutex);
+        // An invalidate() that ran while we were scanning would have dropped this listing, so
+        // don't cache it (found is still the best answer we have)
+        if (!state.invalidatedSince(generation, dir, missingDir))
+            state.dirs.emplace(dir, std::move(listing));     // keeps the existing listing if another thread beat us to it
+    }
+    // Missing dirs can't be watched, so make sure their parent is (creating dir will fire that)
+    if (missingDir && !dir.empty())
+        exists(Path(dir));
+    return found;
+}
+
+// Mirrors what invalidate() / clear() drop: dir itself (or as a parent), anything below a
+// (non-root) invalidated dir, every missing-dir listing, and everything on clear().
+bool PathIndex::State::invalidatedSince (uint64_t since, const std::string & dir, bool missing) const {
+    if (generation == since)
+        return false;
+    if (missing || cleared > since)
+        return true;
+    auto changedSince = [&](const std::string & key) {
+        auto it = invalidated.find(key);
+        return it != invalidated.end() && it->second > since;
+    };
+    if (changedSince(dir))
+        return true;
+    for (auto slash = dir.rfind('/'); slash != std::string::npos && slash > 0; slash = dir.rfind('/', slash - 1))
+        if (changedSince(dir.substr(0, slash)))
+            return true;
+    return false;
+}
+
+void PathIndex::invalidate (const Path & path) {
+    m_state->invalidate(path);
+}
+
+void PathIndex::State::invalidate (const Path & path) {
+    // Make root-relative
+    auto relative = path;
+    if (path.is_absolute()) {
+        auto p = path.begin();
+        auto r = absoluteRoot.begin();
+        for (; r != absoluteRoot.end() && p != path.end() && *r == *p; ++r, ++p) {}
+        if (r != absoluteRoot.end())
+            return;     // not under our root
+        relative.clear();
+        for (; p != path.end(); ++p)
+            relative /= *p;
+    }
+    auto dir = relative.generic_string();
+    if (dir == ".")
+        dir.clear();
+    auto parent = relative.parent_path().generic_string();
+    auto prefix = dir + '/';
+    
+    std::vector<Listing> dropped;     // released after unlocking (handle dtors may call into the watcher)
+    {
+        std::lock_guard<decltype(mutex)> lock (mutex);
+        invalidated[dir] = invalidated[parent] = ++generation;
+        for (auto it = dirs.begin(); it != dirs.end(); ) {
+            auto & key = it->first;
+            // Listings of missing dirs have no watch of their own, so drop those on any change too
+            if (key == dir || key == parent || !it->second.exists ||
+                (!dir.empty() && key.compare(0, prefix.size(), prefix) == 0)) {
+                dropped.push_back(std::move(it->second));
+                it = dirs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    ++stats.invalidations;
+}
+
+void PathIndex::clear () {
+    decltype(m_state->dirs) dirs;
+    {
+        std::lock_guard<decltype(m_state->mutex)> lock (m_state->mutex);
+        dirs.swap(m_state->dirs);
+        m_state->cleared = ++m_state->generation;   // (so scans in flight don't put theirs back)
+    }
+}
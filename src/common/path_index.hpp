@@ -0,0 +1,99 @@
+//
+//  path_index.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/10/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef path_index_hpp
+#define path_index_hpp
+
+#include "resourcelayer/file_watcher.hpp"
+
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace gl_sandbox {
+
+// In-memory index of the files + directories under a resource root, so path resolution is a
+// couple of hash probes instead of a stat() per candidate path.
+//
+// Directories are scanned (non-recursively) the first time a lookup touches them, and each
+// scanned directory gets a watch from the WatchFunction; when it fires, that directory's listing
+// (+ its parent's, anything cached below it, and any cached "doesn't exist" results) is dropped
+// and rescanned on the next lookup.
+// Since a stale index would be wrong rather than just slow, only use this w/ a working watcher.
+//
+// Thread safe.
+class PathIndex {
+public:
+    typedef boost::filesystem::path Path;
+    typedef std::function<void(const resource_impl::FilePath &)> ChangeHandler;
+
+    // Starts watching one directory (not recursive); watching stops when the handle goes away.
+    typedef std::function<resource_impl::DirectoryWatcherHandleRef(const Path & dir, ChangeHandler onChanged)> WatchFunction;
+
+    struct Stats {
+        std::atomic<size_t> hits   { 0 };   // answered from memory
+        std::atomic<size_t> misses { 0 };   // needed a directory scan first
+        std::atomic<size_t> uncached { 0 }; // paths w/ '.' / '..' components; passed through to exists()
+        std::atomic<size_t> invalidations { 0 };
+    };
+
+    PathIndex (const Path & root, WatchFunction watch);
+
+    PathIndex (const PathIndex &) = delete;
+    PathIndex & operator= (const PathIndex &) = delete;
+
+    // Does root / relativePath exist (as a file or directory)?
+    bool exists (const Path & relativePath);
+
+    // Drops cached listings for path (absolute or root-relative) + its parent + everything below it.
+    void invalidate (const Path & path);
+    void clear ();
+
+    const Path  & root  () const { return m_root; }
+    const Stats & stats () const { return m_state->stats; }
+
+protected:
+    struct Listing {
+        bool exists = false;
+        std::unordered_set<std::string> entries;
+        resource_impl::DirectoryWatcherHandleRef watchHandle;
+    };
+    // Everything a watch callback touches. Callbacks only hold a weak_ptr to it, so one that
+    // fires while the index is going away is a no-op.
+    struct State {
+        Path       absoluteRoot;    // canonical; what watchers report paths relative to
+        Stats      stats;
+        std::mutex mutex;           // guards everything below
+        std::unordered_map<std::string, Listing> dirs;  // keyed by root-relative generic path ("" == root)
+
+        // Bumped by every invalidate() / clear(); invalidated[dir] is the generation that last dropped dir's
+        // listing (directly or as a parent), so a scan done outside the lock can tell it's stale.
+        uint64_t generation = 0;
+        uint64_t cleared    = 0;        // generation of the last clear() (drops everything)
+        std::unordered_map<std::string, uint64_t> invalidated;
+
+        void invalidate (const Path & path);
+        bool invalidatedSince (uint64_t generation, const std::string & dir, bool missing) const;
+    };
+    Listing scan (const std::string & dir);
+
+protected:
+    Path          m_root;
+    WatchFunction m_watch;
+    std::shared_ptr<State> m_state;
+};
+
+}; // namespace gl_sandbox
+
+#endif /* path_index_hpp */
@@ -0,0 +1,140 @@
+//
+//  request_table.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/9/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "request_table.hpp"
+#include <iostream>
+
+using namespace gl_sandbox;
+
+bool RequestTable::submit (const std::string & key, LoadPriority priority, const CancellationToken & token,
+                           Work work, Deliver deliver) {
+    {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        ++m_stats.submitted;
+        
+        auto it = m_jobs.find(key);
+        if (it != m_jobs.end()) {
+            auto & job = it->second;
+            job->waiters.push_back({ token, deliver });
+            if (!job->started && priority < job->priority) {
+                // Leaves a stale entry in the old queue; popNext() skips it once this one runs
+                job->priority = priority;
+                m_queues[(size_t)priority].push_back(job);
+            }
+            ++m_stats.coalesced;
+            return true;
+        }
+        
+        auto job = std::make_shared<Job>();
+        job->key      = key;
+        job->work     = work;
+        job->priority = priority;
+        job->waiters.push_back({ token, deliver });
+        m_jobs[key] = job;
+        m_queues[(size_t)priority].push_back(job);
+        ++m_unscheduled;
+    }
+    schedule();
+    return false;
+}
+
+// Runner tasks don't belong to any particular job: each one runs whatever's most important
+// when it starts. There's one runner per job, so every job eventually gets picked up.
+void RequestTable::schedule () {
+    while (1) {
+        {
+            std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+            if (m_unscheduled == 0)
+                return;
+            --m_unscheduled;
+        }
+        ThreadPool::Task task = [this]() { runNext(); };
+        if (!m_tryEnqueue(task)) {
+            std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+            ++m_unscheduled;
+            return;
+        }
+    }
+}
+
+bool RequestTable::allCancelled (const Job & job) {
+    for (auto & waiter : job.waiters)
+        if (!waiter.token.cancelled())
+            return false;
+    return true;
+}
+
+RequestTable::JobRef RequestTable::popNext () {
+    std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+    for (auto & queue : m_queues) {
+        while (!queue.empty()) {
+            auto job = queue.front();
+            queue.pop_front();
+            if (job->started)
+                continue;
+            job->started = true;
+            if (allCancelled(*job)) {
+                m_jobs.erase(job->key);
+                ++m_stats.cancelled;
+                continue;
+            }
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void RequestTable::runNext () {
+    auto job = popNext();
+    if (!job)
+        return schedule();
+    
+    CancelCheck cancelled = [this, job]() {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        return (job->abandoned = allCancelled(*job));
+    };
+    Result result;
+    std::string err;
+    try {
+        result = job->work(err, cancelled);
+    } catch (std::exception & e) {
+        result = nullptr;
+        err = e.what();
+    } catch (...) {
+        result = nullptr;
+        err = "unknown exception";
+    }
+    
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        if (!result && job->abandoned && !allCancelled(*job)) {
+            // Bailed out, but someone new joined in the meantime: run it again
+            job->started = job->abandoned = false;
+            m_queues[(size_t)job->priority].push_back(job);
+            ++m_unscheduled;
+        } else {
+            m_jobs.erase(job->key);
+            waiters.swap(job->waiters);
+            ++(job->abandoned ? m_stats.cancelled : m_stats.completed);
+        }
+    }
+    for (auto & waiter : waiters) {
+        waiter.token.runIfLive([&]() {
+            waiter.deliver(result, err);
+        });
+    }
+    schedule();
+}
+
+RequestTable::Stats RequestTable::getStats () {
+    std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+    auto stats = m_stats;
+    stats.pending = m_jobs.size();
+    return stats;
+}
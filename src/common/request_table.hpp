@@ -0,0 +1,138 @@
+//
+//  request_table.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/9/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef request_table_hpp
+#define request_table_hpp
+
+#include "thread_pool.hpp"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gl_sandbox {
+
+// Shared, sticky cancellation flag (copies share state).
+//
+// runIfLive() runs its body under the token's lock, so once cancel() returns nothing is (or
+// ever will be) running inside runIfLive(). ResourceLoader relies on this to hand callbacks
+// that capture `this` to other threads, and cancels its token in its destructor.
+class CancellationToken {
+public:
+    CancellationToken () : m_state(std::make_shared<State>()) {}
+
+    void cancel () {
+        std::lock_guard<std::mutex> lock (m_state->mutex);
+        m_state->cancelled = true;
+    }
+    bool cancelled () const {
+        std::lock_guard<std::mutex> lock (m_state->mutex);
+        return m_state->cancelled;
+    }
+    template <typename F>
+    bool runIfLive (F && f) const {
+        std::lock_guard<std::mutex> lock (m_state->mutex);
+        if (m_state->cancelled)
+            return false;
+        f();
+        return true;
+    }
+private:
+    struct State {
+        std::mutex mutex;
+        bool cancelled = false;
+    };
+    std::shared_ptr<State> m_state;
+};
+
+enum class LoadPriority {
+    VISIBLE  = 0,   // something on screen is waiting on it
+    PREFETCH = 1,   // might be needed later; runs after all VISIBLE work
+    COUNT
+};
+
+// Table of in-flight async loads, keyed by (kind, resolved path).
+//
+// A request for a key that's already queued or running just adds a waiter to that job, so N
+// modules loading "dragon.obj" share one parse. Jobs wait in per-priority queues, and pool
+// tasks pick the best job when they _start_ rather than when they were submitted -- so a
+// VISIBLE request overtakes queued prefetches (and bumps a matching prefetch job up). A job
+// whose waiters have all been cancelled is dropped before it starts, and its work function
+// can poll the cancel check to bail out early.
+class RequestTable {
+public:
+    typedef std::shared_ptr<const void> Result;
+    typedef std::function<bool()> CancelCheck;
+
+    // Runs on a pool thread. Returns null + sets err on failure.
+    typedef std::function<Result (std::string & err, const CancelCheck & cancelled)> Work;
+
+    // Runs on the pool thread that finished the job (under the waiter token's lock), for each
+    // waiter that's still live. result is null on failure.
+    typedef std::function<void (const Result & result, const std::string & err)> Deliver;
+
+    struct Stats {
+        size_t submitted = 0;   // requests (including coalesced ones)
+        size_t coalesced = 0;   // requests that joined an existing job
+        size_t cancelled = 0;   // jobs dropped before they ran / abandoned mid-run
+        size_t completed = 0;   // jobs that ran to completion
+        size_t pending   = 0;   // jobs queued or running
+    };
+
+    explicit RequestTable (std::function<bool(ThreadPool::Task &)> tryEnqueue) :
+        m_tryEnqueue(tryEnqueue) {}
+
+    RequestTable (const RequestTable &) = delete;
+    RequestTable & operator= (const RequestTable &) = delete;
+
+    // Returns true iff the request was coalesced into an existing job.
+    bool submit (const std::string & key, LoadPriority priority, const CancellationToken & token,
+                 Work work, Deliver deliver);
+
+    // Pushes runner tasks that didn't fit in the pool's queue last time. Called on submit, after
+    // every job, and from ResourceLoader::finishAsyncTasks().
+    void schedule ();
+
+    Stats getStats ();
+
+protected:
+    struct Waiter {
+        CancellationToken token;
+        Deliver           deliver;
+    };
+    struct Job {
+        std::string         key;
+        Work                work;
+        std::vector<Waiter> waiters;
+        LoadPriority        priority;
+        bool                started   = false;
+        bool                abandoned = false;  // work saw the cancel check fire
+    };
+    typedef std::shared_ptr<Job> JobRef;
+
+    void   runNext ();
+    JobRef popNext ();
+    static bool allCancelled (const Job & job);
+
+protected:
+    std::function<bool(ThreadPool::Task &)> m_tryEnqueue;
+
+    std::mutex                              m_mutex;    // guards everything below
+    std::unordered_map<std::string, JobRef> m_jobs;     // queued + running jobs
+    std::deque<JobRef> m_queues [(size_t)LoadPriority::COUNT];  // may hold stale entries (started / reprioritized jobs)
+    size_t                                  m_unscheduled = 0;  // jobs w/out a runner task in the pool yet
+    Stats                                   m_stats;
+};
+
+}; // namespace gl_sandbox
+
+#endif /* request_table_hpp */
@@ -0,0 +1,192 @@
+//
+//  residency.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "residency.hpp"
+#include <cassert>
+#include <iostream>
+
+using namespace gl_sandbox;
+
+const char * gl_sandbox::toString (ResidencyCategory category) {
+    switch (category) {
+        case ResidencyCategory::FILE_BUFFERS: return "file buffers";
+        case ResidencyCategory::IMAGES:       return "images";
+        case ResidencyCategory::MESHES:       return "meshes";
+        case ResidencyCategory::GL_BUFFERS:   return "gl buffers";
+        case ResidencyCategory::GL_PROGRAMS:  return "gl programs";
+        case ResidencyCategory::COUNT:        break;
+    }
+    return "<invalid category>";
+}
+
+ResidencyManager::~ResidencyManager () {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    if (!m_slots.empty())
+        std::cerr << "ResidencyManager: destroyed w/ " << m_slots.size() << " live handle(s) (first: '"
+                  << m_slots.begin()->first << "')\n";
+    assert(m_slots.empty());
+}
+
+std::shared_ptr<ResidencyManager::Slot> ResidencyManager::addSlot (ResidencyCategory c, const std::string & key, Loader load) {
+    auto id = std::string(toString(c)) + ":" + key;
+    std::lock_guard<std::mutex> lock (m_mutex);
+    auto it = m_slots.find(id);
+    if (it != m_slots.end()) {
+        if (auto existing = it->second.ref.lock())
+            return existing;
+    }
+    auto slot = std::make_shared<Slot>(this, c, key, load);
+    m_slots[id] = { slot.get(), slot };
+    ++category(c).stats.numResources;
+    return slot;
+}
+
+void ResidencyManager::unregister (Slot * slot) {
+    Value value;
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        auto & c = category(slot->category);
+        if (slot->value) {
+            unlink(c, *slot);
+            c.resident -= slot->bytes;
+            value = std::move(slot->value);
+        }
+        --c.stats.numResources;
+        auto it = m_slots.find(std::string(toString(slot->category)) + ":" + slot->key);
+        if (it != m_slots.end() && it->second.slot == slot)
+            m_slots.erase(it);
+    }
+    // value gets released here, outside the lock
+}
+
+void ResidencyManager::link (Category & c, Slot & slot) {
+    slot.prev = nullptr;
+    slot.next = c.mru;
+    if (c.mru)
+        c.mru->prev = &slot;
+    c.mru = &slot;
+    if (!c.lru)
+        c.lru = &slot;
+}
+
+void ResidencyManager::unlink (Category & c, Slot & slot) {
+    (slot.prev ? slot.prev->next : c.mru) = slot.next;
+    (slot.next ? slot.next->prev : c.lru) = slot.prev;
+    slot.prev = slot.next = nullptr;
+}
+
+size_t ResidencyManager::evictOverBudget (Category & c, std::vector<Value> & evicted, const Slot * keep) {
+    size_t freed = 0;
+    for (auto slot = c.lru; slot && c.resident > c.budget; ) {
+        auto prev = slot->prev;
+        // use_count() == 1 => only we hold it. Safe to test under the lock: the only way to get a
+        // new ref is acquire(), which needs the lock too.
+        if (slot != keep && slot->value.use_count() == 1) {
+            unlink(c, *slot);
+            c.resident -= slot->bytes;
+            freed      += slot->bytes;
+            ++c.stats.evictions;
+            evicted.push_back(std::move(slot->value));
+            slot->value.reset();
+        }
+        slot = prev;
+    }
+    return freed;
+}
+
+ResidencyManager::Value ResidencyManager::acquire (Slot & slot) {
+    auto & c = category(slot.category);
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        if (slot.value) {
+            unlink(c, slot);
+            link(c, slot);
+            ++c.stats.hits;
+            return slot.value;
+        }
+    }
+    std::lock_guard<std::mutex> loadLock (slot.loadMutex);
+    {
+        // Someone else may have loaded it while we were waiting
+        std::lock_guard<std::mutex> lock (m_mutex);
+        if (slot.value) {
+            unlink(c, slot);
+            link(c, slot);
+            ++c.stats.hits;
+            return slot.value;
+        }
+    }
+    size_t bytes = 0;
+    std::string err;
+    auto value = slot.load(bytes, err);
+
+    std::vector<Value> evicted;
+    std::lock_guard<std::mutex> lock (m_mutex);
+    if (!value) {
+        ++c.stats.failures;
+        slot.lastError = err.empty() ? "load failed" : err;
+        return nullptr;
+    }
+    ++(slot.everLoaded ? c.stats.reloads : c.stats.loads);
+    slot.everLoaded = true;
+    slot.lastError.clear();
+    slot.value = value;
+    slot.bytes = bytes;
+    c.resident += bytes;
+    link(c, slot);
+    evictOverBudget(c, evicted, &slot);
+    // evicted is declared before lock, so it's released after the lock is
+    return value;
+}
+
+bool ResidencyManager::isResident (Slot & slot) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return slot.value != nullptr;
+}
+
+std::string ResidencyManager::lastError (Slot & slot) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return slot.lastError;
+}
+
+void ResidencyManager::setBudget (ResidencyCategory c, size_t bytes) {
+    std::vector<Value> evicted;
+    std::lock_guard<std::mutex> lock (m_mutex);
+    category(c).budget = bytes;
+    evictOverBudget(category(c), evicted);
+}
+
+size_t ResidencyManager::budget (ResidencyCategory c) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return category(c).budget;
+}
+
+size_t ResidencyManager::trim (ResidencyCategory c) {
+    std::vector<Value> evicted;
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return evictOverBudget(category(c), evicted);
+}
+
+size_t ResidencyManager::trim () {
+    size_t freed = 0;
+    for (size_t i = 0; i < (size_t)ResidencyCategory::COUNT; ++i)
+        freed += trim((ResidencyCategory)i);
+    return freed;
+}
+
+ResidencyManager::CategoryStats ResidencyManager::stats (ResidencyCategory c) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    auto & cat = category(c);
+    auto stats = cat.stats;
+    stats.budget        = cat.budget;
+    stats.residentBytes = cat.resident;
+    stats.numResident   = 0;
+    for (auto slot = cat.mru; slot; slot = slot->next)
+        ++stats.numResident;
+    return stats;
+}
@@ -0,0 +1,164 @@
+//
+//  residency.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef residency_hpp
+#define residency_hpp
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gl_sandbox {
+
+enum class ResidencyCategory {
+    FILE_BUFFERS = 0,   // raw / mapped file contents
+    IMAGES,             // decoded pixels
+    MESHES,             // cpu-side mesh data
+    GL_BUFFERS,         // vbos, textures, etc. (evicted on whatever thread calls acquire() / trim())
+    GL_PROGRAMS,        // linked shader programs (ditto)
+    COUNT
+};
+const char * toString (ResidencyCategory category);
+
+// Memory-budgeted LRU cache of reloadable resources.
+//
+// Each resource is registered w/ a loader, and is accessed through a Handle: acquire() (re)loads
+// it if it isn't resident, moves it to the front of its category's LRU list, and returns a
+// shared_ptr that pins it. Whenever a category is over its byte budget, the least recently used
+// resources that nobody has pinned get evicted (their value is dropped) -- the next acquire()
+// just loads them again. Pinned resources are never evicted, so a category can stay over budget
+// if everything in it is in use.
+//
+// A resource lives as long as someone holds a Handle to it; registering the same (category, key)
+// again while it's alive returns the existing one (and keeps its loader). The manager has to
+// outlive every Handle. Thread safe; loads run outside the manager's lock (one at a time per
+// resource), and evicted values are released outside it too.
+class ResidencyManager {
+public:
+    typedef std::shared_ptr<void> Value;
+    // Loads (or reloads) a resource + sets bytes to its size. Returns null (and sets err) on failure.
+    typedef std::function<Value (size_t & bytes, std::string & err)> Loader;
+
+    static constexpr size_t UNLIMITED = SIZE_MAX;
+
+    struct CategoryStats {
+        size_t budget       = UNLIMITED;
+        size_t residentBytes = 0;
+        size_t numResources = 0;    // registered (live handles)
+        size_t numResident  = 0;
+        size_t hits         = 0;    // acquire()s that found the resource resident
+        size_t loads        = 0;    // first loads
+        size_t reloads      = 0;    // loads after an eviction
+        size_t evictions    = 0;
+        size_t failures     = 0;
+    };
+
+    struct Slot {
+        Slot (ResidencyManager * manager, ResidencyCategory category, const std::string & key, Loader load) :
+            manager(manager), category(category), key(key), load(load) {}
+        ~Slot () { manager->unregister(this); }
+        Slot (const Slot &) = delete;
+        Slot & operator= (const Slot &) = delete;
+
+        ResidencyManager * const manager;
+        const ResidencyCategory  category;
+        const std::string        key;
+        const Loader             load;
+        std::mutex               loadMutex;     // serializes (re)loads of this resource
+
+        // Guarded by manager->m_mutex
+        Value       value;
+        size_t      bytes = 0;
+        bool        everLoaded = false;
+        std::string lastError;
+        Slot *      prev = nullptr;             // LRU links (resident slots only); prev => more recent
+        Slot *      next = nullptr;
+    };
+
+    template <typename T>
+    class Handle {
+    public:
+        Handle () {}
+        explicit Handle (std::shared_ptr<Slot> slot) : m_slot(slot) {}
+
+        // The resource, (re)loaded if needed; pins it for as long as the returned ref is held.
+        // Null if loading failed (see error()).
+        std::shared_ptr<T> acquire () const {
+            return std::static_pointer_cast<T>(m_slot->manager->acquire(*m_slot));
+        }
+        bool resident () const { return m_slot->manager->isResident(*m_slot); }
+        std::string error () const { return m_slot->manager->lastError(*m_slot); }
+        const std::string & key () const { return m_slot->key; }
+        explicit operator bool () const { return m_slot != nullptr; }
+    protected:
+        std::shared_ptr<Slot> m_slot;
+    };
+
+    ResidencyManager () {}
+    ~ResidencyManager ();
+    ResidencyManager (const ResidencyManager &) = delete;
+    ResidencyManager & operator= (const ResidencyManager &) = delete;
+
+    // Registers (or finds) a resource. Nothing is loaded until the first acquire().
+    template <typename T>
+    Handle<T> add (ResidencyCategory category, const std::string & key,
+                   std::function<std::shared_ptr<T> (size_t & bytes, std::string & err)> load) {
+        return Handle<T>(addSlot(category, key, [load](size_t & bytes, std::string & err) -> Value {
+            return load(bytes, err);
+        }));
+    }
+
+    // Evicts right away if the category is now over budget.
+    void   setBudget (ResidencyCategory category, size_t bytes);
+    size_t budget (ResidencyCategory category);
+
+    // Evicts unpinned resources in over-budget categories; returns the number of bytes freed.
+    // acquire() does this for the category it loaded into, but pins get released w/out telling
+    // us, so call this once in a while (eg. once a frame) too.
+    size_t trim ();
+    size_t trim (ResidencyCategory category);
+
+    CategoryStats stats (ResidencyCategory category);
+
+protected:
+    std::shared_ptr<Slot> addSlot (ResidencyCategory category, const std::string & key, Loader load);
+    Value acquire (Slot & slot);
+    bool  isResident (Slot & slot);
+    std::string lastError (Slot & slot);
+    void  unregister (Slot * slot);
+
+    struct Category {
+        size_t budget   = UNLIMITED;
+        size_t resident = 0;
+        Slot * mru = nullptr;
+        Slot * lru = nullptr;
+        CategoryStats stats;
+    };
+    void link   (Category & category, Slot & slot);     // as most recently used
+    void unlink (Category & category, Slot & slot);
+    // Evicts into evicted (released by the caller, outside the lock). Skips keep.
+    size_t evictOverBudget (Category & category, std::vector<Value> & evicted, const Slot * keep = nullptr);
+    Category & category (ResidencyCategory c) { return m_categories[(size_t)c]; }
+
+protected:
+    std::mutex m_mutex;                                         // guards everything below + slot state
+    Category   m_categories [(size_t)ResidencyCategory::COUNT];
+    struct Registered {
+        Slot *              slot;   // to tell a dying slot from a newer one w/ the same key
+        std::weak_ptr<Slot> ref;
+    };
+    std::unordered_map<std::string, Registered> m_slots;           // "<category>:<key>"
+};
+
+}; // namespace gl_sandbox
+
+#endif /* residency_hpp */
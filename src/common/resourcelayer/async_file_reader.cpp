@@ -0,0 +1,485 @@
+//
+//  async_file_reader.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/4/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "async_file_reader.hpp"
+#include "../thread_pool.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <deque>
+#include <atomic>
+#include <cassert>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAS_IO_URING 1
+#endif
+#endif
+
+#ifdef HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+using namespace gl_sandbox;
+using namespace resource_impl;
+using namespace async_io;
+
+// ============================================================
+//                   COMPLETION ROUTING
+// ============================================================
+
+CompletionRouter & CompletionRouter::shared () {
+    static CompletionRouter router;
+    return router;
+}
+
+void CompletionRouter::post (std::thread::id target, std::function<void()> callback) {
+    std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+    m_pending[target].push_back(std::move(callback));
+}
+
+unsigned CompletionRouter::runPending () {
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        auto it = m_pending.find(std::this_thread::get_id());
+        if (it == m_pending.end())
+            return 0;
+        callbacks.swap(it->second);
+    }
+    // Run outside the lock -- callbacks are free to issue more loads.
+    for (auto & callback : callbacks)
+        callback();
+    return (unsigned)callbacks.size();
+}
+
+size_t CompletionRouter::numPending () {
+    std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+    auto it = m_pending.find(std::this_thread::get_id());
+    return it != m_pending.end() ? it->second.size() : 0;
+}
+
+static void deliverLoaded (ReadRequest & request, FileBufferRef buffer) {
+    auto onLoad = std::move(request.onLoad);
+    CompletionRouter::shared().post(request.requester, [onLoad, buffer]() {
+        if (onLoad) onLoad(buffer);
+    });
+}
+static void deliverFailed (ReadRequest & request) {
+    auto onFail = std::move(request.onFail);
+    auto path   = request.path;
+    CompletionRouter::shared().post(request.requester, [onFail, path]() {
+        if (onFail) onFail(path);
+    });
+}
+
+static FileBufferRef makeHeapBuffer (const FilePath & path, uint8_t * data, size_t size) {
+    data[size] = 0; // null-terminate, so text loaders can use the buffer directly
+    return std::make_shared<FileBuffer>(path, data, size,
+        [](FileBuffer & buf) { delete[] buf.data; });
+}
+
+// ============================================================
+//                  THREAD POOL FALLBACK
+// ============================================================
+
+static ThreadPool & ioThreadPool () {
+    // IO bound, so this doesn't need to track core count; just enough to keep the disk busy.
+    static ThreadPool pool { 4, 256 };
+    return pool;
+}
+
+// Tasks that didn't fit in the pool's queue (same idea as RequestTable's unscheduled runners):
+// runOnIOThread() never blocks its caller, which is usually the main thread.
+static std::mutex g_overflowMutex;
+static std::deque<std::function<void()>> g_overflow;
+
+void async_io::runOnIOThread (std::function<void()> task) {
+    {
+        std::lock_guard<decltype(g_overflowMutex)> lock (g_overflowMutex);
+        g_overflow.emplace_back(std::move(task));
+    }
+    schedulePending();
+}
+
+// Each task pulls in more overflow when it finishes; finishAsyncTasks() calls this once a frame
+// too, in case the last one finished while we were putting a task back.
+void async_io::schedulePending () {
+    while (1) {
+        std::function<void()> task;
+        {
+            std::lock_guard<decltype(g_overflowMutex)> lock (g_overflowMutex);
+            if (g_overflow.empty())
+                return;
+            task = std::move(g_overflow.front());
+            g_overflow.pop_front();
+        }
+        auto shared = std::make_shared<std::function<void()>>(std::move(task));
+        ThreadPool::Task runner = [shared]() {
+            (*shared)();
+            schedulePending();
+        };
+        if (!ioThreadPool().tryEnqueue(runner)) {
+            std::lock_guard<decltype(g_overflowMutex)> lock (g_overflowMutex);
+            g_overflow.emplace_front(std::move(*shared));
+            return;
+        }
+    }
+}
+
+namespace {
+
+// Blocking ifstream reads, one request per pool task.
+struct PooledFileReader : public IAsyncFileReader {
+    void submit (std::vector<ReadRequest> && requests) override {
+        for (auto & request : requests) {
+            auto shared = std::make_shared<ReadRequest>(std::move(request));
+            runOnIOThread([shared]() {
+                std::ifstream f (shared->path, std::ios::binary);
+                if (f) {
+                    f.seekg(0, std::ios::end);
+                    size_t size = f.tellg();
+                    f.seekg(0, std::ios::beg);
+                    if (size != 0) {
+                        auto data = new uint8_t[size+1];
+                        if (f.read((char*)data, size))
+                            return deliverLoaded(*shared, makeHeapBuffer(shared->path, data, size));
+                        delete[] data;
+                    }
+                }
+                deliverFailed(*shared);
+            });
+        }
+    }
+    const char * backendName () const override { return "threadpool"; }
+};
+
+// ============================================================
+//                     IO_URING BACKEND
+// ============================================================
+
+#ifdef HAS_IO_URING
+
+// Batched reads using io_uring, driven through raw syscalls (no liburing dependency).
+//
+// Each file goes through openat + statx (submitted together) -> read (resubmitted on short reads)
+// -> close. Every request submitted in a batch gets its sqes queued before a single
+// io_uring_enter, so a directory of N small files costs a handful of syscalls instead of ~4N.
+//
+// One reaper thread owns the ring (so the sq needs no locking); submitters hand requests over
+// through a mutex-guarded queue and wake it via an eventfd that the ring polls on.
+class UringFileReader : public IAsyncFileReader {
+    enum Stage : uint64_t { OPEN = 0, STAT = 1, READ = 2, CLOSE = 3 };
+    static constexpr uint64_t WAKE_TAG = ~0ull;
+    static constexpr unsigned QUEUE_DEPTH = 256;
+    static constexpr unsigned MAX_IN_FLIGHT = QUEUE_DEPTH / 2;   // <= 2 sqes outstanding per file
+    static constexpr size_t   MAX_READ_CHUNK = 1 << 30;
+
+    struct alignas(8) FileOp {
+        ReadRequest request;
+        struct statx stx;
+        int      fd = -1;
+        int      pending = 0;       // outstanding open/stat cqes
+        bool     failed = false;
+        uint8_t* data = nullptr;
+        size_t   size = 0, offset = 0;
+
+        FileOp (ReadRequest && request) : request(std::move(request)) {}
+    };
+
+public:
+    // Returns nullptr if io_uring is unavailable (old kernel, seccomp, etc)
+    static UringFileReader * create () {
+        std::unique_ptr<UringFileReader> reader (new UringFileReader());
+        if (!reader->init())
+            return nullptr;
+        reader->m_reaper = std::thread([r = reader.get()]() { r->reaperLoop(); });
+        return reader.release();
+    }
+    ~UringFileReader () {
+        m_alive = false;
+        wake();
+        if (m_reaper.joinable())
+            m_reaper.join();
+        if (m_sqes) munmap(m_sqes, m_sqesSize);
+        if (m_cqRing && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+        if (m_sqRing) munmap(m_sqRing, m_sqRingSize);
+        if (m_ringFd >= 0) close(m_ringFd);
+        if (m_wakeFd >= 0) close(m_wakeFd);
+    }
+
+    void submit (std::vector<ReadRequest> && requests) override {
+        {
+            std::lock_guard<decltype(m_queueMutex)> lock (m_queueMutex);
+            for (auto & request : requests)
+                m_incoming.emplace_back(std::move(request));
+        }
+        wake();
+    }
+    const char * backendName () const override { return "io_uring"; }
+
+protected:
+    UringFileReader () {}
+
+    static int sys_setup (unsigned entries, io_uring_params * p) {
+        return (int)syscall(__NR_io_uring_setup, entries, p);
+    }
+    static int sys_enter (int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+    static int sys_register (int fd, unsigned opcode, void * arg, unsigned nargs) {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+    }
+
+    bool init () {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        if ((m_ringFd = sys_setup(QUEUE_DEPTH, &p)) < 0)
+            return false;
+
+        // Need openat / statx / read / close / poll; all 5.6+, so probe rather than trust uname.
+        size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+        std::unique_ptr<uint8_t[]> probeMem (new uint8_t[probeSize]());
+        auto probe = (io_uring_probe*)probeMem.get();
+        if (sys_register(m_ringFd, IORING_REGISTER_PROBE, probe, 256) < 0)
+            return false;
+        for (auto op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_POLL_ADD }) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+
+        m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMmap)
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+        m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+        if (m_sqRing == MAP_FAILED)
+            return m_sqRing = nullptr, false;
+        m_cqRing = singleMmap ? m_sqRing :
+            mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED)
+            return m_cqRing = nullptr, false;
+        m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED)
+            return m_sqes = nullptr, false;
+
+        auto sq = (uint8_t*)m_sqRing, cq = (uint8_t*)m_cqRing;
+        m_sqHead  = (unsigned*)(sq + p.sq_off.head);
+        m_sqTail  = (unsigned*)(sq + p.sq_off.tail);
+        m_sqMask  = *(unsigned*)(sq + p.sq_off.ring_mask);
+        m_sqArray = (unsigned*)(sq + p.sq_off.array);
+        m_sqEntries = p.sq_entries;
+        m_cqHead  = (unsigned*)(cq + p.cq_off.head);
+        m_cqTail  = (unsigned*)(cq + p.cq_off.tail);
+        m_cqMask  = *(unsigned*)(cq + p.cq_off.ring_mask);
+        m_cqes    = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+        return (m_wakeFd = eventfd(0, EFD_CLOEXEC)) >= 0;
+    }
+
+    void wake () {
+        uint64_t one = 1;
+        if (write(m_wakeFd, &one, sizeof(one)) < 0) {}
+    }
+
+    // Only called from the reaper thread.
+    io_uring_sqe * getSqe () {
+        unsigned tail = *m_sqTail;
+        if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) {
+            flush(0);   // ring full: hand what we have to the kernel
+            tail = *m_sqTail;
+        }
+        auto sqe = &m_sqes[tail & m_sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sqArray[tail & m_sqMask] = tail & m_sqMask;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++m_toSubmit;
+        return sqe;
+    }
+    void flush (unsigned minComplete) {
+        int r;
+        do {
+            r = sys_enter(m_ringFd, m_toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0);
+        } while (r < 0 && errno == EINTR);
+        if (r >= 0)
+            m_toSubmit -= std::min(m_toSubmit, (unsigned)r);
+        else
+            std::cerr << "io_uring_enter failed: " << strerror(errno) << '\n';
+    }
+    static uint64_t tag (FileOp * op, Stage stage) { return (uint64_t)op | stage; }
+
+    void armWakePoll () {
+        auto sqe = getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_wakeFd;
+        sqe->poll_events = POLLIN;
+        sqe->user_data = WAKE_TAG;
+    }
+    void startOp (FileOp * op) {
+        auto sqe = getSqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)op->request.path.c_str();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = tag(op, OPEN);
+
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)op->request.path.c_str();
+        sqe->len = STATX_SIZE;
+        sqe->off = (uint64_t)&op->stx;
+        sqe->user_data = tag(op, STAT);
+
+        op->pending = 2;
+        ++m_inFlight;
+    }
+    void queueRead (FileOp * op) {
+        auto sqe = getSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = op->fd;
+        sqe->addr = (uint64_t)(op->data + op->offset);
+        sqe->len = (unsigned)std::min<size_t>(op->size - op->offset, size_t(MAX_READ_CHUNK));
+        sqe->off = op->offset;
+        sqe->user_data = tag(op, READ);
+    }
+    void finishOp (FileOp * op) {
+        if (op->fd >= 0) {
+            auto sqe = getSqe();    // fire and forget
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = op->fd;
+            sqe->user_data = tag(nullptr, CLOSE);
+        }
+        if (op->failed) {
+            delete[] op->data;
+            deliverFailed(op->request);
+        } else {
+            deliverLoaded(op->request, makeHeapBuffer(op->request.path, op->data, op->size));
+        }
+        delete op;
+        --m_inFlight;
+    }
+
+    void onCompletion (uint64_t userData, int res) {
+        if (userData == WAKE_TAG) {
+            uint64_t count;
+            if (read(m_wakeFd, &count, sizeof(count)) < 0) {}
+            if (m_alive)
+                armWakePoll();
+            return;
+        }
+        auto op = (FileOp*)(userData & ~3ull);
+        switch ((Stage)(userData & 3)) {
+            case OPEN:
+                if (res >= 0) op->fd = res; else op->failed = true;
+                break;
+            case STAT:
+                if (res < 0 || op->stx.stx_size == 0) op->failed = true;
+                break;
+            case READ:
+                if (res <= 0) {
+                    op->failed = true;
+                    return finishOp(op);
+                }
+                op->offset += (size_t)res;
+                return op->offset < op->size ? queueRead(op) : finishOp(op);
+            case CLOSE:
+                return;
+        }
+        if (--op->pending == 0) {
+            if (op->failed)
+                return finishOp(op);
+            op->size = (size_t)op->stx.stx_size;
+            op->data = new uint8_t[op->size + 1];
+            queueRead(op);
+        }
+    }
+
+    void reaperLoop () {
+        armWakePoll();
+        std::deque<ReadRequest> waiting;
+        while (m_alive || m_inFlight > 0) {
+            {
+                std::lock_guard<decltype(m_queueMutex)> lock (m_queueMutex);
+                while (!m_incoming.empty()) {
+                    waiting.emplace_back(std::move(m_incoming.front()));
+                    m_incoming.pop_front();
+                }
+            }
+            while (m_alive && !waiting.empty() && m_inFlight < MAX_IN_FLIGHT) {
+                startOp(new FileOp(std::move(waiting.front())));
+                waiting.pop_front();
+            }
+            flush(1);
+
+            unsigned head = *m_cqHead;
+            while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+                auto & cqe = m_cqes[head & m_cqMask];
+                auto userData = cqe.user_data;
+                auto res = cqe.res;
+                __atomic_store_n(m_cqHead, ++head, __ATOMIC_RELEASE);
+                onCompletion(userData, res);
+                head = *m_cqHead;
+            }
+        }
+        for (auto & request : waiting)
+            deliverFailed(request);
+    }
+
+protected:
+    int m_ringFd = -1, m_wakeFd = -1;
+    void * m_sqRing = nullptr;
+    void * m_cqRing = nullptr;
+    io_uring_sqe * m_sqes = nullptr;
+    size_t m_sqRingSize = 0, m_cqRingSize = 0, m_sqesSize = 0;
+
+    unsigned *m_sqHead, *m_sqTail, *m_sqArray, m_sqMask, m_sqEntries;
+    unsigned *m_cqHead, *m_cqTail, m_cqMask;
+    io_uring_cqe * m_cqes;
+    unsigned m_toSubmit = 0;
+    unsigned m_inFlight = 0;
+
+    std::atomic<bool> m_alive { true };
+    std::mutex m_queueMutex;                // guards m_incoming
+    std::deque<ReadRequest> m_incoming;
+    std::thread m_reaper;
+};
+
+#endif // HAS_IO_URING
+
+}; // anonymous namespace
+
+IAsyncFileReader & async_io::sharedReader () {
+    // Make sure the router + pool outlive the reader (statics are destroyed in reverse order),
+    // since the reader still delivers failures for queued requests while shutting down.
+    CompletionRouter::shared();
+    ioThreadPool();
+    
+    static std::unique_ptr<IAsyncFileReader> reader ([]() -> IAsyncFileReader* {
+#ifdef HAS_IO_URING
+        if (auto uring = UringFileReader::create())
+            return uring;
+        std::cerr << "io_uring unavailable; using threadpool file reader\n";
+#endif
+        return new PooledFileReader();
+    }());
+    return *reader;
+}
@@ -0,0 +1,78 @@
+//
+//  async_file_reader.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/4/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef async_file_reader_hpp
+#define async_file_reader_hpp
+
+#include "resource_impl.hpp"
+#include <thread>
+#include <mutex>
+#include <map>
+
+namespace gl_sandbox {
+namespace resource_impl {
+namespace async_io {
+
+// Routes completion callbacks back to the thread that made the request.
+// Worker / reaper threads post closures tagged w/ the requester's thread id; each requesting
+// thread drains its own queue via runPending() (exposed as async::dispatchCallbacks()).
+class CompletionRouter {
+public:
+    void post (std::thread::id target, std::function<void()> callback);
+
+    // Run all callbacks posted for the calling thread. Returns the number run.
+    unsigned runPending ();
+
+    // Number of callbacks waiting on the calling thread.
+    size_t numPending ();
+
+    static CompletionRouter & shared ();
+protected:
+    std::mutex m_mutex;
+    std::map<std::thread::id, std::vector<std::function<void()>>> m_pending;
+};
+
+struct ReadRequest {
+    FilePath path;
+    std::function<void(const FileBufferRef&)> onLoad;
+    std::function<void(const FilePath&)>      onFail;
+    std::thread::id requester;
+
+    ReadRequest (const FilePath & path,
+                 decltype(onLoad) onLoad,
+                 decltype(onFail) onFail) :
+        path(path), onLoad(onLoad), onFail(onFail),
+        requester(std::this_thread::get_id()) {}
+};
+
+// Reads whole files into FileBuffers off-thread. Implementations batch requests where they can;
+// results always get delivered through CompletionRouter::shared().
+struct IAsyncFileReader {
+    virtual void submit (std::vector<ReadRequest> && requests) = 0;
+    virtual const char * backendName () const = 0;
+    virtual ~IAsyncFileReader () {}
+};
+
+// Runs a blocking task on the shared file io pool (used by the fallback reader, and for async
+// loads that hand out open streams / FILE*s, which io_uring can't help with).
+// Doesn't block: if the pool's queue is full, the task waits in an overflow list until there's room.
+void runOnIOThread (std::function<void()> task);
+
+// Moves overflowed tasks into the pool while there's room. Called once a frame by
+// ResourceLoader::finishAsyncTasks() (running tasks call it too as they finish).
+void schedulePending ();
+
+// Shared reader instance: io_uring on linux when the kernel supports it, otherwise a
+// thread pool running blocking reads.
+IAsyncFileReader & sharedReader ();
+
+}; // namespace async_io
+}; // namespace resource_impl
+}; // namespace gl_sandbox
+
+#endif /* async_file_reader_hpp */
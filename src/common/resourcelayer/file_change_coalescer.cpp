@@ -0,0 +1,134 @@
+//
+//  file_change_coalescer.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "file_change_coalescer.hpp"
+#include <algorithm>
+#include <sys/stat.h>
+
+using namespace gl_sandbox;
+using namespace resource_impl;
+
+constexpr double   FileChangeCoalescer::DEFAULT_QUIET_WINDOW;
+constexpr unsigned FileChangeCoalescer::MAX_DELAY_FACTOR;
+
+static std::chrono::steady_clock::duration toDuration (double seconds) {
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+FileChangeCoalescer::FileChangeCoalescer (double quietWindow) :
+    m_quietWindow(toDuration(quietWindow)) {}
+
+void FileChangeCoalescer::setQuietWindow (double seconds) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_quietWindow = toDuration(seconds);
+}
+double FileChangeCoalescer::quietWindow () {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return std::chrono::duration<double>(m_quietWindow).count();
+}
+
+void FileChangeCoalescer::record (const FilePath & path, Existence before, Existence after) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock (m_mutex);
+    ++m_stats.events;
+    m_lastEvent = now;
+    auto it = m_pending.find(path);
+    if (it == m_pending.end()) {
+        Pending pending;
+        pending.before = before;
+        pending.first  = now;
+        it = m_pending.emplace(path, pending).first;
+    }
+    auto & pending = it->second;
+    pending.after = after;
+    ++pending.numEvents;
+}
+
+void FileChangeCoalescer::created  (const FilePath & path) { record(path, Existence::ABSENT,  Existence::PRESENT); }
+void FileChangeCoalescer::modified (const FilePath & path) { record(path, Existence::PRESENT, Existence::PRESENT); }
+void FileChangeCoalescer::deleted  (const FilePath & path) { record(path, Existence::PRESENT, Existence::ABSENT); }
+void FileChangeCoalescer::changed  (const FilePath & path) { record(path, Existence::UNKNOWN, Existence::UNKNOWN); }
+
+// Renaming onto a path usually replaces a file that was there (editor saves), so it counts as a
+// modification; a genuinely new file just shows up as MODIFIED instead of CREATED.
+void FileChangeCoalescer::renamed (const FilePath & from, const FilePath & to) {
+    deleted(from);
+    record(to, Existence::PRESENT, Existence::PRESENT);
+}
+
+void FileChangeCoalescer::attach (IFileWatcher & watcher) {
+    watcher.onFileCreated ([this](const FilePath & path) { created(path); });
+    watcher.onFileModified([this](const FilePath & path) { modified(path); });
+    watcher.onFileDeleted ([this](const FilePath & path) { deleted(path); });
+    watcher.onFileRenamed ([this](const FilePath & from, const FilePath & to) { renamed(from, to); });
+}
+
+size_t FileChangeCoalescer::dispatch (const BatchHandler & onBatch) {
+    struct Ready {
+        FilePath path;
+        Pending  pending;
+    };
+    std::vector<Ready> ready;
+    {
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock (m_mutex);
+        if (m_pending.empty())
+            return 0;
+        // Wait for everything to go quiet (so a multi-file save lands in one batch), except for
+        // paths that have been pending too long
+        bool quiet    = now - m_lastEvent >= m_quietWindow;
+        auto maxDelay = m_quietWindow * MAX_DELAY_FACTOR;
+        for (auto it = m_pending.begin(); it != m_pending.end(); ) {
+            if (quiet || now - it->second.first >= maxDelay) {
+                ready.push_back({ it->first, it->second });
+                it = m_pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (ready.empty())
+        return 0;
+
+    Batch batch;
+    size_t dropped = 0;
+    for (auto & r : ready) {
+        auto before = r.pending.before, after = r.pending.after;
+        if (after == Existence::UNKNOWN) {
+            struct stat st;
+            after = stat(r.path.c_str(), &st) == 0 ? Existence::PRESENT : Existence::ABSENT;
+        }
+        if (before == Existence::ABSENT && after == Existence::ABSENT) {
+            ++dropped;
+            continue;
+        }
+        auto kind = after  == Existence::ABSENT ? ChangeKind::DELETED :
+                    before == Existence::ABSENT ? ChangeKind::CREATED : ChangeKind::MODIFIED;
+        batch.push_back({ r.path, kind, r.pending.numEvents });
+    }
+    std::sort(batch.begin(), batch.end(), [](const Change & a, const Change & b) { return a.path < b.path; });
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_stats.changes += batch.size();
+        m_stats.dropped += dropped;
+        m_stats.batches += batch.empty() ? 0 : 1;
+    }
+    if (!batch.empty() && onBatch)
+        onBatch(batch);
+    return batch.size();
+}
+
+size_t FileChangeCoalescer::numPending () {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return m_pending.size();
+}
+
+FileChangeCoalescer::Stats FileChangeCoalescer::stats () {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return m_stats;
+}
@@ -0,0 +1,100 @@
+//
+//  file_change_coalescer.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef file_change_coalescer_hpp
+#define file_change_coalescer_hpp
+
+#include "file_watcher.hpp"
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace gl_sandbox {
+namespace resource_impl {
+
+// Sits between a file watcher and whatever reloads stuff. Raw events (from any thread) are merged
+// per path until no events have come in for quietWindow seconds, and each path's sequence of
+// events collapses into one logical change:
+//   create, modify*          => CREATED
+//   modify+ / rename onto    => MODIFIED   (editors save via temp file + rename, or in several writes)
+//   ..., delete              => DELETED    (unless it was created in the same window => dropped)
+// Changes are delivered in batches (sorted by path) from dispatch(), which is meant to be called
+// once a frame on the main thread -- so a "save all" is one batch w/ one change per file.
+//
+// If things never go quiet (eg. something keeps appending to a log file), paths get delivered
+// anyways once they've been pending for MAX_DELAY_FACTOR quiet windows.
+class FileChangeCoalescer {
+public:
+    enum class ChangeKind { CREATED, MODIFIED, DELETED };
+    struct Change {
+        FilePath   path;
+        ChangeKind kind;
+        unsigned   numEvents;   // raw events merged into this change
+    };
+    typedef std::vector<Change> Batch;
+    typedef std::function<void(const Batch &)> BatchHandler;
+
+    struct Stats {
+        size_t events  = 0;     // raw events in
+        size_t changes = 0;     // changes out
+        size_t batches = 0;
+        size_t dropped = 0;     // paths that were created + deleted w/in one window (temp files)
+    };
+
+    static constexpr double   DEFAULT_QUIET_WINDOW = 0.1;
+    static constexpr unsigned MAX_DELAY_FACTOR     = 10;
+
+    explicit FileChangeCoalescer (double quietWindow = DEFAULT_QUIET_WINDOW);
+    FileChangeCoalescer (const FileChangeCoalescer &) = delete;
+    FileChangeCoalescer & operator= (const FileChangeCoalescer &) = delete;
+
+    void   setQuietWindow (double seconds);
+    double quietWindow ();
+
+    // Raw events; thread safe.
+    void created  (const FilePath & path);
+    void modified (const FilePath & path);
+    void deleted  (const FilePath & path);
+    void renamed  (const FilePath & from, const FilePath & to);
+    // Something happened to path (eg. from DirectoryWatcherInstance::watchForChanges, which doesn't
+    // say what); whether it still exists gets checked on delivery.
+    void changed  (const FilePath & path);
+
+    // Points watcher's callbacks at this (replacing any it had). We have to outlive the watcher.
+    void attach (IFileWatcher & watcher);
+
+    // Delivers everything that's gone quiet (if anything) as one batch. Returns the batch size.
+    size_t dispatch (const BatchHandler & onBatch);
+
+    size_t numPending ();
+    Stats  stats ();
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+    enum class Existence : uint8_t { UNKNOWN, ABSENT, PRESENT };
+    struct Pending {
+        Existence         before;       // as of the first event in this window
+        Existence         after;        // as of the last one
+        unsigned          numEvents = 0;
+        Clock::time_point first;
+    };
+    void record (const FilePath & path, Existence before, Existence after);
+
+protected:
+    std::mutex                            m_mutex;      // guards everything below
+    Clock::duration                       m_quietWindow;
+    Clock::time_point                     m_lastEvent;
+    std::unordered_map<FilePath, Pending> m_pending;
+    Stats                                 m_stats;
+};
+
+}; // namespace resource_impl
+}; // namespace gl_sandbox
+
+#endif /* file_change_coalescer_hpp */
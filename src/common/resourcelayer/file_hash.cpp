@@ -0,0 +1,362 @@
+//
+//  file_hash.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/5/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "file_hash.hpp"
+#include <cstring>
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::hash;
+
+// Unaligned little-endian loads (memcpy compiles down to a plain mov on x86 / arm64).
+static inline uint32_t read32 (const uint8_t * p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t read64 (const uint8_t * p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t rotl32 (uint32_t x, int r) { return (x << r) | (x >> (32 - r)); }
+static inline uint64_t rotl64 (uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// Marks an intended switch fallthrough (no [[fallthrough]] before C++17)
+#if defined(__clang__)
+#define FALLTHROUGH [[clang::fallthrough]]
+#elif defined(__GNUC__) && __GNUC__ >= 7
+#define FALLTHROUGH __attribute__((fallthrough))
+#else
+#define FALLTHROUGH
+#endif
+
+static inline uint32_t readBE32 (const uint8_t * p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+static inline void writeBE32 (uint8_t * p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+static inline void writeLE32 (uint8_t * p, uint32_t v) {
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+// Shared buffering for the block-based hashes: tops up a partial block from data, runs
+// processBlock on every full block, and stashes the remainder. Returns nothing; m_length is
+// updated by the caller.
+template <size_t BLOCK, typename F>
+static void feedBlocks (uint8_t * buffer, uint64_t lengthSoFar, const uint8_t * data, size_t size, F processBlock) {
+    size_t used = (size_t)(lengthSoFar % BLOCK);
+    if (used) {
+        size_t n = BLOCK - used < size ? BLOCK - used : size;
+        memcpy(buffer + used, data, n);
+        data += n; size -= n;
+        if (used + n < BLOCK)
+            return;
+        processBlock(buffer);
+    }
+    for (; size >= BLOCK; data += BLOCK, size -= BLOCK)
+        processBlock(data);
+    if (size)
+        memcpy(buffer, data, size);
+}
+
+// ============================================================
+//                          HEX
+// ============================================================
+
+std::string hash::toHex (const uint8_t * bytes, size_t count) {
+    static const char digits[] = "0123456789abcdef";
+    std::string s (count * 2, '0');
+    for (size_t i = 0; i < count; ++i) {
+        s[i * 2]     = digits[bytes[i] >> 4];
+        s[i * 2 + 1] = digits[bytes[i] & 15];
+    }
+    return s;
+}
+std::string hash::toHex (uint64_t value) {
+    uint8_t bytes [8];
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = (uint8_t)(value >> (56 - i * 8));
+    return toHex(bytes, 8);
+}
+std::string hash::toHex (const Hash128 & value) {
+    return toHex(value.hi) + toHex(value.lo);
+}
+
+// ============================================================
+//                          MD5
+// ============================================================
+
+// RFC 1321
+Md5::Md5 () {
+    m_state[0] = 0x67452301; m_state[1] = 0xefcdab89;
+    m_state[2] = 0x98badcfe; m_state[3] = 0x10325476;
+}
+
+void Md5::processBlock (const uint8_t * block) {
+    static const uint32_t K [64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+    static const int R [64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+    };
+    uint32_t M [16];
+    for (int i = 0; i < 16; ++i)
+        M[i] = (uint32_t)block[i*4] | ((uint32_t)block[i*4+1] << 8) |
+               ((uint32_t)block[i*4+2] << 16) | ((uint32_t)block[i*4+3] << 24);
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t f; int g;
+        if (i < 16)      { f = (b & c) | (~b & d); g = i; }
+        else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) & 15; }
+        else if (i < 48) { f = b ^ c ^ d;          g = (3 * i + 5) & 15; }
+        else             { f = c ^ (b | ~d);       g = (7 * i) & 15; }
+        uint32_t tmp = d;
+        d = c;
+        c = b;
+        b = b + rotl32(a + f + K[i] + M[g], R[i]);
+        a = tmp;
+    }
+    m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+}
+
+void Md5::update (const uint8_t * data, size_t size) {
+    feedBlocks<64>(m_buffer, m_length, data, size, [this](const uint8_t * block) { processBlock(block); });
+    m_length += size;
+}
+
+void Md5::finish (uint8_t digest [16]) {
+    uint64_t bits = m_length * 8;
+    uint8_t pad [72] = { 0x80 };
+    size_t padLen = (m_length % 64 < 56 ? 56 : 120) - (m_length % 64);
+    update(pad, padLen);
+    uint8_t lengthBytes [8];
+    for (int i = 0; i < 8; ++i)
+        lengthBytes[i] = (uint8_t)(bits >> (i * 8));
+    update(lengthBytes, 8);
+    for (int i = 0; i < 4; ++i)
+        writeLE32(digest + i * 4, m_state[i]);
+}
+
+// ============================================================
+//                          SHA1
+// ============================================================
+
+// RFC 3174
+Sha1::Sha1 () {
+    m_state[0] = 0x67452301; m_state[1] = 0xefcdab89; m_state[2] = 0x98badcfe;
+    m_state[3] = 0x10325476; m_state[4] = 0xc3d2e1f0;
+}
+
+void Sha1::processBlock (const uint8_t * block) {
+    uint32_t W [80];
+    for (int i = 0; i < 16; ++i)
+        W[i] = readBE32(block + i * 4);
+    for (int i = 16; i < 80; ++i)
+        W[i] = rotl32(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16], 1);
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3], e = m_state[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+        else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+        else             { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+        uint32_t tmp = rotl32(a, 5) + f + e + k + W[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = tmp;
+    }
+    m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d; m_state[4] += e;
+}
+
+void Sha1::update (const uint8_t * data, size_t size) {
+    feedBlocks<64>(m_buffer, m_length, data, size, [this](const uint8_t * block) { processBlock(block); });
+    m_length += size;
+}
+
+void Sha1::finish (uint8_t digest [20]) {
+    uint64_t bits = m_length * 8;
+    uint8_t pad [72] = { 0x80 };
+    size_t padLen = (m_length % 64 < 56 ? 56 : 120) - (m_length % 64);
+    update(pad, padLen);
+    uint8_t lengthBytes [8];
+    for (int i = 0; i < 8; ++i)
+        lengthBytes[i] = (uint8_t)(bits >> (56 - i * 8));
+    update(lengthBytes, 8);
+    for (int i = 0; i < 5; ++i)
+        writeBE32(digest + i * 4, m_state[i]);
+}
+
+// ============================================================
+//                     MURMUR3 (x64, 128)
+// ============================================================
+
+static const uint64_t MURMUR_C1 = 0x87c37b91114253d5ull;
+static const uint64_t MURMUR_C2 = 0x4cf5ad432745937full;
+
+static inline uint64_t fmix64 (uint64_t k) {
+    k ^= k >> 33; k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+Murmur3::Murmur3 (uint32_t seed) : m_h1(seed), m_h2(seed) {}
+
+void Murmur3::processBlock (const uint8_t * block) {
+    uint64_t k1 = read64(block), k2 = read64(block + 8);
+
+    k1 *= MURMUR_C1; k1 = rotl64(k1, 31); k1 *= MURMUR_C2; m_h1 ^= k1;
+    m_h1 = rotl64(m_h1, 27); m_h1 += m_h2; m_h1 = m_h1 * 5 + 0x52dce729;
+
+    k2 *= MURMUR_C2; k2 = rotl64(k2, 33); k2 *= MURMUR_C1; m_h2 ^= k2;
+    m_h2 = rotl64(m_h2, 31); m_h2 += m_h1; m_h2 = m_h2 * 5 + 0x38495ab5;
+}
+
+void Murmur3::update (const uint8_t * data, size_t size) {
+    feedBlocks<16>(m_buffer, m_length, data, size, [this](const uint8_t * block) { processBlock(block); });
+    m_length += size;
+}
+
+Hash128 Murmur3::finish () {
+    const uint8_t * tail = m_buffer;
+    uint64_t h1 = m_h1, h2 = m_h2, k1 = 0, k2 = 0;
+    switch (m_length & 15) {
+        case 15: k2 ^= (uint64_t)tail[14] << 48; FALLTHROUGH;
+        case 14: k2 ^= (uint64_t)tail[13] << 40; FALLTHROUGH;
+        case 13: k2 ^= (uint64_t)tail[12] << 32; FALLTHROUGH;
+        case 12: k2 ^= (uint64_t)tail[11] << 24; FALLTHROUGH;
+        case 11: k2 ^= (uint64_t)tail[10] << 16; FALLTHROUGH;
+        case 10: k2 ^= (uint64_t)tail[ 9] << 8; FALLTHROUGH;
+        case  9: k2 ^= (uint64_t)tail[ 8];
+                 k2 *= MURMUR_C2; k2 = rotl64(k2, 33); k2 *= MURMUR_C1; h2 ^= k2; FALLTHROUGH;
+        case  8: k1 ^= (uint64_t)tail[ 7] << 56; FALLTHROUGH;
+        case  7: k1 ^= (uint64_t)tail[ 6] << 48; FALLTHROUGH;
+        case  6: k1 ^= (uint64_t)tail[ 5] << 40; FALLTHROUGH;
+        case  5: k1 ^= (uint64_t)tail[ 4] << 32; FALLTHROUGH;
+        case  4: k1 ^= (uint64_t)tail[ 3] << 24; FALLTHROUGH;
+        case  3: k1 ^= (uint64_t)tail[ 2] << 16; FALLTHROUGH;
+        case  2: k1 ^= (uint64_t)tail[ 1] << 8; FALLTHROUGH;
+        case  1: k1 ^= (uint64_t)tail[ 0];
+                 k1 *= MURMUR_C1; k1 = rotl64(k1, 31); k1 *= MURMUR_C2; h1 ^= k1;
+    }
+    h1 ^= m_length; h2 ^= m_length;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+
+    Hash128 result;
+    result.lo = h1;
+    result.hi = h2;
+    return result;
+}
+
+// ============================================================
+//                       FAST HASH 64
+// ============================================================
+
+static const uint64_t P1 = 11400714785074694791ull;
+static const uint64_t P2 = 14029467366897019727ull;
+static const uint64_t P3 =  1609587929392839161ull;
+static const uint64_t P4 =  9650029242287828579ull;
+static const uint64_t P5 =  2870177450012600261ull;
+
+static inline uint64_t fhRound (uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc  = rotl64(acc, 31);
+    return acc * P1;
+}
+static inline uint64_t fhMerge (uint64_t acc, uint64_t lane) {
+    acc ^= fhRound(0, lane);
+    return acc * P1 + P4;
+}
+
+FastHash64::FastHash64 (uint64_t seed) : m_seed(seed) {
+    m_lanes[0] = seed + P1 + P2;
+    m_lanes[1] = seed + P2;
+    m_lanes[2] = seed;
+    m_lanes[3] = seed - P1;
+}
+
+void FastHash64::update (const uint8_t * data, size_t size) {
+    // Copy lanes into locals for the hot loop, so they stay in registers
+    uint64_t v0 = m_lanes[0], v1 = m_lanes[1], v2 = m_lanes[2], v3 = m_lanes[3];
+    feedBlocks<32>(m_buffer, m_length, data, size, [&](const uint8_t * p) {
+        v0 = fhRound(v0, read64(p));
+        v1 = fhRound(v1, read64(p + 8));
+        v2 = fhRound(v2, read64(p + 16));
+        v3 = fhRound(v3, read64(p + 24));
+    });
+    m_lanes[0] = v0; m_lanes[1] = v1; m_lanes[2] = v2; m_lanes[3] = v3;
+    m_length += size;
+}
+
+uint64_t FastHash64::finishWith (const uint64_t lanes [4], uint64_t seed) {
+    uint64_t h;
+    if (m_length >= 32) {
+        h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+        h = fhMerge(h, lanes[0]);
+        h = fhMerge(h, lanes[1]);
+        h = fhMerge(h, lanes[2]);
+        h = fhMerge(h, lanes[3]);
+    } else {
+        h = seed + P5;
+    }
+    h += m_length;
+
+    const uint8_t * p = m_buffer;
+    size_t remaining = (size_t)(m_length & 31);
+    for (; remaining >= 8; p += 8, remaining -= 8) {
+        h ^= fhRound(0, read64(p));
+        h  = rotl64(h, 27) * P1 + P4;
+    }
+    if (remaining >= 4) {
+        h ^= (uint64_t)read32(p) * P1;
+        h  = rotl64(h, 23) * P2 + P3;
+        p += 4; remaining -= 4;
+    }
+    for (; remaining; ++p, --remaining) {
+        h ^= (*p) * P5;
+        h  = rotl64(h, 11) * P1;
+    }
+    h ^= h >> 33; h *= P2;
+    h ^= h >> 29; h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t FastHash64::finish () {
+    return finishWith(m_lanes, m_seed);
+}
+
+Hash128 FastHash64::finish128 () {
+    uint64_t rotated [4] = {
+        m_lanes[2] ^ P3, m_lanes[3] ^ P4, m_lanes[0] ^ P5, m_lanes[1] ^ P1
+    };
+    Hash128 result;
+    result.lo = finishWith(m_lanes, m_seed);
+    result.hi = finishWith(rotated, m_seed ^ P2);
+    return result;
+}
+
+uint64_t hash::fastHash64 (const void * data, size_t size, uint64_t seed) {
+    FastHash64 h (seed);
+    h.update((const uint8_t*)data, size);
+    return h.finish();
+}
+Hash128 hash::fastHash128 (const void * data, size_t size, uint64_t seed) {
+    FastHash64 h (seed);
+    h.update((const uint8_t*)data, size);
+    return h.finish128();
+}
@@ -0,0 +1,99 @@
+//
+//  file_hash.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/5/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef file_hash_hpp
+#define file_hash_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace gl_sandbox {
+namespace hash {
+
+// Incremental hash states used by resource_impl::filehash. All of these take arbitrary sized
+// update() calls (so they work over a single mmapped span or chunked fread()s alike), and
+// produce the same result regardless of how the input was split up.
+
+struct Hash128 {
+    uint64_t lo = 0, hi = 0;
+
+    bool operator== (const Hash128 & other) const { return lo == other.lo && hi == other.hi; }
+    bool operator!= (const Hash128 & other) const { return !(*this == other); }
+};
+
+std::string toHex (const uint8_t * bytes, size_t count);
+std::string toHex (uint64_t value);
+std::string toHex (const Hash128 & value);
+
+class Md5 {
+public:
+    Md5 ();
+    void update (const uint8_t * data, size_t size);
+    void finish (uint8_t digest [16]);
+protected:
+    void processBlock (const uint8_t * block);
+    uint32_t m_state [4];
+    uint64_t m_length = 0;
+    uint8_t  m_buffer [64];
+};
+
+class Sha1 {
+public:
+    Sha1 ();
+    void update (const uint8_t * data, size_t size);
+    void finish (uint8_t digest [20]);
+protected:
+    void processBlock (const uint8_t * block);
+    uint32_t m_state [5];
+    uint64_t m_length = 0;
+    uint8_t  m_buffer [64];
+};
+
+// MurmurHash3_x64_128 (Austin Appleby, public domain).
+class Murmur3 {
+public:
+    Murmur3 (uint32_t seed = 0);
+    void update (const uint8_t * data, size_t size);
+    Hash128 finish ();
+protected:
+    void processBlock (const uint8_t * block);
+    uint64_t m_h1, m_h2;
+    uint64_t m_length = 0;
+    uint8_t  m_buffer [16];
+};
+
+// Fast 64-bit non-cryptographic hash (xxHash64 algorithm). Four independent accumulator lanes
+// over 32-byte stripes, so the main loop has no cross-lane dependencies and the compiler can
+// keep all four multiplies in flight (or vectorize them). This is what we use for content
+// addressing; it runs at close to memory bandwidth, vs md5 / sha1 at a few hundred MB/s.
+class FastHash64 {
+public:
+    FastHash64 (uint64_t seed = 0);
+    void update (const uint8_t * data, size_t size);
+    uint64_t finish ();
+    
+    // 128-bit digest: lo is the 64-bit hash, hi folds the same 256 bits of lane state in a
+    // different order / with different constants, so it costs nothing extra to compute.
+    Hash128  finish128 ();
+protected:
+    uint64_t finishWith (const uint64_t lanes [4], uint64_t seed);
+    uint64_t m_lanes [4];
+    uint64_t m_seed;
+    uint64_t m_length = 0;
+    uint8_t  m_buffer [32];
+};
+
+// One-shot helpers
+uint64_t fastHash64  (const void * data, size_t size, uint64_t seed = 0);
+Hash128  fastHash128 (const void * data, size_t size, uint64_t seed = 0);
+
+}; // namespace hash
+}; // namespace gl_sandbox
+
+#endif /* file_hash_hpp */
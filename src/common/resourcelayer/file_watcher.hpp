@@ -109,8 +109,54 @@ namespace platform_windows {
     // ...
 };
 namespace platform_linux {
-    // ...
+    
+// inotify implementation: one watch descriptor per directory (files are matched by name within
+// their parent's watch), so watching a tree costs one watch per subdirectory no matter how many
+// files it has. Events are read by a single epoll-driven thread, and callbacks run on it.
+//
+// Modifications are reported when a file that was open for writing gets closed (IN_CLOSE_WRITE),
+// not on every write(); a file renamed over a watched file counts as modifying it. Handles /
+// FileWatchers can outlive the instance (they just stop firing), and releasing one waits for any
+// of its callbacks that's still running (unless it's released from a callback). If the kernel's event queue
+// overflows, directory watchers get a change notification for their root and file watchers get
+// an error, since individual events were lost.
+//
+// Note: the number of watches is capped by /proc/sys/fs/inotify/max_user_watches (8192 on older
+// kernels); watching a big tree will fail w/ an error telling you to raise it.
+class DirectoryWatcherInstance {
+public:
+    // Not recursive: onChanged gets the path of each entry in dirPath that was created, deleted,
+    // modified or renamed (both paths, for renames).
+    DirectoryWatcherHandleRef watchForChanges (
+        const FilePath & dirPath,
+        const ThreadCallable<void(const FilePath&)> onChanged,
+        const ThreadCallable<void(const ResourceError &)> onError,
+        bool autorelease = true);
+    
+    FileWatcherRef watchFileForChanges (
+        const FilePath & path,
+        const std::function<void(ResourceError &)> onError);
+    
+    FileWatcherRef watchDirForChanges (
+        const FilePath & path,
+        const std::function<bool(const FilePath&)>& fileFilter,
+        const std::function<void(ResourceError &)>& onError);
+    
+    FileWatcherRef watchDirForRecursiveChanges (
+        const FilePath & path,
+        const std::function<bool(const FilePath&)> &fileFilter,
+        const std::function<bool(const FilePath&)> &subdirFilter,
+        const std::function<void(ResourceError &)> &onError);
+    
+    DirectoryWatcherInstance ();
+    ~DirectoryWatcherInstance ();
+    
+    struct Impl;
+protected:
+    std::unique_ptr<Impl> impl;
 };
+    
+}; // namespace platform_linux
         
 }; // namespace resource
 }; // namespace gl_sandbox
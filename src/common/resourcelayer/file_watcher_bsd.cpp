@@ -192,23 +192,27 @@ protected:
             if ((n_events < 0) || (event_data[0].flags == EV_ERROR)) {
                 fprintf(stderr, "\nERROR -- kevent returned %d (error %s: %d)\n", n_events, strerror(errno), errno);
             } else {
-                std::lock_guard<decltype(state->ev_mutex)> lock (state->ev_mutex);
-                
-                for (auto i = 0; i < n_events; ++i) {
-                    FileWatcher * watcher = (FileWatcher*)event_data[i].udata;
-                    if (event_data[i].fflags & (NOTE_WRITE | NOTE_EXTEND)) {
-                        std::cout << "File modified: '" << watcher->path << "'\n";
-                    }
-                    if (event_data[i].fflags & (NOTE_DELETE | NOTE_REVOKE)) {
-                        std::cout << "File deleted: '" << watcher->path << "'\n";
-                    }
-                    if (event_data[i].fflags & NOTE_ATTRIB) {
-                        std::cout << "File attrib changed: '" << watcher->path << "'\n";
-                    }
-                    if (event_data[i].fflags & NOTE_RENAME) {
-                        std::cout << "File renamed: '" << watcher->path << "'\n";
+                // One callback per changed file per kevent() batch; collected under the lock but
+                // run outside it. Debouncing is up to the caller (see file_change_coalescer.hpp).
+                std::vector<std::pair<FileChangeCallbackRef, FilePath>> changed;
+                {
+                    std::lock_guard<decltype(state->ev_mutex)> lock (state->ev_mutex);
+                    for (auto i = 0; i < n_events; ++i) {
+                        FileWatcher * watcher = (FileWatcher*)event_data[i].udata;
+                        if (!(event_data[i].fflags & (NOTE_WRITE | NOTE_EXTEND | NOTE_DELETE | NOTE_REVOKE | NOTE_ATTRIB | NOTE_RENAME)))
+                            continue;
+                        for (auto & callback : watcher->callbacks) {
+                            bool seen = false;
+                            for (auto & c : changed)
+                                seen |= c.first == callback && c.second == watcher->path;
+                            if (callback->active && !seen)
+                                changed.emplace_back(callback, watcher->path);
+                        }
                     }
                 }
+                for (auto & c : changed)
+                    if (c.first->active)
+                        c.first->callback(c.second);
             }
         }
         std::cout << "kqueue run loop terminated\n";
@@ -242,11 +246,8 @@ public:
             
             auto vnode_events = NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_LINK | NOTE_RENAME | NOTE_REVOKE;
             EV_SET(&evt, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, vnode_events, 0, (void*)&watcher);
-            
-        } else {
-            std::cout << "Path watcher already exists on '" << path << "'; adding listener\n";
-//            m_pathCallbacks[path].push_back(callback);
         }
+        m_fileWatchers[path]->callbacks.push_back(callback);
         return DirectoryWatcherHandleRef(new DirectoryWatcherHandle(callback, autorelease));
     }
 };
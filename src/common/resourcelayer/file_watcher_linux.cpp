@@ -0,0 +1,708 @@
+//
+//  file_watcher_linux.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "file_watcher.hpp"
+
+using namespace gl_sandbox;
+using namespace resource_impl;
+using namespace platform_linux;
+
+typedef std::function<bool(const FilePath &)> PathFilter;
+
+// IN_ONLYDIR: we only ever watch directories (files are matched by name).
+// IN_EXCL_UNLINK: don't report writes to files that were already unlinked.
+static constexpr uint32_t WATCH_MASK =
+    IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+static FilePath joinPath (const FilePath & dir, const std::string & name) {
+    return !dir.empty() && dir.back() == '/' ? dir + name : dir + '/' + name;
+}
+static FilePath stripTrailingSlashes (FilePath path) {
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+    return path;
+}
+static bool isWithin (const FilePath & path, const FilePath & dir) {
+    return path.size() >= dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+        (path.size() == dir.size() || path[dir.size()] == '/' || dir == "/");
+}
+
+struct WatchTable;
+
+// State for one watchForChanges() / watch*ForChanges() call.
+struct Listener {
+    enum class Kind {
+        DIRECTORY,  // watchForChanges(): everything in root
+        FILE,       // watchFileForChanges(): just fileName in root
+        FILES,      // watchDirForChanges(): files in root that pass fileFilter
+        RECURSIVE,  // watchDirForRecursiveChanges(): ditto, for every subdir that passes subdirFilter
+    };
+    const Kind     kind;
+    const FilePath root;
+    std::string    fileName;
+    PathFilter     fileFilter;
+    PathFilter     subdirFilter;
+
+    ThreadCallable<void(const FilePath &)>    onChanged;    // DIRECTORY only
+    std::function<void(ResourceError &)>      onError;
+
+    std::mutex callbackMutex;                               // guards the IFileWatcher callbacks
+    std::function<void(const FilePath &)>     onModified, onDeleted, onCreated;
+    std::function<void(const FilePath &, const FilePath &)> onRenamed;
+
+    std::mutex                dispatchMutex;                // held while a callback runs (see release())
+    std::atomic<bool>         active { true };
+    std::weak_ptr<WatchTable> table;
+    std::vector<int>          wds;                          // guarded by table->mutex
+
+    Listener (Kind kind, const FilePath & root) : kind(kind), root(root) {}
+    Listener (const Listener &) = delete;
+    Listener & operator= (const Listener &) = delete;
+
+    bool acceptsFile (const FilePath & path) const { return !fileFilter || fileFilter(path); }
+    bool acceptsDir  (const FilePath & path) const { return kind == Kind::RECURSIVE && (!subdirFilter || subdirFilter(path)); }
+
+    void release ();
+};
+typedef std::shared_ptr<Listener> ListenerRef;
+
+struct Notification {
+    enum class Kind { CHANGED, CREATED, MODIFIED, DELETED, RENAMED, ERROR } kind;
+    ListenerRef listener;
+    FilePath    path;
+    FilePath    newPath;    // RENAMED only; ERROR => the message
+};
+
+// Watch descriptors + who's listening on them. Shared w/ Listeners (weakly), so releasing a
+// handle after the DirectoryWatcherInstance is gone is a no-op.
+struct WatchTable {
+    struct Watch {
+        FilePath path;
+        std::vector<ListenerRef> listeners;
+    };
+    std::mutex mutex;       // guards everything here (+ Listener::wds)
+    int        fd = -1;     // inotify instance; only changed while the read thread isn't running
+    std::thread::id thread; // the read thread (callbacks run on it)
+    std::unordered_map<int, Watch> watches;
+
+    // All of these need mutex held.
+
+    bool addWatch (const FilePath & dir, const ListenerRef & listener, std::string & err) {
+        int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            if (errno == ENOSPC)
+                err = "Cannot watch '" + dir + "': out of inotify watches (raise /proc/sys/fs/inotify/max_user_watches)";
+            else
+                err = "Cannot watch '" + dir + "': " + strerror(errno);
+            return false;
+        }
+        auto & watch = watches[wd];
+        if (watch.path.empty())
+            watch.path = dir;
+        if (std::find(watch.listeners.begin(), watch.listeners.end(), listener) == watch.listeners.end()) {
+            watch.listeners.push_back(listener);
+            listener->wds.push_back(wd);
+        }
+        return true;
+    }
+
+    // Watches dir + every subdirectory the listener accepts. If created is set, files found
+    // along the way are reported as created (used for directories that appear while we're
+    // running, since they may have been filled before we got a watch on them).
+    bool addTree (const FilePath & dir, const ListenerRef & listener, std::string & err,
+                  std::vector<Notification> * created) {
+        if (!addWatch(dir, listener, err))
+            return false;
+        DIR * d = opendir(dir.c_str());
+        if (!d)
+            return true;    // gone already; we'll get an IN_IGNORED for it
+        bool ok = true;
+        while (auto entry = readdir(d)) {
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+                continue;
+            auto path = joinPath(dir, entry->d_name);
+            auto type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (lstat(path.c_str(), &st) != 0)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            // Symlinked dirs are skipped (d_type == DT_LNK), so links can't make us loop
+            if (type == DT_DIR) {
+                if (listener->acceptsDir(path) && !addTree(path, listener, err, created)) {
+                    ok = false;
+                    break;
+                }
+            } else if (created && listener->acceptsFile(path)) {
+                created->push_back({ Notification::Kind::CREATED, listener, path, {} });
+            }
+        }
+        closedir(d);
+        return ok;
+    }
+
+    void removeFromWatch (int wd, Listener & listener) {
+        auto it = watches.find(wd);
+        if (it == watches.end())
+            return;
+        auto & listeners = it->second.listeners;
+        listeners.erase(std::remove_if(listeners.begin(), listeners.end(), [&](const ListenerRef & l) {
+            return l.get() == &listener;
+        }), listeners.end());
+        if (listeners.empty()) {
+            if (fd >= 0)
+                inotify_rm_watch(fd, wd);
+            watches.erase(it);
+        }
+    }
+
+    void remove (Listener & listener) {
+        for (auto wd : listener.wds)
+            removeFromWatch(wd, listener);
+        listener.wds.clear();
+    }
+
+    // Stops listener from watching dir + anything below it (a subtree that left its tree).
+    void removeSubtree (Listener & listener, const FilePath & dir) {
+        std::vector<int> remaining;
+        for (auto wd : listener.wds) {
+            auto it = watches.find(wd);
+            if (it != watches.end() && isWithin(it->second.path, dir))
+                removeFromWatch(wd, listener);
+            else
+                remaining.push_back(wd);
+        }
+        listener.wds.swap(remaining);
+    }
+
+    // The kernel dropped wd (directory deleted / unmounted, or we removed it)
+    void dropWatch (int wd) {
+        auto it = watches.find(wd);
+        if (it == watches.end())
+            return;
+        for (auto & listener : it->second.listeners) {
+            auto & wds = listener->wds;
+            wds.erase(std::remove(wds.begin(), wds.end(), wd), wds.end());
+        }
+        watches.erase(it);
+    }
+
+    // A watched directory was renamed, so every watch at or below it has a new path
+    void renameTree (const FilePath & from, const FilePath & to) {
+        for (auto & kv : watches) {
+            auto & path = kv.second.path;
+            if (isWithin(path, from))
+                path = to + path.substr(from.size());
+        }
+    }
+};
+
+// Once this returns, none of the listener's callbacks are running (or will run again), so the
+// caller can free whatever they use. Called from one of the watcher's callbacks (ie. on the read
+// thread) it can't wait for that one, but it's the only callback that can be running then.
+void Listener::release () {
+    if (!active.exchange(false))
+        return;
+    if (auto t = table.lock()) {
+        bool onReadThread;
+        {
+            std::lock_guard<std::mutex> lock (t->mutex);
+            t->remove(*this);
+            onReadThread = std::this_thread::get_id() == t->thread;
+        }
+        if (!onReadThread) {
+            std::lock_guard<std::mutex> wait (dispatchMutex);   // for a callback that's mid-run
+        }
+    }
+}
+
+struct DirectoryWatcherHandle : public IDirectoryWatcherHandle {
+    ListenerRef ref;
+    bool autorelease = false;
+
+    DirectoryWatcherHandle (const ListenerRef & ref, bool autorelease) : ref(ref), autorelease(autorelease) {}
+
+    void detatch () override {
+        if (ref) ref->release();
+    }
+    ~DirectoryWatcherHandle () {
+        if (autorelease)
+            detatch();
+    }
+};
+
+struct FileWatcher : public IFileWatcher {
+    ListenerRef ref;
+    bool autorelease = true;
+
+    FileWatcher (const ListenerRef & ref) : ref(ref) {}
+
+    IFileWatcher & onFileModified (std::function<void(const FilePath &)> f) override {
+        std::lock_guard<std::mutex> lock (ref->callbackMutex);
+        return ref->onModified = f, *this;
+    }
+    IFileWatcher & onFileDeleted (std::function<void(const FilePath &)> f) override {
+        std::lock_guard<std::mutex> lock (ref->callbackMutex);
+        return ref->onDeleted = f, *this;
+    }
+    IFileWatcher & onFileCreated (std::function<void(const FilePath &)> f) override {
+        std::lock_guard<std::mutex> lock (ref->callbackMutex);
+        return ref->onCreated = f, *this;
+    }
+    IFileWatcher & onFileRenamed (std::function<void(const FilePath &, const FilePath &)> f) override {
+        std::lock_guard<std::mutex> lock (ref->callbackMutex);
+        return ref->onRenamed = f, *this;
+    }
+    void release () override { ref->release(); }
+    IFileWatcher & setAutorelease (bool autorelease) override {
+        return this->autorelease = autorelease, *this;
+    }
+    ~FileWatcher () {
+        if (autorelease)
+            release();
+    }
+};
+
+struct DirectoryWatcherInstance::Impl {
+protected:
+    std::shared_ptr<WatchTable> m_table;
+    int         m_epoll = -1;
+    int         m_wake  = -1;   // eventfd; written to stop the thread
+    std::thread m_thread;
+
+    struct RawEvent {
+        int         wd;
+        uint32_t    mask;
+        uint32_t    cookie;
+        std::string name;
+    };
+    static constexpr size_t MAX_EVENTS_PER_BATCH = 4096;
+
+public:
+    Impl () : m_table(std::make_shared<WatchTable>()) {
+        auto fail = [this](const char * what) {
+            int e = errno;
+            closeFds();
+            return ResourceError("%s: %s (%d)", what, strerror(e), e);
+        };
+        if ((m_table->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+            throw fail("Failed to create inotify instance");
+        if ((m_epoll = epoll_create1(EPOLL_CLOEXEC)) < 0)
+            throw fail("Failed to create epoll instance");
+        if ((m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+            throw fail("Failed to create eventfd");
+        for (auto fd : { m_table->fd, m_wake }) {
+            struct epoll_event ev {};
+            ev.events  = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+                throw fail("epoll_ctl failed");
+        }
+        m_thread = std::thread([this]() {
+            {
+                std::lock_guard<std::mutex> lock (m_table->mutex);
+                m_table->thread = std::this_thread::get_id();
+            }
+            runLoop();
+        });
+    }
+    ~Impl () {
+        uint64_t one = 1;
+        if (write(m_wake, &one, sizeof(one)) != sizeof(one))
+            std::cerr << "DirectoryWatcherInstance: failed to wake inotify thread: " << strerror(errno) << '\n';
+        m_thread.join();
+
+        std::lock_guard<std::mutex> lock (m_table->mutex);
+        m_table->watches.clear();
+        closeFds();
+    }
+
+    bool add (const ListenerRef & listener, std::string & err) {
+        std::lock_guard<std::mutex> lock (m_table->mutex);
+        listener->table = m_table;
+        bool ok = listener->kind == Listener::Kind::RECURSIVE ?
+            m_table->addTree(listener->root, listener, err, nullptr) :
+            m_table->addWatch(listener->root, listener, err);
+        if (!ok) {
+            listener->active = false;
+            m_table->remove(*listener);
+        }
+        return ok;
+    }
+
+protected:
+    void closeFds () {
+        if (m_table->fd >= 0) close(m_table->fd);
+        if (m_epoll >= 0)     close(m_epoll);
+        if (m_wake >= 0)      close(m_wake);
+        m_table->fd = m_epoll = m_wake = -1;
+    }
+
+    void runLoop () {
+        std::vector<char> buffer (64 * 1024);   // operator new alignment is plenty for inotify_event
+        std::vector<RawEvent> events;
+        std::vector<Notification> notifications;
+        for (;;) {
+            struct epoll_event ready [2];
+            int n = epoll_wait(m_epoll, ready, 2, -1);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                std::cerr << "DirectoryWatcherInstance: epoll_wait failed: " << strerror(errno) << '\n';
+                return;
+            }
+            bool readable = false;
+            for (int i = 0; i < n; ++i) {
+                if (ready[i].data.fd == m_wake)
+                    return;
+                readable = true;
+            }
+            if (!readable)
+                continue;
+
+            events.clear();
+            readEvents(buffer, events);
+            notifications.clear();
+            {
+                std::lock_guard<std::mutex> lock (m_table->mutex);
+                translate(events, notifications);
+            }
+            for (auto & notification : notifications)
+                dispatch(notification);
+        }
+    }
+
+    // Drains the inotify fd (up to MAX_EVENTS_PER_BATCH; it's level triggered, so we'll be back)
+    void readEvents (std::vector<char> & buffer, std::vector<RawEvent> & events) {
+        while (events.size() < MAX_EVENTS_PER_BATCH) {
+            auto len = read(m_table->fd, &buffer[0], buffer.size());
+            if (len < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN)
+                    std::cerr << "DirectoryWatcherInstance: inotify read failed: " << strerror(errno) << '\n';
+                return;
+            }
+            if (len == 0)
+                return;
+            for (char * p = &buffer[0]; p < &buffer[0] + len; ) {
+                auto ev = (const struct inotify_event *)p;
+                events.push_back({ ev->wd, ev->mask, ev->cookie, ev->len ? std::string(ev->name) : std::string() });
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+
+    static bool watches (const WatchTable::Watch * watch, const ListenerRef & listener) {
+        return watch && std::find(watch->listeners.begin(), watch->listeners.end(), listener) != watch->listeners.end();
+    }
+
+    // Turns one batch of raw events into per-listener notifications (+ updates the watch table
+    // for directories that came and went). Needs m_table->mutex.
+    void translate (const std::vector<RawEvent> & events, std::vector<Notification> & out) {
+        typedef Notification::Kind Kind;
+        auto & table = *m_table;
+
+        // Pair up renames (IN_MOVED_FROM + IN_MOVED_TO w/ the same cookie)
+        static constexpr size_t UNPAIRED = SIZE_MAX;
+        std::vector<size_t> pairedWith (events.size(), UNPAIRED);
+        std::unordered_map<uint32_t, size_t> movedFrom;
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (events[i].mask & IN_MOVED_FROM) {
+                movedFrom[events[i].cookie] = i;
+            } else if (events[i].mask & IN_MOVED_TO) {
+                auto it = movedFrom.find(events[i].cookie);
+                if (it != movedFrom.end()) {
+                    pairedWith[it->second] = i;
+                    pairedWith[i] = it->second;
+                    movedFrom.erase(it);
+                }
+            }
+        }
+
+        auto findWatch = [&](int wd) -> WatchTable::Watch * {
+            auto it = table.watches.find(wd);
+            return it != table.watches.end() ? &it->second : nullptr;
+        };
+        auto error = [&](const ListenerRef & listener, const std::string & message) {
+            out.push_back({ Kind::ERROR, listener, listener->root, message });
+        };
+
+        // One side of an event (or an unpaired move) in a watched directory
+        auto emit = [&](WatchTable::Watch & watch, Kind kind, const FilePath & path, const std::string & name, bool isDir) {
+            auto listeners = watch.listeners;   // addTree() may add to it
+            for (auto & listener : listeners) {
+                if (!listener->active)
+                    continue;
+                switch (listener->kind) {
+                    case Listener::Kind::DIRECTORY:
+                        out.push_back({ Kind::CHANGED, listener, path, {} });
+                        break;
+                    case Listener::Kind::FILE:
+                        if (name == listener->fileName)
+                            out.push_back({ kind, listener, path, {} });
+                        break;
+                    case Listener::Kind::FILES:
+                    case Listener::Kind::RECURSIVE:
+                        if (!isDir) {
+                            if (listener->acceptsFile(path))
+                                out.push_back({ kind, listener, path, {} });
+                        } else if (kind == Kind::CREATED && listener->acceptsDir(path)) {
+                            std::string err;
+                            if (!table.addTree(path, listener, err, &out))
+                                error(listener, err);
+                        } else if (kind == Kind::DELETED && listener->kind == Listener::Kind::RECURSIVE) {
+                            table.removeSubtree(*listener, path);   // moved out of sight
+                        }
+                        break;
+                }
+            }
+        };
+
+        for (size_t i = 0; i < events.size(); ++i) {
+            auto & e = events[i];
+            if (e.mask & IN_Q_OVERFLOW) {
+                std::unordered_set<Listener *> seen;
+                for (auto & kv : table.watches) {
+                    for (auto & listener : kv.second.listeners) {
+                        if (!listener->active || !seen.insert(listener.get()).second)
+                            continue;
+                        if (listener->kind == Listener::Kind::DIRECTORY)
+                            out.push_back({ Kind::CHANGED, listener, listener->root, {} });
+                        else
+                            error(listener, "inotify event queue overflowed; missed changes under '" + listener->root + "'");
+                    }
+                }
+                continue;
+            }
+            if (e.mask & IN_IGNORED) {
+                table.dropWatch(e.wd);
+                continue;
+            }
+            auto watch = findWatch(e.wd);
+            if (!watch)
+                continue;
+            if (e.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                for (auto & listener : watch->listeners) {
+                    if (!listener->active || listener->root != watch->path)
+                        continue;
+                    if (listener->kind == Listener::Kind::DIRECTORY)
+                        out.push_back({ Kind::CHANGED, listener, listener->root, {} });
+                    else
+                        error(listener, "Watched directory '" + listener->root + "' was " +
+                              (e.mask & IN_DELETE_SELF ? "deleted" : "moved"));
+                }
+                continue;
+            }
+            bool isDir = (e.mask & IN_ISDIR) != 0;
+            auto path  = joinPath(watch->path, e.name);
+            if (e.mask & IN_CREATE)
+                emit(*watch, Kind::CREATED, path, e.name, isDir);
+            if (e.mask & IN_CLOSE_WRITE)
+                emit(*watch, Kind::MODIFIED, path, e.name, isDir);
+            if (e.mask & IN_DELETE)
+                emit(*watch, Kind::DELETED, path, e.name, isDir);
+            if ((e.mask & IN_MOVED_TO) && pairedWith[i] == UNPAIRED)
+                emit(*watch, Kind::CREATED, path, e.name, isDir);
+            if ((e.mask & IN_MOVED_FROM) && pairedWith[i] == UNPAIRED)
+                emit(*watch, Kind::DELETED, path, e.name, isDir);
+            if ((e.mask & IN_MOVED_FROM) && pairedWith[i] != UNPAIRED)
+                translateRename(*watch, e, findWatch(events[pairedWith[i]].wd), events[pairedWith[i]], isDir, emit, out);
+        }
+    }
+
+    // Paired move from watch / from to (possibly unwatched) dest / to
+    template <typename Emit>
+    void translateRename (WatchTable::Watch & watch, const RawEvent & from, WatchTable::Watch * dest, const RawEvent & to,
+                          bool isDir, Emit & emit, std::vector<Notification> & out) {
+        typedef Notification::Kind Kind;
+        auto & table  = *m_table;
+        auto fromPath = joinPath(watch.path, from.name);
+        if (!dest)
+            return emit(watch, Kind::DELETED, fromPath, from.name, isDir);
+        auto toPath   = joinPath(dest->path, to.name);
+
+        // Listeners that only see one side get a create / delete through emit()
+        std::vector<ListenerRef> both;
+        for (auto & listener : watch.listeners)
+            if (listener->active && watches(dest, listener))
+                both.push_back(listener);
+        WatchTable::Watch fromOnly { watch.path, {} }, toOnly { dest->path, {} };
+        for (auto & listener : watch.listeners)
+            if (!watches(dest, listener))
+                fromOnly.listeners.push_back(listener);
+        for (auto & listener : dest->listeners)
+            if (!watches(&watch, listener))
+                toOnly.listeners.push_back(listener);
+
+        for (auto & listener : both) {
+            switch (listener->kind) {
+                case Listener::Kind::DIRECTORY:
+                    out.push_back({ Kind::CHANGED, listener, fromPath, {} });
+                    out.push_back({ Kind::CHANGED, listener, toPath, {} });
+                    break;
+                case Listener::Kind::FILE:
+                    // Renamed over the file (editors saving via a temp file) => it was modified
+                    if (to.name == listener->fileName)
+                        out.push_back({ Kind::MODIFIED, listener, toPath, {} });
+                    else if (from.name == listener->fileName)
+                        out.push_back({ Kind::RENAMED, listener, fromPath, toPath });
+                    break;
+                case Listener::Kind::FILES:
+                case Listener::Kind::RECURSIVE: {
+                    if (isDir)
+                        break;  // subdir moved within the tree; renameTree() below keeps its watches
+                    bool fromIn = listener->acceptsFile(fromPath), toIn = listener->acceptsFile(toPath);
+                    if (fromIn && toIn)     out.push_back({ Kind::RENAMED, listener, fromPath, toPath });
+                    else if (fromIn)        out.push_back({ Kind::DELETED, listener, fromPath, {} });
+                    else if (toIn)          out.push_back({ Kind::CREATED, listener, toPath, {} });
+                } break;
+            }
+        }
+        auto toName = to.name;
+        emit(fromOnly, Kind::DELETED, fromPath, from.name, isDir);
+        if (isDir)
+            table.renameTree(fromPath, toPath);
+        emit(toOnly, Kind::CREATED, toPath, toName, isDir);
+    }
+
+    static void dispatch (Notification & n) {
+        auto & listener = *n.listener;
+        std::lock_guard<std::mutex> dispatching (listener.dispatchMutex);
+        if (!listener.active)
+            return;
+        typedef Notification::Kind Kind;
+        if (n.kind == Kind::CHANGED) {
+            if (listener.onChanged)
+                listener.onChanged(n.path);
+            return;
+        }
+        if (n.kind == Kind::ERROR) {
+            ResourceError error ("%s", n.newPath.c_str());
+            if (listener.onError)
+                listener.onError(error);
+            return;
+        }
+        std::function<void(const FilePath &)> callback;
+        std::function<void(const FilePath &, const FilePath &)> onRenamed;
+        {
+            std::lock_guard<std::mutex> lock (listener.callbackMutex);
+            switch (n.kind) {
+                case Kind::CREATED:  callback  = listener.onCreated; break;
+                case Kind::MODIFIED: callback  = listener.onModified; break;
+                case Kind::DELETED:  callback  = listener.onDeleted; break;
+                case Kind::RENAMED:  onRenamed = listener.onRenamed; break;
+                default: break;
+            }
+        }
+        if (callback)
+            callback(n.path);
+        if (onRenamed)
+            onRenamed(n.path, n.newPath);
+    }
+};
+
+static DirectoryWatcherInstance * g_dirWatcher = nullptr;
+
+DirectoryWatcherInstance::DirectoryWatcherInstance () :
+    impl(new DirectoryWatcherInstance::Impl())
+{
+    if (g_dirWatcher)
+        std::cerr << "Warning: creating a new DirectoryWatcherInstance (already exists!)\n";
+    else
+        g_dirWatcher = this;
+}
+DirectoryWatcherInstance::~DirectoryWatcherInstance () {
+    if (this == g_dirWatcher)
+        g_dirWatcher = nullptr;
+}
+
+DirectoryWatcherHandleRef DirectoryWatcherInstance::watchForChanges (
+    const FilePath & dirPath,
+    const ThreadCallable<void (const FilePath &)> onChanged,
+    const ThreadCallable<void (const ResourceError &)> onError,
+    bool autorelease
+) {
+    auto listener = std::make_shared<Listener>(Listener::Kind::DIRECTORY, stripTrailingSlashes(dirPath));
+    listener->onChanged = onChanged;
+    listener->onError   = [onError](ResourceError & e) { onError(e); };
+    std::string err;
+    if (!impl->add(listener, err))
+        return onError(ResourceError("%s", err.c_str())), nullptr;
+    return std::make_shared<DirectoryWatcherHandle>(listener, autorelease);
+}
+
+static FileWatcherRef watch (DirectoryWatcherInstance::Impl & impl, const ListenerRef & listener,
+                             const std::function<void(ResourceError &)> & onError) {
+    listener->onError = onError;
+    std::string err;
+    if (!impl.add(listener, err)) {
+        ResourceError error ("%s", err.c_str());
+        return onError(error), nullptr;
+    }
+    return std::make_shared<FileWatcher>(listener);
+}
+
+// path doesn't have to exist yet (just its directory); creating it calls onFileCreated.
+FileWatcherRef DirectoryWatcherInstance::watchFileForChanges (
+    const FilePath & path,
+    const std::function<void(ResourceError &)> onError
+) {
+    auto file = stripTrailingSlashes(path);
+    auto slash = file.rfind('/');
+    auto dir = slash == FilePath::npos ? FilePath(".") : slash == 0 ? FilePath("/") : file.substr(0, slash);
+    auto listener = std::make_shared<Listener>(Listener::Kind::FILE, dir);
+    listener->fileName = slash == FilePath::npos ? file : file.substr(slash + 1);
+    return watch(*impl, listener, onError);
+}
+
+FileWatcherRef DirectoryWatcherInstance::watchDirForChanges (
+    const FilePath & path,
+    const std::function<bool(const FilePath &)> & fileFilter,
+    const std::function<void(ResourceError &)> & onError
+) {
+    auto listener = std::make_shared<Listener>(Listener::Kind::FILES, stripTrailingSlashes(path));
+    listener->fileFilter = fileFilter;
+    return watch(*impl, listener, onError);
+}
+
+FileWatcherRef DirectoryWatcherInstance::watchDirForRecursiveChanges (
+    const FilePath & path,
+    const std::function<bool(const FilePath &)> & fileFilter,
+    const std::function<bool(const FilePath &)> & subdirFilter,
+    const std::function<void(ResourceError &)> & onError
+) {
+    auto listener = std::make_shared<Listener>(Listener::Kind::RECURSIVE, stripTrailingSlashes(path));
+    listener->fileFilter   = fileFilter;
+    listener->subdirFilter = subdirFilter;
+    return watch(*impl, listener, onError);
+}
+
+#endif // __linux__
@@ -0,0 +1,436 @@
+//
+//  pack_file.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "pack_file.hpp"
+#include "file_hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// We only want stb's inflate / deflate here. Both are compiled static into this file, so they
+// can't clash w/ the full stb_image that resources.cpp builds.
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_NO_STDIO
+#define STBI_NO_LINEAR
+#define STBI_NO_HDR
+// (most of which goes unused; clang reads the GCC pragmas too)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmisleading-indentation"
+#endif
+#include "../../../libs/stb/stb_image.h"
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../../../libs/stb/stb_image_write.h"
+#pragma GCC diagnostic pop
+
+namespace gl_sandbox {
+namespace resource_impl {
+
+static inline uint64_t alignUp (uint64_t offset) {
+    return (offset + PACK_ALIGNMENT - 1) & ~(uint64_t)(PACK_ALIGNMENT - 1);
+}
+
+static inline int compareNames (const char * a, size_t alen, const char * b, size_t blen) {
+    int c = memcmp(a, b, std::min(alen, blen));
+    return c != 0 ? c : (alen < blen ? -1 : alen > blen ? 1 : 0);
+}
+
+// ============================================================
+//                          PackFile
+// ============================================================
+
+std::shared_ptr<PackFile> PackFile::open (const FilePath & path, std::string & err) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return err = "cannot open pack '" + path + "': " + strerror(errno), nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(PackHeader)) {
+        close(fd);
+        return err = "not a pack file: '" + path + "'", nullptr;
+    }
+    size_t size = (size_t)st.st_size;
+    void * data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return err = "cannot map pack '" + path + "': " + strerror(errno), nullptr;
+
+    std::shared_ptr<PackFile> pack (new PackFile());
+    pack->m_path   = path;
+    pack->m_data   = (const uint8_t*)data;
+    pack->m_size   = size;
+    pack->m_header = (const PackHeader*)data;
+
+    // Validate everything up front, so lookups / loads never have to bounds check the toc.
+    auto & header = *pack->m_header;
+    if (memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0)
+        return err = "not a pack file: '" + path + "'", nullptr;
+    if (header.version != PACK_VERSION)
+        return err = "unsupported pack version " + std::to_string(header.version) + " in '" + path + "'", nullptr;
+    if (header.fileSize != size)
+        return err = "truncated pack: '" + path + "'", nullptr;
+    if (header.tocOffset % alignof(PackEntry) != 0 ||
+        header.tocOffset > size || (size - header.tocOffset) / sizeof(PackEntry) < header.numEntries ||
+        header.namesOffset > size || size - header.namesOffset < header.namesSize)
+        return err = "corrupt pack toc: '" + path + "'", nullptr;
+
+    pack->m_entries = (const PackEntry*)(pack->m_data + header.tocOffset);
+    pack->m_names   = (const char*)(pack->m_data + header.namesOffset);
+    for (uint32_t i = 0; i < header.numEntries; ++i) {
+        auto & e = pack->m_entries[i];
+        bool ok = (uint64_t)e.nameOffset + e.nameLength <= header.namesSize &&
+                  e.offset % PACK_ALIGNMENT == 0 &&
+                  e.offset <= size && size - e.offset >= e.storedSize &&
+                  ((e.flags & PACK_ENTRY_DEFLATE) ? e.size < INT_MAX && e.storedSize < INT_MAX
+                                                  : e.size == e.storedSize);
+        if (ok && i > 0) {
+            auto & prev = pack->m_entries[i-1];
+            ok = compareNames(pack->m_names + prev.nameOffset, prev.nameLength,
+                              pack->m_names + e.nameOffset, e.nameLength) < 0;
+        }
+        if (!ok)
+            return err = "corrupt pack entry " + std::to_string(i) + " in '" + path + "'", nullptr;
+    }
+    // The toc gets hit on every lookup; the payloads are up to whoever loads them.
+    madvise((void*)(pack->m_data + header.tocOffset), size - header.tocOffset, MADV_WILLNEED);
+    return pack;
+}
+
+PackFile::~PackFile () {
+    if (m_data)
+        munmap((void*)m_data, m_size);
+}
+
+std::string PackFile::name (const PackEntry & entry) const {
+    return std::string(m_names + entry.nameOffset, entry.nameLength);
+}
+
+const PackEntry * PackFile::find (const char * name, size_t length) const {
+    auto end = m_entries + m_header->numEntries;
+    auto it = std::lower_bound(m_entries, end, 0, [&](const PackEntry & e, int) {
+        return compareNames(m_names + e.nameOffset, e.nameLength, name, length) < 0;
+    });
+    if (it != end && compareNames(m_names + it->nameOffset, it->nameLength, name, length) == 0)
+        return it;
+    return nullptr;
+}
+
+FileBufferRef PackFile::load (const PackEntry & entry, const FilePath & path, bool copy, std::string & err) const {
+    auto self = shared_from_this();
+    auto payload = m_data + entry.offset;
+
+    if (!(entry.flags & PACK_ENTRY_DEFLATE) && !copy) {
+        return std::make_shared<FileBuffer>(path, payload, (size_t)entry.size,
+            [self](FileBuffer &) {});
+    }
+    auto data = new uint8_t [entry.size + 1];
+    if (entry.flags & PACK_ENTRY_DEFLATE) {
+        int n = stbi_zlib_decode_buffer((char*)data, (int)entry.size, (const char*)payload, (int)entry.storedSize);
+        if (n < 0 || (uint64_t)n != entry.size) {
+            delete[] data;
+            return err = "corrupt pack entry '" + name(entry) + "' in '" + m_path + "'", nullptr;
+        }
+    } else {
+        memcpy(data, payload, entry.size);
+    }
+    data[entry.size] = 0;
+    return std::make_shared<FileBuffer>(path, data, (size_t)entry.size,
+        [](FileBuffer & buf) { delete[] buf.data; });
+}
+
+// FILE* over a FileBuffer; the cookie owns the buffer, and goes away on fclose().
+namespace {
+    struct CFileCookie {
+        FileBufferRef buffer;
+        size_t        pos = 0;
+    };
+    static size_t cookieRead (CFileCookie * c, char * out, size_t n) {
+        n = std::min(n, c->buffer->size - c->pos);
+        memcpy(out, c->buffer->data + c->pos, n);
+        c->pos += n;
+        return n;
+    }
+    static bool cookieSeek (CFileCookie * c, int64_t & offset, int whence) {
+        int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)c->pos : (int64_t)c->buffer->size;
+        if (base + offset < 0 || base + offset > (int64_t)c->buffer->size)
+            return false;
+        c->pos = (size_t)(offset = base + offset);
+        return true;
+    }
+#ifdef __APPLE__
+    static FILE * openCookie (CFileCookie * c) {
+        return funopen(c,
+            [](void * c, char * out, int n) -> int {
+                return (int)cookieRead((CFileCookie*)c, out, (size_t)n);
+            },
+            nullptr,
+            [](void * c, fpos_t offset, int whence) -> fpos_t {
+                int64_t off = offset;
+                return cookieSeek((CFileCookie*)c, off, whence) ? (fpos_t)off : (errno = EINVAL, -1);
+            },
+            [](void * c) -> int { delete (CFileCookie*)c; return 0; });
+    }
+#else
+    static FILE * openCookie (CFileCookie * c) {
+        cookie_io_functions_t io;
+        io.read  = [](void * c, char * out, size_t n) -> ssize_t {
+            return (ssize_t)cookieRead((CFileCookie*)c, out, n);
+        };
+        io.write = nullptr;
+        io.seek  = [](void * c, off64_t * offset, int whence) -> int {
+            int64_t off = *offset;
+            return cookieSeek((CFileCookie*)c, off, whence) ? (*offset = off, 0) : (errno = EINVAL, -1);
+        };
+        io.close = [](void * c) -> int { delete (CFileCookie*)c; return 0; };
+        return fopencookie(c, "r", io);
+    }
+#endif
+};
+
+FILE * PackFile::openCFile (const PackEntry & entry, std::string & err) const {
+    auto cookie = new CFileCookie();
+    if (!(cookie->buffer = load(entry, m_path + ":" + name(entry), false, err))) {
+        delete cookie;
+        return nullptr;
+    }
+    FILE * file = openCookie(cookie);
+    if (!file) {
+        delete cookie;
+        err = std::string("cannot open pack entry as FILE*: ") + strerror(errno);
+    }
+    return file;
+}
+
+// ============================================================
+//                          PackWriter
+// ============================================================
+
+bool PackWriter::add (const std::string & name, const uint8_t * data, size_t size, Compression compression, std::string & err) {
+    if (name.empty() || name.size() > UINT32_MAX)
+        return err = "bad pack entry name '" + name + "'", false;
+    for (auto & e : m_entries)
+        if (e.name == name)
+            return err = "duplicate pack entry '" + name + "'", false;
+
+    Pending entry;
+    entry.name  = name;
+    entry.size  = size;
+    entry.hash  = hash::fastHash64(data, size);
+    entry.flags = 0;
+    if (compression != Compression::NONE && size > 0 && size < INT_MAX / 2) {
+        int n = 0;
+        auto deflated = stbi_zlib_compress((unsigned char*)data, (int)size, &n, 8);
+        if (deflated && (compression == Compression::DEFLATE || (size_t)n <= size - size / 8)) {
+            entry.stored.assign(deflated, deflated + n);
+            entry.flags |= PACK_ENTRY_DEFLATE;
+        }
+        free(deflated);
+    }
+    if (!(entry.flags & PACK_ENTRY_DEFLATE))
+        entry.stored.assign(data, data + size);
+
+    m_stats.entries     += 1;
+    m_stats.compressed  += (entry.flags & PACK_ENTRY_DEFLATE) ? 1 : 0;
+    m_stats.rawBytes    += size;
+    m_stats.storedBytes += entry.stored.size();
+    m_entries.push_back(std::move(entry));
+    return true;
+}
+
+bool PackWriter::addFile (const std::string & name, const FilePath & path, Compression compression, std::string & err) {
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file)
+        return err = "cannot open '" + path + "': " + strerror(errno), false;
+    std::vector<uint8_t> contents;
+    uint8_t chunk [1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        contents.insert(contents.end(), chunk, chunk + n);
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed)
+        return err = "read error on '" + path + "'", false;
+    return add(name, contents.empty() ? nullptr : &contents[0], contents.size(), compression, err);
+}
+
+bool PackWriter::write (const FilePath & path, std::string & err) {
+    std::vector<const Pending*> sorted;
+    for (auto & e : m_entries)
+        sorted.push_back(&e);
+    std::sort(sorted.begin(), sorted.end(), [](const Pending * a, const Pending * b) {
+        return compareNames(a->name.data(), a->name.size(), b->name.data(), b->name.size()) < 0;
+    });
+
+    // Lay out payloads, then the toc + name table
+    PackHeader header;
+    memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.numEntries = (uint32_t)sorted.size();
+
+    std::vector<PackEntry> toc (sorted.size());
+    std::string names;
+    uint64_t offset = sizeof(PackHeader);
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        auto & e = toc[i];
+        e.nameOffset  = (uint32_t)names.size();
+        e.nameLength  = (uint32_t)sorted[i]->name.size();
+        e.offset      = offset = alignUp(offset);
+        e.storedSize  = sorted[i]->stored.size();
+        e.size        = sorted[i]->size;
+        e.contentHash = sorted[i]->hash;
+        e.flags       = sorted[i]->flags;
+        names        += sorted[i]->name;
+        offset       += e.storedSize;
+    }
+    header.tocOffset   = offset = alignUp(offset);
+    header.namesOffset = offset += toc.size() * sizeof(PackEntry);
+    header.namesSize   = names.size();
+    header.fileSize    = offset += names.size();
+
+    FilePath tmpPath = path + ".tmp";
+    FILE * file = fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return err = "cannot create '" + tmpPath + "': " + strerror(errno), false;
+
+    static const uint8_t zeros [PACK_ALIGNMENT] = {};
+    uint64_t written = 0;
+    auto put = [&](const void * data, size_t size) {
+        if (size && fwrite(data, 1, size, file) != size)
+            return false;
+        return written += size, true;
+    };
+    auto pad = [&](uint64_t to) {
+        return put(zeros, (size_t)(to - written));
+    };
+    bool ok = put(&header, sizeof(header));
+    for (size_t i = 0; ok && i < sorted.size(); ++i)
+        ok = pad(toc[i].offset) && put(sorted[i]->stored.data(), sorted[i]->stored.size());
+    ok = ok && pad(header.tocOffset)
+            && put(toc.data(), toc.size() * sizeof(PackEntry))
+            && put(names.data(), names.size());
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        err = "cannot write '" + path + "': " + strerror(errno);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ============================================================
+//                        Mounted packs
+// ============================================================
+
+namespace packs {
+    struct Mount {
+        std::shared_ptr<const PackFile> pack;
+        FilePath                        root;   // "" or "<root>/"
+        LooseFiles                      looseFiles;
+    };
+    typedef std::vector<Mount> MountList;
+
+    // Copy-on-write, so lookups (from any io thread) only hold the lock long enough to grab a ref.
+    static std::mutex                       g_mountMutex;
+    static std::shared_ptr<const MountList> g_mounts;
+    static std::atomic<bool>                g_anyMounted { false };
+    static std::atomic<size_t>              g_hits { 0 }, g_overridden { 0 };
+
+    bool mount (const FilePath & packPath, const FilePath & root, LooseFiles looseFiles, std::string & err) {
+        auto pack = PackFile::open(packPath, err);
+        if (!pack)
+            return false;
+
+        Mount m { pack, root, looseFiles };
+        if (m.root == "." || m.root == "./")
+            m.root.clear();
+        if (!m.root.empty() && m.root.back() != '/')
+            m.root += '/';
+
+        std::lock_guard<std::mutex> lock (g_mountMutex);
+        auto mounts = std::make_shared<MountList>();
+        mounts->push_back(std::move(m));
+        if (g_mounts)
+            mounts->insert(mounts->end(), g_mounts->begin(), g_mounts->end());
+        g_mounts = mounts;
+        g_anyMounted = true;
+        return true;
+    }
+
+    void unmountAll () {
+        std::lock_guard<std::mutex> lock (g_mountMutex);
+        g_mounts.reset();
+        g_anyMounted = false;
+    }
+
+    bool anyMounted () {
+        return g_anyMounted.load(std::memory_order_relaxed);
+    }
+
+    Match find (const FilePath & path) {
+        Match match;
+        if (!anyMounted())
+            return match;
+        std::shared_ptr<const MountList> mounts;
+        {
+            std::lock_guard<std::mutex> lock (g_mountMutex);
+            mounts = g_mounts;
+        }
+        if (!mounts)
+            return match;
+
+        for (auto & m : *mounts) {
+            const char * rel = path.c_str();
+            if (m.root.empty()) {
+                while (rel[0] == '.' && rel[1] == '/')
+                    rel += 2;
+            } else if (path.compare(0, m.root.size(), m.root) == 0) {
+                rel += m.root.size();
+            } else {
+                continue;
+            }
+            auto entry = m.pack->find(rel, strlen(rel));
+            if (!entry)
+                continue;
+
+            struct stat st;
+            if (m.looseFiles == LooseFiles::OVERRIDE && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                ++g_overridden;
+                return match;
+            }
+            ++g_hits;
+            match.pack  = m.pack;
+            match.entry = entry;
+            return match;
+        }
+        return match;
+    }
+
+    Stats stats () {
+        Stats s;
+        s.hits       = g_hits.load();
+        s.overridden = g_overridden.load();
+        return s;
+    }
+};
+
+}; // namespace resource_impl
+}; // namespace gl_sandbox
@@ -0,0 +1,168 @@
+//
+//  pack_file.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef pack_file_hpp
+#define pack_file_hpp
+
+#include "resource_impl.hpp"
+#include <cstdint>
+#include <memory>
+
+namespace gl_sandbox {
+namespace resource_impl {
+
+// Read-only archive of many small files (shaders, scripts, textures), so a cold start can do one
+// open + mmap instead of an open / read / close per file.
+//
+// Layout (native byte order -- packs are build products, not an interchange format):
+//   PackHeader              64 bytes, at offset 0
+//   payloads                each one starts on a 64-byte boundary
+//   PackEntry [numEntries]  sorted by name (memcmp order), so lookups are a binary search
+//   name table              entry names, relative to the pack root w/ '/' separators; not null-terminated
+//
+// Entries are either stored as-is (and handed out as views into the mapping) or deflated
+// (zlib stream), which is worth it for text but rarely for already-compressed images.
+static constexpr char     PACK_MAGIC [8]   = { 'G', 'L', 'S', 'P', 'A', 'C', 'K', 0 };
+static constexpr uint32_t PACK_VERSION     = 1;
+static constexpr size_t   PACK_ALIGNMENT   = 64;
+
+struct PackHeader {
+    char     magic [8];
+    uint32_t version     = PACK_VERSION;
+    uint32_t numEntries  = 0;
+    uint64_t tocOffset   = 0;
+    uint64_t namesOffset = 0;
+    uint64_t namesSize   = 0;
+    uint64_t fileSize    = 0;   // catches truncated packs
+    uint8_t  reserved [16] = {};
+};
+static_assert(sizeof(PackHeader) == 64, "PackHeader must be 64 bytes");
+
+enum PackEntryFlags : uint32_t {
+    PACK_ENTRY_DEFLATE = 1 << 0,
+};
+
+struct PackEntry {
+    uint32_t nameOffset  = 0;   // into the name table
+    uint32_t nameLength  = 0;
+    uint64_t offset      = 0;   // payload offset (multiple of PACK_ALIGNMENT)
+    uint64_t storedSize  = 0;   // payload size in the pack
+    uint64_t size        = 0;   // uncompressed size
+    uint64_t contentHash = 0;   // hash::fastHash64 of the uncompressed contents
+    uint32_t flags       = 0;
+    uint32_t reserved    = 0;
+};
+static_assert(sizeof(PackEntry) == 48, "PackEntry must be 48 bytes");
+
+class PackFile : public std::enable_shared_from_this<PackFile> {
+public:
+    // Maps + validates a pack. Returns null (and sets err) on failure.
+    static std::shared_ptr<PackFile> open (const FilePath & path, std::string & err);
+    ~PackFile ();
+
+    PackFile (const PackFile &) = delete;
+    PackFile & operator= (const PackFile &) = delete;
+
+    const FilePath & path () const { return m_path; }
+    size_t numEntries () const { return m_header->numEntries; }
+    const PackEntry & entry (size_t i) const { return m_entries[i]; }
+    std::string name (const PackEntry & entry) const;
+
+    // name is relative to the pack root ("shaders/common/diffuse_1light.fs"). Returns null if missing.
+    const PackEntry * find (const char * name, size_t length) const;
+    const PackEntry * find (const std::string & name) const { return find(name.data(), name.size()); }
+
+    // Returns the entry as a FileBuffer (w/ path as its path), or null + err on failure.
+    // Stored entries are zero-copy views into the mapping unless copy is set (the buffer keeps the
+    // pack mapped either way); copies and inflated entries are heap allocated + null-terminated.
+    FileBufferRef load (const PackEntry & entry, const FilePath & path, bool copy, std::string & err) const;
+
+    // Read-only FILE* over the entry's contents. Caller fcloses it; null + err on failure.
+    FILE * openCFile (const PackEntry & entry, std::string & err) const;
+
+protected:
+    PackFile () {}
+
+    FilePath           m_path;
+    const uint8_t *    m_data    = nullptr;
+    size_t             m_size    = 0;
+    const PackHeader * m_header  = nullptr;
+    const PackEntry *  m_entries = nullptr;
+    const char *       m_names   = nullptr;
+};
+
+// Builds a pack in memory (entries are compressed as they're added) and writes it out.
+class PackWriter {
+public:
+    enum class Compression {
+        NONE,
+        DEFLATE,
+        AUTO,       // deflate iff it saves at least 1/8th of the entry
+    };
+    struct Stats {
+        size_t entries     = 0;
+        size_t compressed  = 0;
+        size_t rawBytes    = 0;
+        size_t storedBytes = 0;
+    };
+
+    // Returns false (+ err) for duplicate / empty / oversized names.
+    bool add (const std::string & name, const uint8_t * data, size_t size, Compression compression, std::string & err);
+    bool addFile (const std::string & name, const FilePath & path, Compression compression, std::string & err);
+
+    // Writes to a temp file + renames it into place, so a running app never maps a half-written pack.
+    bool write (const FilePath & path, std::string & err);
+
+    const Stats & stats () const { return m_stats; }
+
+protected:
+    struct Pending {
+        std::string          name;
+        std::vector<uint8_t> stored;
+        uint64_t             size;
+        uint64_t             hash;
+        uint32_t             flags;
+    };
+    std::vector<Pending> m_entries;
+    Stats                m_stats;
+};
+
+// Mounted packs. Loads through resource_impl (and so ResourceLayer, and ResourceLoader's file
+// loads) check these before touching the filesystem.
+namespace packs {
+    enum class LooseFiles {
+        OVERRIDE,   // a file that exists on disk wins over its pack entry (costs a stat per pack hit)
+        IGNORE,     // the pack is authoritative for everything it contains
+    };
+
+    // Mounts packPath so that entry "a/b.fs" is served for root + "/a/b.fs". root may be empty
+    // (or ".") to match relative paths. Paths are matched lexically, w/out resolving symlinks
+    // or "..". Later mounts take precedence over earlier ones.
+    bool mount (const FilePath & packPath, const FilePath & root, LooseFiles looseFiles, std::string & err);
+    void unmountAll ();
+    bool anyMounted ();
+
+    struct Match {
+        std::shared_ptr<const PackFile> pack;
+        const PackEntry *               entry = nullptr;
+        explicit operator bool () const { return entry != nullptr; }
+    };
+    // Pack entry that should be served for path, if any (ie. honoring loose file overrides).
+    Match find (const FilePath & path);
+
+    struct Stats {
+        size_t hits = 0;        // loads / lookups served from a pack
+        size_t overridden = 0;  // pack entries shadowed by a loose file
+    };
+    Stats stats ();
+};
+
+}; // namespace resource_impl
+}; // namespace gl_sandbox
+
+#endif /* pack_file_hpp */
@@ -10,8 +10,22 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "resource_impl.hpp"
+#include "async_file_reader.hpp"
+#include "file_hash.hpp"
+#include "pack_file.hpp"
+#include "../residency.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
 
 namespace gl_sandbox {
 namespace resource_impl {
@@ -21,29 +35,145 @@ namespace resource_impl {
 // ============================================================
     
 namespace detail {
+    // Serves a load from a mounted pack (see pack_file.hpp) that has path. Inflated / copied
+    // buffers are null-terminated, same as loadFileAsBuffer's.
+    template <typename FileBufferCallback, typename FilePathCallback>
+    bool loadPackedBuffer (
+        const packs::Match & packed,
+        const FilePath & path, bool copy,
+        const FileBufferCallback & onLoad,
+        const FilePathCallback & onFail
+    ) {
+        std::string err;
+        if (auto buffer = packed.pack->load(*packed.entry, path, copy, err))
+            return onLoad(buffer), true;
+        return onFail(path), false;
+    }
+    
+    // Packs only hold read-only files; anything else ("w", "r+", etc) goes to the filesystem.
+    static bool isReadOnlyMode (const char * mode) {
+        return mode[0] == 'r' && !strchr(mode, '+');
+    }
+    
     template <typename FileBufferCallback, typename FilePathCallback>
     bool loadFileAsBuffer (
         const FilePath & path,
         const FileBufferCallback & onLoad,
         const FilePathCallback & onFail
     ) {
+        if (auto packed = packs::find(path))
+            return loadPackedBuffer(packed, path, true, onLoad, onFail);
+        
         std::ifstream f (path);
         if (f) {
             f.seekg(0, std::ios::end);
             size_t size = f.tellg();
             f.seekg(0, std::ios::beg);
             if (size != 0) {
+                auto data = new uint8_t[size+1];
+                data[size] = 0;
                 auto buffer = std::make_shared<FileBuffer>(
-                        path, new uint8_t[size+1], size,
+                        path, data, size,
                         [](auto &buf) { delete[] buf.data; });
                 
-                f.read((char*)buffer->data, buffer->size);
+                f.read((char*)data, buffer->size);
                 return onLoad(buffer), true;
             }
         }
         return onFail(path), false;
     }
     
+    // Maps path read-only; null if it can't be opened, or isn't a non-empty regular file.
+    static FileBufferRef mapFile (const FilePath & path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            close(fd);
+            return nullptr;
+        }
+        size_t size = (size_t)st.st_size;
+        void * data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // mapping keeps its own reference to the file
+        if (data == MAP_FAILED)
+            return nullptr;
+        
+        // Loaders mostly scan front to back; ask for aggressive readahead.
+        madvise(data, size, MADV_SEQUENTIAL);
+        madvise(data, size, MADV_WILLNEED);
+        
+        return std::make_shared<FileBuffer>(
+                path, (const uint8_t*)data, size,
+                [](auto &buf) { munmap((void*)buf.data, buf.size); });
+    }
+    
+    static std::atomic<ResidencyManager*> g_residency { nullptr };
+    
+    // Mapped files registered w/ g_residency, by path. Each registration is for one version of
+    // the file (stamp); edited / replaced files get a new one.
+    struct ResidentMappings {
+        struct Entry {
+            std::string stamp;
+            ResidencyManager::Handle<FileBuffer> handle;
+        };
+        std::mutex mutex;
+        std::unordered_map<FilePath, Entry> byPath;
+        
+        // First used by setResidencyManager(), so it's destroyed before the manager is.
+        static ResidentMappings & shared () {
+            static ResidentMappings mappings;
+            return mappings;
+        }
+    };
+    
+    static FileBufferRef mapResident (ResidencyManager & manager, const FilePath & path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+            return nullptr;
+        auto stamp = fmtArgs("%llu:%llu:%lld", (unsigned long long)st.st_ino,
+                             (unsigned long long)st.st_size, (long long)st.st_mtime);
+        
+        ResidencyManager::Handle<FileBuffer> handle;
+        {
+            auto & mappings = ResidentMappings::shared();
+            std::lock_guard<std::mutex> lock (mappings.mutex);
+            auto & entry = mappings.byPath[path];
+            if (!entry.handle || entry.stamp != stamp) {
+                entry.stamp  = stamp;
+                entry.handle = manager.add<FileBuffer>(ResidencyCategory::FILE_BUFFERS, path + '@' + stamp,
+                [path](size_t & bytes, std::string & err) -> FileBufferRef {
+                    auto buffer = mapFile(path);
+                    if (!buffer)
+                        return err = "Cannot map '" + path + "'", nullptr;
+                    bytes = buffer->size;
+                    return buffer;
+                });
+            }
+            handle = entry.handle;
+        }
+        return handle.acquire();
+    }
+    
+    // Zero-copy variant of loadFileAsBuffer: maps the file read-only instead of copying it
+    // into a heap buffer, so peak memory == file size (and the kernel can page it in lazily).
+    // Goes through g_residency if there is one.
+    template <typename FileBufferCallback, typename FilePathCallback>
+    bool loadFileAsMappedBuffer (
+        const FilePath & path,
+        const FileBufferCallback & onLoad,
+        const FilePathCallback & onFail
+    ) {
+        if (auto packed = packs::find(path))
+            return loadPackedBuffer(packed, path, false, onLoad, onFail);
+        
+        auto manager = g_residency.load();
+        if (auto buffer = manager ? mapResident(*manager, path) : mapFile(path))
+            return onLoad(buffer), true;
+        return onFail(path), false;
+    }
+    
     template <typename IFStreamCallback, typename FilePathCallback>
     bool loadFileAsIFstream (
         const FilePath & path,
@@ -64,6 +194,17 @@ namespace detail {
         const CFileCallback & onLoad,
         const CFileErrorCallback & onFail
     ) {
+        if (isReadOnlyMode(mode)) {
+            if (auto packed = packs::find(path)) {
+                std::string err;
+                FILE* file = packed.pack->openCFile(*packed.entry, err);
+                if (!file)
+                    return onFail(path, EIO), false;
+                onLoad(file);
+                fclose(file);
+                return true;
+            }
+        }
         FILE* file = fopen(path.c_str(), mode);
         if (file) {
             onLoad(file);
@@ -74,7 +215,96 @@ namespace detail {
             return false;
         }
     }
+    
+    // Source for a chunked load: a file read w/ pread, or a (mapped / inflated) pack entry that
+    // chunks just point into.
+    class StreamSource {
+    public:
+        StreamSource (const FilePath & path, const StreamOptions & options) :
+            m_path(path), m_options(options)
+        {
+            if (m_options.chunkSize == 0)
+                m_options.chunkSize = StreamOptions().chunkSize;
+            if (m_options.maxChunksInFlight == 0)
+                m_options.maxChunksInFlight = 1;
+        }
+        ~StreamSource () {
+            if (m_fd >= 0)
+                close(m_fd);
+        }
+        StreamSource (const StreamSource &) = delete;
+        StreamSource & operator= (const StreamSource &) = delete;
+        
+        // Returns 0 or an errno value.
+        errno_t open () {
+            if (auto packed = packs::find(m_path)) {
+                std::string err;
+                if (!(m_packed = packed.pack->load(*packed.entry, m_path, false, err)))
+                    return EIO;
+                m_size = m_packed->size;
+                return 0;
+            }
+            if ((m_fd = ::open(m_path.c_str(), O_RDONLY)) < 0)
+                return errno;
+            struct stat st;
+            if (fstat(m_fd, &st) != 0)
+                return errno;
+            if (!S_ISREG(st.st_mode))
+                return EISDIR;
+            m_size = (size_t)st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+            posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            return 0;
+        }
+        bool needsBuffer () const { return !m_packed; }
+        bool atEnd () const { return m_offset >= m_size; }
+        
+        // Reads the next chunk (into buffer, for files). chunk is empty at the end of the file.
+        errno_t readChunk (uint8_t * buffer, ChunkSpan & chunk, size_t & offset) {
+            offset = m_offset;
+            size_t want = std::min(m_options.chunkSize, m_size - m_offset);
+            if (m_packed) {
+                chunk = ChunkSpan(m_packed->data + m_offset, want);
+                m_offset += want;
+                return 0;
+            }
+            size_t got = 0;
+            while (got < want) {
+                auto n = pread(m_fd, buffer + got, want - got, (off_t)(m_offset + got));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                    return errno;
+                if (n == 0)
+                    break;  // truncated under us; end early
+                got += (size_t)n;
+            }
+            chunk = ChunkSpan(buffer, got);
+            m_offset = got == want ? m_offset + got : m_size;
+            return 0;
+        }
+        
+        const FilePath & path () const { return m_path; }
+        const StreamOptions & options () const { return m_options; }
+        size_t size () const { return m_size; }
+        
+    protected:
+        FilePath      m_path;
+        StreamOptions m_options;
+        int           m_fd = -1;
+        FileBufferRef m_packed;
+        size_t        m_size   = 0;
+        size_t        m_offset = 0;
+    };
 };
+void setResidencyManager (ResidencyManager * manager) {
+    auto & mappings = detail::ResidentMappings::shared();
+    std::lock_guard<std::mutex> lock (mappings.mutex);
+    mappings.byPath.clear();
+    detail::g_residency = manager;
+}
+    
 namespace immediate {
     bool loadFileImmediate (
         const FilePath & path,
@@ -84,6 +314,14 @@ namespace immediate {
         return detail::loadFileAsBuffer(path, onLoad, onFail);
     }
         
+    bool loadFileMappedImmediate (
+        const FilePath & path,
+        const FileBufferCallback & onLoad,
+        const FilePathCallback & onFail
+    ) {
+        return detail::loadFileAsMappedBuffer(path, onLoad, onFail);
+    }
+        
     bool loadFileImmediate (
         const FilePath & path,
         const IFStreamCallback & onLoad,
@@ -100,14 +338,98 @@ namespace immediate {
     ) {
         return detail::loadFileAsCFile(path, mode, onLoad, onFail);
     }
+    
+    bool streamFileImmediate (
+        const FilePath & path,
+        const StreamOptions & options,
+        const ChunkCallback & onChunk,
+        const StreamEndCallback & onEnd,
+        const CFileErrorCallback & onError
+    ) {
+        detail::StreamSource source (path, options);
+        if (auto err = source.open())
+            return onError(path, err), false;
+        
+        std::unique_ptr<uint8_t[]> buffer;
+        if (source.needsBuffer())
+            buffer.reset(new uint8_t [std::min(source.options().chunkSize, source.size())]);
+        while (!source.atEnd()) {
+            ChunkSpan chunk; size_t offset;
+            if (auto err = source.readChunk(buffer.get(), chunk, offset))
+                return onError(path, err), false;
+            if (!chunk.empty() && !onChunk(chunk, offset))
+                return false;
+        }
+        if (onEnd)
+            onEnd(path, source.size());
+        return true;
+    }
 };
 namespace async {
+    using async_io::CompletionRouter;
+    using async_io::ReadRequest;
+    
+    // Packed files are just a copy / inflate out of an existing mapping, so they skip the
+    // reader (no open / read to batch) and run straight on an io thread.
+    static void loadPackedAsync (
+        const packs::Match & packed,
+        const FilePath & path,
+        const FileBufferCallback & onLoad,
+        const FilePathCallback & onFail
+    ) {
+        auto requester = std::this_thread::get_id();
+        async_io::runOnIOThread([=]() {
+            detail::loadPackedBuffer(packed, path, true, [=](const FileBufferRef & buffer) {
+                CompletionRouter::shared().post(requester, [=]() { if (onLoad) onLoad(buffer); });
+            }, [=](const FilePath & path) {
+                CompletionRouter::shared().post(requester, [=]() { if (onFail) onFail(path); });
+            });
+        });
+    }
+    
     void loadFileAsync (
         const FilePath & path,
         const FileBufferCallback & onLoad,
         const FilePathCallback & onFail
     ) {
-        detail::loadFileAsBuffer(path, onLoad, onFail);
+        if (auto packed = packs::find(path))
+            return loadPackedAsync(packed, path, onLoad, onFail);
+        
+        std::vector<ReadRequest> requests;
+        requests.emplace_back(path, onLoad, onFail);
+        async_io::sharedReader().submit(std::move(requests));
+    }
+    
+    void loadFilesAsync (
+        const std::vector<FilePath> & paths,
+        const FileBufferCallback & onLoad,
+        const FilePathCallback & onFail
+    ) {
+        std::vector<ReadRequest> requests;
+        requests.reserve(paths.size());
+        for (auto & path : paths) {
+            if (auto packed = packs::find(path))
+                loadPackedAsync(packed, path, onLoad, onFail);
+            else
+                requests.emplace_back(path, onLoad, onFail);
+        }
+        if (!requests.empty())
+            async_io::sharedReader().submit(std::move(requests));
+    }
+    
+    void loadFileMappedAsync (
+        const FilePath & path,
+        const FileBufferCallback & onLoad,
+        const FilePathCallback & onFail
+    ) {
+        auto requester = std::this_thread::get_id();
+        async_io::runOnIOThread([=]() {
+            detail::loadFileAsMappedBuffer(path, [=](const FileBufferRef & buffer) {
+                CompletionRouter::shared().post(requester, [=]() { if (onLoad) onLoad(buffer); });
+            }, [=](const FilePath & path) {
+                CompletionRouter::shared().post(requester, [=]() { if (onFail) onFail(path); });
+            });
+        });
     }
 
     void loadFileAsync (
@@ -115,7 +437,14 @@ namespace async {
         const IFStreamCallback & onLoad,
         const FilePathCallback & onFail
     ) {
-        detail::loadFileAsIFstream(path, onLoad, onFail);
+        auto requester = std::this_thread::get_id();
+        async_io::runOnIOThread([=]() {
+            detail::loadFileAsIFstream(path, [=](const std::shared_ptr<std::ifstream> & f) {
+                CompletionRouter::shared().post(requester, [=]() { if (onLoad) onLoad(f); });
+            }, [=](const FilePath & path) {
+                CompletionRouter::shared().post(requester, [=]() { if (onFail) onFail(path); });
+            });
+        });
     }
 
     void loadFileAsync (
@@ -124,10 +453,320 @@ namespace async {
         const CFileCallback & onLoad,
         const CFileErrorCallback & onFail
     ) {
-        detail::loadFileAsCFile(path, mode, onLoad, onFail);
+        // The FILE* has to stay open until the requesting thread has run onLoad, so we can't use
+        // loadFileAsCFile here (it closes the file as soon as its callback returns).
+        auto requester = std::this_thread::get_id();
+        std::string fmode (mode);
+        async_io::runOnIOThread([=]() {
+            FILE* file = nullptr;
+            errno_t err = 0;
+            packs::Match packed;
+            if (detail::isReadOnlyMode(fmode.c_str()) && (packed = packs::find(path))) {
+                std::string msg;
+                file = packed.pack->openCFile(*packed.entry, msg);
+                err  = file ? 0 : EIO;
+            } else {
+                file = fopen(path.c_str(), fmode.c_str());
+                err  = errno;
+            }
+            CompletionRouter::shared().post(requester, [=]() {
+                if (file) {
+                    if (onLoad) onLoad(file);
+                    fclose(file);
+                } else if (onFail) {
+                    onFail(path, err);
+                }
+            });
+        });
+    }
+    
+    // Streaming load state: pump() reads on an io thread (one pump at a time) until it runs out of
+    // chunk slots, and the requesting thread hands slots (+ buffers) back as it consumes chunks,
+    // restarting the pump if it had stalled. Every closure holds a ref, so the file stays open
+    // until both sides are done.
+    class FileStream : public std::enable_shared_from_this<FileStream> {
+    public:
+        FileStream (const FilePath & path, const StreamOptions & options,
+                    const ChunkCallback & onChunk, const StreamEndCallback & onEnd, const CFileErrorCallback & onError) :
+            m_source(path, options), m_onChunk(onChunk), m_onEnd(onEnd), m_onError(onError),
+            m_requester(std::this_thread::get_id()) {}
+        
+        void start () {
+            m_reading = true;
+            auto self = shared_from_this();
+            async_io::runOnIOThread([self]() { self->pump(); });
+        }
+        
+    protected:
+        void pump () {
+            auto self = shared_from_this();
+            if (!m_opened) {
+                m_opened = true;
+                if (auto err = m_source.open())
+                    return fail(err);
+            }
+            for (;;) {
+                uint8_t * buffer = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock (m_mutex);
+                    if (m_stopped || m_done || m_inFlight >= m_source.options().maxChunksInFlight) {
+                        m_reading = false;
+                        return;
+                    }
+                    ++m_inFlight;
+                    if (m_source.needsBuffer()) {
+                        if (m_freeBuffers.empty()) {
+                            m_buffers.emplace_back(new uint8_t [std::max<size_t>(1, std::min(m_source.options().chunkSize, m_source.size()))]);
+                            m_freeBuffers.push_back(m_buffers.back().get());
+                        }
+                        buffer = m_freeBuffers.back();
+                        m_freeBuffers.pop_back();
+                    }
+                }
+                ChunkSpan chunk; size_t offset;
+                if (auto err = m_source.readChunk(buffer, chunk, offset)) {
+                    release(buffer);
+                    return fail(err);
+                }
+                bool atEnd = m_source.atEnd();
+                {
+                    std::lock_guard<std::mutex> lock (m_mutex);
+                    m_done = atEnd;
+                }
+                CompletionRouter::shared().post(m_requester, [self, buffer, chunk, offset]() {
+                    if (!self->m_stopped && !chunk.empty() && !self->m_onChunk(chunk, offset))
+                        self->m_stopped = true;
+                    self->release(buffer);
+                });
+                if (atEnd) {
+                    CompletionRouter::shared().post(m_requester, [self]() {
+                        if (!self->m_stopped && self->m_onEnd)
+                            self->m_onEnd(self->m_source.path(), self->m_source.size());
+                    });
+                }
+            }
+        }
+        
+        void fail (errno_t err) {
+            auto self = shared_from_this();
+            {
+                std::lock_guard<std::mutex> lock (m_mutex);
+                m_done    = true;
+                m_reading = false;
+            }
+            // Chunks posted before this still get delivered; nothing after it does.
+            CompletionRouter::shared().post(m_requester, [self, err]() {
+                if (!self->m_stopped && self->m_onError)
+                    self->m_onError(self->m_source.path(), err);
+                self->m_stopped = true;
+            });
+        }
+        
+        // Requesting thread (or pump(), on a read error)
+        void release (uint8_t * buffer) {
+            bool resume = false;
+            {
+                std::lock_guard<std::mutex> lock (m_mutex);
+                if (buffer)
+                    m_freeBuffers.push_back(buffer);
+                --m_inFlight;
+                if (!m_reading && !m_stopped && !m_done)
+                    resume = m_reading = true;
+            }
+            if (resume) {
+                auto self = shared_from_this();
+                async_io::runOnIOThread([self]() { self->pump(); });
+            }
+        }
+        
+    protected:
+        detail::StreamSource m_source;          // only touched by pump() (which never runs concurrently w/ itself)
+        bool                 m_opened = false;  // ditto
+        ChunkCallback        m_onChunk;
+        StreamEndCallback    m_onEnd;
+        CFileErrorCallback   m_onError;
+        std::thread::id      m_requester;
+        
+        std::mutex           m_mutex;           // guards the fields below
+        std::vector<std::unique_ptr<uint8_t[]>> m_buffers;
+        std::vector<uint8_t*> m_freeBuffers;
+        unsigned             m_inFlight = 0;    // chunks read but not consumed yet
+        bool                 m_reading  = false;// a pump() is scheduled / running
+        bool                 m_done     = false;// hit eof or a read error
+        std::atomic<bool>    m_stopped  { false };  // set on the requesting thread: consumer returned false / got an error
+    };
+    
+    void streamFileAsync (
+        const FilePath & path,
+        const StreamOptions & options,
+        const ChunkCallback & onChunk,
+        const StreamEndCallback & onEnd,
+        const CFileErrorCallback & onError
+    ) {
+        std::make_shared<FileStream>(path, options, onChunk, onEnd, onError)->start();
+    }
+    
+    unsigned dispatchCallbacks () {
+        return CompletionRouter::shared().runPending();
+    }
+    size_t numPendingCallbacks () {
+        return CompletionRouter::shared().numPending();
     }
 };
     
+// ============================================================
+//                       FILE HASHING
+// ============================================================
+
+namespace filehash {
+    // Gives access to a file's contents as one contiguous span: mmapped if possible (regular
+    // files), or read into memory otherwise (pipes, etc). Always starts from the beginning of
+    // the file, and restores the FILE*'s position when done.
+    struct FileContents {
+        const uint8_t * data = nullptr;
+        size_t size = 0;
+        
+        FileContents (FILE* file, long int filesize) {
+            long pos = ftell(file);
+            if (filesize < 0) {
+                if (fseek(file, 0, SEEK_END) != 0 || (filesize = ftell(file)) < 0)
+                    throw ResourceError("filehash: could not determine file size (fd %d)", fileno(file));
+            }
+            size = (size_t)filesize;
+            if (size != 0) {
+                void * mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+                if (mapped != MAP_FAILED) {
+                    madvise(mapped, size, MADV_SEQUENTIAL);
+                    data = (const uint8_t*)mapped;
+                    m_mapped = true;
+                } else {
+                    m_storage.resize(size);
+                    fseek(file, 0, SEEK_SET);
+                    if (fread(&m_storage[0], 1, size, file) != size) {
+                        fseek(file, pos, SEEK_SET);
+                        throw ResourceError("filehash: read error (fd %d, %ld bytes)", fileno(file), filesize);
+                    }
+                    data = &m_storage[0];
+                }
+            }
+            fseek(file, pos, SEEK_SET);
+        }
+        ~FileContents () {
+            if (m_mapped)
+                munmap((void*)data, size);
+        }
+        FileContents (const FileContents &) = delete;
+        FileContents & operator= (const FileContents &) = delete;
+    protected:
+        bool m_mapped = false;
+        std::vector<uint8_t> m_storage;
+    };
+    
+    static std::string md5 (const FileContents & contents) {
+        hash::Md5 h; uint8_t digest [16];
+        h.update(contents.data, contents.size);
+        h.finish(digest);
+        return hash::toHex(digest, sizeof(digest));
+    }
+    static std::string sha1 (const FileContents & contents) {
+        hash::Sha1 h; uint8_t digest [20];
+        h.update(contents.data, contents.size);
+        h.finish(digest);
+        return hash::toHex(digest, sizeof(digest));
+    }
+    static std::string murmur (const FileContents & contents) {
+        hash::Murmur3 h;
+        h.update(contents.data, contents.size);
+        return hash::toHex(h.finish());
+    }
+    static std::string fast (const FileContents & contents) {
+        return hash::toHex(hash::fastHash128(contents.data, contents.size));
+    }
+    
+    std::string & md5hash (FILE* file, std::string & hashvalue, long int filesize) {
+        return hashvalue = md5(FileContents(file, filesize));
+    }
+    std::string & sha1hash (FILE* file, std::string & hashvalue, long int filesize) {
+        return hashvalue = sha1(FileContents(file, filesize));
+    }
+    std::string & murmurhash (FILE* file, std::string & hashvalue, long int filesize) {
+        return hashvalue = murmur(FileContents(file, filesize));
+    }
+    std::string & fasthash (FILE* file, std::string & hashvalue, long int filesize) {
+        return hashvalue = fast(FileContents(file, filesize));
+    }
+    std::string contentHash (const FileBuffer & buffer) {
+        return hash::toHex(hash::fastHash128(buffer.data, buffer.size));
+    }
+    
+    typedef std::chrono::high_resolution_clock Clock;
+    
+    template <typename F>
+    static long timeMicroseconds (F f) {
+        auto t0 = Clock::now();
+        f();
+        return (long)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+    }
+    
+    void hashComparative (FILE* file, std::string & md5hash, std::string & sha1hash, std::string & murmurhash,
+                          HashTimingStats & stats, long int filesize) {
+        FileContents contents (file, filesize);
+        std::string fasthash;
+        
+        // Touch every page first, so that whichever hash runs first doesn't eat the page faults
+        volatile uint8_t sink = 0;
+        for (size_t i = 0; i < contents.size; i += 4096)
+            sink += contents.data[i];
+        
+        HashTimingStats::Sample sample;
+        sample.file_size   = (long)contents.size;
+        sample.md5_time    = timeMicroseconds([&]() { md5hash    = md5(contents); });
+        sample.sha1_time   = timeMicroseconds([&]() { sha1hash   = sha1(contents); });
+        sample.murmur_time = timeMicroseconds([&]() { murmurhash = murmur(contents); });
+        sample.fast_time   = timeMicroseconds([&]() { fasthash   = fast(contents); });
+        stats.samples.push_back(sample);
+    }
+    
+    void hashComparative (const FilePath & path, std::string & md5, std::string & sha1, std::string & murmur,
+                          HashTimingStats & stats, std::function<void(const FilePath &)> handleFileOpenError) {
+        FILE* file = nullptr;
+        auto fopen_time = timeMicroseconds([&]() { file = fopen(path.c_str(), "rb"); });
+        if (!file) {
+            if (handleFileOpenError)
+                handleFileOpenError(path);
+            return;
+        }
+        try {
+            hashComparative(file, md5, sha1, murmur, stats);
+        } catch (...) {
+            fclose(file);
+            throw;
+        }
+        fclose(file);
+        stats.samples.back().fopen_time = fopen_time;
+        stats.samples.back().used_fopen = true;
+    }
+    
+    HashTimingStats::Throughput HashTimingStats::throughput () const {
+        double bytes = 0, md5 = 0, sha1 = 0, murmur = 0, fast = 0;
+        for (auto & sample : samples) {
+            bytes  += sample.file_size;
+            md5    += sample.md5_time;
+            sha1   += sample.sha1_time;
+            murmur += sample.murmur_time;
+            fast   += sample.fast_time;
+        }
+        // bytes / us == MB/s (w/ MB = 1e6 bytes)
+        auto rate = [bytes](double us) { return us > 0 ? bytes / us : 0.0; };
+        Throughput result;
+        result.md5    = rate(md5);
+        result.sha1   = rate(sha1);
+        result.murmur = rate(murmur);
+        result.fast   = rate(fast);
+        return result;
+    }
+};
+
 // ============================================================
 //                      FILE PATH UTILS
 // ============================================================
@@ -13,6 +13,7 @@
 #include <stdexcept>
 #include <vector>
 #include <string>
+#include "../span.hpp"
 
 namespace gl_sandbox {
 
@@ -59,9 +60,12 @@ template <typename T>
 
 
 namespace gl_sandbox {
+class ResidencyManager;
+namespace resource_impl {
     
+// Returns a string (not the stack buffer, which gcc turns into a null pointer at -O2)
 template <typename... Args>
-const char * fmtArgs (const char * fmt, Args... args) {
+std::string fmtArgs (const char * fmt, Args... args) {
     char sbuf [512];
     snprintf(sbuf, sizeof(sbuf), fmt, args...);
     return sbuf;
@@ -73,9 +77,6 @@ struct ResourceError : public std::runtime_error {
         std::runtime_error(fmtArgs(fmt, args...)) {}
 };
     
-    
-namespace resource_impl {
-    
 typedef std::string FilePath;
     
 struct FileBuffer {
@@ -97,6 +98,23 @@ public:
 };
 typedef std::shared_ptr<FileBuffer> FileBufferRef;
     
+// Chunked (streaming) loads: the file is read chunkSize bytes at a time into one of maxChunksInFlight
+// buffers, which get recycled once onChunk returns. Reading runs ahead of the consumer by at most
+// that many chunks (so 2 == double buffered: chunk N+1 is read while chunk N is being processed),
+// and stops -- w/out tying up an io thread -- until the consumer catches up.
+struct StreamOptions {
+    size_t   chunkSize = 1 << 20;
+    unsigned maxChunksInFlight = 2;
+};
+typedef Span<const uint8_t> ChunkSpan;
+    
+// Registers mmapped files (loadFileMappedImmediate / loadFileMappedAsync) w/ manager, under
+// ResidencyCategory::FILE_BUFFERS: mapping an unchanged file again reuses the resident mapping
+// until the category's budget evicts it. Null (the default) maps the file every time. Set once,
+// right after creating the manager (ResourceLoader::residency() does), so it outlives the
+// registrations.
+void setResidencyManager (ResidencyManager * manager);
+    
 namespace utils {
     FilePath joinPath (const FilePath & first, const FilePath & rest);
     
@@ -127,20 +145,32 @@ namespace filehash {
     std::string & sha1hash   (FILE* file, std::string & hashvalue, long int filesize = -1);
     std::string & murmurhash (FILE* file, std::string & hashvalue, long int filesize = -1);
     
-    // Hash timing info generated from hashComparative(...) calls
+    // Fast non-cryptographic 128-bit hash (see hash::FastHash64). Use this for content addressing.
+    std::string & fasthash   (FILE* file, std::string & hashvalue, long int filesize = -1);
+    
+    // fasthash of an already loaded buffer (32 hex chars)
+    std::string contentHash (const FileBuffer & buffer);
+    
+    // Hash timing info generated from hashComparative(...) calls. Times are in microseconds.
     struct HashTimingStats {
         struct Sample {
             long file_size = 0;
             long md5_time  = 0;
             long sha1_time = 0;
             long murmur_time = 0;
+            long fast_time   = 0;
             long fopen_time  = 0;  // set iff using FilePath, not FILE*
             bool used_fopen = false;
         };
         std::vector<Sample> samples;
+        
+        // Sums over all samples, as MB/s per hash
+        struct Throughput { double md5 = 0, sha1 = 0, murmur = 0, fast = 0; };
+        Throughput throughput () const;
     };
     
-    // Run all hashes and collect timing info.
+    // Run all hashes and collect timing info (appends one sample per call). The file is mapped /
+    // read once up front, so the hash times don't include io.
     void hashComparative (FILE* file, std::string & md5, std::string & sha1, std::string & murmur,
                           HashTimingStats & stats, long int filesize = -1);
     
@@ -156,10 +186,26 @@ namespace async {
     typedef ThreadCallable<void(const FilePath&)>           FilePathCallback;
     typedef ThreadCallable<void(const FilePath&, errno_t)>  CFileErrorCallback;
     
+    // chunk is only valid until the callback returns; return false to stop reading (onEnd won't be called).
+    typedef ThreadCallable<bool(ChunkSpan chunk, size_t offset)> ChunkCallback;
+    typedef ThreadCallable<void(const FilePath&, size_t totalBytes)> StreamEndCallback;
+    
     // Load
     void loadFileAsync (const FilePath & path,
                         const FileBufferCallback & onLoad,
                         const FilePathCallback & onFail);
+    
+    // Batched version of the above: all reads are submitted together (one io_uring submission on
+    // linux), and callbacks are invoked per file as each one finishes.
+    void loadFilesAsync (const std::vector<FilePath> & paths,
+                         const FileBufferCallback & onLoad,
+                         const FilePathCallback & onFail);
+    
+    // Load via mmap (zero-copy). Buffer is read-only, not null-terminated, and gets unmapped
+    // when the last FileBufferRef is released.
+    void loadFileMappedAsync (const FilePath & path,
+                              const FileBufferCallback & onLoad,
+                              const FilePathCallback & onFail);
     void loadFileAsync (const FilePath & path,
                         const IFStreamCallback & onLoad,
                         const FilePathCallback & onFail);
@@ -167,6 +213,22 @@ namespace async {
                         const char * mode,
                         const CFileCallback & onLoad,
                         const CFileErrorCallback & onFail);
+    
+    // Streams path in chunks (see StreamOptions). Chunks are delivered in order, then onEnd; or
+    // onError at the point a read failed (chunks before it still get delivered).
+    void streamFileAsync (const FilePath & path,
+                          const StreamOptions & options,
+                          const ChunkCallback & onChunk,
+                          const StreamEndCallback & onEnd,
+                          const CFileErrorCallback & onError);
+    
+    // Loads run on io threads, but callbacks are delivered to the thread that issued the request,
+    // and only run when that thread calls dispatchCallbacks() (eg. once per frame on the main thread).
+    // Returns the number of callbacks run.
+    unsigned dispatchCallbacks ();
+    
+    // Number of finished loads waiting on dispatchCallbacks() for the calling thread.
+    size_t numPendingCallbacks ();
 };
     
 // Immediate (non-threaded) file loading
@@ -176,10 +238,15 @@ namespace immediate {
     typedef std::function<void(FILE*)>                      CFileCallback;
     typedef std::function<void(const FilePath&)>            FilePathCallback;
     typedef std::function<void(const FilePath&, errno_t)>   CFileErrorCallback;
+    typedef std::function<bool(ChunkSpan, size_t)>          ChunkCallback;
+    typedef std::function<void(const FilePath&, size_t)>    StreamEndCallback;
     
     bool loadFileImmediate (const FilePath & path,
                             const FileBufferCallback & onLoad,
                             const FilePathCallback & onFail);
+    bool loadFileMappedImmediate (const FilePath & path,
+                                  const FileBufferCallback & onLoad,
+                                  const FilePathCallback & onFail);
     bool loadFileImmediate (const FilePath & path,
                             const IFStreamCallback & onLoad,
                             const FilePathCallback & onFail);
@@ -187,6 +254,14 @@ namespace immediate {
                             const char * mode,
                             const CFileCallback & onLoad,
                             const CFileErrorCallback & onFail);
+    
+    // Same as streamFileAsync, but reads + calls onChunk inline (one buffer, no read-ahead).
+    // Returns true iff the whole file was streamed.
+    bool streamFileImmediate (const FilePath & path,
+                              const StreamOptions & options,
+                              const ChunkCallback & onChunk,
+                              const StreamEndCallback & onEnd,
+                              const CFileErrorCallback & onError);
 };
     
 }; // namespace resource_impl
@@ -18,12 +18,15 @@
 
 #include "resource_impl.hpp"
 #include "resource_layer_declarative.hpp"
+#include "pack_file.hpp"
 
 namespace gl_sandbox {
 namespace resource {
 using resource_impl::FilePath;
 using resource_impl::FileBuffer;
 using resource_impl::FileBufferRef;
+using resource_impl::ChunkSpan;
+using resource_impl::StreamOptions;
     
 using resource_impl::utils::resolvedPath;
 using resource_impl::utils::joinPath;
@@ -33,12 +36,35 @@ struct ResourceLayer {
     static auto loadAsBuffer (const FilePath & path) {
         return declarative::LoadAsFileBuffer { resolvedPath(path) };
     }
+    static auto loadAsMappedBuffer (const FilePath & path) {
+        return declarative::LoadAsMappedFileBuffer { resolvedPath(path) };
+    }
     static auto loadAsCFile (const FilePath & path, const char * mode) {
         return declarative::LoadAsCFile { resolvedPath(path), mode };
     }
     static auto loadAsFStream (const FilePath & path) {
         return declarative::LoadAsIFstream { resolvedPath(path) };
     }
+    static auto loadAsStream (const FilePath & path) {
+        return declarative::LoadAsStream { resolvedPath(path) };
+    }
+    
+    // Serves loads under root from a pack file (see pack_file.hpp) -- except for loadAsFStream,
+    // which needs a real file. By default, loose files still win in debug builds (so edits show
+    // up w/out repacking), and release builds never look past the pack.
+#ifdef DEBUG
+    static constexpr auto DEFAULT_LOOSE_FILES = resource_impl::packs::LooseFiles::OVERRIDE;
+#else
+    static constexpr auto DEFAULT_LOOSE_FILES = resource_impl::packs::LooseFiles::IGNORE;
+#endif
+    static bool mountPack (const FilePath & packPath, const FilePath & root, std::string & err,
+                           resource_impl::packs::LooseFiles looseFiles = DEFAULT_LOOSE_FILES) {
+        return resource_impl::packs::mount(resolvedPath(packPath), root.empty() ? root : resolvedPath(root),
+                                           looseFiles, err);
+    }
+    static void unmountPacks () {
+        resource_impl::packs::unmountAll();
+    }
 };
     
     
@@ -36,6 +36,25 @@ public:
     }
 };
     
+class LoadAsMappedFileBuffer {
+    FilePath m_filePath;
+    async::FileBufferCallback m_onLoad { nullptr };
+    async::FilePathCallback   m_onFail { nullptr };
+    
+public:
+    LoadAsMappedFileBuffer (const FilePath & path) : m_filePath(path) {}
+    auto & onLoaded (decltype(m_onLoad) onLoad) {
+        return m_onLoad = onLoad, *this;
+    }
+    auto & onLoadFailed (decltype(m_onFail) onFail) {
+        return m_onFail = onFail, *this;
+    }
+    ~LoadAsMappedFileBuffer () {
+        assert(m_onLoad || m_onFail);
+        async::loadFileMappedAsync(m_filePath, m_onLoad, m_onFail);
+    }
+};
+    
 class LoadAsCFile {
     FilePath m_filePath;
     std::string m_mode;
@@ -76,6 +95,44 @@ public:
     }
 };
     
+// Chunked load (see StreamOptions): onChunk gets called w/ each chunk in order, on this
+// thread (from dispatchCallbacks), then onEnd. Return false from onChunk to stop early.
+//
+//   ResourceLayer::loadAsStream(path).chunkSize(4 << 20)
+//       .onChunk([&](ChunkSpan chunk, size_t offset) { return parser.feed(chunk); })
+//       .onEnd([&](auto path, size_t size) { parser.finish(); })
+//       .onError([](auto path, auto err) { ... });
+class LoadAsStream {
+    FilePath m_filePath;
+    StreamOptions m_options;
+    async::ChunkCallback      m_onChunk { nullptr };
+    async::StreamEndCallback  m_onEnd   { nullptr };
+    async::CFileErrorCallback m_onError { nullptr };
+    
+public:
+    LoadAsStream (const FilePath & path) : m_filePath(path) {}
+    auto & chunkSize (size_t bytes) {
+        return m_options.chunkSize = bytes, *this;
+    }
+    // Max chunks read ahead of the consumer (2 => double buffered). Reads pause past this.
+    auto & maxChunksInFlight (unsigned count) {
+        return m_options.maxChunksInFlight = count, *this;
+    }
+    auto & onChunk (decltype(m_onChunk) onChunk) {
+        return m_onChunk = onChunk, *this;
+    }
+    auto & onEnd (decltype(m_onEnd) onEnd) {
+        return m_onEnd = onEnd, *this;
+    }
+    auto & onError (decltype(m_onError) onError) {
+        return m_onError = onError, *this;
+    }
+    ~LoadAsStream () {
+        assert(m_onChunk);
+        async::streamFileAsync(m_filePath, m_options, m_onChunk, m_onEnd, m_onError);
+    }
+};
+    
 }; // namespace declarative
 }; // namespace resource
 }; // namespace gl_sandbox
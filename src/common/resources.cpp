@@ -13,9 +13,16 @@
 #include "../../libs/tinyobjloader/tiny_obj_loader.h"
 
 #include "resources.hpp"
+#include "asset_cache.hpp"
+#include "obj_parser.hpp"
+#include "resourcelayer/resource_layer.hpp"
+#include "resourcelayer/async_file_reader.hpp"
 #include "app.hpp"
 #include <boost/format.hpp>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 
 using namespace gl_sandbox;
 
@@ -24,9 +31,56 @@ typedef ResourceLoader::ObjHandler ObjHandler;
 typedef ResourceLoader::TextHandler TextHandler;
 typedef ResourceLoader::ImageHandler ImageHandler;
 typedef ResourceLoader::ErrorHandler ErrorHandler;
+typedef RequestTable::CancelCheck CancelCheck;
+
+// Cancellation checkpoint for the (optionally) cancellable loaders below; called right before
+// the expensive part (decode / parse), after any cache hit has already been taken.
+static bool isCancelled (const CancelCheck & cancelled, std::string & err) {
+    return cancelled && cancelled() ? (err = "cancelled", true) : false;
+}
+
+// Missing files keep their absolute path (loads just fail for everyone that asks for them).
+static std::string canonicalPath (const Path & filepath) {
+    boost::system::error_code ec;
+    auto path = boost::filesystem::canonical(filepath, ec);
+    if (ec)
+        path = boost::filesystem::absolute(filepath);
+    return path.string();
+}
+
+// Registers filepath's loaded form w/ residency() under category, so loading an unchanged file
+// again is served from memory until the category's budget evicts it. One registration per
+// (canonical) path; an edited file (new write time) replaces it.
+template <typename T>
+static ResidencyManager::Handle<T> residentHandle (ResidencyCategory category, const Path & filepath,
+                                                   std::function<std::shared_ptr<T>(size_t & bytes, std::string & err)> load) {
+    auto & manager = ResourceLoader::residency();   // first, so it outlives the handles below
+    struct Entry {
+        std::time_t writeTime;
+        ResidencyManager::Handle<T> handle;
+    };
+    static std::mutex mutex;
+    static std::unordered_map<std::string, Entry> handles;
+    
+    auto path = canonicalPath(filepath);
+    boost::system::error_code ec;
+    auto writeTime = boost::filesystem::last_write_time(path, ec);
+    if (ec)
+        writeTime = 0;  // (packed / missing)
+    
+    std::lock_guard<std::mutex> lock (mutex);
+    auto & entry = handles[path];
+    if (!entry.handle || entry.writeTime != writeTime) {
+        entry.writeTime = writeTime;
+        entry.handle = manager.add<T>(category, path + '@' + std::to_string(writeTime), load);
+    }
+    return entry.handle;
+}
 
 
 boost::filesystem::path ResourceLoader::g_baseResourcePath;
+std::unique_ptr<AssetCache> ResourceLoader::g_assetCache;
+std::unique_ptr<PathIndex> ResourceLoader::g_pathIndex;
 
 #define RESOURCE_ERROR(msg, rest) ResourceError { (format("ResourceError: " msg) % rest).str() }
 
@@ -38,6 +92,17 @@ bool ResourceLoader::loadTextFile(
     using namespace boost::filesystem;
     using boost::format;
     
+    if (auto packed = resource_impl::packs::find(filepath.string())) {
+        std::string err;
+        auto text = packed.pack->load(*packed.entry, filepath.string(), true, err);  // null-terminated copy
+        if (!text)
+            return onError(RESOURCE_ERROR("%s", err)), false;
+        if (text->size == 0)
+            return onError(RESOURCE_ERROR("Empty file '%s'", filepath)), false;
+        onComplete((const char*)text->data);
+        return true;
+    }
+    
     if (!exists(filepath))
         return onError(RESOURCE_ERROR("File '%s' does not exist\n", filepath)), false;
     
@@ -61,105 +126,480 @@ bool ResourceLoader::loadTextFile(
     return true;
 }
 
+bool ResourceLoader::loadShaderSource (const Path & filepath, TextHandler onComplete, ErrorHandler onError,
+                                       const ShaderPreprocessor::Defines & defines) {
+    using boost::format;
+    std::string err;
+    auto source = ShaderPreprocessor::shared().preprocess(filepath.string(), defines, err);
+    if (!source)
+        return onError(RESOURCE_ERROR("%s", err)), false;
+    onComplete(source->c_str());
+    return true;
+}
+
+void ResourceLoader::setAssetCacheDir (const Path & dir) {
+    g_assetCache.reset(dir.empty() ? nullptr : new AssetCache(dir));
+}
+
+// Bump these whenever the corresponding decode / serialization changes (invalidates old entries)
+static constexpr uint32_t IMAGE_CACHE_VERSION = 1;
+static constexpr uint32_t OBJ_CACHE_VERSION   = 1;
+
+// Decoded image pixels; owned by stb_image, or pointing into a (mmapped) cache entry.
+struct DecodedImage {
+    ResourceLoader::ImageInfo info;
+    const uint8_t *   pixels = nullptr;
+    AssetCache::Entry cached;
+    
+    DecodedImage () {}
+    DecodedImage (const DecodedImage &) = delete;
+    DecodedImage & operator= (const DecodedImage &) = delete;
+    ~DecodedImage () {
+        if (pixels && !cached)
+            stbi_image_free((void*)pixels);
+    }
+};
+
+static bool decodeImage (const Path & filepath, DecodedImage & image, std::string & err) {
+    auto & info = image.info;
+    auto cache = ResourceLoader::assetCache();
+    if (!cache && !resource_impl::packs::anyMounted()) {
+        image.pixels = stbi_load(filepath.string().c_str(), &info.size_x, &info.size_y, &info.image_format, 0);
+        return image.pixels ? true : (err = stbi_failure_reason(), false);
+    }
+    
+    // Map the source once (or get it from a pack): hash it for the cache key, and decode from
+    // memory on a miss.
+    bool loaded = resource_impl::immediate::loadFileMappedImmediate(filepath.string(),
+    [&](const resource_impl::FileBufferRef & source) {
+        AssetCache::Key key;
+        if (cache && (image.cached = cache->lookup(key = AssetCache::makeKey(source->data, source->size, "image", IMAGE_CACHE_VERSION)))) {
+            BlobReader reader (image.cached.data, image.cached.size);
+            if (reader.read(info) && info.size_x > 0 && info.size_y > 0 && info.image_format > 0 &&
+                (image.pixels = reader.readSpan((size_t)info.size_x * info.size_y * info.image_format)))
+                return;
+            image.cached = AssetCache::Entry();
+        }
+        image.pixels = stbi_load_from_memory(source->data, (int)source->size,
+                                             &info.size_x, &info.size_y, &info.image_format, 0);
+        if (!image.pixels) {
+            err = stbi_failure_reason();
+            return;
+        }
+        if (!cache)
+            return;
+        BlobWriter blob;
+        blob.write(info);
+        blob.writeBytes(image.pixels, (size_t)info.size_x * info.size_y * info.image_format);
+        cache->store(key, blob.data);
+    }, [&](const resource_impl::FilePath &) {
+        err = "Cannot open image file '" + filepath.string() + "'";
+    });
+    return loaded && image.pixels;
+}
+
+// Decoded images stay resident (ResidencyCategory::IMAGES) between loads. The loader outlives the
+// request that first runs it, so cancellation is only checked before acquiring.
+static std::shared_ptr<DecodedImage> residentImage (const Path & filepath, std::string & err,
+                                                    const CancelCheck & cancelled = nullptr) {
+    if (isCancelled(cancelled, err))
+        return nullptr;
+    auto handle = residentHandle<DecodedImage>(ResidencyCategory::IMAGES, filepath,
+    [filepath](size_t & bytes, std::string & err) -> std::shared_ptr<DecodedImage> {
+        auto image = std::make_shared<DecodedImage>();
+        if (!decodeImage(filepath, *image, err))
+            return nullptr;
+        bytes = (size_t)image->info.size_x * image->info.size_y * image->info.image_format;
+        return image;
+    });
+    auto image = handle.acquire();
+    if (!image)
+        err = handle.error();
+    return image;
+}
+
 bool ResourceLoader::loadImage(
     const boost::filesystem::path &filepath,
     ImageHandler onComplete,
     ErrorHandler onError
 ) {
-    ImageInfo info;
-    const uint8_t * image_data = stbi_load(filepath.string().c_str(), &info.size_x, &info.size_y, &info.image_format, 0);
-    if (image_data != nullptr) {
-        onComplete(image_data, info);
-        stbi_image_free((void*)image_data);
+    std::string err;
+    if (auto image = residentImage(filepath, err)) {
+        onComplete(image->pixels, image->info);
         return true;
     } else {
-        onError(ResourceError { stbi_failure_reason() });
+        onError(ResourceError { err });
         return false;
     }
 }
 
-void ResourceLoader::loadImageAsync (const Path & filepath, ImageHandler onComplete, ErrorHandler onError) {
-    auto r = std::async([=](){
-        ImageInfo info;
-        const uint8_t * image_data = stbi_load(filepath.string().c_str(), &info.size_x, &info.size_y, &info.image_format, 0);
-        if (image_data != nullptr) {
-            runOnMainThread([=] {
-                onComplete(image_data, info);
-                stbi_image_free((void*)image_data);
-            });
-        } else {
-            std::string fail_reason { stbi_failure_reason() };
-            runOnMainThread([=] {
-                onError(ResourceError { fail_reason });
-            });
+void ResourceLoader::loadImageAsync (const Path & filepath, ImageHandler onComplete, ErrorHandler onError, LoadPriority priority) {
+    submitRequest("image", filepath, priority, [filepath](std::string & err, const CancelCheck & cancelled) {
+        return residentImage(filepath, err, cancelled);
+    }, [onComplete](const RequestTable::Result & result) {
+        auto image = std::static_pointer_cast<const DecodedImage>(result);
+        onComplete(image->pixels, image->info);
+    }, onError);
+}
+
+static void serializeObj (const ResourceLoader::ObjData & obj, BlobWriter & blob) {
+    blob.write((uint64_t)obj.shapes.size());
+    for (auto & shape : obj.shapes) {
+        blob.write(shape.name);
+        blob.write(shape.mesh.positions);
+        blob.write(shape.mesh.normals);
+        blob.write(shape.mesh.texcoords);
+        blob.write(shape.mesh.indices);
+        blob.write(shape.mesh.material_ids);
+    }
+    blob.write((uint64_t)obj.materials.size());
+    for (auto & material : obj.materials) {
+        blob.write(material.name);
+        blob.writeBytes(material.ambient,       sizeof(material.ambient));
+        blob.writeBytes(material.diffuse,       sizeof(material.diffuse));
+        blob.writeBytes(material.specular,      sizeof(material.specular));
+        blob.writeBytes(material.transmittance, sizeof(material.transmittance));
+        blob.writeBytes(material.emission,      sizeof(material.emission));
+        blob.write(material.shininess);
+        blob.write(material.ior);
+        blob.write(material.dissolve);
+        blob.write(material.illum);
+        blob.write(material.ambient_texname);
+        blob.write(material.diffuse_texname);
+        blob.write(material.specular_texname);
+        blob.write(material.specular_highlight_texname);
+        blob.write(material.bump_texname);
+        blob.write(material.displacement_texname);
+        blob.write(material.alpha_texname);
+        blob.write((uint64_t)material.unknown_parameter.size());
+        for (auto & kv : material.unknown_parameter) {
+            blob.write(kv.first);
+            blob.write(kv.second);
+        }
+    }
+}
+
+static bool deserializeObj (BlobReader & blob, ResourceLoader::ObjData & obj) {
+    uint64_t count;
+    if (!blob.read(count))
+        return false;
+    obj.shapes.resize((size_t)std::min<uint64_t>(count, 1 << 20));
+    for (auto & shape : obj.shapes) {
+        blob.read(shape.name);
+        blob.read(shape.mesh.positions);
+        blob.read(shape.mesh.normals);
+        blob.read(shape.mesh.texcoords);
+        blob.read(shape.mesh.indices);
+        blob.read(shape.mesh.material_ids);
+    }
+    if (!blob.read(count))
+        return false;
+    obj.materials.resize((size_t)std::min<uint64_t>(count, 1 << 20));
+    for (auto & material : obj.materials) {
+        blob.read(material.name);
+        blob.readBytes(material.ambient,       sizeof(material.ambient));
+        blob.readBytes(material.diffuse,       sizeof(material.diffuse));
+        blob.readBytes(material.specular,      sizeof(material.specular));
+        blob.readBytes(material.transmittance, sizeof(material.transmittance));
+        blob.readBytes(material.emission,      sizeof(material.emission));
+        blob.read(material.shininess);
+        blob.read(material.ior);
+        blob.read(material.dissolve);
+        blob.read(material.illum);
+        blob.read(material.ambient_texname);
+        blob.read(material.diffuse_texname);
+        blob.read(material.specular_texname);
+        blob.read(material.specular_highlight_texname);
+        blob.read(material.bump_texname);
+        blob.read(material.displacement_texname);
+        blob.read(material.alpha_texname);
+        uint64_t numParams = 0;
+        blob.read(numParams);
+        for (uint64_t i = 0; i < numParams && blob.ok(); ++i) {
+            std::string key, value;
+            blob.read(key);
+            blob.read(value);
+            material.unknown_parameter[key] = value;
         }
+    }
+    return blob.ok() && blob.atEnd();
+}
+
+// Note: the cache key only covers the .obj itself, not any .mtl files it references -- if you
+// edit a material library, bump OBJ_CACHE_VERSION (or clear the cache dir).
+static bool parseObj (const Path & filepath, ResourceLoader::ObjData & obj, std::string & err,
+                      const CancelCheck & cancelled = nullptr) {
+    auto cache = ResourceLoader::assetCache();
+    if (!cache)
+        return !isCancelled(cancelled, err) && obj::loadObj(filepath.string(), obj.shapes, obj.materials, err);
+    
+    bool ok = false;
+    resource_impl::immediate::loadFileMappedImmediate(filepath.string(),
+    [&](const resource_impl::FileBufferRef & source) {
+        auto key = AssetCache::makeKey(source->data, source->size, "obj", OBJ_CACHE_VERSION);
+        if (auto entry = cache->lookup(key)) {
+            BlobReader reader (entry.data, entry.size);
+            if ((ok = deserializeObj(reader, obj)))
+                return;
+            obj.shapes.clear();
+            obj.materials.clear();
+        }
+        if (isCancelled(cancelled, err))
+            return;
+        if ((ok = obj::parseObj((const char*)source->data, source->size, obj.shapes, obj.materials, err))) {
+            BlobWriter blob;
+            serializeObj(obj, blob);
+            cache->store(key, blob.data);
+        }
+    }, [&](const resource_impl::FilePath &) {
+        // Unmappable (eg. empty) files: let loadObj sort it out / report the error
+        ok = obj::loadObj(filepath.string(), obj.shapes, obj.materials, err);
     });
-    m_runningTasks.push_back(std::move(r));
+    return ok;
 }
 
 bool ResourceLoader::loadObj(const Path &filepath, ObjHandler onComplete, ErrorHandler onError
 ) {
     ObjData obj;
     std::string err;
-    if (tinyobj::LoadObj(obj.shapes, obj.materials, err, filepath.string().c_str()))
+    if (parseObj(filepath, obj, err))
         return onComplete(obj), true;
     else
         return onError(ResourceError { err }), false;
 }
 
-void ResourceLoader::loadObjAsync(const Path &filepath, ObjHandler onComplete, ErrorHandler onError) {
-    auto r = std::async(std::launch::async, [=](){
+void ResourceLoader::loadObjAsync(const Path &filepath, ObjHandler onComplete, ErrorHandler onError, LoadPriority priority) {
+    submitRequest("obj", filepath, priority, [filepath](std::string & err, const CancelCheck & cancelled) {
         auto objData = std::make_shared<ObjData>();
-        std::string err;
+        return parseObj(filepath, *objData, err, cancelled) ? objData : nullptr;
+    }, [onComplete](const RequestTable::Result & result) {
+        onComplete(*std::static_pointer_cast<const ObjData>(result));
+    }, onError);
+}
+
+void ResourceLoader::submitObjRequest(const char * kind, const Path & filepath, LoadPriority priority,
+                                      std::function<RequestTable::Result(const ObjData &)> process,
+                                      std::function<void(const RequestTable::Result &)> onComplete, ErrorHandler onError) {
+    submitRequest(kind, filepath, priority, [filepath, process](std::string & err, const CancelCheck & cancelled) -> RequestTable::Result {
+        ObjData objData;
+        if (!parseObj(filepath, objData, err, cancelled) || isCancelled(cancelled, err))
+            return nullptr;
+        return process(objData);
+    }, onComplete, onError);
+}
+
+// Bump when the obj -> mesh conversion changes (the mesh format version is folded into the key too)
+static constexpr uint32_t MESH_CACHE_VERSION = 1;
+
+// .obj files get converted (through the asset cache); anything else is assumed to be a binary mesh.
+static bool loadMeshData (const Path & filepath, mesh::MeshView & mesh, std::string & err) {
+    bool ok = false;
+    bool isObj = filepath.extension() == ".obj";
+    resource_impl::immediate::loadFileMappedImmediate(filepath.string(),
+    [&](const resource_impl::FileBufferRef & source) {
+        if (!isObj) {
+            ok = mesh::parseMesh(source, source->data, source->size, mesh, err);
+            return;
+        }
+        auto cache = ResourceLoader::assetCache();
+        AssetCache::Key key;
+        if (cache) {
+            key = AssetCache::makeKey(source->data, source->size, "mesh", (MESH_CACHE_VERSION << 16) | mesh::MESH_VERSION);
+            if (auto entry = cache->lookup(key))
+                if ((ok = mesh::parseMesh(entry.file, entry.data, entry.size, mesh, err)))
+                    return;
+        }
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        auto blob = std::make_shared<std::vector<uint8_t>>();
+        if (!obj::parseObj((const char*)source->data, source->size, shapes, materials, err) ||
+            !mesh::convertObj(shapes, true, *blob, err))
+            return;
+        if (cache)
+            cache->store(key, *blob);
+        
+        // No cache (or first load): hand out the converted blob itself
+        auto storage = std::make_shared<resource_impl::FileBuffer>(filepath.string(), &(*blob)[0], blob->size(),
+            [blob](resource_impl::FileBuffer &) {});
+        ok = mesh::parseMesh(storage, storage->data, storage->size, mesh, err);
+    }, [&](const resource_impl::FilePath &) {
+        err = "Cannot open mesh file '" + filepath.string() + "'";
+    });
+    return ok;
+}
+
+// Loaded meshes stay resident (ResidencyCategory::MESHES) between loads; their size is what
+// their spans cover.
+static std::shared_ptr<mesh::MeshView> residentMesh (const Path & filepath, std::string & err,
+                                                     const CancelCheck & cancelled = nullptr) {
+    if (isCancelled(cancelled, err))
+        return nullptr;
+    auto handle = residentHandle<mesh::MeshView>(ResidencyCategory::MESHES, filepath,
+    [filepath](size_t & bytes, std::string & err) -> std::shared_ptr<mesh::MeshView> {
+        auto mesh = std::make_shared<mesh::MeshView>();
+        if (!loadMeshData(filepath, *mesh, err))
+            return nullptr;
+        bytes = mesh->indices.bytes();
+        for (size_t i = 0; i < mesh->streams.size(); ++i) {
+            auto & block = mesh->streams[i].block;
+            bool shared = false;    // interleaved streams share a block
+            for (size_t j = 0; j < i && !shared; ++j)
+                shared = mesh->streams[j].block.data == block.data;
+            if (!shared)
+                bytes += block.bytes();
+        }
+        return mesh;
+    });
+    auto mesh = handle.acquire();
+    if (!mesh)
+        err = handle.error();
+    return mesh;
+}
+
+bool ResourceLoader::loadMesh(const Path &filepath, MeshHandler onComplete, ErrorHandler onError) {
+    std::string err;
+    if (auto mesh = residentMesh(filepath, err))
+        return onComplete(*mesh), true;
+    else
+        return onError(ResourceError { err }), false;
+}
+
+void ResourceLoader::loadMeshAsync(const Path &filepath, MeshHandler onComplete, ErrorHandler onError, LoadPriority priority) {
+    submitRequest("mesh", filepath, priority, [filepath](std::string & err, const CancelCheck & cancelled) {
+        return residentMesh(filepath, err, cancelled);
+    }, [onComplete](const RequestTable::Result & result) {
+        onComplete(*std::static_pointer_cast<const mesh::MeshView>(result));
+    }, onError);
+}
+
+void ResourceLoader::loadTextFileAsync(const Path &filepath, TextHandler onComplete, ErrorHandler onError, LoadPriority priority) {
+    submitRequest("text", filepath, priority, [filepath](std::string & err, const CancelCheck &) {
+        auto text = std::make_shared<std::string>();
         
-        if (tinyobj::LoadObj(objData->shapes, objData->materials, err, filepath.string().c_str())) {
-            runOnMainThread([=]() {
-                onComplete(*objData);
-            });
+        boost::filesystem::ifstream f (filepath);
+        if (f) {
+            f.seekg(0, std::ios::end);
+            text->resize(f.tellg());
+            f.seekg(0, std::ios::beg);
+            f.read(&(*text)[0], text->size());
+        }
+        if (!f || text->empty()) {
+            err = "ResourceError: Cannot load text file '" + filepath.string() + "'";
+            text.reset();
+        }
+        return text;
+    }, [onComplete](const RequestTable::Result & result) {
+        onComplete(std::static_pointer_cast<const std::string>(result)->c_str());
+    }, onError);
+}
+
+// Constructed before (=> destroyed after) the io pool, so runner tasks never outlive the table.
+RequestTable & ResourceLoader::requestTable () {
+    static RequestTable table { [](ThreadPool::Task & task) { return ioPool().tryEnqueue(task); } };
+    return table;
+}
+
+// Coalescing key: kind + canonical path, so "./dragon.obj" and "dragon.obj" share a job.
+static std::string requestKey (const char * kind, const Path & filepath) {
+    return std::string(kind) + ':' + canonicalPath(filepath);
+}
+
+void ResourceLoader::submitRequest(const char * kind, const Path & filepath, LoadPriority priority, RequestTable::Work work,
+                                   std::function<void(const RequestTable::Result &)> onComplete, ErrorHandler onError) {
+    requestTable().submit(requestKey(kind, filepath), priority, m_lifetime, work,
+    [this, onComplete, onError](const RequestTable::Result & result, const std::string & err) {
+        // Called under m_lifetime's lock, so this is still alive
+        if (result) {
+            runOnMainThread([=]() { onComplete(result); });
         } else {
-            runOnMainThread([=](){
-                onError(ResourceError { err });
-            });
+            runOnMainThread([=]() { onError(ResourceError { err }); });
         }
     });
-    m_runningTasks.push_back(std::move(r));
+}
+
+ThreadPool & ResourceLoader::ioPool () {
+    requestTable();
+    static ThreadPool pool { ThreadPool::defaultThreadCount(), IO_POOL_QUEUE_DEPTH };
+    return pool;
+}
+
+ResidencyManager & ResourceLoader::residency () {
+    static ResidencyManager manager;
+    static bool registered = (resource_impl::setResidencyManager(&manager), true);
+    (void)registered;
+    return manager;
 }
 
 // Schedule arbitrary resource handling code to run on the main thread (used by ****Async methods)
 void ResourceLoader::runOnMainThread(std::function<void ()> f) {
-    std::lock_guard<std::mutex> lock { m_pendingTasksMutex };
-    m_pendingMainThreadTasks.push_back(f);
+    ++m_numPendingCallbacks;
+    m_pendingMainThreadTasks.push(std::move(f));
 }
 // Run arbitrary resource handling code, finishing async tasks on the main thread
 void ResourceLoader::finishAsyncTasks(double timeLimit) {
     assert(timeLimit > 0);
-    if (m_pendingMainThreadTasks.size() != 0) {
-        std::lock_guard<std::mutex> lock { m_pendingTasksMutex };
-        double t0 = glfwGetTime(), elapsed;
-        assert(m_pendingMainThreadTasks.size() != 0);
-        int n = 0;
-        do {        // always run at least 1 task in case timeLimit is f***-ed
-            ++n;
-            m_pendingMainThreadTasks.back()(); // execute callback(s) on main thread
-            m_pendingMainThreadTasks.pop_back();
-        } while ((elapsed = glfwGetTime() - t0) < timeLimit && m_pendingMainThreadTasks.size() != 0);
-        
-        std::cout << "ResourceLoader: Ran " << n << " task callback(s) in " << (elapsed * 1e3) << " ms";
-        elapsed > timeLimit ?
-            std::cout << " (Overflow! " << (elapsed * 1e3) << " > " << (timeLimit * 1e3) << ")\n" :
-            std::cout << '\n';
-        if (m_pendingMainThreadTasks.size() > 0)
-            std::cout << m_pendingMainThreadTasks.size() << " remaining.";
-    }
+    requestTable().schedule();
+    resource_impl::async_io::schedulePending();
+    
+    // Producers never wait on us: callbacks are popped off a lock-free queue one at a time, and
+    // the budget is checked against a monotonic clock after each one.
+    typedef std::chrono::steady_clock Clock;
+    auto & stats = m_asyncTaskStats;
+    stats.ran = 0;
+    stats.timeSpent = 0;
+    stats.overBudget = false;
+    
+    std::function<void()> task;
+    if (!m_pendingMainThreadTasks.tryPop(task))
+        return;
+    auto t0 = Clock::now();
+    double elapsed;
+    do {        // always run at least 1 task in case timeLimit is f***-ed
+        --m_numPendingCallbacks;
+        task();
+        task = nullptr;
+        ++stats.ran;
+    } while ((elapsed = std::chrono::duration<double>(Clock::now() - t0).count()) < timeLimit &&
+             m_pendingMainThreadTasks.tryPop(task));
+    
+    stats.timeSpent  = elapsed;
+    stats.overBudget = elapsed > timeLimit;
+    stats.totalRun  += stats.ran;
+    stats.totalOverBudget += stats.overBudget;
 }
 ResourceLoader::~ResourceLoader () {
-    if (m_pendingMainThreadTasks.size() != 0) {
-        std::cout << "UsageError: ResourceLoader had " << m_pendingMainThreadTasks.size() << " pending thread tasks at exit (check that you're calling finishAsyncTasks()!)  (from module w/ path " << m_modulePath << ")";
+    // Drops our waiters from any request table jobs (+ blocks until no callback is mid-delivery)
+    m_lifetime.cancel();
+    if (m_numPendingCallbacks != 0) {
+        std::cout << "UsageError: ResourceLoader had " << m_numPendingCallbacks << " pending thread tasks at exit (check that you're calling finishAsyncTasks()!)  (from module w/ path " << m_modulePath << ")";
     }
 }
 
+bool ResourceLoader::mountPack (const Path & pack, std::string & err) {
+    return resource::ResourceLayer::mountPack(pack.string(), g_baseResourcePath.string(), err);
+}
+
+void ResourceLoader::setPathWatcher (PathIndex::WatchFunction watch) {
+    g_pathIndex.reset(watch ? new PathIndex(g_baseResourcePath.empty() ? Path(".") : g_baseResourcePath, watch) : nullptr);
+}
+
 bool ResourceLoader::resolvePath(const char *filename, const char *moduleDir, Path &path) {
     using namespace boost::filesystem;
+    auto index = g_pathIndex.get();
+    if (index || resource_impl::packs::anyMounted()) {
+        const Path candidates[] = {
+            filename,
+            Path("common") / filename,
+            Path(moduleDir) / filename,
+            Path("modules") / moduleDir / filename
+        };
+        for (auto & candidate : candidates) {
+            if (resource_impl::packs::find((g_baseResourcePath / candidate).string()) ||
+                (index ? index->exists(candidate) : exists(g_baseResourcePath / candidate)))
+                return path = g_baseResourcePath / candidate, true;
+        }
+        return false;
+    }
     if (exists(g_baseResourcePath / filename))
         return path = g_baseResourcePath / filename, true;
     if (exists(g_baseResourcePath / "common" / filename))
@@ -10,14 +10,22 @@
 #define resources_hpp
 
 #include "./gl/gl_wrapper.hpp"
+#include "thread_pool.hpp"
+#include "request_table.hpp"
+#include "mpsc_queue.hpp"
+#include "path_index.hpp"
+#include "mesh_format.hpp"
+#include "residency.hpp"
+#include "shader_preprocessor.hpp"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include "../../libs/tinyobjloader/tiny_obj_loader.h"
 #include <string>
 #include <array>
-#include <future>
 #include <mutex>
+#include <memory>
+#include <type_traits>
 
 namespace gl_sandbox {
     
@@ -25,6 +33,7 @@ struct ResourceError : public std::runtime_error {
     using std::runtime_error::runtime_error; // constructor
 };
 class Application;
+class AssetCache;
 class ResourceLoader {
     friend class Application;
 public:
@@ -47,30 +56,109 @@ public:
     typedef std::function<void(const char *)> TextHandler;
     typedef std::function<void(const uint8_t *, const ImageInfo & info)> ImageHandler;
     typedef std::function<void (const ObjData &)> ObjHandler;
+    typedef std::function<void (const mesh::MeshView &)> MeshHandler;
     typedef std::function<void (const ResourceError &)> ErrorHandler;
     
     bool loadTextFile (const Path & filepath, TextHandler onComplete, ErrorHandler onError = dumpToStdout);
     bool loadImage (const Path & filepath, ImageHandler onComplete, ErrorHandler onError = dumpToStdout);
     bool loadObj (const Path & filepath, ObjHandler onComplete, ErrorHandler onError = dumpToStdout);
+    
+    // loadTextFile for glsl: expanded by ShaderPreprocessor::shared() (#includes resolved against
+    // the resource roots, defines injected after #version), and memoized per (file, define set).
+    bool loadShaderSource (const Path & filepath, TextHandler onComplete, ErrorHandler onError = dumpToStdout,
+                           const ShaderPreprocessor::Defines & defines = {});
+    
+    // Loads a binary mesh (see mesh_format.hpp) as spans into a single mapping -- ready to pass to
+    // glBufferData w/out any intermediate copies. .obj files are converted on first load and the
+    // result is kept in the asset cache, so subsequent loads are just an mmap.
+    bool loadMesh (const Path & filepath, MeshHandler onComplete, ErrorHandler onError = dumpToStdout);
 
     // Async versions. Guarantees that:
-    // - loading is done in parallel / on another thread (via std::async currently)
+    // - loading is done in parallel / on another thread (on the shared io pool -- see ioPool())
     // - callbacks get called on the main thread (cuz that's usually pretty important...)
     // - callbacks get called whenever they feel like it (ie. arbitrary)
     // - calling resourceLoader.finishAsyncTasks() is needed to actually _finish_ any of the tasks
     //   (so callback time is actually not totally arbitrary..)
+    // - requests go through a shared RequestTable (see request_table.hpp): concurrent loads of the
+    //   same file (from any ResourceLoader) share one job, PREFETCH loads run after VISIBLE ones,
+    //   and callbacks are dropped (+ unstarted work skipped) once this ResourceLoader is destroyed
     // Oh, and don't actually call any of these unless you actually _need_ it, since they have a lot of overhead
     // compared to the regular versions (ie. no async calls for 4kb text files...)
-    void loadTextFileAsync (const Path & filepath, TextHandler onComplete, ErrorHandler onError = dumpToStdout);
-    void loadImageAsync    (const Path & filepath, ImageHandler onComplete, ErrorHandler onError = dumpToStdout);
-    void loadObjAsync      (const Path & filepath, ObjHandler onComplete, ErrorHandler onError = dumpToStdout);
+    void loadTextFileAsync (const Path & filepath, TextHandler onComplete, ErrorHandler onError = dumpToStdout,
+                            LoadPriority priority = LoadPriority::VISIBLE);
+    void loadImageAsync    (const Path & filepath, ImageHandler onComplete, ErrorHandler onError = dumpToStdout,
+                            LoadPriority priority = LoadPriority::VISIBLE);
+    void loadObjAsync      (const Path & filepath, ObjHandler onComplete, ErrorHandler onError = dumpToStdout,
+                            LoadPriority priority = LoadPriority::VISIBLE);
+    void loadMeshAsync     (const Path & filepath, MeshHandler onComplete, ErrorHandler onError = dumpToStdout,
+                            LoadPriority priority = LoadPriority::VISIBLE);
+    
+    // loadObjAsync + process(const ObjData &) -> T, both run as one job on the io pool; onComplete
+    // gets the T (on the main thread, like the above). For work that's too slow to do in a callback
+    // (eg. mesh optimization). kind is part of the coalescing key, so use a distinct one per kind
+    // of processing: requests w/ the same kind + path share one job (and one call to process).
+    template <typename Process, typename Handler>
+    void processObjAsync (const Path & filepath, const char * kind, Process process, Handler onComplete,
+                          ErrorHandler onError = dumpToStdout, LoadPriority priority = LoadPriority::VISIBLE) {
+        typedef typename std::decay<typename std::result_of<Process(const ObjData &)>::type>::type T;
+        submitObjRequest(kind, filepath, priority, [process](const ObjData & obj) -> RequestTable::Result {
+            return std::make_shared<T>(process(obj));
+        }, [onComplete](const RequestTable::Result & result) {
+            onComplete(*std::static_pointer_cast<const T>(result));
+        }, onError);
+    }
     
     // Call this every frame / whatever if you're using async tasks -- does work (ie. callback execution) that is
     // expected to / needs to be called from the main thread. MUST be called from main thread.
     // Timelimit restricts async execution (as a rough ballpark -- actual time taken is >= timelimit) so this method
-    // can't hijack main thread execution + fuck up the framerate.
+    // can't hijack main thread execution + fuck up the framerate. Callbacks run in completion order.
     void finishAsyncTasks (double timelimit = 1.0 / 60);
     
+    // What finishAsyncTasks() did on its last call (+ running totals). Replaces the old per-call
+    // logging, so check this instead of stdout.
+    struct AsyncTaskStats {
+        unsigned ran        = 0;        // callbacks run by the last finishAsyncTasks()
+        double   timeSpent  = 0;        // seconds spent in them
+        bool     overBudget = false;    // last call ran past its time limit
+        size_t   pending    = 0;        // callbacks still waiting to run
+        size_t   totalRun   = 0;
+        size_t   totalOverBudget = 0;   // # of finishAsyncTasks() calls that ran past their time limit
+    };
+    AsyncTaskStats getAsyncTaskStats () const {
+        auto stats = m_asyncTaskStats;
+        stats.pending = m_numPendingCallbacks.load(std::memory_order_relaxed);
+        return stats;
+    }
+    
+    // Queued / running / completed counters for the shared io + decode pool.
+    static ThreadPool::Stats getIOPoolStats () { return ioPool().getStats(); }
+    static RequestTable::Stats getRequestStats () { return requestTable().getStats(); }
+    
+    // Cancelled when this ResourceLoader (ie. its module) goes away. Modules can use it for their
+    // own background work, too.
+    const CancellationToken & lifetime () const { return m_lifetime; }
+    
+    // Enables the processed-asset cache (see asset_cache.hpp): loadObj / loadImage (+ async versions)
+    // check it before parsing / decoding, and write results back to it on a miss. Set once at
+    // startup (from resources.asset_dirs.cached), before any loads are issued.
+    static void setAssetCacheDir (const Path & dir);
+    static AssetCache * assetCache () { return g_assetCache.get(); }
+    
+    // Makes resolvePath() use an in-memory index of the resource dirs (see path_index.hpp),
+    // kept in sync via watch. Pass nullptr to go back to stat()-ing every candidate path.
+    // Like setAssetCacheDir(), call this at startup / shutdown, not while loads are running.
+    static void setPathWatcher (PathIndex::WatchFunction watch);
+    
+    // Mounts an asset pack (see resourcelayer/pack_file.hpp) over the resource dir, so loads
+    // and resolvePath() are served from it. Same rules as setAssetCacheDir() -- startup only.
+    static bool mountPack (const Path & pack, std::string & err);
+    static PathIndex * pathIndex () { return g_pathIndex.get(); }
+    
+    // Shared budget for evictable resources (see residency.hpp): mapped files, decoded images +
+    // meshes (loadImage / loadMesh, + async versions), and eg. ObjViewer's models + shader programs.
+    // Budgets are set per category at startup (from resources.budgets); Application trims once a frame.
+    static ResidencyManager & residency ();
+    
     // Deprecated
     bool loadTextFile (const char * filename, const char * moduleDir, TextHandler onComplete, ErrorHandler onError = dumpToStdout);
     bool loadImage (const char * filename, const char * moduleDir, ImageHandler onComplete, ErrorHandler onError = dumpToStdout);
@@ -82,14 +170,33 @@ protected:
     }
     bool resolvePath (const char * filename, const char * moduleDir, Path & path);
     void runOnMainThread (std::function<void()>);
+    
+    // Submits an async load to the request table, keyed by kind + canonical path. onComplete /
+    // onError get run on the main thread (via runOnMainThread) if we're still alive by then.
+    void submitRequest (const char * kind, const Path & filepath, LoadPriority priority, RequestTable::Work work,
+                        std::function<void(const RequestTable::Result &)> onComplete, ErrorHandler onError);
+    // processObjAsync(): parses filepath, then runs process on it (on the same pool thread)
+    void submitObjRequest (const char * kind, const Path & filepath, LoadPriority priority,
+                           std::function<RequestTable::Result(const ObjData &)> process,
+                           std::function<void(const RequestTable::Result &)> onComplete, ErrorHandler onError);
+    static RequestTable & requestTable ();
+    
+    // Shared by all ResourceLoader instances, so a burst of loads scales w/ core count instead
+    // of spawning one thread per file. Queue depth is bounded; overflow waits in the request table.
+    static ThreadPool & ioPool ();
+    static constexpr size_t IO_POOL_QUEUE_DEPTH = 256;
 protected:
     static boost::filesystem::path g_baseResourcePath;
+    static std::unique_ptr<AssetCache> g_assetCache;
+    static std::unique_ptr<PathIndex> g_pathIndex;
     boost::filesystem::path m_modulePath;
     
     // thread stuff
-    std::mutex                            m_pendingTasksMutex;      // guards m_pendingMainThreadTasks
-    std::vector<std::function<void()>> m_pendingMainThreadTasks;    // list of stuff that needs to run on the main thread (LIFO stack; we don't care about execution order)
-    std::vector<std::future<void>>        m_runningTasks;           // list of running async stuff (throwaway)
+    MPSCQueue<std::function<void()>>      m_pendingMainThreadTasks; // stuff that needs to run on the main thread (pushed from any thread, run in FIFO order)
+    std::atomic<size_t>                   m_numPendingCallbacks { 0 };
+    AsyncTaskStats                        m_asyncTaskStats;         // main thread only
+    
+    CancellationToken                     m_lifetime;               // cancelled in dtor; guards callbacks from request table jobs
 };
 }; // namespace gl_sandbox
 
@@ -0,0 +1,381 @@
+//
+//  shader_preprocessor.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "shader_preprocessor.hpp"
+#include "resourcelayer/file_hash.hpp"
+#include "resourcelayer/pack_file.hpp"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+// Same as stb_c_lexer's defaults, except that preprocessor lines come back as tokens (that's
+// all we're looking for), and there are no sq strings in glsl.
+#define STB_C_LEX_C_DECIMAL_INTS    Y
+#define STB_C_LEX_C_HEX_INTS        Y
+#define STB_C_LEX_C_OCTAL_INTS      Y
+#define STB_C_LEX_C_DECIMAL_FLOATS  Y
+#define STB_C_LEX_C_IDENTIFIERS     Y
+#define STB_C_LEX_C_DQ_STRINGS      Y
+#define STB_C_LEX_C_SQ_STRINGS      N
+#define STB_C_LEX_C_CHARS           Y
+#define STB_C_LEX_C_COMMENTS        Y
+#define STB_C_LEX_CPP_COMMENTS      Y
+#define STB_C_LEX_C_COMPARISONS     Y
+#define STB_C_LEX_C_LOGICAL         Y
+#define STB_C_LEX_C_SHIFTS          Y
+#define STB_C_LEX_C_INCREMENTS      Y
+#define STB_C_LEX_C_ARROW           Y
+#define STB_C_LEX_EQUAL_ARROW       N
+#define STB_C_LEX_C_BITWISEEQ       Y
+#define STB_C_LEX_C_ARITHEQ         Y
+
+#define STB_C_LEX_PARSE_SUFFIXES    N
+#define STB_C_LEX_DECIMAL_SUFFIXES  ""
+#define STB_C_LEX_HEX_SUFFIXES      ""
+#define STB_C_LEX_OCTAL_SUFFIXES    ""
+#define STB_C_LEX_FLOAT_SUFFIXES    ""
+
+#define STB_C_LEX_0_IS_EOF             N
+#define STB_C_LEX_INTEGERS_AS_DOUBLES  N
+#define STB_C_LEX_MULTILINE_DSTRINGS   N
+#define STB_C_LEX_MULTILINE_SSTRINGS   N
+#define STB_C_LEX_USE_STDLIB           Y
+#define STB_C_LEX_DOLLAR_IDENTIFIER    Y
+#define STB_C_LEX_FLOAT_NO_DECIMAL     Y
+
+#define STB_C_LEX_DEFINE_ALL_TOKEN_NAMES  N
+#define STB_C_LEX_DISCARD_PREPROCESSOR    N
+
+#define STB_C_LEXER_DEFINITIONS
+#define STB_C_LEXER_IMPLEMENTATION
+// (stb__strchr is only used w/ some of the options above; see pack_file.cpp for stb_image)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "../../libs/stb/stb_c_lexer.h"
+#pragma GCC diagnostic pop
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::resource_impl;
+
+constexpr unsigned ShaderPreprocessor::MAX_INCLUDE_DEPTH;
+
+ShaderPreprocessor & ShaderPreprocessor::shared () {
+    static ShaderPreprocessor preprocessor;
+    return preprocessor;
+}
+
+void ShaderPreprocessor::setIncludeDirs (std::vector<FilePath> dirs) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_includeDirs = std::move(dirs);
+    m_outputs.clear();  // includes might resolve differently now
+}
+
+void ShaderPreprocessor::invalidate (const FilePath & path) {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    for (auto it = m_files.begin(); it != m_files.end(); ) {
+        if (it->first == path || boost::filesystem::path(it->first).parent_path() == path)
+            it = m_files.erase(it);
+        else
+            ++it;
+    }
+}
+
+void ShaderPreprocessor::clear () {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_files.clear();
+    m_outputs.clear();
+}
+
+ShaderPreprocessor::Stats ShaderPreprocessor::stats () {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return m_stats;
+}
+
+bool ShaderPreprocessor::stamp (const FilePath & path, Stamp & stamp) {
+    if (auto packed = packs::find(path)) {
+        stamp.mtime = -1;
+        stamp.size  = packed.entry->contentHash;    // packs don't change while they're mounted
+        return true;
+    }
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+#ifdef __APPLE__
+    stamp.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    stamp.size = (uint64_t)st.st_size;
+    return true;
+}
+
+static bool readFile (const FilePath & path, std::string & text, std::string & err) {
+    if (auto packed = packs::find(path)) {
+        auto buffer = packed.pack->load(*packed.entry, path, false, err);
+        if (!buffer)
+            return false;
+        text.assign((const char *)buffer->data, buffer->size);
+        return true;
+    }
+    std::ifstream f (path, std::ios::in | std::ios::binary);
+    if (!f)
+        return err = "Cannot open '" + path + "'", false;
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    text = ss.str();
+    return true;
+}
+
+// Finds the directives we care about (#include, #version, #pragma once). The lexer skips comments
+// for us, so a commented out #include stays commented out.
+bool ShaderPreprocessor::parse (File & file, std::string & err) {
+    file.directives.clear();
+    if (file.text.empty())
+        return true;
+
+    const char * text = file.text.data();
+    const char * eof  = text + file.text.size();
+    char store [1024];
+    stb_lexer lexer;
+    stb_c_lexer_init(&lexer, text, eof, store, sizeof(store));
+
+    unsigned line = 1;
+    const char * counted = text;    // line == 1 + # of newlines before counted
+    auto lineOf = [&](const char * p) {
+        line += (unsigned)std::count(counted, p, '\n');
+        counted = p;
+        return line;
+    };
+    auto lineStart = [&](const char * p) {
+        while (p > text && p[-1] != '\n')
+            --p;
+        return p;
+    };
+    auto lineEnd = [&](const char * p) {  // past the newline; follows line continuations
+        for (; p < eof; ++p)
+            if (*p == '\n' && p[-1] != '\\')
+                return p + 1;
+        return eof;
+    };
+
+    while (stb_c_lexer_get_token(&lexer)) {
+        if (lexer.token != '#')
+            continue;
+        const char * hash  = lexer.where_firstchar;
+        const char * begin = lineStart(hash);
+        if (std::any_of(begin, hash, [](char c) { return c != ' ' && c != '\t'; }))
+            continue;   // not at the start of a line
+
+        const char * end = lineEnd(hash);
+        Directive directive;
+        directive.begin = begin - text;
+        directive.end   = end - text;
+        directive.line  = lineOf(begin);
+
+        // Anything else (#define, #ifdef, ...) is the driver's business
+        bool found = false;
+        if (stb_c_lexer_get_token(&lexer) && lexer.token == CLEX_id && lexer.where_firstchar < end) {
+            std::string name (lexer.string);   // (string_len isn't set for identifiers)
+            if (name == "version") {
+                directive.kind = Directive::VERSION;
+                found = true;
+            } else if (name == "pragma") {
+                found = stb_c_lexer_get_token(&lexer) && lexer.token == CLEX_id && lexer.where_firstchar < end &&
+                        strcmp(lexer.string, "once") == 0;
+                directive.kind = Directive::PRAGMA_ONCE;
+            } else if (name == "include") {
+                directive.kind = Directive::INCLUDE;
+                const char * p = lexer.parse_point;
+                while (p < end && (*p == ' ' || *p == '\t'))
+                    ++p;
+                char close = p < end && *p == '<' ? '>' : p < end && *p == '"' ? '"' : 0;
+                auto last  = close ? std::find(p + 1, end, close) : end;
+                if (last == end) {
+                    return err = file.path + ":" + std::to_string(directive.line) +
+                                 ": expected #include \"file\" or <file>", false;
+                }
+                directive.include.assign(p + 1, last);
+                directive.angled = close == '>';
+                found = true;
+            }
+        }
+        if (found)
+            file.directives.push_back(std::move(directive));
+        lexer.parse_point = (char *)end;    // skip the rest of the directive
+    }
+    return true;
+}
+
+ShaderPreprocessor::FileRef ShaderPreprocessor::load (const FilePath & path, std::string & err) {
+    Stamp current;
+    if (!stamp(path, current))
+        return err = "Cannot open '" + path + "'", nullptr;
+
+    auto & memo = m_files[path];
+    if (memo && memo->stamp == current)
+        return ++m_stats.fileHits, memo;
+
+    auto file = std::make_shared<File>();
+    file->path  = path;
+    file->stamp = current;
+    if (!readFile(path, file->text, err))
+        return m_files.erase(path), nullptr;
+    ++m_stats.reads;
+    file->hash = hash::fastHash64(file->text.data(), file->text.size());
+
+    // Touched (or rewritten w/ the same contents): keep what we parsed last time
+    if (memo && memo->hash == file->hash) {
+        file->directives = memo->directives;
+        return memo = file;
+    }
+    ++m_stats.parses;
+    if (!parse(*file, err))
+        return m_files.erase(path), nullptr;
+    return memo = file;
+}
+
+bool ShaderPreprocessor::resolve (const File & includer, const Directive & include, FilePath & path) {
+    typedef boost::filesystem::path Path;
+    Stamp ignored;
+    if (!include.angled) {
+        auto candidate = (Path(includer.path).parent_path() / include.include).string();
+        if (stamp(candidate, ignored))
+            return path = candidate, true;
+    }
+    for (auto & dir : m_includeDirs) {
+        auto candidate = (Path(dir) / include.include).string();
+        if (stamp(candidate, ignored))
+            return path = candidate, true;
+    }
+    return false;
+}
+
+bool ShaderPreprocessor::expand (const FileRef & file, Expansion & expansion, std::string & err) {
+    auto & out = expansion.out;
+    auto index = std::find(expansion.files.begin(), expansion.files.end(), file) - expansion.files.begin();
+    if (index == (ptrdiff_t)expansion.files.size())
+        expansion.files.push_back(file);
+    expansion.stack.push_back(file.get());
+
+    size_t pos = 0;
+    for (auto & directive : file->directives) {
+        out.append(file->text, pos, directive.begin - pos);
+        pos = directive.end;
+
+        auto next   = directive.line + std::count(file->text.begin() + directive.begin, file->text.begin() + directive.end, '\n');
+        auto resume = "#line " + std::to_string(next) + " " + std::to_string(index) + "\n";
+        switch (directive.kind) {
+            case Directive::VERSION:
+                // Only the root's first one is kept; the define set goes right after it
+                if (expansion.stack.size() == 1 && !expansion.versioned) {
+                    out.append(file->text, directive.begin, directive.end - directive.begin);
+                    if (out.back() != '\n')
+                        out += '\n';
+                    expansion.versioned = true;
+                    if (expansion.defines->empty())
+                        break;      // still in sync
+                    out += *expansion.defines;
+                }
+                out += resume;
+                break;
+            case Directive::PRAGMA_ONCE:
+                expansion.once.push_back(file.get());
+                out += resume;
+                break;
+            case Directive::INCLUDE: {
+                auto where = file->path + ":" + std::to_string(directive.line) + ": ";
+                FilePath path;
+                if (!resolve(*file, directive, path))
+                    return err = where + "cannot find include '" + directive.include + "'", false;
+                auto included = load(path, err);
+                if (!included)
+                    return err = where + err, false;
+                if (std::find(expansion.stack.begin(), expansion.stack.end(), included.get()) != expansion.stack.end())
+                    return err = where + "'" + path + "' includes itself", false;
+                if (expansion.stack.size() >= MAX_INCLUDE_DEPTH)
+                    return err = where + "includes nested too deeply", false;
+                if (std::find(expansion.once.begin(), expansion.once.end(), included.get()) == expansion.once.end()) {
+                    auto includedIndex = std::find(expansion.files.begin(), expansion.files.end(), included) - expansion.files.begin();
+                    out += "#line 1 " + std::to_string(includedIndex) + "\n";
+                    if (!expand(included, expansion, err))
+                        return false;
+                    if (!out.empty() && out.back() != '\n')
+                        out += '\n';
+                }
+                out += resume;
+            } break;
+        }
+    }
+    out.append(file->text, pos, std::string::npos);
+    expansion.stack.pop_back();
+    return true;
+}
+
+ShaderPreprocessor::Source ShaderPreprocessor::preprocess (const FilePath & path, const Defines & defines,
+                                                           std::string & err, std::vector<FilePath> * files) {
+    // Same set in a different order => same permutation
+    auto sorted = defines;
+    std::sort(sorted.begin(), sorted.end());
+    std::string defineLines;
+    for (auto & define : sorted)
+        defineLines += "#define " + define.first + (define.second.empty() ? "" : " " + define.second) + "\n";
+
+    auto key = path + '\0' + defineLines;
+
+    std::lock_guard<std::mutex> lock (m_mutex);
+    auto & output = m_outputs[key];
+
+    // Valid as long as every file that went into it still hashes the same
+    bool valid = output.source != nullptr;
+    for (auto it = output.files.begin(); valid && it != output.files.end(); ++it) {
+        auto file = load(it->first, err);
+        valid = file && file->hash == it->second;
+    }
+    if (valid) {
+        ++m_stats.outputHits;
+        if (files) {
+            files->clear();
+            for (auto & file : output.files)
+                files->push_back(file.first);
+        }
+        return output.source;
+    }
+    ++m_stats.outputMisses;
+    output = Output();
+    err.clear();
+
+    auto root = load(path, err);
+    if (!root)
+        return m_outputs.erase(key), nullptr;
+
+    // Defines go right after the #version (which has to come first; see expand()), or at the very
+    // top if there isn't one
+    Expansion expansion;
+    expansion.defines = &defineLines;
+    expansion.out.reserve(root->text.size() + defineLines.size() + 64);
+    if (!defineLines.empty() && std::none_of(root->directives.begin(), root->directives.end(), [](const Directive & d) {
+        return d.kind == Directive::VERSION;
+    }))
+        expansion.out += defineLines + "#line 1 0\n";
+    if (!expand(root, expansion, err))
+        return m_outputs.erase(key), nullptr;
+
+    output.source = std::make_shared<const std::string>(std::move(expansion.out));
+    if (files)
+        files->clear();
+    for (auto & file : expansion.files) {
+        output.files.emplace_back(file->path, file->hash);
+        if (files)
+            files->push_back(file->path);
+    }
+    return output.source;
+}
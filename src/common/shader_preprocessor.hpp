@@ -0,0 +1,125 @@
+//
+//  shader_preprocessor.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef shader_preprocessor_hpp
+#define shader_preprocessor_hpp
+
+#include "resourcelayer/resource_impl.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace gl_sandbox {
+
+// Expands GLSL sources before they go to the driver:
+//  - #include "file" / #include <file> is replaced w/ that file's (expanded) contents. Quoted
+//    includes are looked up next to the including file first; both forms then search the include
+//    dirs (the resource roots) in order. Mounted packs are checked before the filesystem.
+//  - #pragma once in an included file keeps it from being pasted in twice; #version lines in
+//    included files are dropped (the root file's stays first).
+//  - a define set (name, value) is injected right after the root's #version, which is how
+//    variants get made: one source w/ #ifdefs, compiled once per permutation. Conditionals are
+//    left to the driver's preprocessor -- we only tokenize enough (w/ stb_c_lexer) to find
+//    directives outside of comments.
+//  - #line directives are emitted around includes, so the driver's error log points at the right
+//    line. Source string numbers index the list of files preprocess() hands back (0 = root).
+//
+// Everything's memoized: files by path (revalidated w/ a stat, so an unchanged header is never
+// re-read or re-tokenized), and outputs by (root path, define set), checked against the content
+// hashes of every file that went into them. Thread safe; shared() is what ResourceLoader and
+// ShaderReloader use.
+class ShaderPreprocessor {
+public:
+    typedef resource_impl::FilePath FilePath;
+    typedef std::vector<std::pair<std::string, std::string>> Defines;   // order doesn't matter
+    typedef std::shared_ptr<const std::string> Source;
+
+    struct Stats {
+        size_t reads       = 0;     // files read (first use, or changed on disk)
+        size_t parses      = 0;     // files tokenized (reads whose contents actually changed)
+        size_t fileHits    = 0;     // file lookups served from the memo
+        size_t outputHits  = 0;
+        size_t outputMisses = 0;
+    };
+    static constexpr unsigned MAX_INCLUDE_DEPTH = 32;
+
+    ShaderPreprocessor () {}
+    ShaderPreprocessor (const ShaderPreprocessor &) = delete;
+    ShaderPreprocessor & operator= (const ShaderPreprocessor &) = delete;
+
+    // Searched (in order) for includes not found next to their includer.
+    void setIncludeDirs (std::vector<FilePath> dirs);
+
+    // Expanded source, or null + err. If files is non-null, it's set to every file that went into
+    // the result (root first), in source string number order.
+    Source preprocess (const FilePath & path, const Defines & defines, std::string & err,
+                       std::vector<FilePath> * files = nullptr);
+
+    // Forgets path (or everything directly under it, if it's a directory), for when it changed
+    // w/in the filesystem's mtime granularity. Outputs that used it get revalidated on their next use.
+    void invalidate (const FilePath & path);
+    void clear ();
+
+    Stats stats ();
+
+    static ShaderPreprocessor & shared ();
+
+protected:
+    struct Directive {
+        enum Kind { INCLUDE, VERSION, PRAGMA_ONCE } kind;
+        size_t      begin, end;     // the directive's line(s), including the trailing newline
+        unsigned    line;           // 1-based
+        std::string include;        // INCLUDE only
+        bool        angled = false;
+    };
+    struct Stamp {
+        int64_t  mtime = -1;        // ns; pack entries use -1 + their content hash as size
+        uint64_t size  = 0;
+        bool operator== (const Stamp & other) const { return mtime == other.mtime && size == other.size; }
+    };
+    struct File {
+        FilePath               path;
+        Stamp                  stamp;
+        uint64_t               hash;
+        std::string            text;
+        std::vector<Directive> directives;
+    };
+    typedef std::shared_ptr<const File> FileRef;
+    struct Output {
+        Source                                      source;
+        std::vector<std::pair<FilePath, uint64_t>>  files;      // + their content hashes
+    };
+    struct Expansion {
+        const std::string *  defines;   // #define lines
+        bool                 versioned = false;
+        std::string          out;
+        std::vector<FileRef> files;
+        std::vector<const File *> stack;     // include chain (cycle detection)
+        std::vector<const File *> once;      // #pragma once'd files already pasted in
+    };
+
+    static bool stamp (const FilePath & path, Stamp & stamp);
+    static bool parse (File & file, std::string & err);
+    FileRef load (const FilePath & path, std::string & err);
+    bool resolve (const File & includer, const Directive & include, FilePath & path);
+    bool expand (const FileRef & file, Expansion & expansion, std::string & err);
+
+protected:
+    std::mutex                                  m_mutex;    // guards everything below
+    std::vector<FilePath>                       m_includeDirs;
+    std::unordered_map<FilePath, FileRef>       m_files;
+    std::unordered_map<std::string, Output>     m_outputs;  // by root path + define set
+    Stats                                       m_stats;
+};
+
+}; // namespace gl_sandbox
+
+#endif /* shader_preprocessor_hpp */
@@ -0,0 +1,324 @@
+//
+//  shader_reloader.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "shader_reloader.hpp"
+#include "resourcelayer/async_file_reader.hpp"
+#include "resourcelayer/file_hash.hpp"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// KHR_parallel_shader_compile / ARB_parallel_shader_compile (same enum + entry point signature).
+// Not in every glew version, so we load glMaxShaderCompilerThreads* ourselves.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (GLAPIENTRY * MaxShaderCompilerThreadsFn)(GLuint count);
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::resource_impl;
+
+// Canonical if it exists (so it matches the paths watchers hand back), absolute otherwise.
+static std::string absolutePath (const std::string & path) {
+    boost::system::error_code ec;
+    auto p = boost::filesystem::canonical(path, ec);
+    if (ec)
+        p = boost::filesystem::absolute(path);
+    return p.string();
+}
+
+static std::string parentDir (const std::string & path) {
+    return boost::filesystem::path(path).parent_path().string();
+}
+
+static bool readSource (const std::string & path, std::string & src, std::string & err) {
+    std::ifstream f (path, std::ios::in | std::ios::binary);
+    if (!f)
+        return err = "Cannot open '" + path + "'", false;
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    src = ss.str();
+    return src.empty() ? (err = "Empty file '" + path + "'", false) : true;
+}
+
+static uint64_t sourceHash (const std::string & fs, const std::string & vs) {
+    return hash::fastHash64(vs.data(), vs.size(), hash::fastHash64(fs.data(), fs.size()));
+}
+
+ShaderReloader::ShaderReloader (PathIndex::WatchFunction watch, double quietWindow) :
+    m_watch(watch),
+    m_coalescer(std::make_shared<FileChangeCoalescer>(quietWindow)),
+    m_loaded(std::make_shared<MPSCQueue<Sources>>())
+{
+    // Let the driver compile on its own threads (as many as it likes), so a reload doesn't
+    // stall the frame it's submitted on.
+    MaxShaderCompilerThreadsFn setMaxThreads = nullptr;
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        setMaxThreads = (MaxShaderCompilerThreadsFn)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        setMaxThreads = (MaxShaderCompilerThreadsFn)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    if (setMaxThreads) {
+        setMaxThreads(0xFFFFFFFF);
+        m_parallelCompile = true;
+    }
+    CHECK_GL_ERRORS();
+}
+
+ShaderReloader::~ShaderReloader () {
+    if (!m_entries.empty())
+        std::cerr << "ShaderReloader: destroyed w/ " << m_entries.size() << " shader(s) still registered (first: '"
+                  << m_entries.begin()->second.shader->name << "')\n";
+    assert(m_entries.empty());
+}
+
+ShaderReloader::Registration ShaderReloader::watch (gl::Shader & shader, const FilePath & fragmentPath, const FilePath & vertexPath,
+                                                    const ShaderPreprocessor::Defines & defines) {
+    Entry entry;
+    entry.shader  = &shader;
+    entry.fs      = absolutePath(fragmentPath);
+    entry.vs      = absolutePath(vertexPath);
+    entry.defines = defines;
+    watchDir(parentDir(entry.fs));
+    watchDir(parentDir(entry.vs));
+
+    // Pick up its includes now (from the preprocessor's memo, if the shader was just built from
+    // it), so the first edit to one of them already triggers a reload. Hashing what it was built
+    // from means a save that doesn't change anything doesn't recompile it either.
+    std::string err;
+    if (m_preprocessor) {
+        std::vector<FilePath> fsFiles, vsFiles;
+        auto fsSource = m_preprocessor->preprocess(entry.fs, defines, err, &fsFiles);
+        auto vsSource = m_preprocessor->preprocess(entry.vs, defines, err, &vsFiles);
+        if (fsSource && vsSource)
+            entry.hash = sourceHash(*fsSource, *vsSource);
+        fsFiles.insert(fsFiles.end(), vsFiles.begin(), vsFiles.end());
+        setIncludes(entry, fsFiles);
+    } else {
+        std::string fsSource, vsSource;
+        if (readSource(entry.fs, fsSource, err) && readSource(entry.vs, vsSource, err))
+            entry.hash = sourceHash(fsSource, vsSource);
+    }
+
+    auto id = m_nextId++;
+    m_entries.emplace(id, std::move(entry));
+    return Registration(this, id);
+}
+
+void ShaderReloader::unwatch (unsigned id) {
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+    unwatchDir(parentDir(it->second.fs));
+    unwatchDir(parentDir(it->second.vs));
+    setIncludes(it->second, {});
+    m_entries.erase(it);    // drops any compile in flight; reads in flight get ignored
+}
+
+void ShaderReloader::watchDir (const FilePath & dir) {
+    auto & watched = m_dirs[dir];
+    if (watched.refs++ == 0 && m_watch) {
+        auto coalescer = m_coalescer;
+        watched.handle = m_watch(dir, [coalescer](const FilePath & path) {
+            coalescer->changed(path);
+        });
+    }
+}
+
+void ShaderReloader::unwatchDir (const FilePath & dir) {
+    auto it = m_dirs.find(dir);
+    if (it != m_dirs.end() && --it->second.refs == 0)
+        m_dirs.erase(it);
+}
+
+// Watches the dirs of includes we didn't have yet, + lets go of the ones we don't need anymore.
+void ShaderReloader::setIncludes (Entry & entry, const std::vector<FilePath> & files) {
+    std::vector<FilePath> includes;
+    for (auto & file : files) {
+        auto path = absolutePath(file);
+        if (path != entry.fs && path != entry.vs &&
+            std::find(includes.begin(), includes.end(), path) == includes.end())
+            includes.push_back(path);
+    }
+    for (auto & include : includes)
+        watchDir(parentDir(include));
+    for (auto & include : entry.includes)
+        unwatchDir(parentDir(include));
+    entry.includes = std::move(includes);
+}
+
+void ShaderReloader::onChanged (const FileChangeCoalescer::Batch & batch) {
+    // Changes can land w/in the same mtime tick as the preprocessor's last look at a file
+    if (m_preprocessor) {
+        for (auto & change : batch)
+            m_preprocessor->invalidate(change.path);
+    }
+    auto matches = [](const FilePath & changed, const FilePath & path) {
+        // Some watchers (FSEvents) only tell us which directory changed
+        return changed == path || changed == parentDir(path);
+    };
+    std::vector<unsigned> changed;     // once per shader, even if several of its files changed
+    for (auto & kv : m_entries) {
+        auto & entry = kv.second;
+        for (auto & change : batch) {
+            if (change.kind == FileChangeCoalescer::ChangeKind::DELETED)
+                continue;   // keep running what we have; it'll reload if the file comes back
+            if (matches(change.path, entry.fs) || matches(change.path, entry.vs) ||
+                std::any_of(entry.includes.begin(), entry.includes.end(), [&](const FilePath & include) {
+                    return matches(change.path, include);
+                })) {
+                changed.push_back(kv.first);
+                break;
+            }
+        }
+    }
+    m_stats.changes += changed.size();
+    for (auto id : changed)
+        startRead(id);
+}
+
+void ShaderReloader::startRead (unsigned id) {
+    auto & entry = m_entries.at(id);
+    if (entry.reading) {
+        entry.dirty = true;     // re-read once this one lands
+        return;
+    }
+    entry.reading = true;
+    entry.dirty   = false;
+
+    auto loaded = m_loaded;
+    auto preprocessor = m_preprocessor;
+    auto fs = entry.fs, vs = entry.vs;
+    auto defines = entry.defines;
+    async_io::runOnIOThread([loaded, preprocessor, fs, vs, defines, id]() {
+        Sources sources;
+        sources.id = id;
+        if (preprocessor) {
+            std::vector<FilePath> vsFiles;
+            auto fsSource = preprocessor->preprocess(fs, defines, sources.err, &sources.includes);
+            auto vsSource = fsSource ? preprocessor->preprocess(vs, defines, sources.err, &vsFiles) : nullptr;
+            if ((sources.ok = fsSource && vsSource)) {
+                sources.fs = *fsSource;
+                sources.vs = *vsSource;
+                sources.includes.insert(sources.includes.end(), vsFiles.begin(), vsFiles.end());
+            }
+        } else {
+            sources.ok = readSource(fs, sources.fs, sources.err) &&
+                         readSource(vs, sources.vs, sources.err);
+        }
+        loaded->push(std::move(sources));
+    });
+}
+
+void ShaderReloader::update () {
+    m_coalescer->dispatch([this](const FileChangeCoalescer::Batch & batch) {
+        onChanged(batch);
+    });
+
+    Sources sources;
+    while (m_loaded->tryPop(sources)) {
+        auto it = m_entries.find(sources.id);
+        if (it == m_entries.end())
+            continue;   // unwatched while we were reading it
+        it->second.reading = false;
+        if (sources.ok) {
+            setIncludes(it->second, sources.includes);
+            startCompile(sources);
+        } else {
+            ++m_stats.failures;
+            std::cerr << "Not reloading shader '" << it->second.shader->name << "': " << sources.err << '\n';
+        }
+        if (it->second.dirty)
+            startRead(sources.id);
+    }
+
+    if (m_parallelCompile) {
+        for (auto & kv : m_entries) {
+            if (!kv.second.compile)
+                continue;
+            GLint done = GL_FALSE;
+            glGetProgramiv(kv.second.compile->program.handle, GL_COMPLETION_STATUS_KHR, &done); CHECK_GL_ERRORS();
+            if (done)
+                finishCompile(kv.first);
+        }
+    }
+}
+
+void ShaderReloader::startCompile (Sources & sources) {
+    auto & entry = m_entries.at(sources.id);
+    auto srcHash = sourceHash(sources.fs, sources.vs);
+    if (srcHash == (entry.compile ? entry.compile->hash : entry.hash)) {
+        ++m_stats.unchanged;
+        return;
+    }
+
+    // Supersedes anything still compiling for this shader
+    entry.compile.reset(new Compile());
+    auto & compile = *entry.compile;
+    compile.hash    = srcHash;
+    compile.started = glfwGetTime();
+
+    auto cache = gl::ProgramCache::shared();
+    if (cache && cache->load(compile.key = cache->key(sources.fs, sources.vs), compile.program)) {
+        compile.fromCache = true;
+        finishCompile(sources.id);
+        return;
+    }
+    if (cache)
+        cache->prepare(compile.program);
+
+    const char * fs = sources.fs.c_str(), * vs = sources.vs.c_str();
+    glShaderSource(compile.fs.handle, 1, &fs, nullptr); CHECK_GL_ERRORS();
+    glShaderSource(compile.vs.handle, 1, &vs, nullptr); CHECK_GL_ERRORS();
+    glCompileShader(compile.fs.handle);                 CHECK_GL_ERRORS();
+    glCompileShader(compile.vs.handle);                 CHECK_GL_ERRORS();
+
+    // Linking right away is fine -- if either stage failed, so does the link (and we report
+    // the compile log instead).
+    glAttachShader(compile.program.handle, compile.vs.handle); CHECK_GL_ERRORS();
+    glAttachShader(compile.program.handle, compile.fs.handle); CHECK_GL_ERRORS();
+    glLinkProgram(compile.program.handle);                     CHECK_GL_ERRORS();
+
+    if (!m_parallelCompile)
+        finishCompile(sources.id);
+}
+
+void ShaderReloader::finishCompile (unsigned id) {
+    auto & entry = m_entries.at(id);
+    std::unique_ptr<Compile> compile = std::move(entry.compile);
+
+    GLint fsCompiled = GL_TRUE, vsCompiled = GL_TRUE, linked = GL_TRUE;
+    if (!compile->fromCache) {
+        glGetShaderiv(compile->fs.handle, GL_COMPILE_STATUS, &fsCompiled);  CHECK_GL_ERRORS();
+        glGetShaderiv(compile->vs.handle, GL_COMPILE_STATUS, &vsCompiled);  CHECK_GL_ERRORS();
+        glGetProgramiv(compile->program.handle, GL_LINK_STATUS, &linked);   CHECK_GL_ERRORS();
+    }
+    m_stats.lastCompileTime = glfwGetTime() - compile->started;
+    entry.hash = compile->hash;     // so re-saving the same broken source doesn't recompile it
+
+    if (fsCompiled && vsCompiled && linked) {
+        auto cache = gl::ProgramCache::shared();
+        if (cache && !compile->fromCache)
+            cache->store(compile->key, compile->program);
+        entry.shader->replaceProgram(std::move(compile->program), std::move(compile->vs), std::move(compile->fs));
+        ++m_stats.reloads;
+        std::cout << "Reloaded shader '" << entry.shader->name << "' (" << m_stats.lastCompileTime * 1e3 << " ms"
+                  << (compile->fromCache ? ", cached binary)\n" : ")\n");
+        return;
+    }
+    ++m_stats.failures;
+    std::cerr << "Failed to reload shader '" << entry.shader->name << "' (still using the previous version):\n";
+    if (!fsCompiled)
+        std::cerr << entry.fs << ":\n" << gl::shaderInfoLog(compile->fs.handle) << '\n';
+    if (!vsCompiled)
+        std::cerr << entry.vs << ":\n" << gl::shaderInfoLog(compile->vs.handle) << '\n';
+    if (fsCompiled && vsCompiled)
+        std::cerr << "link:\n" << gl::programInfoLog(compile->program.handle) << '\n';
+}
@@ -0,0 +1,153 @@
+//
+//  shader_reloader.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef shader_reloader_hpp
+#define shader_reloader_hpp
+
+#include "gl/gl_shaders.hpp"
+#include "gl/gl_program_cache.hpp"
+#include "shader_preprocessor.hpp"
+#include "path_index.hpp"
+#include "mpsc_queue.hpp"
+#include "resourcelayer/file_change_coalescer.hpp"
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+namespace gl_sandbox {
+
+// Hot-reloads shaders when their source files change.
+//
+// Shaders get registered w/ watch(); their directories are watched (w/ the same watch function
+// ResourceLoader's path index uses), and raw change events go through a FileChangeCoalescer, so
+// an editor save (or a "save all") turns into one reload per shader. From there:
+//  - sources are read + preprocessed on the io pool (see setPreprocessor()). Files they #include
+//    are watched too, so editing a shared header reloads every shader that uses it;
+//  - if the preprocessed sources are the same as last time, nothing else happens;
+//  - otherwise the program comes from the program binary cache (gl::ProgramCache::shared()) if
+//    it has one for these sources, or gets compiled + linked on the main (gl) thread. If the driver has
+//    KHR/ARB_parallel_shader_compile, compiles run in the background and get polled once a
+//    frame; otherwise they're done synchronously in update();
+//  - the shader's program only gets swapped if the new one linked. Uniform handles stay valid
+//    (Shader::replaceProgram() re-resolves them). On errors the log gets printed, and the old
+//    program keeps running.
+//
+// Everything except the watcher callbacks runs on the main thread; call update() once a frame.
+class ShaderReloader {
+public:
+    typedef resource_impl::FilePath FilePath;
+
+    struct Stats {
+        size_t changes   = 0;   // change batches that hit a watched shader (per shader)
+        size_t reloads   = 0;   // programs swapped
+        size_t unchanged = 0;   // changes that didn't change the (preprocessed) source
+        size_t failures  = 0;   // read / preprocess / compile / link errors
+        double lastCompileTime = 0; // seconds from submitting the last compile to its link status
+    };
+
+    // Stops reloading its shader when it goes away.
+    class Registration {
+    public:
+        Registration () {}
+        Registration (ShaderReloader * reloader, unsigned id) : m_reloader(reloader), m_id(id) {}
+        Registration (Registration && other) : m_reloader(other.m_reloader), m_id(other.m_id) { other.m_reloader = nullptr; }
+        Registration & operator= (Registration && other) {
+            std::swap(m_reloader, other.m_reloader);
+            std::swap(m_id, other.m_id);
+            return *this;
+        }
+        Registration (const Registration &) = delete;
+        Registration & operator= (const Registration &) = delete;
+        ~Registration () { if (m_reloader) m_reloader->unwatch(m_id); }
+    protected:
+        ShaderReloader * m_reloader = nullptr;
+        unsigned         m_id = 0;
+    };
+
+    // Needs a current gl context (checks for parallel compile support).
+    ShaderReloader (PathIndex::WatchFunction watch, double quietWindow = resource_impl::FileChangeCoalescer::DEFAULT_QUIET_WINDOW);
+    ~ShaderReloader ();
+    ShaderReloader (const ShaderReloader &) = delete;
+    ShaderReloader & operator= (const ShaderReloader &) = delete;
+
+    // shader has to outlive the returned registration. Paths can be relative (to the cwd).
+    // defines should be whatever the shader was built with (it's reloaded as the same permutation).
+    Registration watch (gl::Shader & shader, const FilePath & fragmentPath, const FilePath & vertexPath,
+                        const ShaderPreprocessor::Defines & defines = {});
+
+    // Sources get expanded w/ this (null => compiled as-is). Set before calling watch(); has to
+    // outlive us.
+    void setPreprocessor (ShaderPreprocessor * preprocessor) { m_preprocessor = preprocessor; }
+
+    // Picks up changes, starts reads / compiles, and swaps in anything that finished linking.
+    void update ();
+
+    bool  parallelCompile () const { return m_parallelCompile; }
+    const Stats & stats () const { return m_stats; }
+
+protected:
+    void unwatch (unsigned id);
+    void watchDir (const FilePath & dir);
+    void unwatchDir (const FilePath & dir);
+    void onChanged (const resource_impl::FileChangeCoalescer::Batch & batch);
+    void startRead (unsigned id);
+
+    // Result of an io thread read (+ preprocess)
+    struct Sources {
+        unsigned    id;
+        bool        ok;
+        std::string fs, vs;
+        std::string err;
+        std::vector<FilePath> includes;     // as the preprocessor named them
+    };
+    void startCompile (Sources & sources);
+    void finishCompile (unsigned id);
+
+    struct Compile {
+        gl::ShaderProgram  program;
+        gl::VertexShader   vs;
+        gl::FragmentShader fs;
+        uint64_t hash;
+        double   started;
+        AssetCache::Key key;            // program cache key (if there's a cache)
+        bool     fromCache = false;     // loaded from a cached binary; nothing to compile
+    };
+    struct Entry {
+        gl::Shader * shader;
+        FilePath     fs, vs;        // absolute
+        ShaderPreprocessor::Defines defines;
+        std::vector<FilePath> includes;     // absolute; their dirs are watched too
+        uint64_t     hash = 0;      // of the sources it's running (what it was registered w/, then the last reload)
+        bool         reading = false;
+        bool         dirty   = false;   // changed again while reading
+        std::unique_ptr<Compile> compile;   // in flight (parallel compile only)
+    };
+    struct WatchedDir {
+        resource_impl::DirectoryWatcherHandleRef handle;
+        unsigned refs = 0;
+    };
+    void setIncludes (Entry & entry, const std::vector<FilePath> & files);
+
+protected:
+    PathIndex::WatchFunction                 m_watch;
+    // Shared w/ the watcher callbacks, which can still be running on the watcher's thread as we go away
+    std::shared_ptr<resource_impl::FileChangeCoalescer> m_coalescer;
+    ShaderPreprocessor *                     m_preprocessor = nullptr;
+    std::unordered_map<unsigned, Entry>      m_entries;
+    std::map<FilePath, WatchedDir>           m_dirs;
+    unsigned                                 m_nextId = 1;
+    bool                                     m_parallelCompile = false;
+    Stats                                    m_stats;
+
+    // Filled by io threads, drained in update(). Shared so reads still in flight can outlive us.
+    std::shared_ptr<MPSCQueue<Sources>>      m_loaded;
+};
+
+}; // namespace gl_sandbox
+
+#endif /* shader_reloader_hpp */
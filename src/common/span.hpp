@@ -0,0 +1,50 @@
+//
+//  span.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/7/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef span_hpp
+#define span_hpp
+
+#include <cstddef>
+#include <cassert>
+#include <vector>
+
+namespace gl_sandbox {
+
+// Non-owning view of a contiguous array (poor man's std::span). Whatever owns the memory
+// (a FileBuffer, a vector, etc) has to outlive the span.
+template <typename T>
+struct Span {
+    T *    data = nullptr;
+    size_t size = 0;
+
+    Span () {}
+    Span (T * data, size_t size) : data(data), size(size) {}
+
+    template <typename U>
+    Span (std::vector<U> & v) : data(v.empty() ? nullptr : &v[0]), size(v.size()) {}
+    template <typename U>
+    Span (const std::vector<U> & v) : data(v.empty() ? nullptr : &v[0]), size(v.size()) {}
+
+    T * begin () const { return data; }
+    T * end   () const { return data + size; }
+    bool   empty () const { return size == 0; }
+    size_t bytes () const { return size * sizeof(T); }
+
+    T & operator[] (size_t i) const {
+        assert(i < size);
+        return data[i];
+    }
+    Span subspan (size_t offset, size_t count) const {
+        assert(offset + count <= size);
+        return Span(data + offset, count);
+    }
+};
+
+}; // namespace gl_sandbox
+
+#endif /* span_hpp */
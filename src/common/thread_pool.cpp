@@ -0,0 +1,105 @@
+//
+//  thread_pool.cpp
+//  GLSandbox
+//
+//  Created by semery on 2/2/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <iostream>
+
+using namespace gl_sandbox;
+
+ThreadPool::ThreadPool (unsigned numThreads, size_t maxQueueDepth) :
+    m_slots(maxQueueDepth)
+{
+    assert(numThreads > 0 && maxQueueDepth > 0);
+    m_workers.reserve(numThreads);
+    for (auto i = 0u; i < numThreads; ++i)
+        m_workers.emplace_back([this]() { runWorker(); });
+}
+
+ThreadPool::~ThreadPool () {
+    {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        m_alive = false;
+    }
+    m_hasWork.notify_all();
+    m_hasSpace.notify_all();
+    for (auto & worker : m_workers)
+        worker.join();
+}
+
+unsigned ThreadPool::defaultThreadCount () {
+    return std::max(2u, std::thread::hardware_concurrency());
+}
+
+bool ThreadPool::tryEnqueue (Task & task) {
+    {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        if (m_count == m_slots.size() || !m_alive)
+            return false;
+        m_slots[(m_head + m_count++) % m_slots.size()] = std::move(task);
+    }
+    m_hasWork.notify_one();
+    return true;
+}
+
+void ThreadPool::enqueue (Task task) {
+    {
+        std::unique_lock<decltype(m_mutex)> lock (m_mutex);
+        m_hasSpace.wait(lock, [this]() { return m_count < m_slots.size() || !m_alive; });
+        if (!m_alive)
+            return;
+        m_slots[(m_head + m_count++) % m_slots.size()] = std::move(task);
+    }
+    m_hasWork.notify_one();
+}
+
+ThreadPool::Stats ThreadPool::getStats () {
+    Stats stats;
+    {
+        std::lock_guard<decltype(m_mutex)> lock (m_mutex);
+        stats.queued = m_count;
+    }
+    stats.running    = m_running;
+    stats.completed  = m_completed;
+    stats.capacity   = m_slots.size();
+    stats.numThreads = (unsigned)m_workers.size();
+    return stats;
+}
+
+void ThreadPool::runWorker () {
+    while (1) {
+        Task task;
+        {
+            std::unique_lock<decltype(m_mutex)> lock (m_mutex);
+            m_hasWork.wait(lock, [this]() { return m_count != 0 || !m_alive; });
+            if (!m_alive)
+                return;
+
+            // Move the task out so the slot's closure (and anything it captured) is released now,
+            // not whenever the ring wraps back around to it.
+            task = std::move(m_slots[m_head]);
+            m_slots[m_head] = nullptr;
+            m_head = (m_head + 1) % m_slots.size();
+            --m_count;
+            ++m_running;
+        }
+        m_hasSpace.notify_one();
+
+        try {
+            task();
+        } catch (std::exception & e) {
+            std::cerr << "ThreadPool: uncaught exception in task: " << e.what() << '\n';
+        } catch (...) {
+            std::cerr << "ThreadPool: uncaught exception in task\n";
+        }
+        --m_running;
+        ++m_completed;
+    }
+}
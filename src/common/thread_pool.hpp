@@ -0,0 +1,77 @@
+//
+//  thread_pool.hpp
+//  GLSandbox
+//
+//  Created by semery on 2/2/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+
+namespace gl_sandbox {
+
+// Fixed-size worker pool with a bounded task queue.
+//
+// Tasks live in a fixed ring of slots (allocated once at construction), so finished slots
+// get reused instead of growing a list forever. Producers can either block until a slot
+// frees up (enqueue) or bail out immediately (tryEnqueue) and hang on to the task themselves
+// -- the latter is what the main thread should use, since blocking it would stall frames.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    struct Stats {
+        size_t queued    = 0;   // waiting for a worker
+        size_t running   = 0;   // currently executing
+        size_t completed = 0;   // total finished since pool creation
+        size_t capacity  = 0;   // max queue depth
+        unsigned numThreads = 0;
+    };
+
+    ThreadPool (unsigned numThreads, size_t maxQueueDepth);
+    ~ThreadPool ();
+
+    ThreadPool (const ThreadPool &) = delete;
+    ThreadPool & operator= (const ThreadPool &) = delete;
+
+    // Push a task; returns false (and leaves task untouched) if the queue is full.
+    bool tryEnqueue (Task & task);
+
+    // Push a task, blocking the calling thread until there's room.
+    void enqueue (Task task);
+
+    Stats getStats ();
+
+    // Worker count to use by default: one per hardware thread, with a floor of 2 so
+    // that one long decode can't starve everything else.
+    static unsigned defaultThreadCount ();
+
+protected:
+    void runWorker ();
+
+protected:
+    std::vector<std::thread> m_workers;
+    std::vector<Task>        m_slots;       // ring buffer of queued tasks (size == capacity)
+    size_t                   m_head  = 0;   // index of next task to run
+    size_t                   m_count = 0;   // number of queued tasks
+    bool                     m_alive = true;
+
+    std::mutex               m_mutex;       // guards m_slots, m_head, m_count, m_alive
+    std::condition_variable  m_hasWork;
+    std::condition_variable  m_hasSpace;
+
+    std::atomic<size_t>      m_running   { 0 };
+    std::atomic<size_t>      m_completed { 0 };
+};
+
+}; // namespace gl_sandbox
+
+#endif /* thread_pool_hpp */
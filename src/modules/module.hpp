@@ -11,6 +11,7 @@
 
 #include "../common/module_events.hpp"
 #include "../common/resources.hpp"
+#include "../common/gl/gl_commands.hpp"
 #include <string>
 
 namespace gl_sandbox {
@@ -19,7 +20,12 @@ struct IModule {
     const std::string name;
     
     virtual ~IModule (){};
+    // Main thread, once per frame: updates, uploads, anything else that needs gl.
     virtual void drawFrame () = 0;
+    // After every module's drawFrame(): records this frame's draws, which get sorted together
+    // w/ every other module's + submitted. Runs on a worker thread (in parallel w/ other modules),
+    // so no gl calls -- DrawCommand::setup callbacks are what run on the main thread.
+    virtual void recordFrame (gl::CommandList &) {}
 protected:
     IModule (const char * name) : name(name) {}
 };
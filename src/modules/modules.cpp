@@ -18,6 +18,8 @@
 #include "app.hpp"
 
 #include <iostream>
+#include <condition_variable>
+#include <mutex>
 
 using namespace gl_sandbox;
 using namespace gl_sandbox::modules;
@@ -35,6 +37,7 @@ ModuleInterface::ModuleInterface () :
         ADD_MODULE(TriangleModule),
         ADD_MODULE(UboDynamicModule),
         ADD_MODULE(UboStaticModule),
+        ADD_MODULE(UboCoalescedModule),
         ADD_MODULE(ObjViewer),
         ADD_MODULE(InputTestModule),
         ADD_MODULE(CameraModule),
@@ -120,6 +123,48 @@ void ModuleInterface::runModules() {
     for (auto & module : m_runningModules) {
         module->drawFrame();
     }
+    // Draws from every module get sorted together, so programs + vaos only get bound when they
+    // change -- not once per module, every frame.
+    recordModules();
+    m_renderQueue.submit();
+}
+
+void ModuleInterface::recordModules () {
+    std::mutex              mutex;
+    std::condition_variable done;
+    size_t                  remaining = m_runningModules.size();
+    
+    auto record = [&] (IModule * module) {
+        // Counted down even if recordFrame() throws: we wait for every worker before these
+        // locals go away (a module that throws just doesn't draw this frame)
+        struct Done {
+            std::mutex & mutex; std::condition_variable & done; size_t & remaining;
+            ~Done () {
+                std::lock_guard<std::mutex> lock (mutex);
+                if (--remaining == 0)
+                    done.notify_one();
+            }
+        } countDown { mutex, done, remaining };
+        try {
+            gl::CommandList commands;
+            module->recordFrame(commands);
+            m_renderQueue.enqueue(std::move(commands));
+        } catch (std::exception & e) {
+            std::cerr << "Module '" << module->name << "': uncaught exception in recordFrame(): " << e.what() << '\n';
+        } catch (...) {
+            std::cerr << "Module '" << module->name << "': uncaught exception in recordFrame()\n";
+        }
+    };
+    // Main thread takes the first module instead of just waiting
+    for (size_t i = 1; i < m_runningModules.size(); ++i) {
+        auto module = m_runningModules[i].get();
+        m_recordThreads.enqueue([&record, module] () { record(module); });
+    }
+    if (!m_runningModules.empty())
+        record(m_runningModules[0].get());
+    
+    std::unique_lock<std::mutex> lock (mutex);
+    done.wait(lock, [&] () { return remaining == 0; });
 }
 
 void ModuleInterface::killAllModules() {
@@ -10,6 +10,7 @@
 #define modules_hpp
 
 #include "module.hpp"
+#include "../common/thread_pool.hpp"
 #include <vector>
 #include <unordered_map>
 #include <memory>
@@ -35,14 +36,21 @@ public:
     bool hasRunningModuleWithName (const std::string & moduleName) const;
     bool hasRunnableModuleWithName (const std::string & moduleName) const;
     
+    // Draws recorded by the last runModules()
+    const gl::RenderQueue::Stats & renderStats () const { return m_renderQueue.stats(); }
+    
 protected:
     void initModule (IModule * module);
     void deinitModule (IModule * module);
+    void recordModules ();
 protected:
     typedef std::function<IModule*()> ModuleConstructor;
     
     std::vector<std::unique_ptr<IModule>> m_runningModules;
     std::unordered_map<std::string, ModuleConstructor> m_moduleConstructors;
+    
+    gl::RenderQueue m_renderQueue;
+    ThreadPool      m_recordThreads { 2, 64 };    // + the main thread
 };
     
 }; // namespace gl_sandbox
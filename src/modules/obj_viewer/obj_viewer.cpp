@@ -9,10 +9,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <boost/math/constants/constants.hpp>
-#include <future>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
 #include "obj_viewer.hpp"
 #include "../../common/app.hpp"
+#include "../../common/resourcelayer/file_hash.hpp"
 
 using namespace gl_sandbox;
 using namespace gl_sandbox::modules;
@@ -20,12 +23,312 @@ using namespace gl_sandbox::gl;
 
 typedef ObjViewer::ShaderRef ShaderRef;
 
+typedef ObjViewer::OptimizedGeometry OptimizedGeometry;
+
+// Mesh optimization for the post-transform vertex cache:
+//  - weld():            merges bitwise-identical vertices (hashed), across shapes
+//  - reorderTriangles(): greedy Forsyth ordering ("Linear-Speed Vertex Cache Optimisation")
+//  - emitBatches():     splits the triangle list into batches of <= vertLimit vertices, and lays
+//                       out each batch's vertices in first-use order (fetch locality)
 struct GeometryOptimizer {
+    static constexpr unsigned CACHE_SIZE = 32;      // LRU cache size Forsyth scoring assumes
+    static constexpr unsigned FIFO_SIZE  = 16;      // FIFO cache size used for ACMR / ATVR stats
+    
+    typedef OptimizedGeometry::CacheStats CacheStats;
+    
+    // Interleaved vertices: position [+ normal] [+ texcoord]
+    std::vector<float>    vertices;
+    std::vector<uint32_t> indices;
+    unsigned stride = 3;
+    bool hasNormals = false, hasTexcoords = false;
+    
+    size_t numVertices () const { return vertices.size() / stride; }
+    
+    // Merges all shapes into one vertex / index list. Normals + uvs are kept iff every shape has them.
+    void gather (const ResourceLoader::ObjData & data) {
+        hasNormals = hasTexcoords = !data.shapes.empty();
+        for (auto & shape : data.shapes) {
+            hasNormals   &= !shape.mesh.normals.empty();
+            hasTexcoords &= !shape.mesh.texcoords.empty();
+        }
+        stride = 3 + (hasNormals ? 3 : 0) + (hasTexcoords ? 2 : 0);
+        
+        for (auto & shape : data.shapes) {
+            auto & m = shape.mesh;
+            auto base = (uint32_t)numVertices();
+            auto n = m.positions.size() / 3;
+            for (size_t i = 0; i < n; ++i) {
+                vertices.insert(vertices.end(), &m.positions[i * 3], &m.positions[i * 3] + 3);
+                if (hasNormals)
+                    vertices.insert(vertices.end(), &m.normals[i * 3], &m.normals[i * 3] + 3);
+                if (hasTexcoords)
+                    vertices.insert(vertices.end(), &m.texcoords[i * 2], &m.texcoords[i * 2] + 2);
+            }
+            for (size_t i = 0; i + 2 < m.indices.size(); i += 3)
+                if (m.indices[i] < n && m.indices[i + 1] < n && m.indices[i + 2] < n)
+                    for (int k = 0; k < 3; ++k)
+                        indices.push_back(base + m.indices[i + k]);
+        }
+    }
     
+    // Open-addressed hash table over the raw vertex bytes; vertices are compacted in place.
+    // Returns the number of vertices removed.
+    size_t weld () {
+        auto n = numVertices();
+        size_t tableSize = 16;
+        while (tableSize < n * 2)
+            tableSize *= 2;
+        std::vector<uint32_t> table (tableSize, ~0u);
+        std::vector<uint32_t> remap (n);
+        
+        uint32_t count = 0;
+        for (size_t v = 0; v < n; ++v) {
+            const float * vertex = &vertices[v * stride];
+            size_t slot = hash::fastHash64(vertex, stride * sizeof(float)) & (tableSize - 1);
+            while (table[slot] != ~0u &&
+                   memcmp(&vertices[table[slot] * stride], vertex, stride * sizeof(float)) != 0)
+                slot = (slot + 1) & (tableSize - 1);
+            
+            if (table[slot] == ~0u) {
+                // count <= v, so this only ever overwrites vertices we've already visited
+                if (count != v)
+                    memmove(&vertices[count * stride], vertex, stride * sizeof(float));
+                table[slot] = count++;
+            }
+            remap[v] = table[slot];
+        }
+        vertices.resize(count * stride);
+        for (auto & index : indices)
+            index = remap[index];
+        return n - count;
+    }
+    
+    static CacheStats measure (const std::vector<uint32_t> & indices, size_t numVertices) {
+        CacheStats stats;
+        stats.numTriangles = indices.size() / 3;
+        stats.numVertices  = numVertices;
+        
+        std::vector<unsigned> timestamp (numVertices, 0);
+        unsigned time = FIFO_SIZE + 1;
+        for (auto index : indices) {
+            // Entry is live iff it was pushed within the last FIFO_SIZE misses
+            if (time - timestamp[index] > FIFO_SIZE) {
+                timestamp[index] = time++;
+                ++stats.transforms;
+            }
+        }
+        return stats;
+    }
+    
+    void reorderTriangles () {
+        auto numTris  = indices.size() / 3;
+        auto numVerts = numVertices();
+        if (numTris == 0)
+            return;
+        
+        // Score tables (Forsyth's constants)
+        float cacheScore [CACHE_SIZE];
+        for (unsigned i = 0; i < CACHE_SIZE; ++i)
+            cacheScore[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+        const unsigned MAX_VALENCE_SCORE = 64;
+        float valenceScore [MAX_VALENCE_SCORE];
+        valenceScore[0] = 0;
+        for (unsigned i = 1; i < MAX_VALENCE_SCORE; ++i)
+            valenceScore[i] = 2.0f * powf((float)i, -0.5f);
+        
+        // Vertex -> triangle adjacency. Each vertex's live triangles are kept at the front of its
+        // range (emitted ones get swapped out past remaining[v]).
+        std::vector<uint32_t> remaining (numVerts, 0), adjOffset (numVerts + 1, 0);
+        for (auto index : indices)
+            ++remaining[index];
+        for (size_t v = 0; v < numVerts; ++v)
+            adjOffset[v + 1] = adjOffset[v] + remaining[v];
+        std::vector<uint32_t> adjacency (indices.size()), fill (adjOffset.begin(), adjOffset.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+        
+        std::vector<int>   cachePos (numVerts, -1);
+        std::vector<float> vertexScore (numVerts);
+        auto scoreVertex = [&](uint32_t v) {
+            auto n = remaining[v];
+            if (n == 0)
+                return -1.0f;
+            return (cachePos[v] >= 0 ? cacheScore[cachePos[v]] : 0.0f) +
+                (n < MAX_VALENCE_SCORE ? valenceScore[n] : 0.0f);
+        };
+        for (size_t v = 0; v < numVerts; ++v)
+            vertexScore[v] = scoreVertex((uint32_t)v);
+        
+        auto scoreTriangle = [&](size_t t) {
+            return vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+        };
+        std::vector<bool> emitted (numTris, false);
+        size_t best = 0;
+        for (size_t t = 1; t < numTris; ++t)
+            if (scoreTriangle(t) > scoreTriangle(best))
+                best = t;
+        
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+        std::vector<uint32_t> cache, nextCache;
+        cache.reserve(CACHE_SIZE + 3);
+        nextCache.reserve(CACHE_SIZE + 3);
+        size_t cursor = 0;
+        
+        for (size_t numEmitted = 0; numEmitted < numTris; ++numEmitted) {
+            if (best == (size_t)-1) {
+                // Dead end (nothing in the cache has live triangles): take the next unemitted one
+                while (emitted[cursor])
+                    ++cursor;
+                best = cursor;
+            }
+            emitted[best] = true;
+            
+            const uint32_t * tri = &indices[best * 3];
+            nextCache.clear();
+            for (int k = 0; k < 3; ++k) {
+                auto v = tri[k];
+                output.push_back(v);
+                
+                // Remove best from v's live triangles
+                auto begin = &adjacency[adjOffset[v]], end = begin + remaining[v];
+                std::swap(*std::find(begin, end, (uint32_t)best), end[-1]);
+                --remaining[v];
+                
+                if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+                    nextCache.push_back(v);
+            }
+            for (auto v : cache)
+                if (v != tri[0] && v != tri[1] && v != tri[2])
+                    nextCache.push_back(v);
+            std::swap(cache, nextCache);
+            
+            // Vertices pushed out of the cache lose their position score
+            for (size_t i = 0; i < cache.size(); ++i) {
+                cachePos[cache[i]] = i < CACHE_SIZE ? (int)i : -1;
+                vertexScore[cache[i]] = scoreVertex(cache[i]);
+            }
+            
+            // Rescore + pick the next triangle among those touching the cache
+            best = (size_t)-1;
+            float bestScore = -1;
+            for (auto v : cache) {
+                for (auto t = &adjacency[adjOffset[v]], end = t + remaining[v]; t != end; ++t) {
+                    float score = scoreTriangle(*t);
+                    if (score > bestScore) {
+                        bestScore = score;
+                        best = *t;
+                    }
+                }
+            }
+            if (cache.size() > CACHE_SIZE)
+                cache.resize(CACHE_SIZE);
+        }
+        indices.swap(output);
+    }
+    
+    // Splits the (reordered) triangles into batches of <= vertLimit vertices (0 => no limit).
+    // Vertices are emitted per batch in first-use order, so vertices shared between batches
+    // get duplicated.
+    void emitBatches (unsigned vertLimit, OptimizedGeometry & out) const {
+        std::vector<uint32_t> batchOf (numVertices(), ~0u), localIndex (numVertices());
+        std::vector<uint32_t> batchIndices;
+        batchIndices.reserve(indices.size());
+        
+        out.batches.clear();
+        auto emitVertex = [&](uint32_t v) {
+            const float * vertex = &vertices[v * stride];
+            out.positions.insert(out.positions.end(), vertex, vertex + 3);
+            if (hasNormals)
+                out.normals.insert(out.normals.end(), vertex + 3, vertex + 6);
+            if (hasTexcoords)
+                out.texcoords.insert(out.texcoords.end(), vertex + stride - 2, vertex + stride);
+        };
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            if (out.batches.empty() || vertLimit) {
+                unsigned newVertices = 0;
+                for (int k = 0; k < 3; ++k)
+                    newVertices += out.batches.empty() || batchOf[indices[i + k]] != out.batches.size() - 1;
+                if (out.batches.empty() || out.batches.back().numVertices + newVertices > vertLimit) {
+                    OptimizedGeometry::Batch batch;
+                    batch.firstIndex  = (unsigned)i;
+                    batch.numIndices  = 0;
+                    batch.baseVertex  = (unsigned)(out.positions.size() / 3);
+                    batch.numVertices = 0;
+                    out.batches.push_back(batch);
+                }
+            }
+            auto & batch = out.batches.back();
+            auto batchId = (uint32_t)out.batches.size() - 1;
+            for (int k = 0; k < 3; ++k) {
+                auto v = indices[i + k];
+                if (batchOf[v] != batchId) {
+                    batchOf[v] = batchId;
+                    localIndex[v] = batch.numVertices++;
+                    emitVertex(v);
+                }
+                batchIndices.push_back(localIndex[v]);
+            }
+            batch.numIndices += 3;
+        }
+        
+        bool fits16 = true;
+        for (auto & batch : out.batches)
+            fits16 &= batch.numVertices <= std::numeric_limits<uint16_t>::max() + 1u;
+        if (fits16) {
+            out.indices16.assign(batchIndices.begin(), batchIndices.end());
+            out.indices32.clear();
+        } else {
+            out.indices32.swap(batchIndices);
+            out.indices16.clear();
+        }
+    }
+    
+    // Flattens batch-relative indices back to absolute ones (for measure())
+    static std::vector<uint32_t> absoluteIndices (const OptimizedGeometry & geometry) {
+        std::vector<uint32_t> result;
+        for (auto & batch : geometry.batches) {
+            for (auto i = batch.firstIndex; i < batch.firstIndex + batch.numIndices; ++i) {
+                auto index = geometry.indices16.empty() ? geometry.indices32[i] : geometry.indices16[i];
+                result.push_back(batch.baseVertex + index);
+            }
+        }
+        return result;
+    }
 };
 
-void optimizeGeometry (const ResourceLoader::ObjData & data, unsigned vertLimit = 1600) {
+static std::ostream & operator<< (std::ostream & os, const GeometryOptimizer::CacheStats & stats) {
+    return os << "ACMR " << stats.acmr() << ", ATVR " << stats.atvr()
+        << " (" << stats.transforms << " transforms, " << stats.numTriangles << " tris, "
+        << stats.numVertices << " verts)";
+}
+
+// Welds + reorders geometry for the post-transform cache. Batches reference <= vertLimit vertices
+// each (0 => one batch). Runs on the io pool, so it doesn't print anything itself (see printStats()).
+static OptimizedGeometry optimizeGeometry (const ResourceLoader::ObjData & data, unsigned vertLimit) {
+    double startTime = glfwGetTime();
+    
+    GeometryOptimizer optimizer;
+    optimizer.gather(data);
+    auto before = GeometryOptimizer::measure(optimizer.indices, optimizer.numVertices());
+    
+    auto welded = optimizer.weld();
+    optimizer.reorderTriangles();
     
+    OptimizedGeometry result;
+    optimizer.emitBatches(vertLimit, result);
+    result.welded = welded;
+    result.before = before;
+    result.after  = GeometryOptimizer::measure(GeometryOptimizer::absoluteIndices(result), result.positions.size() / 3);
+    result.optimizeTime = glfwGetTime() - startTime;
+    return result;
+}
+
+static void printStats (const OptimizedGeometry & geometry) {
+    std::cout << "optimizeGeometry: welded " << geometry.welded << " vertices, " << geometry.batches.size() << " batch(es), "
+       << (geometry.indices16.empty() ? "32" : "16") << "-bit indices (took " << geometry.optimizeTime << " seconds)\n"
+       << "  before: " << geometry.before << "\n"
+       << "  after:  " << geometry.after  << "\n";
 }
 
 // Loads an .obj model 
@@ -36,143 +339,302 @@ void ObjViewer::loadModel(const std::string &modelName) {
 void ObjViewer::loadModelAsync(const std::string &modelName) {
     std::cout << "Loading '" << modelName << "'\n";
     double startTime = glfwGetTime();
-    m_resourceLoader.loadObjAsync(modelName, [=](const ResourceLoader::ObjData & modelData) {
+    m_resourceLoader.loadMeshAsync(modelName, [=](const mesh::MeshView & mesh) {
         double loadTime = glfwGetTime() - startTime;
         
         std::cout << "Loaded '" << modelName << "' (took " << loadTime << " seconds)\n";
-        std::cout << "Has " << modelData.shapes.size() << " shapes, "
-        << modelData.materials.size() << " materials\n";
-        for (auto & shape : modelData.shapes) {
-            std::cout << "Shape '" << shape.name << "'\n";
-            std::cout << shape.mesh.indices.size() << " indices\n";
-            std::cout << shape.mesh.positions.size() << " vertices\n";
-            std::cout << shape.mesh.normals.size() << " normals\n";
-            std::cout << shape.mesh.texcoords.size() << " uvs\n";
-            std::cout << shape.mesh.material_ids.size() << " material ids\n";
-        }
+        std::cout << mesh.numVertices << " vertices, " << mesh.numIndices << " indices ("
+            << (mesh.indexType == mesh::IndexType::UINT16 ? "16" : "32") << "-bit), "
+            << mesh.streams.size() << " streams\n";
+        std::cout << "Bounds: (" << mesh.boundsMin[0] << ", " << mesh.boundsMin[1] << ", " << mesh.boundsMin[2]
+            << ") - (" << mesh.boundsMax[0] << ", " << mesh.boundsMax[1] << ", " << mesh.boundsMax[2] << ")\n";
         
-        // Lock iff we're doing any threading (this is safe, since the callback to loadObjAsync
+        // Lock iff we're doing any threading (this is safe, since the callback to loadMeshAsync
         // gets called on the main thread during finishAsyncTasks())
         // This is also why we don't need locks for cout, etc.,
-        m_modelInstances.emplace_back(modelData, loadShader("diffuse_1light"));
+        auto shader = shaderHandle("diffuse_1light");
+        addModel(modelName, [&]() {
+            return std::make_shared<ModelInstance>(mesh, shader.acquire());
+        }, [modelName, shader]() {
+            std::shared_ptr<ModelInstance> model;
+            ResourceLoader resourceLoader { MODULE_NAME };
+            resourceLoader.loadMesh(modelName, [&](const mesh::MeshView & mesh) {
+                model = std::make_shared<ModelInstance>(mesh, shader.acquire());
+            });
+            return model;
+        });
     });
 }
 
+void ObjViewer::loadOptimizedModelAsync(const std::string &modelName) {
+    std::cout << "Loading '" << modelName << "' (optimized)\n";
+    // Load + optimize on the io pool (optimization is too slow to run on the main thread for big
+    // models, and ObjData isn't copyable anyways); the result gets handed to us in finishAsyncTasks().
+    m_resourceLoader.processObjAsync(modelName, "obj-optimized", [](const ResourceLoader::ObjData & data) {
+        // Only split where we'd need 32-bit indices otherwise; smaller batches just duplicate more vertices
+        return optimizeGeometry(data, 1 << 16);
+    }, [=](const OptimizedGeometry & geometry) {
+        if (geometry.batches.empty())
+            return;
+        std::cout << "Loaded '" << modelName << "' (optimized)\n";
+        printStats(geometry);
+        auto shader = shaderHandle("diffuse_1light");
+        addModel(modelName + " (optimized)", [&]() {
+            return std::make_shared<ModelInstance>(geometry, shader.acquire());
+        }, [modelName, shader]() {
+            // Redoes the whole load + optimize, on the main thread; only happens if the
+            // GL_BUFFERS budget is too small for what's on screen.
+            std::shared_ptr<ModelInstance> model;
+            ResourceLoader resourceLoader { MODULE_NAME };
+            resourceLoader.loadObj(modelName, [&](const ResourceLoader::ObjData & data) {
+                auto geometry = optimizeGeometry(data, 1 << 16);
+                if (!geometry.batches.empty())
+                    model = std::make_shared<ModelInstance>(geometry, shader.acquire());
+            });
+            return model;
+        });
+    });
+}
+
+void ObjViewer::addModel (const std::string & key, const ModelBuilder & build, ModelBuilder rebuild) {
+    // build is only good for the call below; after that, loads go through rebuild
+    auto first = std::make_shared<const ModelBuilder *>(&build);
+    auto handle = ResourceLoader::residency().add<ModelInstance>(ResidencyCategory::GL_BUFFERS,
+                                                                 std::string(MODULE_NAME) + ":" + key,
+    [first, rebuild](size_t & bytes, std::string & err) {
+        auto model = *first ? (**first)() : rebuild();
+        if (!model)
+            return err = "Failed to load model", model;
+        bytes = model->bufferBytes;
+        return model;
+    });
+    handle.acquire();
+    *first = nullptr;
+    m_models.push_back(handle);
+}
+
 ObjViewer::ModelInstance::ModelInstance (const ResourceLoader::ObjData & data, ShaderRef s)
     : shader(s)
 {
     
     CHECK_GL_ERRORS();
+    auto & state = gl::StateCache::shared();
     
     assert(data.shapes.size() > 0);
     const auto & indices = data.shapes[0].mesh.indices;
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0].handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0].handle); CHECK_GL_ERRORS();
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
     numIndices = (unsigned)indices.size();
+    bufferBytes += indices.size() * sizeof(unsigned int);
     
     const auto & positions = data.shapes[0].mesh.positions;
     const auto & normals   = data.shapes[0].mesh.normals;
     
-    glBindVertexArray(vao.handle); CHECK_GL_ERRORS();
+    state.bindVertexArray(vao.handle); CHECK_GL_ERRORS();
     glEnableVertexAttribArray(0); CHECK_GL_ERRORS();
     glEnableVertexAttribArray(1); CHECK_GL_ERRORS();
     
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[1].handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, buffers[1].handle); CHECK_GL_ERRORS();
     glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), &positions[0], GL_STATIC_DRAW); CHECK_GL_ERRORS();
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
+    bufferBytes += positions.size() * sizeof(float);
     
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[2].handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, buffers[2].handle); CHECK_GL_ERRORS();
     glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), &normals[0], GL_STATIC_DRAW); CHECK_GL_ERRORS();
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
+    bufferBytes += normals.size() * sizeof(float);
+    
+    state.bindVertexArray(0); CHECK_GL_ERRORS();
+    state.useProgram(0); CHECK_GL_ERRORS();
+}
+
+ObjViewer::ModelInstance::ModelInstance (const OptimizedGeometry & geometry, ShaderRef s)
+    : shader(s)
+{
+    CHECK_GL_ERRORS();
+    auto & state = gl::StateCache::shared();
+    
+    bool use16 = !geometry.indices16.empty();
+    size_t indexSize = use16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    size_t totalIndices = use16 ? geometry.indices16.size() : geometry.indices32.size();
+    const void * indexData = use16 ? (const void*)geometry.indices16.data() : (const void*)geometry.indices32.data();
     
-    glBindVertexArray(0); CHECK_GL_ERRORS();
-    glUseProgram(0); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0].handle); CHECK_GL_ERRORS();
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalIndices * indexSize, indexData, GL_STATIC_DRAW); CHECK_GL_ERRORS();
+    numIndices = (unsigned)totalIndices;
+    bufferBytes += totalIndices * indexSize;
+    indexType  = use16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
     
-#define GET_UNIFORM(k) (shaderUniforms.k = shader->getUniformLocation(#k))
-    GET_UNIFORM(LightPosition);
-    GET_UNIFORM(Kd);
-    GET_UNIFORM(Ld);
-    GET_UNIFORM(ModelViewMatrix);
-    GET_UNIFORM(NormalMatrix);
-//    GET_UNIFORM(ProjectionMatrix);
-    GET_UNIFORM(MVP);
-#undef GET_UNIFORM
+    for (auto & batch : geometry.batches) {
+        batchCounts.push_back((GLsizei)batch.numIndices);
+        batchOffsets.push_back((const GLvoid*)(batch.firstIndex * indexSize));
+        batchBaseVertices.push_back((GLint)batch.baseVertex);
+    }
     
-    startTime = glfwGetTime();
+    state.bindVertexArray(vao.handle); CHECK_GL_ERRORS();
+    
+    state.bindBuffer(GL_ARRAY_BUFFER, buffers[1].handle); CHECK_GL_ERRORS();
+    glBufferData(GL_ARRAY_BUFFER, geometry.positions.size() * sizeof(float), geometry.positions.data(), GL_STATIC_DRAW); CHECK_GL_ERRORS();
+    bufferBytes += geometry.positions.size() * sizeof(float);
+    glEnableVertexAttribArray(0); CHECK_GL_ERRORS();
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
+    
+    if (!geometry.normals.empty()) {
+        state.bindBuffer(GL_ARRAY_BUFFER, buffers[2].handle); CHECK_GL_ERRORS();
+        glBufferData(GL_ARRAY_BUFFER, geometry.normals.size() * sizeof(float), geometry.normals.data(), GL_STATIC_DRAW); CHECK_GL_ERRORS();
+        bufferBytes += geometry.normals.size() * sizeof(float);
+        glEnableVertexAttribArray(1); CHECK_GL_ERRORS();
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
+    }
+    
+    state.bindVertexArray(0); CHECK_GL_ERRORS();
+    state.useProgram(0); CHECK_GL_ERRORS();
 }
 
-void ObjViewer::ModelInstance::draw () {
+// Uploads straight out of the mesh's mapping; no intermediate copies.
+ObjViewer::ModelInstance::ModelInstance (const mesh::MeshView & mesh, ShaderRef s)
+    : shader(s)
+{
     CHECK_GL_ERRORS();
+    auto & state = gl::StateCache::shared();
     
-    glUseProgram(shader->handle()); CHECK_GL_ERRORS();
-    glBindVertexArray(vao.handle);  CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0].handle); CHECK_GL_ERRORS();
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.bytes(), mesh.indices.data, GL_STATIC_DRAW); CHECK_GL_ERRORS();
+    numIndices = (unsigned)mesh.numIndices;
+    bufferBytes += mesh.indices.bytes();
+    indexType  = mesh.indexType == mesh::IndexType::UINT16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
     
-    glm::vec4 lightPosition;
+    state.bindVertexArray(vao.handle); CHECK_GL_ERRORS();
     
-//    uniform vec4 LightPosition;
-//    uniform vec3 Kd;
-//    uniform vec3 Ld;
-//    
-//    uniform mat4 ModelViewMatrix;
-//    uniform mat3 NormalMatrix;
-//    uniform mat4 MVP;
+    // Position -> attrib 0, normal -> attrib 1. Interleaved streams share a block, so each
+    // distinct block only gets uploaded once.
+    const uint8_t * uploaded [2] = { nullptr, nullptr };
+    unsigned numUploaded = 0;
+    for (auto & stream : mesh.streams) {
+        GLuint attrib;
+        switch (stream.type) {
+            case mesh::StreamType::POSITION: attrib = 0; break;
+            case mesh::StreamType::NORMAL:   attrib = 1; break;
+            default: continue;
+        }
+        unsigned i = 0;
+        while (i < numUploaded && uploaded[i] != stream.block.data)
+            ++i;
+        state.bindBuffer(GL_ARRAY_BUFFER, buffers[1 + i].handle); CHECK_GL_ERRORS();
+        if (i == numUploaded) {
+            glBufferData(GL_ARRAY_BUFFER, stream.block.bytes(), stream.block.data, GL_STATIC_DRAW); CHECK_GL_ERRORS();
+            uploaded[numUploaded++] = stream.block.data;
+            bufferBytes += stream.block.bytes();
+        }
+        glEnableVertexAttribArray(attrib); CHECK_GL_ERRORS();
+        glVertexAttribPointer(attrib, stream.components, GL_FLOAT, GL_FALSE, stream.stride,
+                              (void*)(uintptr_t)stream.attribOffset); CHECK_GL_ERRORS();
+    }
+    
+    state.bindVertexArray(0); CHECK_GL_ERRORS();
+    state.useProgram(0); CHECK_GL_ERRORS();
+}
+
+void ObjViewer::ModelInstance::record (gl::CommandList & commands) const {
+    // diffuse_1light.vs (hashed at compile time; values that didn't change since the last draw
+    // w/ this shader -- Kd, Ld, NormalMatrix, usually MVP -- never reach gl)
+    static constexpr gl::Uniform<glm::vec4>   LightPosition   { "LightPosition" };
+    static constexpr gl::Uniform<glm::vec3>   Kd              { "Kd" };
+    static constexpr gl::Uniform<glm::vec3>   Ld              { "Ld" };
+    static constexpr gl::Uniform<glm::mat4x4> ModelViewMatrix { "ModelViewMatrix" };
+    static constexpr gl::Uniform<glm::mat3x3> NormalMatrix    { "NormalMatrix" };
+    static constexpr gl::Uniform<glm::mat4x4> MVP             { "MVP" };
+    constexpr float FAR_PLANE = 300.0f;
     
     double elapsed = glfwGetTime() - startTime;
     const double LIGHT_ROTATION_SPEED = 5.0 * boost::math::constants::pi<double>();
     
-#define SET_UNIFORM(k, v) shader->setUniform(shaderUniforms.k, (v))
-    
     double angle = elapsed * LIGHT_ROTATION_SPEED;
-    
-    SET_UNIFORM(LightPosition, glm::vec4((float)cos(angle), 0, (float)sin(angle), 1)); CHECK_GL_ERRORS();
-    SET_UNIFORM(Kd, glm::vec3(0.5)); CHECK_GL_ERRORS();
-    SET_UNIFORM(Ld, glm::vec3(1.0)); CHECK_GL_ERRORS();
+    glm::vec4 lightPosition ((float)cos(angle), 0, (float)sin(angle), 1);
     
 //    auto model = glm::translate(glm::mat4x4(1.0), glm::vec3(0, 0, -2.0));
     auto model = glm::mat4x4(1.0);
     auto const & view = Application::mainCamera()->view;
-    glm::mat4x4 proj = glm::perspective(45.0f, 1.7f, 0.1f, 300.0f);
-    
-    SET_UNIFORM(ModelViewMatrix, view * model); CHECK_GL_ERRORS();
-    SET_UNIFORM(NormalMatrix, glm::mat3x3(1.0f)); CHECK_GL_ERRORS();
-    SET_UNIFORM(MVP, proj * view * model); CHECK_GL_ERRORS();
+    glm::mat4x4 proj = glm::perspective(45.0f, 1.7f, 0.1f, FAR_PLANE);
+    glm::mat4x4 modelView = view * model;
     
-#undef SET_UNIFORM
-    
-    CHECK_GL_ERRORS();
-    
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0].handle);            CHECK_GL_ERRORS();
-    glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, (void*)0); CHECK_GL_ERRORS();
+    gl::DrawCommand draw;
+    draw.program       = shader->loaded() ? shader->handle() : 0;      // (dropped if it isn't)
+    draw.vao           = vao.handle;
+    draw.elementBuffer = buffers[0].handle;
+    draw.depth         = -modelView[3][2] / FAR_PLANE;     // (origin's view depth) front to back
+    draw.indexType     = indexType;
+    if (batchCounts.empty()) {
+        draw.type  = gl::DrawCommand::ELEMENTS;
+        draw.count = (GLsizei)numIndices;
+    } else {
+        draw.type         = gl::DrawCommand::MULTI_ELEMENTS_BASE_VERTEX;
+        draw.counts       = &batchCounts[0];
+        draw.offsets      = &batchOffsets[0];
+        draw.baseVertices = &batchBaseVertices[0];
+        draw.drawCount    = (GLsizei)batchCounts.size();
+    }
+    draw.setup = [shader = shader.get(), lightPosition, modelView, mvp = proj * modelView] () {
+        shader->setUniform(LightPosition, lightPosition);
+        shader->setUniform(Kd, glm::vec3(0.5));
+        shader->setUniform(Ld, glm::vec3(1.0));
+        shader->setUniform(ModelViewMatrix, modelView);
+        shader->setUniform(NormalMatrix, glm::mat3x3(1.0f));
+        shader->setUniform(MVP, mvp);
+        CHECK_GL_ERRORS();
+    };
+    commands.push(std::move(draw));
 }
 
 
 
 
-ShaderRef ObjViewer::loadShader (const std::string & shaderName) {
+ObjViewer::ShaderHandle ObjViewer::shaderHandle (const std::string & shaderName) {
     auto it = m_shaderCache.find(shaderName);
-    if (it != m_shaderCache.end())
-        return it->second;
-    
-    auto shader = std::make_shared<Shader>(shaderName);
-    m_resourceLoader.loadTextFile(shaderName + ".fs", [&shader](const char *src) {
-        shader->compileFragment(src);
-    }) &&
-    m_resourceLoader.loadTextFile(shaderName + ".vs", [&shader](const char *src) {
-        shader->compileVertex(src);
-    }) &&
-    shader->linkProgram() ?
-        (std::cout << "Successfully loaded shader '" << shader->name << "'\n") :
-        (std::cout << "Failed to load shader '" << shader->name << "'\n");
-    
-    m_shaderCache.insert({ shaderName, shader });
-    return shader;
+    if (it == m_shaderCache.end()) {
+        // Shared w/ every other ObjViewer, so the loader can't hang onto this
+        auto handle = ResourceLoader::residency().add<Shader>(ResidencyCategory::GL_PROGRAMS,
+                                                              std::string(MODULE_NAME) + ":" + shaderName,
+        [shaderName](size_t & bytes, std::string &) {
+            // Hot-reloaded for as long as it's resident
+            struct WatchedShader {
+                Shader shader;
+                ShaderReloader::Registration reload;
+                WatchedShader (const std::string & name) : shader(name) {}
+            };
+            ResourceLoader resourceLoader { MODULE_NAME };
+            auto watched = std::make_shared<WatchedShader>(shaderName);
+            auto shader = std::shared_ptr<Shader>(watched, &watched->shader);
+            resourceLoader.loadShaderSource(shaderName + ".fs", [&shader](const char *src) {
+                shader->compileFragment(src);
+            }) &&
+            resourceLoader.loadShaderSource(shaderName + ".vs", [&shader](const char *src) {
+                shader->compileVertex(src);
+            }) &&
+            shader->linkProgram() ?
+                (std::cout << "Successfully loaded shader '" << shader->name << "'\n") :
+                (std::cout << "Failed to load shader '" << shader->name << "'\n");
+            
+            // Driver-side size is opaque; the program binary is a decent proxy
+            GLint length = 0;
+            if (shader->loaded()) {
+                glGetProgramiv(shader->handle(), GL_PROGRAM_BINARY_LENGTH, &length); CHECK_GL_ERRORS();
+            }
+            bytes = (size_t)length;
+            if (auto reloader = Application::shaderReloader())
+                watched->reload = reloader->watch(*shader, shaderName + ".fs", shaderName + ".vs");
+            return shader;
+        });
+        it = m_shaderCache.insert({ shaderName, handle }).first;
+    }
+    return it->second;
 }
 
 ObjViewer::ObjViewer ()
 {
     std::cout << "Initializing model viewer\n";
     
-    loadModelAsync("dragon.obj");
+    loadOptimizedModelAsync("dragon.obj");
 //    loadModelAsync("cube.obj");
 //    loadModelAsync("sibenik.obj");
 }
@@ -182,8 +644,24 @@ ObjViewer::~ObjViewer() {
 }
 void ObjViewer::drawFrame() {
     m_resourceLoader.finishAsyncTasks();
-    for (auto & model : m_modelInstances)
-        model.draw();
+    
+    // Pins stay until next frame's drawFrame(): the draws recordFrame() makes use the models' gl
+    // objects until they're submitted.
+    m_drawnModels.clear();
+    for (auto it = m_models.begin(); it != m_models.end(); ) {
+        if (auto model = it->acquire()) {
+            m_drawnModels.push_back(model);
+            ++it;
+        } else {
+            std::cerr << "Dropping model '" << it->key() << "': " << it->error() << '\n';
+            it = m_models.erase(it);
+        }
+    }
+}
+
+void ObjViewer::recordFrame(gl::CommandList & commands) {
+    for (auto & model : m_drawnModels)
+        model->record(commands);
 }
 
 
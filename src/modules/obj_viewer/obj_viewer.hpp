@@ -13,7 +13,6 @@
 #include <glm/glm.hpp>
 #include <unordered_map>
 #include <mutex>
-#include <future>
 
 namespace gl_sandbox {
 namespace modules {
@@ -23,6 +22,7 @@ public:
     ObjViewer ();
     ~ObjViewer ();
     void drawFrame () override;
+    void recordFrame (gl::CommandList & commands) override;
     
     static constexpr const char * MODULE_NAME = "module-objviewer";
     static constexpr const char * MODULE_DIR  = "obj_viewer";
@@ -36,33 +36,84 @@ public:
         ShaderRef shader;
     };
     
+    // Output of optimizeGeometry() (see obj_viewer.cpp): welded + cache-ordered geometry, split
+    // into batches that each reference at most vertLimit vertices. Indices are batch-relative
+    // (drawn w/ a base vertex), and 16-bit whenever every batch fits.
+    struct OptimizedGeometry {
+        struct Batch {
+            unsigned firstIndex, numIndices;
+            unsigned baseVertex, numVertices;
+        };
+        std::vector<float>    positions, normals, texcoords;
+        std::vector<uint16_t> indices16;
+        std::vector<uint32_t> indices32;
+        std::vector<Batch>    batches;
+        
+        // Simulated post-transform cache behavior (FIFO, see GeometryOptimizer::measure())
+        struct CacheStats {
+            size_t numTriangles = 0;
+            size_t numVertices  = 0;
+            size_t transforms   = 0;                // simulated vertex shader invocations
+            
+            double acmr () const { return numTriangles ? (double)transforms / numTriangles : 0; }
+            double atvr () const { return numVertices  ? (double)transforms / numVertices  : 0; }
+        };
+        // Filled in on the io thread that optimized it; printed by whoever gets the result
+        size_t     welded = 0;
+        CacheStats before, after;
+        double     optimizeTime = 0;                // seconds
+    };
+    
     struct ModelInstance {
         gl::VAO vao;
         gl::VBO buffers [3];
         ShaderRef shader;
         unsigned numIndices = 0;
-        double startTime;
-        struct {
-            GLint LightPosition, Kd, Ld, ModelViewMatrix, NormalMatrix, ProjectionMatrix, MVP;
-        } shaderUniforms;
+        GLenum indexType = GL_UNSIGNED_INT;
+        
+        // Set iff drawn in batches (w/ glMultiDrawElementsBaseVertex)
+        std::vector<GLsizei>       batchCounts;
+        std::vector<const GLvoid*> batchOffsets;
+        std::vector<GLint>         batchBaseVertices;
+        double startTime = glfwGetTime();
+        size_t bufferBytes = 0;     // uploaded by the constructor (what residency() counts it as)
         
         ModelInstance (const ResourceLoader::ObjData &, ShaderRef shader);
+        ModelInstance (const mesh::MeshView &, ShaderRef shader);
+        ModelInstance (const OptimizedGeometry &, ShaderRef shader);
         ModelInstance (const ModelInstance &) = delete;
         ModelInstance (ModelInstance &&) = default;
-        void draw ();
+        void record (gl::CommandList & commands) const;
     };
 
 protected:
-    // Loads and/or caches shader w/ name
-    ShaderRef loadShader (const std::string & shaderName);
+    typedef ResidencyManager::Handle<gl::Shader>    ShaderHandle;
+    typedef ResidencyManager::Handle<ModelInstance> ModelHandle;
+    typedef std::function<std::shared_ptr<ModelInstance>()> ModelBuilder;
+    
+    // Registers and/or caches shader w/ name; acquire() loads it (again, if it got evicted)
+    ShaderHandle shaderHandle (const std::string & shaderName);
+    
+    // Registers a model w/ ResourceLoader::residency() (GL_BUFFERS), built by build before this
+    // returns. If its buffers get evicted, rebuild makes it again (from the file) when it's next drawn.
+    void addModel (const std::string & key, const ModelBuilder & build, ModelBuilder rebuild);
     void loadModel (const std::string & modelName);
     void loadModelAsync (const std::string & modelName);
     
+    // Loads an .obj + runs it through optimizeGeometry() on the io pool. Finished models get
+    // picked up in drawFrame().
+    void loadOptimizedModelAsync (const std::string & modelName);
+    
 private:
     ResourceLoader m_resourceLoader { MODULE_NAME };
     
-    std::vector<ModelInstance> m_modelInstances;
-    std::unordered_map<std::string, ShaderRef> m_shaderCache;
+    // Handles into ResourceLoader::residency() (GL_PROGRAMS); model instances keep their shaders pinned.
+    std::unordered_map<std::string, ShaderHandle> m_shaderCache;
+    std::vector<ModelHandle> m_models;
+    
+    // This frame's models: pinned (+ rebuilt if they got evicted) by drawFrame() on the main
+    // thread, since recordFrame() runs on a worker
+    std::vector<std::shared_ptr<ModelInstance>> m_drawnModels;
 };
     
 }; // namespace modules
@@ -31,10 +31,10 @@ constexpr double ROTATION_PERIOD = 2.5;
 
 gl::Shader loadShader (ResourceLoader &r, std::string name) {
     gl::Shader shader { name };
-    r.loadTextFile(name + ".fs", [&] (auto src) {
+    r.loadShaderSource(name + ".fs", [&] (auto src) {
         shader.compileFragment(src); CHECK_GL_ERRORS();
     });
-    r.loadTextFile(name + ".vs", [&](auto src) {
+    r.loadShaderSource(name + ".vs", [&](auto src) {
         shader.compileVertex(src); CHECK_GL_ERRORS();
     });
     if (shader.linkProgram()) {
@@ -61,21 +61,24 @@ TriangleModule::TriangleModule() {
 //    });
 
     // But can settle for this in the meantime:
-    m_resourceLoader.loadTextFile(m_shader.name + ".fs", [this] (auto src) {
+    m_resourceLoader.loadShaderSource(m_shader.name + ".fs", [this] (auto src) {
         m_shader.compileFragment(src);
     });
-    m_resourceLoader.loadTextFile(m_shader.name + ".vs", [this] (const char * src) {
+    m_resourceLoader.loadShaderSource(m_shader.name + ".vs", [this] (const char * src) {
         m_shader.compileVertex(src);
     });
     
     if (m_shader.linkProgram()) {
         std::cout << "Successfully loaded shader '" << m_shader.name << "'\n";
-        glUseProgram(m_shader.handle()); CHECK_GL_ERRORS();
+        gl::StateCache::shared().useProgram(m_shader.handle()); CHECK_GL_ERRORS();
         glValidateProgram(m_shader.handle()); CHECK_GL_ERRORS();
     } else {
         std::cout << "Failed to load shader '" << m_shader.name << "'\n";
-        glUseProgram(0); CHECK_GL_ERRORS();
+        gl::StateCache::shared().useProgram(0); CHECK_GL_ERRORS();
     }
+    // Even if it failed -- fixing the source will load it
+    if (auto reloader = Application::shaderReloader())
+        m_shaderReload = reloader->watch(m_shader, m_shader.name + ".fs", m_shader.name + ".vs");
     
     std::cout << "Loading vaos, etc\n";
 
@@ -107,30 +110,31 @@ TriangleModule::TriangleModule() {
     }
     assert(instancePositions[1] != instancePositions[21]);
     
-    glBindBuffer(GL_ARRAY_BUFFER, positionBuffer.handle); CHECK_GL_ERRORS();
+    auto & state = gl::StateCache::shared();
+    state.bindBuffer(GL_ARRAY_BUFFER, positionBuffer.handle); CHECK_GL_ERRORS();
     glBufferData(GL_ARRAY_BUFFER, 9 * sizeof(float), positionData, GL_STATIC_DRAW); CHECK_GL_ERRORS();
     
-    glBindBuffer(GL_ARRAY_BUFFER, colorBuffer.handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, colorBuffer.handle); CHECK_GL_ERRORS();
     glBufferData(GL_ARRAY_BUFFER, 9 * sizeof(float), colorData, GL_STATIC_DRAW); CHECK_GL_ERRORS();
     
-    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer.handle); CHECK_GL_ERRORS();
     glBufferData(GL_ARRAY_BUFFER, INSTANCE_ARRAY_SIZE * sizeof(float) * 3, &instancePositions[0], GL_STATIC_DRAW); CHECK_GL_ERRORS();
     
-    glBindVertexArray(m_vao.handle); CHECK_GL_ERRORS();
+    state.bindVertexArray(m_vao.handle); CHECK_GL_ERRORS();
     
     glEnableVertexAttribArray(0); CHECK_GL_ERRORS();
     glEnableVertexAttribArray(1); CHECK_GL_ERRORS();
     glEnableVertexAttribArray(2); CHECK_GL_ERRORS();
     
-    glBindBuffer(GL_ARRAY_BUFFER, positionBuffer.handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, positionBuffer.handle); CHECK_GL_ERRORS();
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
     
-    glBindBuffer(GL_ARRAY_BUFFER, colorBuffer.handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, colorBuffer.handle); CHECK_GL_ERRORS();
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
     
-    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.handle); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer.handle); CHECK_GL_ERRORS();
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, NULL); CHECK_GL_ERRORS();
-    glBindBuffer(GL_ARRAY_BUFFER, 0); CHECK_GL_ERRORS();
+    state.bindBuffer(GL_ARRAY_BUFFER, 0); CHECK_GL_ERRORS();
     glVertexAttribDivisor(2, 1); CHECK_GL_ERRORS(); // instance data: update each draw (1; default 0)
     
     m_uniform_vp_matrix = m_shader.getUniformLocation ("ViewProjMatrix");
@@ -157,10 +161,7 @@ TriangleModule::TriangleModule() {
 TriangleModule::~TriangleModule() {
     std::cout << "Killing triangle module" << std::endl;
 }
-void TriangleModule::drawFrame() {
-    glUseProgram(m_shader.handle());
-    glBindVertexArray(m_vao.handle); CHECK_GL_ERRORS();
-    
+void TriangleModule::recordFrame(gl::CommandList & commands) {
     double curTime     = glfwGetTime();
     double elapsedTime = m_startTime - curTime;
     double dt          = m_lastTime  - curTime;
@@ -182,10 +183,16 @@ void TriangleModule::drawFrame() {
     mat4 view           = Application::mainCamera()->view;
     mat4 proj           = glm::perspective(m_cameraFov, 1.7f, 0.01f, 1e3f);
     
-    m_shader.setUniform(m_uniform_vp_matrix, proj * view);
-    m_shader.setUniform(m_uniform_rot_matrix, rotationMatrix);
-    
-    glDrawArraysInstanced(GL_TRIANGLES, 0, 3, INSTANCE_ARRAY_SIZE); CHECK_GL_ERRORS();
+    gl::DrawCommand draw;
+    draw.program   = m_shader.loaded() ? m_shader.handle() : 0;     // (dropped if it isn't)
+    draw.vao       = m_vao.handle;
+    draw.count     = 3;
+    draw.instances = INSTANCE_ARRAY_SIZE;
+    draw.setup = [this, viewProj = proj * view, rotationMatrix] () {
+        m_shader.setUniform(m_uniform_vp_matrix, viewProj);
+        m_shader.setUniform(m_uniform_rot_matrix, rotationMatrix);
+    };
+    commands.push(std::move(draw));
     
 //    auto pv = proj * view;
 //    mat4 identity (1.0f);
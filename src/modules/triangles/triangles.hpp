@@ -12,6 +12,7 @@
 #include "../module.hpp"
 #include "../../common/gl/gl_wrapper.hpp"
 #include "../../common/input.hpp"
+#include "../../common/shader_reloader.hpp"
 
 namespace gl_sandbox {
     
@@ -19,13 +20,15 @@ class TriangleModule : public Module<TriangleModule> {
 public:
     TriangleModule ();
     ~TriangleModule ();
-    void drawFrame () override;
+    void drawFrame () override {}
+    void recordFrame (gl::CommandList & commands) override;
     
     static constexpr const char* MODULE_NAME = "module-triangles";
     static constexpr const char* MODULE_DIR  = "triangles";
 private:
     ResourceLoader m_resourceLoader { MODULE_DIR };
     gl::Shader m_shader { "basic_shader" };
+    ShaderReloader::Registration m_shaderReload;
     gl::VAO    m_vao;
     gl::VBO    m_buffers [3];
     double     m_startTime, m_lastTime;
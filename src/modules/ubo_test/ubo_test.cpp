@@ -7,6 +7,7 @@
 //
 
 #include "ubo_test.hpp"
+#include <chrono>
 
 using namespace gl_sandbox;
 using namespace gl_sandbox::modules;
@@ -16,41 +17,73 @@ const char * UboDynamicModule::MODULE_NAME = "ubo-dynamic-test";
 const char * UboDynamicModule::MODULE_DIR =  "ubo_test";
 const char * UboStaticModule::MODULE_NAME = "ubo-static-test";
 const char * UboStaticModule::MODULE_DIR = "ubo_test";
+const char * UboCoalescedModule::MODULE_NAME = "ubo-coalesced-test";
+const char * UboCoalescedModule::MODULE_DIR = "ubo_test";
 
+// Doesn't match the (std140) block: vec3s where it has vec4s
 struct Foo {
-    glm::vec3 innerColor;
-    glm::vec3 outerColor;
-    float radiusInner;
-    float radiusOuter;
+    glm::vec3 innerColor  { 1.0f, 0.5f, 0.25f };
+    glm::vec3 outerColor  { 0.0f, 0.0f, 0.0f };
+    float radiusInner = 0.25f;
+    float radiusOuter = 0.45f;
     
     Foo () {}
 };
+// Does
+struct Foo140 {
+    glm::vec4 innerColor  { 1.0f, 0.5f, 0.25f, 1.0f };
+    glm::vec4 outerColor  { 0.0f, 0.0f, 0.0f, 0.0f };
+    float radiusInner = 0.25f;
+    float radiusOuter = 0.45f;
+    float padding [2] = { 0, 0 };
+    
+    Foo140 () {}
+};
 std::unique_ptr<Shader> loadShader (ResourceLoader & resourceLoader, const std::string & shaderName);
 
-template <typename T, typename M>
+static constexpr unsigned UPLOADS_PER_FRAME = 256;
+
+template <typename T, typename M, typename Data>
 struct TestImpl {
 protected:
+    typedef std::chrono::high_resolution_clock clock;
+    
     ResourceLoader m_resourceLoader { M::MODULE_DIR };
-    Foo            m_foo;
+    Data           m_foo;
     std::unique_ptr<Shader> m_shader;
+    clock::duration m_uploadTime { 0 };
+    size_t          m_uploads = 0;
     
 #define m_ubo static_cast<T*>(this)->m_ubo
 public:
     TestImpl () :
         m_shader(loadShader(m_resourceLoader, "ubo_test"))
     {}
+    ~TestImpl () {
+        if (m_uploads) {
+            std::cout << M::MODULE_NAME << ": " << m_uploads << " uploads, "
+                      << std::chrono::duration<double, std::micro>(m_uploadTime).count() / m_uploads << " us / upload\n";
+        }
+    }
     void drawFrame () {
-        m_ubo.bufferData(m_foo);
+        auto start = clock::now();
+        for (unsigned i = 0; i < UPLOADS_PER_FRAME; ++i) {
+            m_foo.radiusOuter = 0.45f + 0.0001f * i;    // (so it's not the same thing every time)
+            m_ubo.bufferData(m_foo);
+            m_ubo.bind(0);
+        }
+        m_uploadTime += clock::now() - start;
+        m_uploads    += UPLOADS_PER_FRAME;
     }
 #undef m_ubo
 };
 
 std::unique_ptr<Shader> loadShader (ResourceLoader &resourceLoader, const std::string & shaderName) {
     Shader * shader = new Shader(shaderName.c_str());
-    resourceLoader.loadTextFile(shaderName + ".fs", [shader] (const char * src) {
+    resourceLoader.loadShaderSource(shaderName + ".fs", [shader] (const char * src) {
         shader->compileFragment(src);
     });
-    resourceLoader.loadTextFile(shaderName + ".vs", [shader] (const char * src) {
+    resourceLoader.loadShaderSource(shaderName + ".vs", [shader] (const char * src) {
         shader->compileVertex(src);
     });
     if (shader->linkProgram()) {
@@ -61,26 +94,43 @@ std::unique_ptr<Shader> loadShader (ResourceLoader &resourceLoader, const std::s
     return std::unique_ptr<Shader> { shader };
 }
 
-struct gl_sandbox::modules::UboDynamicImpl : public TestImpl<UboDynamicImpl, UboDynamicModule> {
+struct gl_sandbox::modules::UboDynamicImpl : public TestImpl<UboDynamicImpl, UboDynamicModule, Foo> {
 public:
     UboDynamicImpl (const UboDynamicModule & module) :
-        m_ubo { *m_shader, "BlobSettings", (Foo*)&m_foo, {
+        m_ubo { *m_shader, "BlobSettings", &m_foo, {
             { "InnerColor", sizeof(m_foo.innerColor), &m_foo.innerColor },
             { "OuterColor", sizeof(m_foo.outerColor), &m_foo.outerColor },
             { "RadiusInner", sizeof(m_foo.radiusInner), &m_foo.radiusInner },
             { "RadiusOuter", sizeof(m_foo.radiusOuter), &m_foo.radiusOuter }
         }}
-    {}
+    {
+        std::cout << "UBO dynamic test: 4 fields => " << m_ubo.copySpans() << " copies\n";
+    }
 public:
     ubo_dynamic::UniformBuffer<Foo> m_ubo;
 };
-struct gl_sandbox::modules::UboStaticImpl : public TestImpl<UboDynamicImpl, UboDynamicModule> {
+struct gl_sandbox::modules::UboStaticImpl : public TestImpl<UboStaticImpl, UboStaticModule, Foo140> {
     UboStaticImpl (const UboStaticModule & module) :
         m_ubo { *m_shader, "BlobSettings" }
     {}
 
 public:
-    ubo_fast::UniformBuffer<Foo> m_ubo;
+    ubo_fast::UniformBuffer<Foo140> m_ubo;
+};
+struct gl_sandbox::modules::UboCoalescedImpl : public TestImpl<UboCoalescedImpl, UboCoalescedModule, Foo140> {
+public:
+    UboCoalescedImpl (const UboCoalescedModule &) :
+        m_ubo { *m_shader, "BlobSettings", &m_foo, {
+            { "InnerColor", sizeof(m_foo.innerColor), &m_foo.innerColor },
+            { "OuterColor", sizeof(m_foo.outerColor), &m_foo.outerColor },
+            { "RadiusInner", sizeof(m_foo.radiusInner), &m_foo.radiusInner },
+            { "RadiusOuter", sizeof(m_foo.radiusOuter), &m_foo.radiusOuter }
+        }}
+    {
+        std::cout << "UBO coalesced test: 4 fields => " << m_ubo.copySpans() << " copies" << (m_ubo.direct() ? " (direct)\n" : "\n");
+    }
+public:
+    ubo_dynamic::UniformBuffer<Foo140> m_ubo;
 };
 
 UboDynamicModule::UboDynamicModule ()
@@ -95,12 +145,21 @@ UboStaticModule::UboStaticModule ()
     std::cout << "Initializing UBO static / fast test\n";
 }
 
+UboCoalescedModule::UboCoalescedModule ()
+    : impl(new UboCoalescedImpl(*this))
+{
+    std::cout << "Initializing UBO coalesced test\n";
+}
+
 void UboDynamicModule::drawFrame () {
     impl->drawFrame();
 }
 void UboStaticModule::drawFrame () {
     impl->drawFrame();
 }
+void UboCoalescedModule::drawFrame () {
+    impl->drawFrame();
+}
 
 UboDynamicModule::~UboDynamicModule() {
     std::cout << "Killing UBO dynamic test\n";
@@ -108,6 +167,9 @@ UboDynamicModule::~UboDynamicModule() {
 UboStaticModule::~UboStaticModule() {
     std::cout << "Killing UBO static / fast test\n";
 }
+UboCoalescedModule::~UboCoalescedModule() {
+    std::cout << "Killing UBO coalesced test\n";
+}
 
 
 
@@ -17,6 +17,13 @@ namespace modules {
 
 class UboDynamicImpl;
 class UboStaticImpl;
+class UboCoalescedImpl;
+
+// Upload micro-benchmarks: each does UPLOADS_PER_FRAME uploads (+ binds) of the same BlobSettings
+// block per frame, as if for that many objects, and reports the average time per upload on exit.
+//  static:    ubo_fast -- T is the block; one memcpy
+//  dynamic:   ubo_dynamic w/ a T that doesn't match (vec3s) => a copy per span after coalescing
+//  coalesced: ubo_dynamic w/ a T that does => coalesces down to one span, uploaded directly
     
 struct UboDynamicModule : public Module<UboDynamicModule> {
 public:
@@ -42,6 +49,18 @@ protected:
     std::unique_ptr<UboStaticImpl> impl;
 };
 
+class UboCoalescedModule : public Module<UboCoalescedModule> {
+public:
+    UboCoalescedModule ();
+    ~UboCoalescedModule ();
+    void drawFrame () override;
+    
+    static const char * MODULE_NAME;
+    static const char * MODULE_DIR;
+protected:
+    std::unique_ptr<UboCoalescedImpl> impl;
+};
+
 }; // namespace modules
 }; // namespace gl_sandbox
 
@@ -0,0 +1,159 @@
+//
+//  main.cpp
+//  file-change-coalescer-test
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "../../src/common/resourcelayer/file_change_coalescer.hpp"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::resource_impl;
+
+typedef FileChangeCoalescer::ChangeKind ChangeKind;
+
+static const double QUIET = 0.02;
+
+static void sleepFor (double seconds) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+// Waits out the quiet window, then returns whatever gets dispatched.
+static FileChangeCoalescer::Batch settle (FileChangeCoalescer & coalescer) {
+    FileChangeCoalescer::Batch result;
+    sleepFor(QUIET * 2);
+    coalescer.dispatch([&](const FileChangeCoalescer::Batch & batch) { result = batch; });
+    return result;
+}
+
+// A "save all" from an editor: several writes to several files, in one burst.
+void testBurst () {
+    FileChangeCoalescer coalescer (QUIET);
+    for (auto i = 0; i < 3; ++i) {
+        coalescer.modified("c.glsl");
+        coalescer.modified("a.glsl");
+        coalescer.modified("b.glsl");
+    }
+    // Not quiet yet
+    assert(coalescer.dispatch([](const FileChangeCoalescer::Batch &) { assert(0); }) == 0);
+    assert(coalescer.numPending() == 3);
+
+    auto batch = settle(coalescer);
+    assert(batch.size() == 3);
+    assert(batch[0].path == "a.glsl" && batch[1].path == "b.glsl" && batch[2].path == "c.glsl");
+    for (auto & change : batch)
+        assert(change.kind == ChangeKind::MODIFIED && change.numEvents == 3);
+    assert(coalescer.numPending() == 0);
+
+    // Nothing left over
+    assert(coalescer.dispatch([](const FileChangeCoalescer::Batch &) { assert(0); }) == 0);
+    auto stats = coalescer.stats();
+    assert(stats.events == 9 && stats.changes == 3 && stats.batches == 1 && stats.dropped == 0);
+}
+
+// How each path's events collapse
+void testKinds () {
+    FileChangeCoalescer coalescer (QUIET);
+    coalescer.created("new");       coalescer.modified("new");
+    coalescer.modified("gone");     coalescer.deleted("gone");
+    coalescer.created("temp");      coalescer.modified("temp");  coalescer.deleted("temp");
+    coalescer.deleted("back");      coalescer.created("back");
+
+    auto batch = settle(coalescer);
+    assert(batch.size() == 3);
+    assert(batch[0].path == "back" && batch[0].kind == ChangeKind::MODIFIED && batch[0].numEvents == 2);
+    assert(batch[1].path == "gone" && batch[1].kind == ChangeKind::DELETED);
+    assert(batch[2].path == "new"  && batch[2].kind == ChangeKind::CREATED);
+    assert(coalescer.stats().dropped == 1);
+}
+
+// Editors that save through a temp file + rename: just one MODIFIED for the real file.
+void testRenameSave () {
+    FileChangeCoalescer coalescer (QUIET);
+    coalescer.created("shader.fs~");
+    coalescer.modified("shader.fs~");
+    coalescer.renamed("shader.fs~", "shader.fs");
+
+    auto batch = settle(coalescer);
+    assert(batch.size() == 1);
+    assert(batch[0].path == "shader.fs" && batch[0].kind == ChangeKind::MODIFIED && batch[0].numEvents == 1);
+    assert(coalescer.stats().dropped == 1);
+}
+
+// changed() doesn't say what happened; the file's existence decides.
+void testUntypedChanges () {
+    char path [] = "/tmp/file-change-coalescer-test.XXXXXX";
+    auto fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    std::string missing = std::string(path) + ".missing";
+
+    FileChangeCoalescer coalescer (QUIET);
+    coalescer.changed(path);
+    coalescer.changed(missing);
+    auto batch = settle(coalescer);
+    unlink(path);
+
+    assert(batch.size() == 2);
+    assert(batch[0].path == path    && batch[0].kind == ChangeKind::MODIFIED);
+    assert(batch[1].path == missing && batch[1].kind == ChangeKind::DELETED);
+}
+
+// Something that never goes quiet doesn't hold everything else back forever.
+void testMaxDelay () {
+    FileChangeCoalescer coalescer (QUIET);
+    coalescer.modified("shader.vs");
+
+    FileChangeCoalescer::Batch delivered;
+    auto maxDelay = QUIET * FileChangeCoalescer::MAX_DELAY_FACTOR;
+    for (auto t = 0.0; t < maxDelay * 3 && delivered.empty(); t += QUIET / 4) {
+        coalescer.modified("app.log");
+        coalescer.dispatch([&](const FileChangeCoalescer::Batch & batch) { delivered = batch; });
+        sleepFor(QUIET / 4);
+    }
+    // Delivered once it'd been pending for maxDelay, even though things never went quiet
+    assert(std::any_of(delivered.begin(), delivered.end(), [](const FileChangeCoalescer::Change & change) {
+        return change.path == "shader.vs" && change.numEvents == 1;
+    }));
+}
+
+// Events come in from watcher threads
+void testThreads () {
+    const int NUM_THREADS = 4, NUM_EVENTS = 1000, NUM_PATHS = 50;
+    FileChangeCoalescer coalescer (QUIET);
+    std::vector<std::thread> threads;
+    for (auto t = 0; t < NUM_THREADS; ++t) {
+        threads.emplace_back([&coalescer, t]() {
+            for (auto i = 0; i < NUM_EVENTS; ++i)
+                coalescer.modified("file" + std::to_string((i + t) % NUM_PATHS));
+        });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    auto batch = settle(coalescer);
+    assert(batch.size() == NUM_PATHS);
+    unsigned numEvents = 0;
+    for (auto & change : batch)
+        numEvents += change.numEvents;
+    assert(numEvents == NUM_THREADS * NUM_EVENTS);
+    assert(coalescer.stats().events == NUM_THREADS * NUM_EVENTS);
+}
+
+int main() {
+    testBurst();
+    testKinds();
+    testRenameSave();
+    testUntypedChanges();
+    testMaxDelay();
+    testThreads();
+    std::cout << "Tests passed\n";
+    return 0;
+}
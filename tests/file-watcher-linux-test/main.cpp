@@ -0,0 +1,222 @@
+//
+//  main.cpp
+//  file-watcher-linux-test
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "../../src/common/resourcelayer/file_watcher.hpp"
+#include <iostream>
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace gl_sandbox;
+using namespace gl_sandbox::resource_impl;
+using namespace gl_sandbox::resource_impl::platform_linux;
+
+static const std::string ROOT = "/tmp/file-watcher-linux-test";
+
+static void sleepMs (int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static void touch (const std::string & path) {
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    close(fd);
+}
+
+static void removeTree (const std::string & path) {
+    if (auto d = opendir(path.c_str())) {
+        while (auto entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..")
+                removeTree(path + "/" + name);
+        }
+        closedir(d);
+        rmdir(path.c_str());
+    } else {
+        unlink(path.c_str());
+    }
+}
+
+static void makeDirs (std::initializer_list<std::string> dirs) {
+    removeTree(ROOT);
+    mkdir(ROOT.c_str(), 0755);
+    for (auto & dir : dirs)
+        mkdir((ROOT + "/" + dir).c_str(), 0755);
+}
+
+// inotify watches this process holds (the kernel lists them in the inotify fd's fdinfo)
+static unsigned numWatches () {
+    unsigned count = 0;
+    auto d = opendir("/proc/self/fdinfo");
+    assert(d);
+    while (auto entry = readdir(d)) {
+        std::ifstream info (std::string("/proc/self/fdinfo/") + entry->d_name);
+        std::string line;
+        while (std::getline(info, line))
+            count += line.find("inotify wd:") == 0;
+    }
+    closedir(d);
+    return count;
+}
+
+static auto logErrors = [](const ResourceError & e) { std::cerr << e.what() << '\n'; };
+static auto logErrorsMut = [](ResourceError & e) { std::cerr << e.what() << '\n'; };
+
+// Every listener on a directory shares its watch descriptor; a recursive watch costs one per subdir.
+void testOneWatchPerDirectory () {
+    makeDirs({ "a", "a/b", "c" });
+    DirectoryWatcherInstance watcher;
+    auto base = numWatches();
+    {
+        auto h1 = watcher.watchForChanges(ROOT, [](const FilePath &) {}, logErrors);
+        auto h2 = watcher.watchForChanges(ROOT, [](const FilePath &) {}, logErrors);
+        auto file  = watcher.watchFileForChanges(ROOT + "/x.glsl", logErrorsMut);
+        auto files = watcher.watchDirForChanges(ROOT, [](const FilePath &) { return true; }, logErrorsMut);
+        assert(h1 && h2 && file && files);
+        assert(numWatches() == base + 1);
+
+        auto tree = watcher.watchDirForRecursiveChanges(ROOT, [](const FilePath &) { return true; },
+                                                        [](const FilePath &) { return true; }, logErrorsMut);
+        assert(tree);
+        assert(numWatches() == base + 4);   // root, a, a/b, c
+
+        // New subdirectories get picked up (+ share the watch if it's already there)
+        mkdir((ROOT + "/c/d").c_str(), 0755);
+        sleepMs(100);
+        assert(numWatches() == base + 5);
+
+        tree->release();
+        assert(numWatches() == base + 1);
+        h1->detatch();
+        file->release();
+        files->release();
+        assert(numWatches() == base + 1);   // h2 still has it
+    }
+    assert(numWatches() == base);
+}
+
+// release() waits for a callback that's running on the watcher thread, + doesn't deadlock when
+// it's called from that callback.
+void testReleaseWaitsForCallbacks () {
+    makeDirs({ "self" });
+    DirectoryWatcherInstance watcher;
+
+    std::atomic<bool> inCallback { false };
+    auto state = new int(0);
+    auto h = watcher.watchForChanges(ROOT, [&inCallback, state](const FilePath &) {
+        inCallback = true;
+        sleepMs(200);
+        ++*state;           // use after free if release() didn't wait
+    }, logErrors);
+
+    std::mutex selfMutex;   // (self gets set after the watch starts)
+    DirectoryWatcherHandleRef self;
+    std::atomic<int> selfCalls { 0 };
+    auto handle = watcher.watchForChanges(ROOT + "/self", [&](const FilePath &) {
+        ++selfCalls;
+        std::lock_guard<std::mutex> lock (selfMutex);
+        self->detatch();
+    }, logErrors);
+    {
+        std::lock_guard<std::mutex> lock (selfMutex);
+        self = handle;
+    }
+    touch(ROOT + "/self/x");
+    sleepMs(100);
+    touch(ROOT + "/self/y");
+    touch(ROOT + "/a");
+
+    while (!inCallback)
+        sleepMs(1);
+    auto t0 = std::chrono::steady_clock::now();
+    h->detatch();
+    auto waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    delete state;
+    sleepMs(100);
+    assert(waited > 0.05);
+    assert(selfCalls == 1);
+}
+
+// If the kernel's queue overflows, directory watchers hear that their root changed, and file
+// watchers get an error (individual events were lost).
+void testOverflow () {
+    unsigned maxQueued = 16384;
+    std::ifstream ("/proc/sys/fs/inotify/max_queued_events") >> maxQueued;
+    makeDirs({});
+    DirectoryWatcherInstance watcher;
+
+    // Hold up the watcher thread in a callback while the queue fills up
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool blocked = false, unblock = false, sawRoot = false;
+    auto h = watcher.watchForChanges(ROOT, [&](const FilePath & path) {
+        std::unique_lock<std::mutex> lock (mutex);
+        if (path == ROOT)
+            sawRoot = true;
+        if (!blocked) {
+            blocked = true;
+            cv.notify_all();
+            cv.wait(lock, [&]() { return unblock; });
+        }
+    }, logErrors);
+
+    std::atomic<bool> sawError { false };
+    auto files = watcher.watchDirForChanges(ROOT, [](const FilePath &) { return true; }, [&](ResourceError & e) {
+        if (std::string(e.what()).find("overflowed") != std::string::npos)
+            sawError = true;
+    });
+
+    touch(ROOT + "/first");
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        cv.wait(lock, [&]() { return blocked; });
+    }
+    for (unsigned i = 0; i < maxQueued; ++i)
+        touch(ROOT + "/" + std::to_string(i));
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        unblock = true;
+        cv.notify_all();
+    }
+    for (auto i = 0; i < 500 && !(sawError && sawRoot); ++i)
+        sleepMs(10);
+    h->detatch();
+    files->release();
+    assert(sawRoot && sawError);
+}
+
+int main() {
+    testOneWatchPerDirectory();
+    testReleaseWaitsForCallbacks();
+    testOverflow();
+    removeTree(ROOT);
+    std::cout << "Tests passed\n";
+    return 0;
+}
+
+#else
+
+int main() {
+    std::cout << "Skipped (inotify watcher is linux only)\n";
+    return 0;
+}
+
+#endif // __linux__
@@ -0,0 +1,211 @@
+//
+//  main.cpp
+//  gl-state-test
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "../../src/common/gl/gl_state.hpp"
+#include "../../src/common/gl/gl_commands.hpp"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace gl_sandbox;
+
+// Recording gl: every call that gets through ends up here, so no context is needed.
+static std::vector<std::string> g_calls;
+
+static gl::StateCache::Functions recordingFunctions () {
+    gl::StateCache::Functions fns;
+    fns.useProgram      = [](GLuint program) { g_calls.push_back("useProgram " + std::to_string(program)); };
+    fns.bindVertexArray = [](GLuint vao) { g_calls.push_back("bindVertexArray " + std::to_string(vao)); };
+    fns.bindBuffer      = [](GLenum target, GLuint buffer) {
+        g_calls.push_back("bindBuffer " + std::to_string(target) + " " + std::to_string(buffer));
+    };
+    fns.bindBufferRange = [](GLenum target, GLuint index, GLuint buffer, GLintptr, GLsizeiptr) {
+        g_calls.push_back("bindBufferRange " + std::to_string(target) + " " + std::to_string(index) + " " + std::to_string(buffer));
+    };
+    fns.enable  = [](GLenum cap) { g_calls.push_back("enable " + std::to_string(cap)); };
+    fns.disable = [](GLenum cap) { g_calls.push_back("disable " + std::to_string(cap)); };
+    return fns;
+}
+
+void testFiltering () {
+    gl::StateCache state (recordingFunctions());
+    g_calls.clear();
+
+    // Unknown at first => everything goes through once
+    state.useProgram(1);
+    state.useProgram(1);
+    state.bindVertexArray(2);
+    state.bindVertexArray(2);
+    state.bindBuffer(GL_ARRAY_BUFFER, 3);
+    state.bindBuffer(GL_ARRAY_BUFFER, 3);
+    state.bindBuffer(GL_UNIFORM_BUFFER, 3);     // per target
+    state.enable(GL_DEPTH_TEST);
+    state.enable(GL_DEPTH_TEST);
+    state.disable(GL_DEPTH_TEST);
+    assert(g_calls.size() == 6);
+    assert(state.frame().issued == 6 && state.frame().skipped == 4);
+
+    // Element array binding belongs to the vao
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 4);
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 4);
+    state.bindVertexArray(5);
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 4);
+    state.bindBuffer(GL_ARRAY_BUFFER, 3);       // isn't
+    assert(g_calls.size() == 9 && g_calls.back() == "bindBuffer " + std::to_string(GL_ELEMENT_ARRAY_BUFFER) + " 4");
+
+    // Deleted objects get unbound by gl
+    state.onDeleteBuffer(3);
+    state.bindBuffer(GL_ARRAY_BUFFER, 0);
+    state.bindBuffer(GL_ARRAY_BUFFER, 3);
+    state.onDeleteVertexArray(5);
+    state.bindVertexArray(0);
+    assert(g_calls.size() == 10);
+
+    // Indexed bindings always go through, but also bind the target
+    state.bindBufferRange(GL_UNIFORM_BUFFER, 0, 7, 0, 64);
+    state.bindBufferRange(GL_UNIFORM_BUFFER, 0, 7, 256, 64);
+    state.bindBuffer(GL_UNIFORM_BUFFER, 7);
+    assert(g_calls.size() == 12);
+
+    // Targets we don't track always go through
+    state.bindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 6);
+    state.bindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 6);
+    assert(g_calls.size() == 14);
+
+    state.invalidate();
+    state.useProgram(1);
+    state.enable(GL_DEPTH_TEST);
+    assert(g_calls.size() == 16);
+
+    auto frame = state.frame();
+    state.endFrame();
+    assert(state.lastFrame().issued == frame.issued && state.frame().issued == 0);
+    assert(state.total().issued == 16);
+
+    std::cout << "filtering: ok\n";
+}
+
+// Roughly what a frame looks like w/ triangles + obj_viewer loaded: one instanced draw, then
+// N models sharing a shader, each of which used to bind program, vao + index buffer per draw.
+void measureFrames (unsigned numModels, unsigned numFrames) {
+    gl::StateCache state (recordingFunctions());
+    g_calls.clear();
+
+    const GLuint TRIANGLES_PROGRAM = 1, TRIANGLES_VAO = 2, MODEL_PROGRAM = 3, UBO = 4;
+    size_t naive = 0;
+    for (unsigned frame = 0; frame < numFrames; ++frame) {
+        state.useProgram(TRIANGLES_PROGRAM);
+        state.bindVertexArray(TRIANGLES_VAO);
+        naive += 2;
+
+        for (unsigned i = 0; i < numModels; ++i) {
+            // Models w/ multiple batches get drawn once per batch
+            for (unsigned batch = 0; batch < 2; ++batch) {
+                state.useProgram(MODEL_PROGRAM);
+                state.bindVertexArray(100 + i);
+                state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 200 + i);
+                naive += 3;
+            }
+        }
+        for (unsigned i = 0; i < 4; ++i) {
+            state.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+            ++naive;
+        }
+        state.endFrame();
+    }
+    auto & total = state.total();
+    assert(total.issued == g_calls.size() && total.issued + total.skipped == naive);
+    std::cout << numModels << " models x " << numFrames << " frames: " << total.issued << " of " << naive
+              << " calls issued (" << state.lastFrame().issued << " / frame), "
+              << (100.0 * total.skipped / naive) << "% skipped\n";
+}
+
+void testRadixSort () {
+    std::mt19937_64 rng (7);
+    std::vector<gl::SortItem> items, scratch;
+    for (uint32_t i = 0; i < 10000; ++i)
+        items.push_back({ rng() & 0xff0000ffff00ffffull, i });     // (some constant digits)
+    for (uint32_t i = 0; i < 1000; ++i)
+        items.push_back({ items[i].key, 10000 + i });               // duplicates
+    auto expected = items;
+    std::stable_sort(expected.begin(), expected.end(), [](const gl::SortItem & a, const gl::SortItem & b) {
+        return a.key < b.key;
+    });
+    gl::radixSort(items, scratch);
+    for (size_t i = 0; i < items.size(); ++i)
+        assert(items[i].key == expected[i].key && items[i].index == expected[i].index);
+    std::cout << "radix sort: ok\n";
+}
+
+// A few "modules" recording on their own threads, each w/ draws spread over a couple of shared
+// programs / vaos. Sorted, programs + vaos only change when the key does.
+void testRenderQueue () {
+    gl::RenderQueue queue;
+    const unsigned NUM_THREADS = 4, DRAWS_PER_THREAD = 64;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < NUM_THREADS; ++t) {
+        threads.emplace_back([&queue, t] () {
+            gl::CommandList commands;
+            for (unsigned i = 0; i < DRAWS_PER_THREAD; ++i) {
+                gl::DrawCommand draw;
+                draw.pass    = (i % 8 == 0) ? 1 : 0;
+                draw.program = 1 + (i + t) % 3;
+                draw.vao     = 10 + i % 5;
+                draw.depth   = (float)((i * 37) % 64) / 64.0f;
+                commands.push(std::move(draw));
+            }
+            gl::DrawCommand noProgram;
+            commands.push(noProgram);       // dropped
+            queue.enqueue(std::move(commands));
+        });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    queue.sort();
+    assert(queue.size() == NUM_THREADS * DRAWS_PER_THREAD);
+    size_t programChanges = 0, vaoChanges = 0;
+    GLuint program = 0, vao = 0;
+    for (size_t i = 0; i < queue.size(); ++i) {
+        auto & draw = queue.sorted(i);
+        if (i > 0) {
+            auto & prev = queue.sorted(i - 1);
+            assert(prev.pass < draw.pass || (prev.pass == draw.pass && gl::sortKey(prev) <= gl::sortKey(draw)));
+        }
+        programChanges += draw.program != program;
+        vaoChanges     += draw.vao != vao;
+        program = draw.program;
+        vao     = draw.vao;
+    }
+    // 2 passes x 3 programs; vaos at most 5 per (pass, program)
+    assert(programChanges <= 6 && vaoChanges <= 6 * 5);
+    std::cout << "render queue: " << queue.size() << " draws from " << NUM_THREADS << " threads => "
+              << programChanges << " program changes, " << vaoChanges << " vao changes (unsorted: up to "
+              << queue.size() << " each)\n";
+
+    // Submitting binds exactly that much
+    gl::StateCache state (recordingFunctions());
+    g_calls.clear();
+    queue.submit(state);
+    assert(queue.size() == 0 && queue.stats().draws == NUM_THREADS * DRAWS_PER_THREAD);
+    assert(queue.stats().programChanges == programChanges && queue.stats().vaoChanges == vaoChanges);
+    assert(g_calls.size() == programChanges + vaoChanges);
+}
+
+int main() {
+    testFiltering();
+    measureFrames(1, 100);
+    measureFrames(16, 100);
+    testRadixSort();
+    testRenderQueue();
+    return 0;
+}
@@ -0,0 +1,204 @@
+//
+//  main.cpp
+//  objparser-bench
+//
+//  Created by semery on 2/8/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../../libs/tinyobjloader/tiny_obj_loader.h"
+#include "../../src/common/obj_parser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace gl_sandbox;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double msSince (Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static size_t fileSize (const std::string & path) {
+    FILE * f = fopen(path.c_str(), "rb");
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+// Opens a fixture for writing; bails out if it can't (nothing after this would mean anything).
+static FILE * createFile (const std::string & path) {
+    FILE * f = fopen(path.c_str(), "wb");
+    if (!f) {
+        fprintf(stderr, "could not create '%s'\n", path.c_str());
+        exit(-1);
+    }
+    return f;
+}
+
+// Generates a (gridSize x gridSize) quad grid w/ positions, normals + uvs, split into a few
+// groups / materials, with a mix of absolute and relative (negative) face indices.
+static std::string makeTestFile (unsigned gridSize) {
+    std::string path = "/tmp/objparser-bench.obj";
+    FILE * f = createFile(path);
+    fprintf(f, "# generated by objparser-bench\nmtllib objparser-bench.mtl\no grid\n");
+    srand(42);
+    for (auto y = 0u; y < gridSize; ++y) {
+        for (auto x = 0u; x < gridSize; ++x) {
+            float h = (rand() % 100000) * 1e-5f;
+            fprintf(f, "v %f %f %f\n", x * 0.01f, h, y * 0.01f);
+            fprintf(f, "vn %.6f %.6f %.6f\n", 0.0f, 1.0f, h);
+            fprintf(f, "vt %g %g\n", x / (float)gridSize, y / (float)gridSize);
+        }
+    }
+    for (auto y = 0u; y + 1 < gridSize; ++y) {
+        if (y % (gridSize / 4 + 1) == 0)
+            fprintf(f, "g strip_%u\nusemtl %s\n", y, (y & 1) ? "red" : "missing");
+        for (auto x = 0u; x + 1 < gridSize; ++x) {
+            unsigned a = y * gridSize + x + 1, b = a + 1, c = a + gridSize + 1, d = a + gridSize;
+            fprintf(f, "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c, d, d, d);
+        }
+    }
+    // A few trailing faces using relative indices (and no normals / uvs)
+    fprintf(f, "g relative\r\nv 0 0 0\r\nv 1 0 0\r\nv 1 1 0\r\nf -3 -2 -1\r\nf -1 -2 -3\r\n");
+    fclose(f);
+    
+    FILE * mtl = createFile("/tmp/objparser-bench.mtl");
+    fprintf(mtl, "newmtl red\nKd 1 0 0\n");
+    fclose(mtl);
+    return path;
+}
+
+static int ulpDistance (float a, float b) {
+    int32_t ia, ib;
+    memcpy(&ia, &a, 4); memcpy(&ib, &b, 4);
+    if ((ia < 0) != (ib < 0))
+        return a == b ? 0 : INT32_MAX;
+    return std::abs(ia - ib);
+}
+
+// Compares everything exactly, except floats (reported as # differing + max ulp distance).
+static bool compare (const std::vector<tinyobj::shape_t> & a, const std::vector<tinyobj::shape_t> & b) {
+    if (a.size() != b.size())
+        return printf("  MISMATCH: %zu vs %zu shapes\n", a.size(), b.size()), false;
+    size_t floatsDiffering = 0, floatsTotal = 0;
+    int maxUlp = 0;
+    auto compareFloats = [&](const std::vector<float> & x, const std::vector<float> & y) {
+        if (x.size() != y.size())
+            return false;
+        for (size_t i = 0; i < x.size(); ++i) {
+            int d = ulpDistance(x[i], y[i]);
+            floatsDiffering += d != 0;
+            maxUlp = std::max(maxUlp, d);
+        }
+        floatsTotal += x.size();
+        return true;
+    };
+    for (size_t i = 0; i < a.size(); ++i) {
+        auto & ma = a[i].mesh;
+        auto & mb = b[i].mesh;
+        if (a[i].name != b[i].name || ma.indices != mb.indices || ma.material_ids != mb.material_ids ||
+            !compareFloats(ma.positions, mb.positions) ||
+            !compareFloats(ma.normals, mb.normals) ||
+            !compareFloats(ma.texcoords, mb.texcoords))
+            return printf("  MISMATCH in shape %zu ('%s')\n", i, a[i].name.c_str()), false;
+    }
+    printf("  output matches (%zu shapes); %zu / %zu floats differ, max %d ulp\n",
+           a.size(), floatsDiffering, floatsTotal, maxUlp);
+    return true;
+}
+
+bool benchObj (const std::string & path, unsigned iterations) {
+    double mb = fileSize(path) / (1024.0 * 1024.0);
+    printf("%s (%0.1f MB, %u runs)\n", path.c_str(), mb, iterations);
+    
+    std::vector<tinyobj::shape_t> shapes [2];
+    std::vector<tinyobj::material_t> materials [2];
+    std::string err [2];
+    double t_tinyobj = 0, t_parallel = 0;
+    for (auto i = 0u; i < iterations; ++i) {
+        materials[0].clear(); materials[1].clear();
+        auto t0 = Clock::now();
+        if (!tinyobj::LoadObj(shapes[0], materials[0], err[0], path.c_str()))
+            return printf("  tinyobj failed: %s\n", err[0].c_str()), false;
+        t_tinyobj += msSince(t0);
+        
+        t0 = Clock::now();
+        if (!obj::loadObj(path, shapes[1], materials[1], err[1]))
+            return printf("  obj::loadObj failed: %s\n", err[1].c_str()), false;
+        t_parallel += msSince(t0);
+    }
+    t_tinyobj /= iterations; t_parallel /= iterations;
+    printf("  tinyobj:      %8.2f ms  (%0.1f MB/s)\n", t_tinyobj, mb / (t_tinyobj * 1e-3));
+    printf("  obj::loadObj: %8.2f ms  (%0.1f MB/s)\n", t_parallel, mb / (t_parallel * 1e-3));
+    if (materials[0].size() != materials[1].size())
+        return printf("  MISMATCH: %zu vs %zu materials\n", materials[0].size(), materials[1].size()), false;
+    return compare(shapes[0], shapes[1]);
+}
+
+// Spot checks for the float parser: same accept / reject behavior as tinyobj.
+static bool testParseDouble () {
+    struct { const char * s; bool ok; double value; } cases[] = {
+        { "0", true, 0 }, { "-0", true, -0.0 }, { "+3.1417e+2", true, 314.17 }, { "-0.0E-3", true, -0.0 },
+        { "1.0324", true, 1.0324 }, { "11e2", true, 1100 }, { "1.", true, 1 }, { "1e", false, 0 },
+        { ".5", false, 0 }, { "-.5", false, 0 }, { "abc", false, 0 }, { "2.5abc", true, 2.5 },
+        { "123456789012345678901234", true, 123456789012345678901234.0 }, { "1e-30", true, 1e-30 },
+    };
+    bool ok = true;
+    for (auto & c : cases) {
+        double value = 0;
+        bool parsed = obj::parseDouble(c.s, c.s + strlen(c.s), value);
+        if (parsed != c.ok || (parsed && value != c.value) || std::signbit(value) != std::signbit(c.value)) {
+            printf("parseDouble('%s') = %d, %g (expected %d, %g)\n", c.s, parsed, value, c.ok, c.value);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// A missing mtllib isn't an error for tinyobj's MaterialFileReader (just a warning + a default
+// material); a reader that does fail fails the whole load. Same here.
+static bool testMissingMtl () {
+    const char * src = "mtllib does-not-exist.mtl\nv 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+    FILE * f = createFile("/tmp/objparser-missing-mtl.obj");
+    fputs(src, f);
+    fclose(f);
+    std::vector<tinyobj::shape_t> shapes [2];
+    std::vector<tinyobj::material_t> materials [2];
+    std::string err [2];
+    bool tinyobjOk  = tinyobj::LoadObj(shapes[0], materials[0], err[0], "/tmp/objparser-missing-mtl.obj", "/tmp/");
+    obj::ParseOptions options;
+    options.mtlBasePath = "/tmp/";
+    bool parallelOk = obj::parseObj(src, strlen(src), shapes[1], materials[1], err[1], options);
+    if (tinyobjOk != parallelOk || err[0] != err[1] || materials[0].size() != materials[1].size())
+        return printf("missing mtllib: tinyobj %d '%s', obj::parseObj %d '%s'\n",
+                      tinyobjOk, err[0].c_str(), parallelOk, err[1].c_str()), false;
+    return true;
+}
+
+int main(int argc, const char * argv[]) {
+    // usage: objparser-bench [files...]
+    // With no arguments, benchmarks a generated ~100 MB grid.
+    bool ok = testParseDouble();
+    ok &= testMissingMtl();
+    std::vector<std::string> files;
+    for (auto i = 1; i < argc; ++i)
+        files.push_back(argv[i]);
+    if (files.empty())
+        files.push_back(makeTestFile(1000));
+    
+    for (auto & file : files)
+        ok &= benchObj(file, 3);
+    return ok ? 0 : 1;
+}
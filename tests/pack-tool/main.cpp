@@ -0,0 +1,154 @@
+//
+//  main.cpp
+//  pack-tool
+//
+//  Created by semery on 2/11/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "../../src/common/resourcelayer/pack_file.hpp"
+#include "../../src/common/resourcelayer/file_hash.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace gl_sandbox;
+using namespace resource_impl;
+
+static int usage () {
+    fprintf(stderr,
+        "usage:\n"
+        "  pack-tool create [-z none|deflate|auto] <out.pack> <dir> [.ext ...]\n"
+        "      packs every file under dir (or just the ones w/ the given extensions);\n"
+        "      entry names are relative to dir. Compression defaults to auto.\n"
+        "  pack-tool list <pack>\n"
+        "  pack-tool verify <pack>\n"
+        "      inflates every entry and checks it against its content hash\n");
+    return 1;
+}
+
+static bool hasExtension (const std::string & name, const std::vector<std::string> & extensions) {
+    if (extensions.empty())
+        return true;
+    for (auto & ext : extensions)
+        if (name.size() >= ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+            return true;
+    return false;
+}
+
+// Recursively collects files under dir, as paths relative to it. Skips dotfiles.
+static void listFiles (const std::string & dir, const std::string & prefix, std::vector<std::string> & files) {
+    DIR * d = opendir(dir.c_str());
+    if (!d) {
+        fprintf(stderr, "cannot open directory '%s'\n", dir.c_str());
+        return;
+    }
+    while (auto entry = readdir(d)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        std::string path = dir + "/" + entry->d_name;
+        std::string name = prefix + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            listFiles(path, name + "/", files);
+        else if (S_ISREG(st.st_mode))
+            files.push_back(name);
+    }
+    closedir(d);
+}
+
+static int create (int argc, const char * argv[]) {
+    auto compression = PackWriter::Compression::AUTO;
+    int i = 0;
+    if (i + 1 < argc && strcmp(argv[i], "-z") == 0) {
+        std::string z = argv[i + 1];
+        if (z == "none")         compression = PackWriter::Compression::NONE;
+        else if (z == "deflate") compression = PackWriter::Compression::DEFLATE;
+        else if (z == "auto")    compression = PackWriter::Compression::AUTO;
+        else return usage();
+        i += 2;
+    }
+    if (argc - i < 2)
+        return usage();
+    std::string out = argv[i], dir = argv[i + 1];
+    std::vector<std::string> extensions (argv + i + 2, argv + argc);
+    while (dir.size() > 1 && dir.back() == '/')
+        dir.pop_back();
+
+    std::vector<std::string> files;
+    listFiles(dir, "", files);
+    std::sort(files.begin(), files.end());
+
+    PackWriter writer;
+    std::string err;
+    for (auto & name : files) {
+        if (!hasExtension(name, extensions))
+            continue;
+        if (!writer.addFile(name, dir + "/" + name, compression, err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 1;
+        }
+    }
+    if (!writer.write(out, err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    auto & stats = writer.stats();
+    printf("%s: %zu files (%zu deflated), %zu -> %zu bytes\n", out.c_str(),
+           stats.entries, stats.compressed, stats.rawBytes, stats.storedBytes);
+    return 0;
+}
+
+static std::shared_ptr<PackFile> openPack (const char * path) {
+    std::string err;
+    auto pack = PackFile::open(path, err);
+    if (!pack)
+        fprintf(stderr, "%s\n", err.c_str());
+    return pack;
+}
+
+static int list (const char * path) {
+    auto pack = openPack(path);
+    if (!pack)
+        return 1;
+    for (size_t i = 0; i < pack->numEntries(); ++i) {
+        auto & e = pack->entry(i);
+        printf("%10llu %10llu %s %016llx  %s\n", (unsigned long long)e.size, (unsigned long long)e.storedSize,
+               (e.flags & PACK_ENTRY_DEFLATE) ? "z" : "-", (unsigned long long)e.contentHash, pack->name(e).c_str());
+    }
+    return 0;
+}
+
+static int verify (const char * path) {
+    auto pack = openPack(path);
+    if (!pack)
+        return 1;
+    size_t bad = 0;
+    for (size_t i = 0; i < pack->numEntries(); ++i) {
+        auto & e = pack->entry(i);
+        std::string err;
+        auto buffer = pack->load(e, pack->name(e), false, err);
+        if (!buffer || hash::fastHash64(buffer->data, buffer->size) != e.contentHash) {
+            fprintf(stderr, "bad entry '%s' %s\n", pack->name(e).c_str(), err.c_str());
+            ++bad;
+        }
+    }
+    printf("%s: %zu entries, %zu bad\n", path, pack->numEntries(), bad);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 3)
+        return usage();
+    std::string cmd = argv[1];
+    if (cmd == "create") return create(argc - 2, argv + 2);
+    if (cmd == "list")   return list(argv[2]);
+    if (cmd == "verify") return verify(argv[2]);
+    return usage();
+}
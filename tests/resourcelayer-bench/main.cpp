@@ -0,0 +1,354 @@
+//
+//  main.cpp
+//  resourcelayer-bench
+//
+//  Created by semery on 2/3/16.
+//  Copyright © 2016 Seiji Emery. All rights reserved.
+//
+
+#include "../../src/common/resourcelayer/resource_impl.hpp"
+#include "../../src/common/resourcelayer/async_file_reader.hpp"
+#include "../../src/common/resourcelayer/pack_file.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace gl_sandbox;
+using namespace resource_impl;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double msSince (Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// Sum every byte so neither path gets to skip work (mmap is lazy; untouched pages are free).
+static uint64_t touchBuffer (const FileBufferRef & buffer) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < buffer->size; ++i)
+        sum += buffer->data[i];
+    return sum;
+}
+
+static FilePath makeTestFile (size_t size) {
+    FilePath path = "/tmp/resourcelayer-bench.dat";
+    FILE * f = fopen(path.c_str(), "wb");
+    if (!f) {
+        fprintf(stderr, "could not create '%s'\n", path.c_str());
+        exit(-1);
+    }
+    std::vector<uint8_t> chunk (1 << 20);
+    for (size_t i = 0; i < chunk.size(); ++i)
+        chunk[i] = (uint8_t)(i * 31 + 7);
+    for (size_t written = 0; written < size; written += chunk.size())
+        fwrite(&chunk[0], 1, std::min(chunk.size(), size - written), f);
+    fclose(f);
+    return path;
+}
+
+// ifstream + heap copy (current default path) vs mmap, on the same file.
+void benchFileLoad (const FilePath & path, unsigned iterations) {
+    double t_buffer = 0, t_mapped = 0;
+    size_t size = 0;
+    uint64_t checksum [2] = { 0, 0 };
+    auto onFail = [](const FilePath & path) {
+        fprintf(stderr, "could not load '%s'\n", path.c_str());
+    };
+    
+    for (auto i = 0u; i < iterations; ++i) {
+        auto t0 = Clock::now();
+        immediate::loadFileImmediate(path, [&](const FileBufferRef & buffer) {
+            size = buffer->size;
+            checksum[0] = touchBuffer(buffer);
+        }, onFail);
+        t_buffer += msSince(t0);
+        
+        t0 = Clock::now();
+        immediate::loadFileMappedImmediate(path, [&](const FileBufferRef & buffer) {
+            checksum[1] = touchBuffer(buffer);
+        }, onFail);
+        t_mapped += msSince(t0);
+    }
+    if (checksum[0] != checksum[1])
+        fprintf(stderr, "checksum mismatch for '%s'!\n", path.c_str());
+    
+    double mb = size / (1024.0 * 1024.0);
+    t_buffer /= iterations; t_mapped /= iterations;
+    printf("%s (%0.1f MB, %u runs)\n", path.c_str(), mb, iterations);
+    printf("  ifstream + copy: %8.2f ms  (%0.1f MB/s)\n", t_buffer, mb / (t_buffer * 1e-3));
+    printf("  mmap:            %8.2f ms  (%0.1f MB/s)\n", t_mapped, mb / (t_mapped * 1e-3));
+}
+
+// Lots of small files (shader / config sized): sequential blocking loads vs one batched async
+// submission. This is mostly measuring per-file syscall + wakeup overhead, not bandwidth.
+void benchSmallFiles (unsigned count, size_t size) {
+    std::vector<FilePath> paths;
+    std::vector<uint8_t> contents (size, 'x');
+    for (auto i = 0u; i < count; ++i) {
+        char path [64];
+        snprintf(path, sizeof(path), "/tmp/resourcelayer-bench-%u.dat", i);
+        FILE * f = fopen(path, "wb");
+        if (!f) {
+            fprintf(stderr, "could not create '%s'\n", path);
+            exit(-1);
+        }
+        fwrite(&contents[0], 1, contents.size(), f);
+        fclose(f);
+        paths.push_back(path);
+    }
+    auto onFail = [](const FilePath & path) {
+        fprintf(stderr, "could not load '%s'\n", path.c_str());
+    };
+    
+    uint64_t checksum [2] = { 0, 0 };
+    auto t0 = Clock::now();
+    for (auto & path : paths) {
+        immediate::loadFileImmediate(path, [&](const FileBufferRef & buffer) {
+            checksum[0] += touchBuffer(buffer);
+        }, onFail);
+    }
+    double t_sequential = msSince(t0);
+    
+    unsigned remaining = count;
+    t0 = Clock::now();
+    async::loadFilesAsync(paths, [&](const FileBufferRef & buffer) {
+        checksum[1] += touchBuffer(buffer);
+        --remaining;
+    }, [&](const FilePath & path) {
+        onFail(path);
+        --remaining;
+    });
+    while (remaining) {
+        if (!async::dispatchCallbacks())
+            std::this_thread::yield();
+    }
+    double t_batched = msSince(t0);
+    
+    if (checksum[0] != checksum[1])
+        fprintf(stderr, "checksum mismatch for small file batch!\n");
+    
+    printf("%u files x %zu bytes\n", count, size);
+    printf("  sequential immediate: %8.2f ms\n", t_sequential);
+    printf("  batched async (%s): %8.2f ms\n", async_io::sharedReader().backendName(), t_batched);
+    
+    for (auto & path : paths)
+        unlink(path.c_str());
+}
+
+// Drops a file's pages from the page cache, so the next load has to hit the disk. Only clean
+// pages go, which is all we've got here. Returns false where there's no way to do that w/out root.
+static bool evictFromPageCache (const FilePath & path) {
+#ifdef POSIX_FADV_DONTNEED
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    fdatasync(fd);
+    bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+// Startup-style load of a few hundred small text assets: loose files (open / read / close each)
+// vs the same files out of a mounted pack (one open + mmap, then a copy / inflate per file).
+void benchPackColdStart (unsigned count) {
+    FilePath root = "/tmp/resourcelayer-bench-pack";
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/shaders").c_str(), 0755);
+    
+    // Shader-ish text, varied enough that deflate has to do some work
+    std::vector<std::string> names;
+    PackWriter stored, deflated;
+    std::string err;
+    for (auto i = 0u; i < count; ++i) {
+        char name [64];
+        snprintf(name, sizeof(name), "shaders/bench_%u.%s", i, i & 1 ? "fs" : "vs");
+        std::string text = "#version 410\n";
+        for (auto line = 0u; line < 40 + (i * 7) % 200; ++line) {
+            char buf [128];
+            snprintf(buf, sizeof(buf), "uniform vec4 u_param%u_%u; // %08x\n", i, line, (i * 2654435761u) ^ (line * 40503u));
+            text += buf;
+        }
+        text += "void main () { gl_Position = u_param0_0; }\n";
+        
+        FILE * f = fopen((root + "/" + name).c_str(), "wb");
+        if (!f) {
+            fprintf(stderr, "could not create '%s/%s'\n", root.c_str(), name);
+            exit(-1);
+        }
+        fwrite(text.data(), 1, text.size(), f);
+        fclose(f);
+        if (!stored.add(name, (const uint8_t*)text.data(), text.size(), PackWriter::Compression::NONE, err) ||
+            !deflated.add(name, (const uint8_t*)text.data(), text.size(), PackWriter::Compression::DEFLATE, err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            exit(-1);
+        }
+        names.push_back(name);
+    }
+    FilePath storedPack = "/tmp/resourcelayer-bench-stored.pack";
+    FilePath deflatedPack = "/tmp/resourcelayer-bench-deflated.pack";
+    if (!stored.write(storedPack, err) || !deflated.write(deflatedPack, err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        exit(-1);
+    }
+    
+    bool cold = true;
+    auto evictAll = [&]() {
+        for (auto & name : names)
+            cold &= evictFromPageCache(root + "/" + name);
+        cold &= evictFromPageCache(storedPack);
+        cold &= evictFromPageCache(deflatedPack);
+    };
+    auto onFail = [](const FilePath & path) {
+        fprintf(stderr, "could not load '%s'\n", path.c_str());
+    };
+    // pack == "" => loose files
+    auto run = [&](const FilePath & pack, packs::LooseFiles looseFiles, uint64_t & checksum) {
+        auto t0 = Clock::now();
+        std::string err;
+        if (!pack.empty() && !packs::mount(pack, root, looseFiles, err))
+            fprintf(stderr, "%s\n", err.c_str());
+        for (auto & name : names) {
+            immediate::loadFileImmediate(root + "/" + name, [&](const FileBufferRef & buffer) {
+                checksum += touchBuffer(buffer);
+            }, onFail);
+        }
+        double t = msSince(t0);
+        packs::unmountAll();
+        return t;
+    };
+    
+    const struct { const char * name; FilePath pack; packs::LooseFiles looseFiles; } configs [] = {
+        { "loose files          ", "",           packs::LooseFiles::IGNORE },
+        { "pack, stored         ", storedPack,   packs::LooseFiles::IGNORE },
+        { "pack, deflated       ", deflatedPack, packs::LooseFiles::IGNORE },
+        { "pack, loose overrides", storedPack,   packs::LooseFiles::OVERRIDE },
+    };
+    printf("cold start: %u files, %0.1f KB (deflated pack: %0.1f KB)\n", count,
+           stored.stats().rawBytes / 1024.0, deflated.stats().storedBytes / 1024.0);
+    uint64_t expected = 0;
+    for (auto & config : configs) {
+        uint64_t checksum [2] = { 0, 0 };
+        evictAll();
+        double t_cold = run(config.pack, config.looseFiles, checksum[0]);
+        double t_warm = run(config.pack, config.looseFiles, checksum[1]);
+        if (!expected)
+            expected = checksum[0];
+        if (checksum[0] != expected || checksum[1] != expected)
+            fprintf(stderr, "checksum mismatch for '%s'!\n", config.name);
+        printf("  %s: %8.2f ms %s, %8.2f ms warm\n", config.name, t_cold, cold ? "cold" : "(cache not dropped)", t_warm);
+    }
+    
+    for (auto & name : names)
+        unlink((root + "/" + name).c_str());
+    rmdir((root + "/shaders").c_str());
+    rmdir(root.c_str());
+    unlink(storedPack.c_str());
+    unlink(deflatedPack.c_str());
+}
+
+// Whole-file load then process, vs streaming w/ 1 and 2 chunks in flight (ie. whether reading
+// overlaps processing), w/ a consumer that does a few ns of work per byte. Cold cache where possible.
+void benchStreaming (const FilePath & path, size_t chunkSize) {
+    auto process = [](const uint8_t * data, size_t size, uint64_t & state) {
+        for (size_t i = 0; i < size; ++i)
+            state = (state ^ data[i]) * 0x100000001b3ull;
+    };
+    auto onFail = [](const FilePath & path) {
+        fprintf(stderr, "could not load '%s'\n", path.c_str());
+    };
+    bool cold = evictFromPageCache(path);
+    uint64_t result [3] = { 0xcbf29ce484222325ull, 0xcbf29ce484222325ull, 0xcbf29ce484222325ull };
+    size_t size = 0;
+    
+    auto t0 = Clock::now();
+    immediate::loadFileImmediate(path, [&](const FileBufferRef & buffer) {
+        size = buffer->size;
+        process(buffer->data, buffer->size, result[0]);
+    }, onFail);
+    double t_whole = msSince(t0);
+    
+    double t_stream [2];
+    for (unsigned inFlight = 1; inFlight <= 2; ++inFlight) {
+        cold &= evictFromPageCache(path);
+        bool done = false;
+        auto & state = result[inFlight];
+        StreamOptions options;
+        options.chunkSize = chunkSize;
+        options.maxChunksInFlight = inFlight;
+        t0 = Clock::now();
+        async::streamFileAsync(path, options, [&](ChunkSpan chunk, size_t) {
+            process(chunk.data, chunk.size, state);
+            return true;
+        }, [&](const FilePath &, size_t) {
+            done = true;
+        }, [&](const FilePath & path, errno_t) {
+            onFail(path);
+            done = true;
+        });
+        while (!done) {
+            if (!async::dispatchCallbacks())
+                std::this_thread::yield();
+        }
+        t_stream[inFlight - 1] = msSince(t0);
+    }
+    if (result[0] != result[1] || result[0] != result[2])
+        fprintf(stderr, "checksum mismatch for '%s'!\n", path.c_str());
+    
+    double mb = size / (1024.0 * 1024.0);
+    printf("streaming %s (%0.1f MB, %zu KB chunks, %s)\n", path.c_str(), mb, chunkSize >> 10, cold ? "cold" : "cache not dropped");
+    printf("  whole file, then process: %8.2f ms  (peak buffer %0.1f MB)\n", t_whole, mb);
+    printf("  stream, 1 chunk in flight: %7.2f ms  (peak buffer %0.1f MB)\n", t_stream[0], chunkSize / (1024.0 * 1024.0));
+    printf("  stream, 2 chunks in flight: %6.2f ms  (peak buffer %0.1f MB)\n", t_stream[1], 2 * chunkSize / (1024.0 * 1024.0));
+}
+
+// Compare the filehash:: hashes on the same files (io excluded; see hashComparative).
+void benchHashes (const std::vector<FilePath> & paths, unsigned iterations) {
+    filehash::HashTimingStats stats;
+    std::string md5, sha1, murmur;
+    for (auto i = 0u; i < iterations; ++i) {
+        for (auto & path : paths) {
+            filehash::hashComparative(path, md5, sha1, murmur, stats, [](const FilePath & path) {
+                fprintf(stderr, "could not open '%s'\n", path.c_str());
+            });
+        }
+    }
+    auto rate = stats.throughput();
+    printf("hashes (%zu samples)\n", stats.samples.size());
+    printf("  md5:      %8.1f MB/s\n", rate.md5);
+    printf("  sha1:     %8.1f MB/s\n", rate.sha1);
+    printf("  murmur3:  %8.1f MB/s\n", rate.murmur);
+    printf("  fasthash: %8.1f MB/s\n", rate.fast);
+}
+
+int main(int argc, const char * argv[]) {
+    // usage: resourcelayer-bench [files...]
+    // With no arguments, benchmarks a generated 256 MB file.
+    std::vector<FilePath> files;
+    for (auto i = 1; i < argc; ++i)
+        files.push_back(argv[i]);
+    bool generated = files.empty();
+    if (generated)
+        files.push_back(makeTestFile(256 << 20));
+    
+    for (auto & file : files)
+        benchFileLoad(file, 5);
+    for (auto & file : files)
+        benchStreaming(file, 4 << 20);
+    benchHashes(files, 3);
+    if (generated)
+        unlink(files[0].c_str());
+    
+    benchSmallFiles(2000, 4096);
+    benchPackColdStart(400);
+    return 0;
+}